@@ -130,6 +130,9 @@ Window {
                 root.lastPickPos = worldPos
             renderer.handlePick(item, hit, modifiers)
         }
+        onRegionPicked: function(items, modifiers) {
+            renderer.handleRegionPick(items, modifiers)
+        }
 
         WheelHandler {
             target: renderer
@@ -0,0 +1,25 @@
+#version 450
+
+// Positions only, from the compact stream PassDepth builds per geometry.
+layout(location = 0) in vec3 inPosition;
+// Per instance model matrix, see PassDepth::updateInstances().
+layout(location = 1) in vec4 inModel0;
+layout(location = 2) in vec4 inModel1;
+layout(location = 3) in vec4 inModel2;
+layout(location = 4) in vec4 inModel3;
+
+// Only the matrix, PassDepth binds a 64 byte buffer.
+layout(std140, binding = 0) uniform CameraUbo {
+    mat4 viewProj;
+} uCamera;
+
+// Must come out bit identical to the GBuffer vertex shaders, which draw with
+// an EQUAL depth test against this depth.
+invariant gl_Position;
+
+void main()
+{
+    mat4 model = mat4(inModel0, inModel1, inModel2, inModel3);
+    vec4 worldPos = model * vec4(inPosition, 1.0);
+    gl_Position = uCamera.viewProj * worldPos;
+}
@@ -8,6 +8,10 @@ layout(location = 0) out vec4 outG0;
 layout(location = 1) out vec4 outG1;
 layout(location = 2) out vec4 outG2;
 layout(location = 3) out vec4 outG3;
+#ifdef OBJECT_ID
+// Mesh index + 1, read back by the CPU for GPU picking.
+layout(location = 4) out vec4 outObjectId;
+#endif
 
 layout(std140, binding = 2) uniform MaterialUbo {
     vec4 baseColorMetal;
@@ -61,4 +65,7 @@ void main()
     outG1 = vec4(worldNormal * 0.5 + 0.5, roughness);
     outG2 = vec4(vWorldPos, occlusion);
     outG3 = vec4(uMat.emissive.xyz * emissiveTex, 1.0);
+#ifdef OBJECT_ID
+    outObjectId = unpackUnorm4x8(uint(uMat.miscParams.w + 0.5));
+#endif
 }
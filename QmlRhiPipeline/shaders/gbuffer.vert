@@ -18,6 +18,9 @@ layout(std140, binding = 1) uniform ModelUbo {
     mat4 normalMatrix;
 } uModel;
 
+// Tested EQUAL against the depth PassDepth renders.
+invariant gl_Position;
+
 void main()
 {
     vec4 worldPos = uModel.model * vec4(inPosition, 1.0);
@@ -0,0 +1,49 @@
+#version 450
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal;
+layout(location = 2) in vec2 inTexCoord;
+
+// Per instance attributes, laid out as InstanceData in PassGBuffer.cpp.
+layout(location = 3) in vec4 inModel0;
+layout(location = 4) in vec4 inModel1;
+layout(location = 5) in vec4 inModel2;
+layout(location = 6) in vec4 inModel3;
+layout(location = 7) in vec4 inNormalMatrix0;
+layout(location = 8) in vec4 inNormalMatrix1;
+layout(location = 9) in vec4 inNormalMatrix2;
+layout(location = 10) in vec4 inBaseColorMetal;
+layout(location = 11) in vec4 inRoughnessOcclusion;
+layout(location = 12) in vec4 inEmissive;
+layout(location = 13) in vec4 inMiscParams;
+
+layout(location = 0) out vec3 vWorldPos;
+layout(location = 1) out vec3 vWorldNormal;
+layout(location = 2) out vec2 vUv;
+layout(location = 3) flat out vec4 vBaseColorMetal;
+layout(location = 4) flat out vec4 vRoughnessOcclusion;
+layout(location = 5) flat out vec4 vEmissive;
+layout(location = 6) flat out vec4 vMiscParams;
+
+layout(std140, binding = 0) uniform CameraUbo {
+    mat4 viewProj;
+    vec4 cameraPos;
+} uCamera;
+
+// Tested EQUAL against the depth PassDepth renders.
+invariant gl_Position;
+
+void main()
+{
+    mat4 model = mat4(inModel0, inModel1, inModel2, inModel3);
+    mat3 normalMatrix = mat3(inNormalMatrix0.xyz, inNormalMatrix1.xyz, inNormalMatrix2.xyz);
+    vec4 worldPos = model * vec4(inPosition, 1.0);
+    vWorldPos = worldPos.xyz;
+    vWorldNormal = normalize(normalMatrix * inNormal);
+    vUv = inTexCoord;
+    vBaseColorMetal = inBaseColorMetal;
+    vRoughnessOcclusion = inRoughnessOcclusion;
+    vEmissive = inEmissive;
+    vMiscParams = inMiscParams;
+    gl_Position = uCamera.viewProj * worldPos;
+}
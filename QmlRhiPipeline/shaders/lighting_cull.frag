@@ -1,7 +1,6 @@
 #version 450
 #extension GL_EXT_control_flow_attributes : enable
 
-#define MAX_LIGHTS 100
 #define MAX_SPOT_SHADOWS 32
 #define MAX_BEAM_STEPS 16
 layout(location = 0) in vec2 vUv;
@@ -16,11 +15,8 @@ layout(std430, binding = 3) readonly buffer LightsBuffer {
     vec4 lightCount;
     vec4 lightParams;
     vec4 lightFlags;
-    vec4 lightBeam[MAX_LIGHTS];
-    vec4 lightPosRange[MAX_LIGHTS];
-    vec4 lightColorIntensity[MAX_LIGHTS];
-    vec4 lightDirInner[MAX_LIGHTS];
-    vec4 lightOther[MAX_LIGHTS];
+    vec4 lightLayout; // x=capacity
+    vec4 lightData[];
 } uLights;
 
 layout(std140, binding = 4) uniform CameraUbo {
@@ -34,9 +30,8 @@ layout(std430, binding = 5) readonly buffer ShadowBuffer {
     vec4 splits;
     vec4 dirLightDir;
     vec4 dirLightColorIntensity;
-    mat4 spotLightViewProj[MAX_LIGHTS];
-    vec4 spotShadowParams[MAX_LIGHTS];
     vec4 shadowDepthParams;
+    vec4 spotData[];
 } uShadow;
 
 layout(binding = 6) uniform sampler2D shadowMap0;
@@ -57,6 +52,72 @@ layout(std140, binding = 21) uniform LightCullUbo {
 } uLightCull;
 
 layout(binding = 22) uniform usampler2D lightIndexTex;
+layout(binding = 23) uniform usampler2D lightListTex;
+
+// Per-light data is stored as consecutive arrays of lightLayout.x entries each.
+int lightStride()
+{
+    return int(uLights.lightLayout.x + 0.5);
+}
+
+vec4 lightBeam(int i)
+{
+    return uLights.lightData[i];
+}
+
+vec4 lightPosRange(int i)
+{
+    return uLights.lightData[lightStride() + i];
+}
+
+vec4 lightColorIntensity(int i)
+{
+    return uLights.lightData[2 * lightStride() + i];
+}
+
+vec4 lightDirInner(int i)
+{
+    return uLights.lightData[3 * lightStride() + i];
+}
+
+vec4 lightOther(int i)
+{
+    return uLights.lightData[4 * lightStride() + i];
+}
+
+// Five vec4 per light: spot view-projection columns followed by the shadow params.
+mat4 spotLightViewProj(int i)
+{
+    int base = i * 5;
+    return mat4(uShadow.spotData[base], uShadow.spotData[base + 1],
+                uShadow.spotData[base + 2], uShadow.spotData[base + 3]);
+}
+
+vec4 spotShadowParams(int i)
+{
+    return uShadow.spotData[i * 5 + 4];
+}
+
+// x = offset into the compacted light list, y = number of lights in the cluster.
+uvec2 clusterLightRange(int cluster)
+{
+    return uvec2(texelFetch(lightIndexTex, ivec2(0, cluster), 0).r,
+                 texelFetch(lightIndexTex, ivec2(1, cluster), 0).r);
+}
+
+// Same layout for the spot lights whose volumetric beam crosses the cluster's view column.
+uvec2 clusterBeamRange(int cluster)
+{
+    return uvec2(texelFetch(lightIndexTex, ivec2(2, cluster), 0).r,
+                 texelFetch(lightIndexTex, ivec2(3, cluster), 0).r);
+}
+
+int clusterLightIndex(uint offset, int li)
+{
+    int width = textureSize(lightListTex, 0).x;
+    int index = int(offset) + li;
+    return int(texelFetch(lightListTex, ivec2(index % width, index / width), 0).r);
+}
 
 vec3 decodeNormal(vec3 enc)
 {
@@ -286,20 +347,25 @@ void main()
     int clusterZ = int(floor(log2(viewDepth) * logScale + logBias));
     clusterZ = clamp(clusterZ, 0, max(countZ - 1, 0));
     int clusterIndex = clusterX + clusterY * countX + clusterZ * countX * countY;
-    int tileCount = (countX > 0 && countY > 0 && countZ > 0)
-            ? int(texelFetch(lightIndexTex, ivec2(0, clusterIndex), 0).r)
-            : 0;
+    uvec2 clusterRange = (countX > 0 && countY > 0 && countZ > 0)
+            ? clusterLightRange(clusterIndex)
+            : uvec2(0u);
+    int tileCount = int(clusterRange.y);
+    uvec2 beamRange = (countX > 0 && countY > 0 && countZ > 0)
+            ? clusterBeamRange(clusterIndex)
+            : uvec2(0u);
+    int beamCount = int(beamRange.y);
     bool volumetricsEnabled = uLights.lightFlags.x > 0.5;
     bool smokeNoiseEnabled = uLights.lightFlags.y > 0.5;
     bool shadowsEnabled = uLights.lightFlags.z > 0.5;
     [[dont_unroll]] for (int li = 0; li < tileCount; ++li) {
-        int i = int(texelFetch(lightIndexTex, ivec2(1 + li, clusterIndex), 0).r);
+        int i = clusterLightIndex(clusterRange.x, li);
         if (i < 0 || i >= count)
             continue;
-        vec4 pr = uLights.lightPosRange[i];
-        vec4 ci = uLights.lightColorIntensity[i];
-        vec4 di = uLights.lightDirInner[i];
-        vec4 other = uLights.lightOther[i];
+        vec4 pr = lightPosRange(i);
+        vec4 ci = lightColorIntensity(i);
+        vec4 di = lightDirInner(i);
+        vec4 other = lightOther(i);
         int type = int(other.y + 0.5);
 
         vec3 L;
@@ -336,7 +402,7 @@ void main()
         vec3 gobo = vec3(1.0);
         if (type == 2 && other.z >= 0.0) {
             vec2 goboUv;
-            if (spotProject(uShadow.spotLightViewProj[i], worldPos, goboUv))
+            if (spotProject(spotLightViewProj(i), worldPos, goboUv))
                 gobo = textureLod(spotGoboMap, vec3(goboUv, other.z), 0.0).rgb;
             else
                 gobo = vec3(0.0);
@@ -362,11 +428,11 @@ void main()
 
         float shadow = 1.0;
         if (shadowsEnabled && type == 2) {
-            vec4 spotParams = uShadow.spotShadowParams[i];
+            vec4 spotParams = spotShadowParams(i);
             if (spotParams.y > 0.5) {
                 int slot = int(spotParams.x + 0.5);
                 float bias = 0.001;
-                shadow = sampleSpotShadow(uShadow.spotLightViewProj[i],
+                shadow = sampleSpotShadow(spotLightViewProj(i),
                                           worldPos,
                                           pr.xyz,
                                           spotParams.z,
@@ -438,20 +504,20 @@ void main()
             rayLen = max(uFlip.flip.z, 50.0);
         }
 
-        [[dont_unroll]] for (int li = 0; li < tileCount; ++li) {
-        int i = int(texelFetch(lightIndexTex, ivec2(1 + li, clusterIndex), 0).r);
+        [[dont_unroll]] for (int li = 0; li < beamCount; ++li) {
+            int i = clusterLightIndex(beamRange.x, li);
             if (i < 0 || i >= count)
                 continue;
-            vec4 other = uLights.lightOther[i];
+            vec4 other = lightOther(i);
             int type = int(other.y + 0.5);
             if (type != 2)
                 continue;
             if (other.w <= 0.0)
                 continue;
-            vec4 pr = uLights.lightPosRange[i];
-            vec4 ci = uLights.lightColorIntensity[i];
-            vec4 di = uLights.lightDirInner[i];
-            vec4 beamData = uLights.lightBeam[i];
+            vec4 pr = lightPosRange(i);
+            vec4 ci = lightColorIntensity(i);
+            vec4 di = lightDirInner(i);
+            vec4 beamData = lightBeam(i);
             float beamRadius = max(beamData.x, 0.001);
             int beamShape = int(beamData.y + 0.5);
             bool hasGobo = other.z >= 0.0;
@@ -581,7 +647,7 @@ void main()
             int steps = clamp(int(other.w), 1, MAX_BEAM_STEPS);
             float stepLen = (tEnd - tStart) / float(steps);
             float jitter = interleavedGradientNoise(gl_FragCoord.xy + 5.588238 * float(i)) * stepLen;
-            vec4 spotParams = uShadow.spotShadowParams[i];
+            vec4 spotParams = spotShadowParams(i);
             [[dont_unroll]] for (int s = 0; s < steps && s < MAX_BEAM_STEPS; ++s) {
                 float t = tStart + jitter + float(s) * stepLen;
                 vec3 p = uCamera.cameraPos.xyz + rayDir * t;
@@ -635,7 +701,7 @@ void main()
                 }
                 density *= smokeAmount;
                 if (shadowsEnabled && spotParams.y > 0.5) {
-                    float shadow = sampleSpotShadow(uShadow.spotLightViewProj[i],
+                    float shadow = sampleSpotShadow(spotLightViewProj(i),
                                                     p,
                                                     pr.xyz,
                                                     spotParams.z,
@@ -648,7 +714,7 @@ void main()
                 vec3 gobo = vec3(1.0);
                 if (other.z >= 0.0) {
                     vec2 goboUv;
-                    if (!spotProject(uShadow.spotLightViewProj[i], p, goboUv))
+                    if (!spotProject(spotLightViewProj(i), p, goboUv))
                         continue;
                     gobo = textureLod(spotGoboMap, vec3(goboUv, other.z), 0.0).rgb;
                 }
@@ -1,6 +1,5 @@
 #version 450
 
-#define MAX_LIGHTS 100
 #define MAX_BEAM_STEPS 16
 
 layout(location = 0) in vec2 vUv;
@@ -20,11 +19,8 @@ layout(std430, binding = 6) readonly buffer LightsBuffer {
     vec4 lightCount;
     vec4 lightParams;
     vec4 lightFlags;
-    vec4 lightBeam[MAX_LIGHTS];
-    vec4 lightPosRange[MAX_LIGHTS];
-    vec4 lightColorIntensity[MAX_LIGHTS];
-    vec4 lightDirInner[MAX_LIGHTS];
-    vec4 lightOther[MAX_LIGHTS];
+    vec4 lightLayout; // x=capacity
+    vec4 lightData[];
 } uLights;
 
 layout(std140, binding = 7) uniform CameraUbo {
@@ -38,9 +34,8 @@ layout(std430, binding = 8) readonly buffer ShadowBuffer {
     vec4 splits;
     vec4 dirLightDir;
     vec4 dirLightColorIntensity;
-    mat4 spotLightViewProj[MAX_LIGHTS];
-    vec4 spotShadowParams[MAX_LIGHTS];
     vec4 shadowDepthParams;
+    vec4 spotData[];
 } uShadow;
 
 layout(binding = 9) uniform sampler2DArray spotShadowMap;
@@ -54,6 +49,72 @@ layout(std140, binding = 10) uniform LightCullUbo {
 } uLightCull;
 
 layout(binding = 11) uniform usampler2D lightIndexTex;
+layout(binding = 12) uniform usampler2D lightListTex;
+
+// Per-light data is stored as consecutive arrays of lightLayout.x entries each.
+int lightStride()
+{
+    return int(uLights.lightLayout.x + 0.5);
+}
+
+vec4 lightBeam(int i)
+{
+    return uLights.lightData[i];
+}
+
+vec4 lightPosRange(int i)
+{
+    return uLights.lightData[lightStride() + i];
+}
+
+vec4 lightColorIntensity(int i)
+{
+    return uLights.lightData[2 * lightStride() + i];
+}
+
+vec4 lightDirInner(int i)
+{
+    return uLights.lightData[3 * lightStride() + i];
+}
+
+vec4 lightOther(int i)
+{
+    return uLights.lightData[4 * lightStride() + i];
+}
+
+// Five vec4 per light: spot view-projection columns followed by the shadow params.
+mat4 spotLightViewProj(int i)
+{
+    int base = i * 5;
+    return mat4(uShadow.spotData[base], uShadow.spotData[base + 1],
+                uShadow.spotData[base + 2], uShadow.spotData[base + 3]);
+}
+
+vec4 spotShadowParams(int i)
+{
+    return uShadow.spotData[i * 5 + 4];
+}
+
+// x = offset into the compacted light list, y = number of lights in the cluster.
+uvec2 clusterLightRange(int cluster)
+{
+    return uvec2(texelFetch(lightIndexTex, ivec2(0, cluster), 0).r,
+                 texelFetch(lightIndexTex, ivec2(1, cluster), 0).r);
+}
+
+// Same layout for the spot lights whose volumetric beam crosses the cluster's view column.
+uvec2 clusterBeamRange(int cluster)
+{
+    return uvec2(texelFetch(lightIndexTex, ivec2(2, cluster), 0).r,
+                 texelFetch(lightIndexTex, ivec2(3, cluster), 0).r);
+}
+
+int clusterLightIndex(uint offset, int li)
+{
+    int width = textureSize(lightListTex, 0).x;
+    int index = int(offset) + li;
+    return int(texelFetch(lightListTex, ivec2(index % width, index / width), 0).r);
+}
 
 vec3 fresnelSchlick(float cosTheta, vec3 F0)
 {
@@ -223,20 +284,25 @@ void main()
     int clusterZ = int(floor(log2(viewDepth) * logScale + logBias));
     clusterZ = clamp(clusterZ, 0, max(countZ - 1, 0));
     int clusterIndex = clusterX + clusterY * countX + clusterZ * countX * countY;
-    int listCount = (countX > 0 && countY > 0 && countZ > 0)
-            ? int(texelFetch(lightIndexTex, ivec2(0, clusterIndex), 0).r)
-            : 0;
+    uvec2 clusterRange = (countX > 0 && countY > 0 && countZ > 0)
+            ? clusterLightRange(clusterIndex)
+            : uvec2(0u);
+    uvec2 beamRange = (countX > 0 && countY > 0 && countZ > 0)
+            ? clusterBeamRange(clusterIndex)
+            : uvec2(0u);
+    int listCount = int(clusterRange.y);
     bool useList = uLightCull.flags.x > 0.5;
     int tileCount = useList ? listCount : count;
-    for (int li = 0; li < tileCount && li < MAX_LIGHTS; ++li)
+    int beamCount = useList ? int(beamRange.y) : count;
+    for (int li = 0; li < tileCount; ++li)
     {
-        int i = useList ? int(texelFetch(lightIndexTex, ivec2(1 + li, clusterIndex), 0).r) : li;
+        int i = useList ? clusterLightIndex(clusterRange.x, li) : li;
         if (i < 0 || i >= count)
             continue;
-        vec4 pr = uLights.lightPosRange[i];
-        vec4 ci = uLights.lightColorIntensity[i];
-        vec4 di = uLights.lightDirInner[i];
-        vec4 other = uLights.lightOther[i];
+        vec4 pr = lightPosRange(i);
+        vec4 ci = lightColorIntensity(i);
+        vec4 di = lightDirInner(i);
+        vec4 other = lightOther(i);
         int type = int(other.y + 0.5);
 
         vec3 L;
@@ -277,7 +343,7 @@ void main()
         if (type == 2 && other.z >= 0.0)
         {
             vec2 goboUv;
-            if (spotProject(uShadow.spotLightViewProj[i], worldPos, goboUv))
+            if (spotProject(spotLightViewProj(i), worldPos, goboUv))
                 gobo = textureLod(spotGoboMap, vec3(goboUv, other.z), 0.0).rgb;
             else
                 gobo = vec3(0.0);
@@ -304,12 +370,12 @@ void main()
         float shadow = 1.0;
         if (type == 2)
         {
-            vec4 spotParams = uShadow.spotShadowParams[i];
+            vec4 spotParams = spotShadowParams(i);
             if (spotParams.y > 0.5)
             {
                 int slot = int(spotParams.x + 0.5);
                 float bias = 0.001;
-                shadow = sampleSpotShadow(uShadow.spotLightViewProj[i],
+                shadow = sampleSpotShadow(spotLightViewProj(i),
                                           worldPos,
                                           pr.xyz,
                                           spotParams.z,
@@ -352,20 +418,20 @@ void main()
             rayLen = max(uFlip.flip.z, 50.0);
         }
 
-        for (int li = 0; li < tileCount && li < MAX_LIGHTS; ++li) {
-            int vi = useList ? int(texelFetch(lightIndexTex, ivec2(1 + li, clusterIndex), 0).r) : li;
+        for (int li = 0; li < beamCount; ++li) {
+            int vi = useList ? clusterLightIndex(beamRange.x, li) : li;
             if (vi < 0 || vi >= count)
                 continue;
-            vec4 other = uLights.lightOther[vi];
+            vec4 other = lightOther(vi);
             int type = int(other.y + 0.5);
             if (type != 2)
                 continue;
             if (other.w <= 0.0)
                 continue;
-            vec4 pr = uLights.lightPosRange[vi];
-            vec4 ci = uLights.lightColorIntensity[vi];
-            vec4 di = uLights.lightDirInner[vi];
-            vec4 beamData = uLights.lightBeam[vi];
+            vec4 pr = lightPosRange(vi);
+            vec4 ci = lightColorIntensity(vi);
+            vec4 di = lightDirInner(vi);
+            vec4 beamData = lightBeam(vi);
             float beamRadius = max(beamData.x, 0.001);
             int beamShape = int(beamData.y + 0.5);
             bool hasGobo = other.z >= 0.0;
@@ -495,7 +561,7 @@ void main()
             int steps = clamp(int(other.w), 1, MAX_BEAM_STEPS);
             float stepLen = (tEnd - tStart) / float(steps);
             float jitter = interleavedGradientNoise(gl_FragCoord.xy + 5.588238 * float(vi)) * stepLen;
-            vec4 spotParams = uShadow.spotShadowParams[vi];
+            vec4 spotParams = spotShadowParams(vi);
             for (int s = 0; s < steps && s < MAX_BEAM_STEPS; ++s) {
                 float t = tStart + jitter + float(s) * stepLen;
                 vec3 p = uCamera.cameraPos.xyz + rayDir * t;
@@ -549,7 +615,7 @@ void main()
                 }
                 density *= smokeAmount;
                 if (spotParams.y > 0.5) {
-                    float shadow = sampleSpotShadow(uShadow.spotLightViewProj[vi],
+                    float shadow = sampleSpotShadow(spotLightViewProj(vi),
                                                     p,
                                                     pr.xyz,
                                                     spotParams.z,
@@ -562,7 +628,7 @@ void main()
                 vec3 gobo = vec3(1.0);
                 if (other.z >= 0.0) {
                     vec2 goboUv;
-                    if (!spotProject(uShadow.spotLightViewProj[vi], p, goboUv))
+                    if (!spotProject(spotLightViewProj(vi), p, goboUv))
                         continue;
                     gobo = textureLod(spotGoboMap, vec3(goboUv, other.z), 0.0).rgb;
                 }
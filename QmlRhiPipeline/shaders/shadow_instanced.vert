@@ -0,0 +1,26 @@
+#version 450
+
+layout(location = 0) in vec3 inPosition;
+// Per instance model matrix, see PassShadow::updateInstanceBatches().
+layout(location = 3) in vec4 inModel0;
+layout(location = 4) in vec4 inModel1;
+layout(location = 5) in vec4 inModel2;
+layout(location = 6) in vec4 inModel3;
+
+layout(location = 0) out vec4 vClip;
+layout(location = 1) out vec3 vWorld;
+
+layout(std140, binding = 0) uniform ShadowUbo {
+    mat4 lightViewProj;
+    vec4 shadowDepthParams;
+    vec4 lightPosNear;
+    vec4 lightParams;
+} uShadow;
+
+void main()
+{
+    vec4 world = mat4(inModel0, inModel1, inModel2, inModel3) * vec4(inPosition, 1.0);
+    vWorld = world.xyz;
+    vClip = uShadow.lightViewProj * world;
+    gl_Position = vClip;
+}
@@ -0,0 +1,25 @@
+#version 450
+
+#define SPOT_VIEW_COUNT 4
+
+layout(location = 0) in vec3 vWorld;
+layout(location = 1) flat in int vView;
+layout(location = 0) out vec4 outColor;
+
+layout(std140, binding = 0) uniform SpotViewsUbo {
+    mat4 lightViewProj[SPOT_VIEW_COUNT];
+    vec4 lightPosNear[SPOT_VIEW_COUNT];
+    vec4 lightParams[SPOT_VIEW_COUNT];
+    vec4 shadowDepthParams;
+} uViews;
+
+void main()
+{
+    vec4 posNear = uViews.lightPosNear[vView];
+    float dist = length(posNear.xyz - vWorld);
+    float nearPlane = posNear.w;
+    float farPlane = uViews.lightParams[vView].x;
+    float depth = (dist - nearPlane) / max(farPlane - nearPlane, 1e-6);
+    depth = clamp(depth, 0.0, 1.0);
+    outColor = vec4(depth, depth, depth, 1.0);
+}
@@ -0,0 +1,28 @@
+#version 450
+#extension GL_EXT_multiview : require
+
+// Must match kSpotViewsPerPass in PassShadow.cpp and VIEW_COUNT in CMakeLists.txt.
+#define SPOT_VIEW_COUNT 4
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 0) out vec3 vWorld;
+layout(location = 1) flat out int vView;
+
+layout(std140, binding = 0) uniform SpotViewsUbo {
+    mat4 lightViewProj[SPOT_VIEW_COUNT];
+    vec4 lightPosNear[SPOT_VIEW_COUNT];
+    vec4 lightParams[SPOT_VIEW_COUNT];
+    vec4 shadowDepthParams;
+} uViews;
+
+layout(std140, binding = 1) uniform ModelUbo {
+    mat4 model;
+} uModel;
+
+void main()
+{
+    vec4 world = uModel.model * vec4(inPosition, 1.0);
+    vWorld = world.xyz;
+    vView = int(gl_ViewIndex);
+    gl_Position = uViews.lightViewProj[gl_ViewIndex] * world;
+}
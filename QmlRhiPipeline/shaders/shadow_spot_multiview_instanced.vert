@@ -0,0 +1,30 @@
+#version 450
+#extension GL_EXT_multiview : require
+
+// Must match kSpotViewsPerPass in PassShadow.cpp and VIEW_COUNT in CMakeLists.txt.
+#define SPOT_VIEW_COUNT 4
+
+layout(location = 0) in vec3 inPosition;
+// Per instance model matrix, see PassShadow::updateInstanceBatches().
+layout(location = 3) in vec4 inModel0;
+layout(location = 4) in vec4 inModel1;
+layout(location = 5) in vec4 inModel2;
+layout(location = 6) in vec4 inModel3;
+
+layout(location = 0) out vec3 vWorld;
+layout(location = 1) flat out int vView;
+
+layout(std140, binding = 0) uniform SpotViewsUbo {
+    mat4 lightViewProj[SPOT_VIEW_COUNT];
+    vec4 lightPosNear[SPOT_VIEW_COUNT];
+    vec4 lightParams[SPOT_VIEW_COUNT];
+    vec4 shadowDepthParams;
+} uViews;
+
+void main()
+{
+    vec4 world = mat4(inModel0, inModel1, inModel2, inModel3) * vec4(inPosition, 1.0);
+    vWorld = world.xyz;
+    vView = int(gl_ViewIndex);
+    gl_Position = uViews.lightViewProj[gl_ViewIndex] * world;
+}
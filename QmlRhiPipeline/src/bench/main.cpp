@@ -0,0 +1,387 @@
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QVector>
+#include <QtGui/QGuiApplication>
+#include <QtGui/QMatrix4x4>
+#include <QtMath>
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <rhi/qrhi.h>
+
+#include "core/RhiContext.h"
+#include "core/RenderTargetCache.h"
+#include "core/ShaderManager.h"
+#include "qml/MeshUtils.h"
+#include "renderer/DeferredRenderer.h"
+#include "scene/Scene.h"
+
+// Process wide allocation counter, read around each frame to report heap churn.
+static std::atomic<quint64> g_allocationCount{ 0 };
+
+void *operator new(std::size_t size)
+{
+    g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    return ::operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+namespace {
+
+struct BenchConfig
+{
+    QRhi::Implementation backend = QRhi::Null;
+    QSize size = QSize(1280, 720);
+    int meshes = 64;
+    int pointLights = 16;
+    int spotLights = 8;
+    int areaLights = 2;
+    int frames = 200;
+    int warmup = 10;
+    bool shadows = true;
+    bool volumetric = true;
+    bool animate = true;
+    float bloom = 0.6f;
+    QString output;
+};
+
+struct FrameSample
+{
+    double cpuMs = 0.0;
+    // endFrame(), which may wait for the GPU (e.g. OpenGL), kept out of cpuMs.
+    double submitMs = 0.0;
+    quint64 allocations = 0;
+};
+
+void buildScene(Scene &scene, const BenchConfig &config)
+{
+    using namespace RhiQmlUtils;
+
+    scene.meshes().clear();
+    Mesh floor = createUnitCubeMesh();
+    floor.name = QStringLiteral("BenchFloor");
+    floor.modelMatrix.translate(0.0f, -0.55f, 0.0f);
+    floor.modelMatrix.scale(40.0f, 0.1f, 40.0f);
+    floor.material.baseColor = QVector3D(0.5f, 0.5f, 0.5f);
+    scene.meshes().push_back(floor);
+
+    const int side = qMax(1, int(std::ceil(std::sqrt(double(config.meshes)))));
+    const float spacing = 1.6f;
+    const float origin = -0.5f * spacing * float(side - 1);
+    for (int i = 0; i < config.meshes; ++i)
+    {
+        Mesh mesh = (i % 2) ? createSphereMesh() : createUnitCubeMesh();
+        mesh.name = QStringLiteral("BenchMesh%1").arg(i);
+        mesh.modelMatrix.translate(origin + spacing * float(i % side), 0.0f,
+                                   origin + spacing * float(i / side));
+        mesh.material.baseColor = QVector3D(0.3f + 0.7f * float(i % 3) / 2.0f,
+                                            0.3f + 0.7f * float(i % 5) / 4.0f,
+                                            0.3f + 0.7f * float(i % 7) / 6.0f);
+        mesh.material.roughness = 0.2f + 0.6f * float(i % 4) / 3.0f;
+        mesh.material.metalness = (i % 6 == 0) ? 1.0f : 0.0f;
+        scene.meshes().push_back(mesh);
+    }
+
+    const float radius = qMax(4.0f, -origin + 2.0f);
+    QVector<Light> lights;
+    Light sun;
+    sun.type = Light::Type::Directional;
+    sun.direction = QVector3D(-0.3f, -1.0f, -0.4f).normalized();
+    sun.intensity = 0.5f;
+    sun.castShadows = true;
+    lights.push_back(sun);
+
+    auto ringPosition = [radius](int index, int count, float height) {
+        const float angle = 2.0f * float(M_PI) * float(index) / float(qMax(1, count));
+        return QVector3D(radius * qCos(angle), height, radius * qSin(angle));
+    };
+    for (int i = 0; i < config.pointLights; ++i)
+    {
+        Light light;
+        light.type = Light::Type::Point;
+        light.position = ringPosition(i, config.pointLights, 1.5f);
+        light.color = QVector3D(1.0f, 0.8f + 0.2f * float(i % 2), 0.6f + 0.4f * float(i % 3) / 2.0f);
+        light.intensity = 3.0f;
+        light.range = 6.0f;
+        light.castShadows = false;
+        lights.push_back(light);
+    }
+    for (int i = 0; i < config.spotLights; ++i)
+    {
+        Light light;
+        light.type = Light::Type::Spot;
+        light.position = ringPosition(i, config.spotLights, 6.0f);
+        light.direction = (QVector3D(0.0f, 0.0f, 0.0f) - light.position).normalized();
+        light.intensity = 6.0f;
+        light.range = 30.0f;
+        light.outerCone = qDegreesToRadians(18.0f);
+        light.innerCone = light.outerCone * 0.8f;
+        light.qualitySteps = 24;
+        light.castShadows = true;
+        lights.push_back(light);
+    }
+    for (int i = 0; i < config.areaLights; ++i)
+    {
+        Light light;
+        light.type = Light::Type::Area;
+        light.position = ringPosition(i, config.areaLights, 4.0f);
+        light.direction = QVector3D(0.0f, -1.0f, 0.0f);
+        light.intensity = 2.0f;
+        light.areaSize = QVector2D(2.0f, 1.0f);
+        light.castShadows = false;
+        lights.push_back(light);
+    }
+    scene.setLights(lights);
+
+    const float aspect = float(config.size.width()) / float(qMax(1, config.size.height()));
+    scene.camera().setPerspective(60.0f, aspect, 0.01f, 300.0f);
+    scene.camera().setPosition(QVector3D(0.0f, radius * 0.8f, radius * 1.6f));
+    scene.camera().lookAt(QVector3D(0.0f, 0.0f, 0.0f));
+    scene.setAmbientLight(QVector3D(0.05f, 0.05f, 0.06f));
+    scene.setAmbientIntensity(1.0f);
+    scene.setShadowsEnabled(config.shadows);
+    scene.setVolumetricEnabled(config.volumetric);
+    scene.setSmokeAmount(config.volumetric ? 0.3f : 0.0f);
+    scene.setBloomIntensity(config.bloom);
+}
+
+void animateScene(Scene &scene, int frame)
+{
+    const float t = float(frame) / 60.0f;
+    scene.setTimeSeconds(t);
+    for (int i = 0; i < scene.lights().size(); ++i)
+    {
+        Light light = scene.lightAt(i);
+        if (light.type != Light::Type::Spot)
+            continue;
+        const float sway = 0.25f * qSin(t + light.position.x());
+        light.direction = (QVector3D(sway * 4.0f, 0.0f, 0.0f) - light.position).normalized();
+        scene.setLight(i, light);
+    }
+}
+
+double percentile(QVector<double> values, double p)
+{
+    if (values.isEmpty())
+        return 0.0;
+    std::sort(values.begin(), values.end());
+    const int index = qBound(0, int(std::ceil(p * values.size())) - 1, int(values.size()) - 1);
+    return values[index];
+}
+
+bool parseConfig(const QCoreApplication &app, BenchConfig &config)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Headless DeferredRenderer benchmark"));
+    parser.addHelpOption();
+    const QCommandLineOption backendOpt(QStringLiteral("backend"), QStringLiteral("null or gl"),
+                                        QStringLiteral("backend"), QStringLiteral("null"));
+    const QCommandLineOption sizeOpt(QStringLiteral("size"), QStringLiteral("Target size WxH"),
+                                     QStringLiteral("size"), QStringLiteral("1280x720"));
+    const QCommandLineOption meshesOpt(QStringLiteral("meshes"), QStringLiteral("Mesh count"),
+                                       QStringLiteral("n"), QString::number(config.meshes));
+    const QCommandLineOption pointOpt(QStringLiteral("point-lights"), QStringLiteral("Point light count"),
+                                      QStringLiteral("n"), QString::number(config.pointLights));
+    const QCommandLineOption spotOpt(QStringLiteral("spot-lights"), QStringLiteral("Spot light count"),
+                                     QStringLiteral("n"), QString::number(config.spotLights));
+    const QCommandLineOption areaOpt(QStringLiteral("area-lights"), QStringLiteral("Area light count"),
+                                     QStringLiteral("n"), QString::number(config.areaLights));
+    const QCommandLineOption framesOpt(QStringLiteral("frames"), QStringLiteral("Measured frames"),
+                                       QStringLiteral("n"), QString::number(config.frames));
+    const QCommandLineOption warmupOpt(QStringLiteral("warmup"), QStringLiteral("Frames rendered before measuring"),
+                                       QStringLiteral("n"), QString::number(config.warmup));
+    const QCommandLineOption noShadowsOpt(QStringLiteral("no-shadows"), QStringLiteral("Disable shadows"));
+    const QCommandLineOption noVolumetricOpt(QStringLiteral("no-volumetric"), QStringLiteral("Disable volumetric beams"));
+    const QCommandLineOption staticOpt(QStringLiteral("static"), QStringLiteral("Do not animate lights"));
+    const QCommandLineOption outputOpt(QStringLiteral("output"), QStringLiteral("Write pass timings (.csv or .json)"),
+                                       QStringLiteral("path"));
+    parser.addOptions({ backendOpt, sizeOpt, meshesOpt, pointOpt, spotOpt, areaOpt, framesOpt,
+                        warmupOpt, noShadowsOpt, noVolumetricOpt, staticOpt, outputOpt });
+    parser.process(app);
+
+    const QString backend = parser.value(backendOpt).toLower();
+    if (backend == QLatin1String("null"))
+    {
+        config.backend = QRhi::Null;
+    }
+    else if (backend == QLatin1String("gl") || backend == QLatin1String("opengl"))
+    {
+        config.backend = QRhi::OpenGLES2;
+    }
+    else
+    {
+        qWarning() << "qmlrhipipeline_bench: unknown backend" << backend;
+        return false;
+    }
+
+    const QStringList size = parser.value(sizeOpt).split(QLatin1Char('x'));
+    if (size.size() != 2 || size[0].toInt() <= 0 || size[1].toInt() <= 0)
+    {
+        qWarning() << "qmlrhipipeline_bench: invalid size" << parser.value(sizeOpt);
+        return false;
+    }
+    config.size = QSize(size[0].toInt(), size[1].toInt());
+    config.meshes = qMax(0, parser.value(meshesOpt).toInt());
+    config.pointLights = qMax(0, parser.value(pointOpt).toInt());
+    config.spotLights = qMax(0, parser.value(spotOpt).toInt());
+    config.areaLights = qMax(0, parser.value(areaOpt).toInt());
+    config.frames = qMax(1, parser.value(framesOpt).toInt());
+    config.warmup = qMax(0, parser.value(warmupOpt).toInt());
+    config.shadows = !parser.isSet(noShadowsOpt);
+    config.volumetric = !parser.isSet(noVolumetricOpt);
+    config.animate = !parser.isSet(staticOpt);
+    config.output = parser.value(outputOpt);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QGuiApplication app(argc, argv);
+
+    BenchConfig config;
+    if (!parseConfig(app, config))
+        return 1;
+
+    RhiContext rhiContext;
+    if (!rhiContext.initializeOffscreen(config.backend, config.size))
+    {
+        qWarning() << "qmlrhipipeline_bench: failed to initialize offscreen RHI";
+        return 1;
+    }
+
+    int result = 0;
+    {
+        RenderTargetCache targets(rhiContext.rhi());
+        ShaderManager shaders(rhiContext.rhi());
+        DeferredRenderer renderer;
+        renderer.initialize(&rhiContext, &targets, &shaders);
+        renderer.profiler().setHistorySize(config.frames);
+
+        Scene scene;
+        buildScene(scene, config);
+
+        QVector<FrameSample> samples;
+        samples.reserve(config.frames);
+        QElapsedTimer timer;
+        const int totalFrames = config.warmup + config.frames;
+        for (int frame = 0; frame < totalFrames; ++frame)
+        {
+            const bool measured = frame >= config.warmup;
+            if (frame == config.warmup)
+                renderer.profiler().setEnabled(true);
+
+            const quint64 allocationsBefore = g_allocationCount.load(std::memory_order_relaxed);
+            timer.start();
+            if (config.animate)
+                animateScene(scene, frame);
+            rhiContext.beginFrame();
+            if (!rhiContext.commandBuffer())
+            {
+                result = 1;
+                break;
+            }
+            renderer.render(&scene);
+            const double cpuMs = double(timer.nsecsElapsed()) / 1.0e6;
+            timer.start();
+            rhiContext.endFrame();
+            const double submitMs = double(timer.nsecsElapsed()) / 1.0e6;
+            const quint64 allocations = g_allocationCount.load(std::memory_order_relaxed) - allocationsBefore;
+            if (measured)
+                samples.push_back({ cpuMs, submitMs, allocations });
+        }
+
+        if (!samples.isEmpty())
+        {
+            QVector<double> cpu;
+            QVector<double> submit;
+            double cpuSum = 0.0;
+            double submitSum = 0.0;
+            quint64 allocationSum = 0;
+            quint64 allocationMax = 0;
+            for (const FrameSample &sample : samples)
+            {
+                cpu.push_back(sample.cpuMs);
+                cpuSum += sample.cpuMs;
+                submit.push_back(sample.submitMs);
+                submitSum += sample.submitMs;
+                allocationSum += sample.allocations;
+                allocationMax = qMax(allocationMax, sample.allocations);
+            }
+
+            std::printf("backend=%s size=%dx%d meshes=%d lights=%d/%d/%d frames=%d\n",
+                        rhiContext.rhi()->backendName(), config.size.width(), config.size.height(),
+                        config.meshes, config.pointLights, config.spotLights, config.areaLights,
+                        int(samples.size()));
+            std::printf("frame cpu ms: avg %.3f p50 %.3f p95 %.3f max %.3f\n",
+                        cpuSum / samples.size(), percentile(cpu, 0.5), percentile(cpu, 0.95),
+                        percentile(cpu, 1.0));
+            std::printf("frame submit ms: avg %.3f p50 %.3f p95 %.3f max %.3f\n",
+                        submitSum / samples.size(), percentile(submit, 0.5), percentile(submit, 0.95),
+                        percentile(submit, 1.0));
+            std::printf("allocations/frame: avg %.1f max %llu\n",
+                        double(allocationSum) / samples.size(), (unsigned long long)allocationMax);
+
+            const QVector<FrameProfiler::FrameTiming> frames = renderer.profiler().frames();
+            const FrameProfiler::FrameTiming last = renderer.profiler().latest();
+            std::printf("%-20s %12s %12s %8s\n", "pass", "prepare ms", "execute ms", "culled");
+            for (int i = 0; i < last.passes.size(); ++i)
+            {
+                double prepareSum = 0.0;
+                double executeSum = 0.0;
+                int culledFrames = 0;
+                for (const FrameProfiler::FrameTiming &timing : frames)
+                {
+                    if (i >= timing.passes.size())
+                        continue;
+                    prepareSum += timing.passes[i].prepareMs;
+                    executeSum += timing.passes[i].executeMs;
+                    culledFrames += timing.passes[i].culled ? 1 : 0;
+                }
+                const double count = qMax(1, int(frames.size()));
+                std::printf("%-20s %12.3f %12.3f %8d\n", last.passes[i].name.constData(),
+                            prepareSum / count, executeSum / count, culledFrames);
+            }
+            if (last.gpuMs >= 0.0)
+                std::printf("last gpu ms: %.3f\n", last.gpuMs);
+
+            if (!config.output.isEmpty() && !renderer.profiler().dump(config.output))
+                result = 1;
+        }
+        rhiContext.rhi()->finish();
+    }
+    rhiContext.shutdown();
+    return result;
+}
@@ -0,0 +1,212 @@
+#include "core/FrameProfiler.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QPair>
+#include <QtCore/QTextStream>
+#include <rhi/qrhi.h>
+
+void FrameProfiler::setEnabled(bool enabled)
+{
+    if (m_enabled == enabled)
+        return;
+    m_enabled = enabled;
+    if (!enabled)
+        clear();
+}
+
+void FrameProfiler::setHistorySize(int count)
+{
+    count = qMax(1, count);
+    if (m_historySize == count)
+        return;
+    const QVector<FrameTiming> ordered = frames();
+    m_historySize = count;
+    m_history.clear();
+    for (int i = qMax(0, ordered.size() - count); i < ordered.size(); ++i)
+        m_history.push_back(ordered[i]);
+    m_head = m_history.size() % m_historySize;
+}
+
+void FrameProfiler::beginFrame(QRhiCommandBuffer *cb)
+{
+    m_current = FrameTiming();
+    m_current.frameIndex = m_frameIndex++;
+    if (cb)
+    {
+        const double gpuSeconds = cb->lastCompletedGpuTime();
+        if (gpuSeconds > 0.0)
+            m_current.gpuMs = gpuSeconds * 1000.0;
+    }
+    m_frameTimer.start();
+}
+
+void FrameProfiler::recordPass(const char *name, double prepareMs, double executeMs, bool culled)
+{
+    PassTiming pass;
+    pass.name = name;
+    pass.prepareMs = prepareMs;
+    pass.executeMs = executeMs;
+    pass.culled = culled;
+    m_current.passes.push_back(pass);
+}
+
+void FrameProfiler::endFrame()
+{
+    m_current.cpuMs = double(m_frameTimer.nsecsElapsed()) / 1.0e6;
+    if (m_history.size() < m_historySize)
+    {
+        m_history.push_back(m_current);
+        m_head = m_history.size() % m_historySize;
+    }
+    else
+    {
+        m_history[m_head] = m_current;
+        m_head = (m_head + 1) % m_historySize;
+    }
+}
+
+QVector<FrameProfiler::FrameTiming> FrameProfiler::frames() const
+{
+    if (m_history.size() < m_historySize)
+        return m_history;
+    QVector<FrameTiming> ordered;
+    ordered.reserve(m_history.size());
+    for (int i = 0; i < m_history.size(); ++i)
+        ordered.push_back(m_history[(m_head + i) % m_history.size()]);
+    return ordered;
+}
+
+FrameProfiler::FrameTiming FrameProfiler::latest() const
+{
+    if (m_history.isEmpty())
+        return FrameTiming();
+    const int index = (m_head + m_history.size() - 1) % m_history.size();
+    return m_history[index];
+}
+
+QVariantMap FrameProfiler::toVariantMap() const
+{
+    QVariantMap map;
+    const FrameTiming last = latest();
+    map.insert(QStringLiteral("frame"), qulonglong(last.frameIndex));
+    map.insert(QStringLiteral("cpuMs"), last.cpuMs);
+    map.insert(QStringLiteral("gpuMs"), last.gpuMs);
+    map.insert(QStringLiteral("historySize"), m_history.size());
+
+    double cpuSum = 0.0;
+    double gpuSum = 0.0;
+    int gpuCount = 0;
+    QHash<QByteArray, QPair<double, double>> passSums;
+    for (const FrameTiming &frame : m_history)
+    {
+        cpuSum += frame.cpuMs;
+        if (frame.gpuMs >= 0.0)
+        {
+            gpuSum += frame.gpuMs;
+            ++gpuCount;
+        }
+        for (const PassTiming &pass : frame.passes)
+        {
+            QPair<double, double> &sum = passSums[pass.name];
+            sum.first += pass.prepareMs;
+            sum.second += pass.executeMs;
+        }
+    }
+    const double frameCount = qMax(1, int(m_history.size()));
+    map.insert(QStringLiteral("averageCpuMs"), cpuSum / frameCount);
+    map.insert(QStringLiteral("averageGpuMs"), gpuCount > 0 ? gpuSum / gpuCount : -1.0);
+
+    QVariantList passes;
+    for (const PassTiming &pass : last.passes)
+    {
+        const QPair<double, double> sum = passSums.value(pass.name);
+        QVariantMap entry;
+        entry.insert(QStringLiteral("name"), QString::fromLatin1(pass.name));
+        entry.insert(QStringLiteral("prepareMs"), pass.prepareMs);
+        entry.insert(QStringLiteral("executeMs"), pass.executeMs);
+        entry.insert(QStringLiteral("culled"), pass.culled);
+        entry.insert(QStringLiteral("averagePrepareMs"), sum.first / frameCount);
+        entry.insert(QStringLiteral("averageExecuteMs"), sum.second / frameCount);
+        passes.push_back(entry);
+    }
+    map.insert(QStringLiteral("passes"), passes);
+    return map;
+}
+
+bool FrameProfiler::dump(const QString &path) const
+{
+    if (path.endsWith(QLatin1String(".json"), Qt::CaseInsensitive))
+        return dumpJson(path);
+    return dumpCsv(path);
+}
+
+bool FrameProfiler::dumpCsv(const QString &path) const
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+    {
+        qWarning() << "FrameProfiler: failed to open" << path;
+        return false;
+    }
+    QTextStream out(&file);
+    out << "frame,pass,prepare_ms,execute_ms,culled,frame_cpu_ms,frame_gpu_ms\n";
+    for (const FrameTiming &frame : frames())
+    {
+        for (const PassTiming &pass : frame.passes)
+        {
+            out << frame.frameIndex << ','
+                << pass.name << ','
+                << pass.prepareMs << ','
+                << pass.executeMs << ','
+                << (pass.culled ? 1 : 0) << ','
+                << frame.cpuMs << ','
+                << frame.gpuMs << '\n';
+        }
+    }
+    return true;
+}
+
+bool FrameProfiler::dumpJson(const QString &path) const
+{
+    QJsonArray framesJson;
+    for (const FrameTiming &frame : frames())
+    {
+        QJsonArray passesJson;
+        for (const PassTiming &pass : frame.passes)
+        {
+            QJsonObject passJson;
+            passJson.insert(QStringLiteral("name"), QString::fromLatin1(pass.name));
+            passJson.insert(QStringLiteral("prepareMs"), pass.prepareMs);
+            passJson.insert(QStringLiteral("executeMs"), pass.executeMs);
+            passJson.insert(QStringLiteral("culled"), pass.culled);
+            passesJson.push_back(passJson);
+        }
+        QJsonObject frameJson;
+        frameJson.insert(QStringLiteral("frame"), qint64(frame.frameIndex));
+        frameJson.insert(QStringLiteral("cpuMs"), frame.cpuMs);
+        frameJson.insert(QStringLiteral("gpuMs"), frame.gpuMs);
+        frameJson.insert(QStringLiteral("passes"), passesJson);
+        framesJson.push_back(frameJson);
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qWarning() << "FrameProfiler: failed to open" << path;
+        return false;
+    }
+    file.write(QJsonDocument(framesJson).toJson());
+    return true;
+}
+
+void FrameProfiler::clear()
+{
+    m_history.clear();
+    m_head = 0;
+    m_current = FrameTiming();
+}
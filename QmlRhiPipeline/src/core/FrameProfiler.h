@@ -0,0 +1,58 @@
+#pragma once
+
+#include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QString>
+#include <QtCore/QVariant>
+#include <QtCore/QVector>
+
+class QRhiCommandBuffer;
+
+class FrameProfiler
+{
+public:
+    struct PassTiming
+    {
+        QByteArray name;
+        double prepareMs = 0.0;
+        double executeMs = 0.0;
+        bool culled = false;
+    };
+
+    struct FrameTiming
+    {
+        quint64 frameIndex = 0;
+        double cpuMs = 0.0;
+        // Whole command buffer time of the last completed frame, -1 when the
+        // backend or the QRhi was not set up for timestamps.
+        double gpuMs = -1.0;
+        QVector<PassTiming> passes;
+    };
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return m_enabled; }
+    void setHistorySize(int count);
+    int historySize() const { return m_historySize; }
+
+    void beginFrame(QRhiCommandBuffer *cb);
+    void recordPass(const char *name, double prepareMs, double executeMs, bool culled);
+    void endFrame();
+
+    QVector<FrameTiming> frames() const;
+    FrameTiming latest() const;
+    QVariantMap toVariantMap() const;
+    bool dump(const QString &path) const;
+    void clear();
+
+private:
+    bool dumpCsv(const QString &path) const;
+    bool dumpJson(const QString &path) const;
+
+    bool m_enabled = false;
+    int m_historySize = 240;
+    int m_head = 0;
+    quint64 m_frameIndex = 0;
+    QVector<FrameTiming> m_history;
+    FrameTiming m_current;
+    QElapsedTimer m_frameTimer;
+};
@@ -1,14 +1,356 @@
 #include "core/RenderGraph.h"
 
+#include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
+#include <algorithm>
+#include <limits>
+
+#include "core/FrameProfiler.h"
+#include "core/RhiContext.h"
+
+namespace {
+
+bool descMatches(const RenderGraphTextureDesc &a, const RenderGraphTextureDesc &b)
+{
+    return a.format == b.format
+            && a.size == b.size
+            && a.sampleCount == b.sampleCount
+            && a.flags == b.flags;
+}
+
+RenderGraphTextureDesc descForTexture(const QRhiTexture *texture)
+{
+    RenderGraphTextureDesc desc;
+    desc.format = texture->format();
+    desc.size = texture->pixelSize();
+    desc.sampleCount = texture->sampleCount();
+    desc.flags = texture->flags();
+    return desc;
+}
+
+} // namespace
+
+RenderGraphBuilder::RenderGraphBuilder(RenderGraph *graph, int passIndex)
+    : m_graph(graph)
+    , m_passIndex(passIndex)
+{
+}
+
+void RenderGraphBuilder::read(const char *resource)
+{
+    const QByteArray name(resource);
+    RenderGraph::PassNode &node = m_graph->m_nodes[m_passIndex];
+    if (!node.reads.contains(name))
+        node.reads.push_back(name);
+    m_graph->m_resources[name];
+}
+
+void RenderGraphBuilder::write(const char *resource)
+{
+    const QByteArray name(resource);
+    RenderGraph::PassNode &node = m_graph->m_nodes[m_passIndex];
+    if (!node.writes.contains(name))
+        node.writes.push_back(name);
+    m_graph->m_resources[name];
+}
+
+void RenderGraphBuilder::importTexture(const char *resource, QRhiTexture *texture, bool aliasable)
+{
+    RenderGraph::ResourceNode &res = m_graph->m_resources[QByteArray(resource)];
+    res.texture = texture;
+    res.transient = false;
+    res.aliasable = aliasable && texture;
+    if (texture)
+        res.desc = descForTexture(texture);
+}
+
+void RenderGraphBuilder::createTexture(const char *resource, const RenderGraphTextureDesc &desc)
+{
+    RenderGraph::ResourceNode &res = m_graph->m_resources[QByteArray(resource)];
+    res.desc = desc;
+    res.transient = true;
+    res.aliasable = false;
+    write(resource);
+}
+
+void RenderGraphBuilder::setSideEffect()
+{
+    m_graph->m_nodes[m_passIndex].sideEffect = true;
+}
+
+void RenderPass::setup(RenderGraphBuilder &builder, FrameContext &ctx)
+{
+    Q_UNUSED(ctx);
+    builder.setSideEffect();
+}
 
 void RenderGraph::addPass(std::unique_ptr<RenderPass> pass)
 {
     m_passes.push_back(std::move(pass));
 }
 
+void RenderGraph::addOutput(const char *resource)
+{
+    const QByteArray name(resource);
+    if (!m_outputs.contains(name))
+        m_outputs.push_back(name);
+}
+
 void RenderGraph::clear()
 {
     m_passes.clear();
+    m_nodes.clear();
+    m_resources.clear();
+    m_outputs.clear();
+    m_order.clear();
+    releaseResources();
+}
+
+void RenderGraph::releaseResources()
+{
+    for (PooledTexture &pooled : m_pool)
+        delete pooled.texture;
+    m_pool.clear();
+    for (ResourceNode &res : m_resources)
+    {
+        if (res.transient)
+            res.texture = nullptr;
+    }
+}
+
+QRhiTexture *RenderGraph::texture(const char *resource) const
+{
+    const auto it = m_resources.constFind(QByteArray(resource));
+    if (it == m_resources.constEnd())
+        return nullptr;
+    return it->texture;
+}
+
+bool RenderGraph::isLive(const RenderPass *pass) const
+{
+    for (int i = 0; i < int(m_passes.size()) && i < m_nodes.size(); ++i)
+    {
+        if (m_passes[i].get() == pass)
+            return m_nodes[i].live;
+    }
+    return false;
+}
+
+void RenderGraph::compile()
+{
+    const int count = m_nodes.size();
+    QVector<QVector<int>> edges(count);
+    QVector<int> inDegree(count, 0);
+    auto addEdge = [&](int from, int to) {
+        if (from < 0 || from == to || edges[from].contains(to))
+            return;
+        edges[from].push_back(to);
+        ++inDegree[to];
+    };
+    auto writerBefore = [&](const QByteArray &res, int pass) {
+        for (int i = pass - 1; i >= 0; --i)
+        {
+            if (m_nodes[i].writes.contains(res))
+                return i;
+        }
+        return -1;
+    };
+    auto writerAfter = [&](const QByteArray &res, int pass) {
+        for (int i = pass + 1; i < count; ++i)
+        {
+            if (m_nodes[i].writes.contains(res))
+                return i;
+        }
+        return -1;
+    };
+
+    for (int i = 0; i < count; ++i)
+    {
+        for (const QByteArray &res : m_nodes[i].reads)
+        {
+            int writer = writerBefore(res, i);
+            if (writer < 0)
+                writer = writerAfter(res, i);
+            addEdge(writer, i);
+        }
+        for (const QByteArray &res : m_nodes[i].writes)
+            addEdge(writerBefore(res, i), i);
+    }
+
+    // Kahn's algorithm, preferring insertion order among ready passes so the
+    // result stays stable from frame to frame.
+    QVector<int> sorted;
+    sorted.reserve(count);
+    QVector<int> ready;
+    for (int i = 0; i < count; ++i)
+    {
+        if (inDegree[i] == 0)
+            ready.push_back(i);
+    }
+    while (!ready.isEmpty())
+    {
+        const auto minIt = std::min_element(ready.begin(), ready.end());
+        const int node = *minIt;
+        ready.erase(minIt);
+        sorted.push_back(node);
+        for (int next : edges[node])
+        {
+            if (--inDegree[next] == 0)
+                ready.push_back(next);
+        }
+    }
+    if (sorted.size() != count)
+    {
+        qWarning() << "RenderGraph: dependency cycle, falling back to insertion order";
+        sorted.clear();
+        for (int i = 0; i < count; ++i)
+            sorted.push_back(i);
+    }
+
+    for (PassNode &node : m_nodes)
+    {
+        node.live = node.sideEffect;
+        for (const QByteArray &res : node.writes)
+        {
+            if (m_outputs.contains(res))
+                node.live = true;
+        }
+    }
+    for (int i = sorted.size() - 1; i >= 0; --i)
+    {
+        PassNode &node = m_nodes[sorted[i]];
+        if (node.live)
+            continue;
+        for (int next : edges[sorted[i]])
+        {
+            if (m_nodes[next].live)
+            {
+                node.live = true;
+                break;
+            }
+        }
+    }
+
+    m_order.clear();
+    for (int index : sorted)
+    {
+        if (m_nodes[index].live)
+            m_order.push_back(index);
+    }
+
+    for (ResourceNode &res : m_resources)
+    {
+        res.firstUse = -1;
+        res.lastUse = -1;
+    }
+    for (int pos = 0; pos < m_order.size(); ++pos)
+    {
+        const PassNode &node = m_nodes[m_order[pos]];
+        auto touch = [&](const QByteArray &name) {
+            ResourceNode &res = m_resources[name];
+            if (res.firstUse < 0)
+                res.firstUse = pos;
+            res.lastUse = pos;
+        };
+        for (const QByteArray &name : node.reads)
+            touch(name);
+        for (const QByteArray &name : node.writes)
+            touch(name);
+    }
+    for (const QByteArray &name : m_outputs)
+    {
+        auto it = m_resources.find(name);
+        if (it != m_resources.end() && it->firstUse >= 0)
+            it->lastUse = std::numeric_limits<int>::max();
+    }
+}
+
+void RenderGraph::allocateTransients(QRhi *rhi)
+{
+    struct AliasCandidate
+    {
+        QRhiTexture *texture = nullptr;
+        RenderGraphTextureDesc desc;
+        int busyUntil = -1;
+    };
+    QVector<AliasCandidate> candidates;
+    QVector<QByteArray> transients;
+    for (auto it = m_resources.begin(); it != m_resources.end(); ++it)
+    {
+        ResourceNode &res = it.value();
+        if (res.transient)
+        {
+            res.texture = nullptr;
+            if (res.firstUse >= 0)
+                transients.push_back(it.key());
+        }
+        else if (res.aliasable && res.texture && res.firstUse >= 0)
+        {
+            candidates.push_back({ res.texture, res.desc, res.lastUse });
+        }
+    }
+    std::sort(transients.begin(), transients.end(), [this](const QByteArray &a, const QByteArray &b) {
+        return m_resources.value(a).firstUse < m_resources.value(b).firstUse;
+    });
+
+    for (PooledTexture &pooled : m_pool)
+    {
+        pooled.busyUntil = -1;
+        pooled.used = false;
+    }
+
+    for (const QByteArray &name : transients)
+    {
+        ResourceNode &res = m_resources[name];
+        for (AliasCandidate &candidate : candidates)
+        {
+            if (candidate.busyUntil < res.firstUse && descMatches(candidate.desc, res.desc))
+            {
+                res.texture = candidate.texture;
+                candidate.busyUntil = res.lastUse;
+                break;
+            }
+        }
+        if (res.texture)
+            continue;
+        for (PooledTexture &pooled : m_pool)
+        {
+            if (pooled.busyUntil < res.firstUse && descMatches(pooled.desc, res.desc))
+            {
+                res.texture = pooled.texture;
+                pooled.busyUntil = res.lastUse;
+                pooled.used = true;
+                break;
+            }
+        }
+        if (res.texture || !rhi || res.desc.size.isEmpty())
+            continue;
+
+        QRhiTexture *texture = rhi->newTexture(res.desc.format, res.desc.size,
+                                               res.desc.sampleCount, res.desc.flags);
+        if (!texture->create())
+        {
+            qWarning() << "RenderGraph: failed to create transient texture" << name;
+            delete texture;
+            continue;
+        }
+        PooledTexture pooled;
+        pooled.texture = texture;
+        pooled.desc = res.desc;
+        pooled.busyUntil = res.lastUse;
+        pooled.used = true;
+        m_pool.push_back(pooled);
+        res.texture = texture;
+    }
+
+    for (int i = m_pool.size() - 1; i >= 0; --i)
+    {
+        if (!m_pool[i].used)
+        {
+            delete m_pool[i].texture;
+            m_pool.removeAt(i);
+        }
+    }
 }
 
 void RenderGraph::run(FrameContext &ctx)
@@ -19,9 +361,64 @@ void RenderGraph::run(FrameContext &ctx)
         return;
     }
 
-    for (const auto &pass : m_passes)
-        pass->prepare(ctx);
+    ctx.graph = this;
+    m_nodes.clear();
+    m_nodes.resize(int(m_passes.size()));
+    for (ResourceNode &res : m_resources)
+    {
+        if (!res.transient)
+            res.texture = nullptr;
+    }
+    for (int i = 0; i < int(m_passes.size()); ++i)
+    {
+        RenderGraphBuilder builder(this, i);
+        m_passes[i]->setup(builder, ctx);
+    }
+
+    compile();
+    allocateTransients(ctx.rhi->rhi());
+
+    for (int i = 0; i < int(m_passes.size()); ++i)
+    {
+        if (!m_nodes[i].live)
+            m_passes[i]->onCulled(ctx);
+    }
+
+    FrameProfiler *profiler = (m_profiler && m_profiler->isEnabled()) ? m_profiler : nullptr;
+    if (!profiler)
+    {
+        for (int index : m_order)
+            m_passes[index]->prepare(ctx);
+
+        for (int index : m_order)
+            m_passes[index]->execute(ctx);
+        return;
+    }
+
+    QRhiCommandBuffer *cb = ctx.rhi->commandBuffer();
+    profiler->beginFrame(cb);
+    m_prepareMs.fill(0.0, int(m_passes.size()));
+    m_executeMs.fill(0.0, int(m_passes.size()));
+    QElapsedTimer timer;
+    for (int index : m_order)
+    {
+        timer.start();
+        m_passes[index]->prepare(ctx);
+        m_prepareMs[index] = double(timer.nsecsElapsed()) / 1.0e6;
+    }
+
+    for (int index : m_order)
+    {
+        if (cb)
+            cb->debugMarkBegin(QByteArray(m_passes[index]->name()));
+        timer.start();
+        m_passes[index]->execute(ctx);
+        m_executeMs[index] = double(timer.nsecsElapsed()) / 1.0e6;
+        if (cb)
+            cb->debugMarkEnd();
+    }
 
-    for (const auto &pass : m_passes)
-        pass->execute(ctx);
+    for (int i = 0; i < int(m_passes.size()); ++i)
+        profiler->recordPass(m_passes[i]->name(), m_prepareMs[i], m_executeMs[i], !m_nodes[i].live);
+    profiler->endFrame();
 }
@@ -1,20 +1,44 @@
 #pragma once
 
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QRect>
+#include <QtCore/QSize>
+#include <QtCore/QVector>
 #include <QtGui/QMatrix4x4>
 #include <QtGui/QVector4D>
+#include <functional>
 #include <memory>
 #include <vector>
+#include <rhi/qrhi.h>
 
 class RhiContext;
 class RenderTargetCache;
 class ShaderManager;
 class Scene;
-class QRhiTexture;
-class QRhiBuffer;
+class RenderGraph;
+class FrameProfiler;
 
-inline constexpr int kMaxLights = 100;
 inline constexpr int kMaxSpotShadows = 32;
 
+namespace RenderResource
+{
+inline constexpr char GBufferAlbedo[] = "gbuffer.albedo";
+inline constexpr char GBufferNormal[] = "gbuffer.normal";
+inline constexpr char GBufferPosition[] = "gbuffer.position";
+inline constexpr char GBufferEmissive[] = "gbuffer.emissive";
+inline constexpr char GBufferDepth[] = "gbuffer.depth";
+inline constexpr char DepthPrepass[] = "depth.prepass";
+inline constexpr char HiZ[] = "depth.hiz";
+inline constexpr char Occlusion[] = "depth.occlusion";
+inline constexpr char ShadowMaps[] = "shadow.maps";
+inline constexpr char LightClusters[] = "light.clusters";
+inline constexpr char LightingColor[] = "lighting.color";
+inline constexpr char Bloom[] = "post.bloom";
+inline constexpr char BloomBlur[] = "post.bloomBlur";
+inline constexpr char Backbuffer[] = "backbuffer";
+} // namespace RenderResource
+
 struct ShadowData
 {
     int cascadeCount = 0;
@@ -23,8 +47,9 @@ struct ShadowData
     QVector4D dirLightColorIntensity;
     QMatrix4x4 lightViewProj[3];
     QRhiTexture *shadowMaps[3] = { nullptr, nullptr, nullptr };
-    QMatrix4x4 spotLightViewProj[kMaxLights];
-    QVector4D spotShadowParams[kMaxLights];
+    // Indexed by light, sized to the scene light count by PassShadow.
+    QVector<QMatrix4x4> spotLightViewProj;
+    QVector<QVector4D> spotShadowParams;
     int spotShadowCount = 0;
     QRhiTexture *spotShadowMapArray = nullptr;
     QVector4D shadowDepthParams;
@@ -32,7 +57,9 @@ struct ShadowData
 
 struct LightCullingData
 {
+    // Per cluster row: texel 0 = offset into the light list, texel 1 = count.
     QRhiTexture *clusterLightIndexTexture = nullptr;
+    QRhiTexture *clusterLightListTexture = nullptr;
     int clusterCountX = 0;
     int clusterCountY = 0;
     int clusterCountZ = 0;
@@ -44,21 +71,117 @@ struct LightCullingData
     bool enabled = false;
 };
 
+struct ObjectIdRequest
+{
+    // Render target pixels, top-left origin.
+    QRect rect;
+    // Called once the region is read back, a frame or more later, with the part
+    // of `rect` inside the target. The ids are row-major from the top row, 0 for
+    // no mesh and mesh index + 1 otherwise. Empty when the object ID attachment
+    // isn't available.
+    std::function<void(const QVector<quint32> &ids, const QRect &rect)> completed;
+};
+
+struct ObjectIdData
+{
+    // Adds the object ID attachment to the GBuffer.
+    bool enabled = false;
+    // Read back by PassGBuffer after the GBuffer is rendered, then cleared.
+    QVector<ObjectIdRequest> requests;
+};
+
+struct DrawListData
+{
+    // Visible meshes inside the camera frustum, gizmos excluded. Sorted by
+    // pipeline state (alpha mode, then culling), front to back within it.
+    // Built by DeferredRenderer before the passes run.
+    QVector<int> meshes;
+    // The meshes minus those found occluded, in the same order. Filled by
+    // PassOcclusion, PassDepth and PassGBuffer draw from it.
+    QVector<int> visible;
+};
+
+struct RetiredTextureData
+{
+    // Textures an item set on its meshes and replaced since, e.g. video frames
+    // that changed size. PassGBuffer drops its bindings using them, then
+    // deletes them.
+    QVector<QRhiTexture *> textures;
+};
+
+struct DepthPrepassData
+{
+    // Renders the depth of the opaque meshes ahead of the GBuffer.
+    bool enabled = true;
+    // Per mesh, set for the meshes PassDepth drew this frame. PassGBuffer draws
+    // them with an EQUAL depth test and without writing depth.
+    QVector<bool> drawn;
+    // Furthest depth of each 2x2 block of the level above, level 0 covering the
+    // depth buffer at half its size. Built from the pre-pass depth, so only the
+    // opaque meshes occlude. Null without compute support.
+    QRhiTexture *hiZ = nullptr;
+    int hiZMipCount = 0;
+    // Size of the depth the Hi-Z was built from.
+    QSize depthSize;
+    // Clip space matrix the depth was rendered with.
+    QMatrix4x4 viewProj;
+};
+
 struct FrameContext
 {
     RhiContext *rhi = nullptr;
     RenderTargetCache *targets = nullptr;
     ShaderManager *shaders = nullptr;
     Scene *scene = nullptr;
+    RenderGraph *graph = nullptr;
     ShadowData *shadows = nullptr;
     LightCullingData *lightCulling = nullptr;
+    ObjectIdData *objectIds = nullptr;
+    DrawListData *drawList = nullptr;
+    DepthPrepassData *depthPrepass = nullptr;
+    RetiredTextureData *retiredTextures = nullptr;
+    // Storage copy of Scene::lightBuffer(), patched by DeferredRenderer before the passes run.
+    QRhiBuffer *lightBuffer = nullptr;
     bool lightingEnabled = true;
 };
 
+struct RenderGraphTextureDesc
+{
+    QRhiTexture::Format format = QRhiTexture::RGBA8;
+    QSize size;
+    int sampleCount = 1;
+    QRhiTexture::Flags flags;
+};
+
+class RenderGraphBuilder
+{
+public:
+    void read(const char *resource);
+    void write(const char *resource);
+    // Registers a texture owned by someone else. Aliasable textures may be handed
+    // out as transients once their last reader in the frame has run.
+    void importTexture(const char *resource, QRhiTexture *texture, bool aliasable = false);
+    // Declares a graph-owned texture written by this pass, see RenderGraph::texture().
+    void createTexture(const char *resource, const RenderGraphTextureDesc &desc);
+    void setSideEffect();
+
+private:
+    friend class RenderGraph;
+    RenderGraphBuilder(RenderGraph *graph, int passIndex);
+
+    RenderGraph *m_graph = nullptr;
+    int m_passIndex = -1;
+};
+
 class RenderPass
 {
 public:
     virtual ~RenderPass() = default;
+    virtual const char *name() const = 0;
+    // Called every frame before prepare(). The default keeps the pass always alive.
+    virtual void setup(RenderGraphBuilder &builder, FrameContext &ctx);
+    // Called instead of prepare()/execute() when no live pass consumes the outputs.
+    virtual void onCulled(FrameContext &ctx) { Q_UNUSED(ctx); }
     virtual void prepare(FrameContext &ctx) = 0;
     virtual void execute(FrameContext &ctx) = 0;
 };
@@ -67,9 +190,54 @@ class RenderGraph
 {
 public:
     void addPass(std::unique_ptr<RenderPass> pass);
+    void addOutput(const char *resource);
     void clear();
     void run(FrameContext &ctx);
+    void setProfiler(FrameProfiler *profiler) { m_profiler = profiler; }
+
+    QRhiTexture *texture(const char *resource) const;
+    bool isLive(const RenderPass *pass) const;
+    void releaseResources();
 
 private:
+    friend class RenderGraphBuilder;
+
+    struct PassNode
+    {
+        QVector<QByteArray> reads;
+        QVector<QByteArray> writes;
+        bool sideEffect = false;
+        bool live = false;
+    };
+
+    struct ResourceNode
+    {
+        QRhiTexture *texture = nullptr;
+        RenderGraphTextureDesc desc;
+        bool transient = false;
+        bool aliasable = false;
+        int firstUse = -1;
+        int lastUse = -1;
+    };
+
+    struct PooledTexture
+    {
+        QRhiTexture *texture = nullptr;
+        RenderGraphTextureDesc desc;
+        int busyUntil = -1;
+        bool used = false;
+    };
+
+    void compile();
+    void allocateTransients(QRhi *rhi);
+
     std::vector<std::unique_ptr<RenderPass>> m_passes;
+    QVector<PassNode> m_nodes;
+    QHash<QByteArray, ResourceNode> m_resources;
+    QVector<QByteArray> m_outputs;
+    QVector<int> m_order;
+    QVector<PooledTexture> m_pool;
+    QVector<double> m_prepareMs;
+    QVector<double> m_executeMs;
+    FrameProfiler *m_profiler = nullptr;
 };
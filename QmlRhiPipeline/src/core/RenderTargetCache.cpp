@@ -8,7 +8,9 @@ RenderTargetCache::RenderTargetCache(QRhi *rhi)
 
 RenderTargetCache::GBufferTargets RenderTargetCache::getOrCreateGBuffer(const QSize &size, int sampleCount)
 {
-    if (m_gbuffer.rt && (m_lastSize == size) && (m_lastSamples == sampleCount))
+    if (m_gbuffer.rt && (m_lastSize == size) && (m_lastSamples == sampleCount)
+        && (m_gbuffer.objectIds != nullptr) == m_objectIdsEnabled
+        && (m_gbuffer.depthRt != nullptr) == m_depthPrepassEnabled)
         return m_gbuffer;
 
     releaseAll();
@@ -36,25 +38,36 @@ RenderTargetCache::GBufferTargets RenderTargetCache::getOrCreateGBuffer(const QS
     m_gbuffer.color2 = m_rhi->newTexture(gbufFormat, size, sampleCount, QRhiTexture::RenderTarget);
     m_gbuffer.color3 = m_rhi->newTexture(gbufFormat, size, sampleCount, QRhiTexture::RenderTarget);
     m_gbuffer.depth = m_rhi->newTexture(depthFormat, size, sampleCount, QRhiTexture::RenderTarget);
+    if (m_objectIdsEnabled)
+    {
+        m_gbuffer.objectIds = m_rhi->newTexture(QRhiTexture::RGBA8, size, sampleCount,
+                                                QRhiTexture::RenderTarget | QRhiTexture::UsedAsTransferSource);
+    }
 
     if (!m_gbuffer.color0->create() || !m_gbuffer.color1->create() ||
-        !m_gbuffer.color2->create() || !m_gbuffer.color3->create() || !m_gbuffer.depth->create())
+        !m_gbuffer.color2->create() || !m_gbuffer.color3->create() || !m_gbuffer.depth->create()
+        || (m_gbuffer.objectIds && !m_gbuffer.objectIds->create()))
         {
         qWarning() << "RenderTargetCache: failed to create GBuffer textures";
         releaseAll();
         return m_gbuffer;
     }
 
-    QRhiTextureRenderTargetDescription rtDesc;
-    rtDesc.setColorAttachments({
+    QVector<QRhiColorAttachment> attachments = {
         QRhiColorAttachment(m_gbuffer.color0),
         QRhiColorAttachment(m_gbuffer.color1),
         QRhiColorAttachment(m_gbuffer.color2),
         QRhiColorAttachment(m_gbuffer.color3)
-    });
+    };
+    if (m_gbuffer.objectIds)
+        attachments.push_back(QRhiColorAttachment(m_gbuffer.objectIds));
+    QRhiTextureRenderTargetDescription rtDesc;
+    rtDesc.setColorAttachments(attachments.cbegin(), attachments.cend());
     rtDesc.setDepthTexture(m_gbuffer.depth);
 
-    m_gbuffer.rt = m_rhi->newTextureRenderTarget(rtDesc);
+    m_gbuffer.rt = m_rhi->newTextureRenderTarget(rtDesc, m_depthPrepassEnabled
+                                                          ? QRhiTextureRenderTarget::PreserveDepthStencilContents
+                                                          : QRhiTextureRenderTarget::Flags());
     m_gbuffer.rpDesc = m_gbuffer.rt->newCompatibleRenderPassDescriptor();
     m_gbuffer.rt->setRenderPassDescriptor(m_gbuffer.rpDesc);
 
@@ -65,9 +78,43 @@ RenderTargetCache::GBufferTargets RenderTargetCache::getOrCreateGBuffer(const QS
         return m_gbuffer;
     }
 
+    if (m_depthPrepassEnabled)
+    {
+        QRhiTextureRenderTargetDescription depthDesc;
+        depthDesc.setDepthTexture(m_gbuffer.depth);
+        m_gbuffer.depthRt = m_rhi->newTextureRenderTarget(depthDesc);
+        m_gbuffer.depthRpDesc = m_gbuffer.depthRt->newCompatibleRenderPassDescriptor();
+        m_gbuffer.depthRt->setRenderPassDescriptor(m_gbuffer.depthRpDesc);
+        if (!m_gbuffer.depthRt->create())
+        {
+            qWarning() << "RenderTargetCache: failed to create depth pre-pass render target";
+            releaseAll();
+            return m_gbuffer;
+        }
+    }
+
     return m_gbuffer;
 }
 
+void RenderTargetCache::setObjectIdsEnabled(bool enabled)
+{
+    // The attachment comes on top of the four GBuffer targets.
+    if (enabled && m_rhi->resourceLimit(QRhi::MaxColorAttachments) < 5)
+    {
+        static bool s_warned = false;
+        if (!s_warned)
+            qWarning() << "RenderTargetCache: not enough color attachments for object IDs";
+        s_warned = true;
+        enabled = false;
+    }
+    m_objectIdsEnabled = enabled;
+}
+
+void RenderTargetCache::setDepthPrepassEnabled(bool enabled)
+{
+    m_depthPrepassEnabled = enabled;
+}
+
 RenderTargetCache::LightingTargets RenderTargetCache::getOrCreateLightingTarget(const QSize &size, int sampleCount)
 {
     if (m_lighting.rt && (m_lastSize == size) && (m_lastSamples == sampleCount))
@@ -112,6 +159,10 @@ RenderTargetCache::LightingTargets RenderTargetCache::getOrCreateLightingTarget(
 
 void RenderTargetCache::releaseAll()
 {
+    delete m_gbuffer.depthRpDesc;
+    m_gbuffer.depthRpDesc = nullptr;
+    delete m_gbuffer.depthRt;
+    m_gbuffer.depthRt = nullptr;
     delete m_gbuffer.rpDesc;
     m_gbuffer.rpDesc = nullptr;
     delete m_gbuffer.rt;
@@ -120,6 +171,7 @@ void RenderTargetCache::releaseAll()
     delete m_gbuffer.color1;
     delete m_gbuffer.color2;
     delete m_gbuffer.color3;
+    delete m_gbuffer.objectIds;
     delete m_gbuffer.depth;
     m_gbuffer = {};
 
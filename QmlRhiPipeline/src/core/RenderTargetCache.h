@@ -17,9 +17,15 @@ public:
         QRhiTexture *color1 = nullptr;
         QRhiTexture *color2 = nullptr;
         QRhiTexture *color3 = nullptr;
+        // Mesh index + 1 per pixel, packed into RGBA8. Only when enabled.
+        QRhiTexture *objectIds = nullptr;
         QRhiTexture *depth = nullptr;
         QRhiTextureRenderTarget *rt = nullptr;
         QRhiRenderPassDescriptor *rpDesc = nullptr;
+        // Depth only target over `depth`, only with the depth pre-pass. `rt`
+        // then keeps the depth it starts with instead of clearing it.
+        QRhiTextureRenderTarget *depthRt = nullptr;
+        QRhiRenderPassDescriptor *depthRpDesc = nullptr;
         QRhiTexture::Format colorFormat = QRhiTexture::RGBA8;
     };
 
@@ -32,6 +38,10 @@ public:
     };
 
     GBufferTargets getOrCreateGBuffer(const QSize &size, int sampleCount);
+    // Takes effect on the next getOrCreateGBuffer(), which then recreates the targets.
+    void setObjectIdsEnabled(bool enabled);
+    // Same as above, for the depth only target.
+    void setDepthPrepassEnabled(bool enabled);
     LightingTargets getOrCreateLightingTarget(const QSize &size, int sampleCount);
     void releaseAll();
 
@@ -39,6 +49,8 @@ private:
     QRhi *m_rhi = nullptr;
     QSize m_lastSize;
     int m_lastSamples = 1;
+    bool m_objectIdsEnabled = false;
+    bool m_depthPrepassEnabled = false;
     GBufferTargets m_gbuffer;
     LightingTargets m_lighting;
 };
@@ -212,8 +212,74 @@ bool RhiContext::initializeExternal(QRhi *rhi)
     return true;
 }
 
+bool RhiContext::initializeOffscreen(QRhi::Implementation backend, const QSize &size)
+{
+    const QRhi::Flags flags = QRhi::EnableTimestamps;
+    if (backend == QRhi::Null)
+    {
+        QRhiNullInitParams nullParams;
+        m_rhi = QRhi::create(QRhi::Null, &nullParams, flags);
+    }
+    else if (backend == QRhi::OpenGLES2)
+    {
+#if QT_CONFIG(opengl)
+        QSurfaceFormat fmt;
+        fmt.setMajorVersion(3);
+        fmt.setMinorVersion(3);
+        fmt.setProfile(QSurfaceFormat::CoreProfile);
+        m_glOffscreenSurface = QRhiGles2InitParams::newFallbackSurface(fmt);
+        QRhiGles2InitParams glParams;
+        glParams.fallbackSurface = m_glOffscreenSurface;
+        glParams.format = fmt;
+        m_rhi = QRhi::create(QRhi::OpenGLES2, &glParams, flags);
+#endif
+    }
+    else
+    {
+        qWarning() << "RhiContext: unsupported offscreen backend" << backend;
+        return false;
+    }
+
+    if (!m_rhi)
+    {
+        qWarning() << "RhiContext: failed to create offscreen RHI";
+        return false;
+    }
+
+    m_backend = backend;
+    m_ownsRhi = true;
+    logRhiInfo(m_rhi);
+
+    m_offscreenColor = m_rhi->newTexture(QRhiTexture::RGBA8, size, 1,
+                                         QRhiTexture::RenderTarget | QRhiTexture::UsedAsTransferSource);
+    if (!m_offscreenColor->create())
+        return false;
+    m_offscreenDepthStencil = m_rhi->newRenderBuffer(QRhiRenderBuffer::DepthStencil, size, 1);
+    if (!m_offscreenDepthStencil->create())
+        return false;
+
+    QRhiTextureRenderTargetDescription rtDesc{ QRhiColorAttachment(m_offscreenColor) };
+    rtDesc.setDepthStencilBuffer(m_offscreenDepthStencil);
+    m_offscreenRt = m_rhi->newTextureRenderTarget(rtDesc);
+    m_offscreenRpDesc = m_offscreenRt->newCompatibleRenderPassDescriptor();
+    m_offscreenRt->setRenderPassDescriptor(m_offscreenRpDesc);
+    if (!m_offscreenRt->create())
+        return false;
+
+    m_swapChainSize = size;
+    return true;
+}
+
 void RhiContext::shutdown()
 {
+    delete m_offscreenRt;
+    m_offscreenRt = nullptr;
+    delete m_offscreenRpDesc;
+    m_offscreenRpDesc = nullptr;
+    delete m_offscreenDepthStencil;
+    m_offscreenDepthStencil = nullptr;
+    delete m_offscreenColor;
+    m_offscreenColor = nullptr;
     delete m_swapChainDepthStencil;
     m_swapChainDepthStencil = nullptr;
     delete m_swapChainRpDesc;
@@ -235,6 +301,16 @@ void RhiContext::shutdown()
 
 void RhiContext::beginFrame()
 {
+    if (m_rhi && m_offscreenRt)
+    {
+        const QRhi::FrameOpResult res = m_rhi->beginOffscreenFrame(&m_cb);
+        if (res != QRhi::FrameOpSuccess)
+        {
+            qWarning() << "RhiContext: beginOffscreenFrame failed with" << res;
+            m_cb = nullptr;
+        }
+        return;
+    }
     if (!m_rhi || !m_swapChain)
         return;
 
@@ -250,6 +326,13 @@ void RhiContext::beginFrame()
 
 void RhiContext::endFrame()
 {
+    if (m_rhi && m_offscreenRt)
+    {
+        if (m_cb)
+            m_rhi->endOffscreenFrame();
+        m_cb = nullptr;
+        return;
+    }
     if (!m_rhi || !m_swapChain)
         return;
     if (!m_cb)
@@ -279,6 +362,8 @@ QRhiRenderTarget *RhiContext::swapchainRenderTarget() const
 {
     if (m_externalRt)
         return m_externalRt;
+    if (m_offscreenRt)
+        return m_offscreenRt;
     return m_swapChain ? m_swapChain->currentFrameRenderTarget() : nullptr;
 }
 
@@ -15,6 +15,8 @@ public:
 
     bool initialize(QWindow *window);
     bool initializeExternal(QRhi *rhi);
+    // Windowless setup rendering into an owned texture target, for headless runs.
+    bool initializeOffscreen(QRhi::Implementation backend, const QSize &size);
     void shutdown();
 
     void beginFrame();
@@ -27,6 +29,7 @@ public:
     QRhi *rhi() const { return m_rhi; }
     QRhiCommandBuffer *commandBuffer() const { return m_externalCb ? m_externalCb : m_cb; }
     QRhiRenderTarget *swapchainRenderTarget() const;
+    QRhiTexture *offscreenColorTexture() const { return m_offscreenColor; }
 
 private:
     QWindow *m_window = nullptr;
@@ -37,6 +40,10 @@ private:
     QRhiCommandBuffer *m_cb = nullptr;
     QRhiCommandBuffer *m_externalCb = nullptr;
     QRhiRenderTarget *m_externalRt = nullptr;
+    QRhiTexture *m_offscreenColor = nullptr;
+    QRhiRenderBuffer *m_offscreenDepthStencil = nullptr;
+    QRhiTextureRenderTarget *m_offscreenRt = nullptr;
+    QRhiRenderPassDescriptor *m_offscreenRpDesc = nullptr;
 #if QT_CONFIG(vulkan)
     QVulkanInstance m_vkInstance;
 #endif
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+
+struct SlotHandle
+{
+    int index = -1;
+    quint32 generation = 0;
+
+    bool isNull() const { return index < 0; }
+    bool operator==(const SlotHandle &other) const
+    {
+        return index == other.index && generation == other.generation;
+    }
+    bool operator!=(const SlotHandle &other) const { return !(*this == other); }
+};
+
+// Storage whose elements keep their index. Removing an element frees its slot
+// for reuse and bumps the slot generation, so handles to it stop resolving.
+// Elements do move when an insert grows the storage, hold handles rather
+// than the pointers get() returns.
+template<typename T>
+class SlotMap
+{
+public:
+    SlotHandle insert(const T &value)
+    {
+        int index;
+        if (!m_free.isEmpty())
+        {
+            index = m_free.takeLast();
+        }
+        else
+        {
+            index = m_slots.size();
+            m_slots.push_back(Slot());
+        }
+        Slot &slot = m_slots[index];
+        slot.value = value;
+        slot.used = true;
+        ++m_count;
+        return { index, slot.generation };
+    }
+
+    bool remove(const SlotHandle &handle)
+    {
+        if (!contains(handle))
+            return false;
+        Slot &slot = m_slots[handle.index];
+        slot.value = T();
+        slot.used = false;
+        ++slot.generation;
+        m_free.push_back(handle.index);
+        --m_count;
+        return true;
+    }
+
+    bool contains(const SlotHandle &handle) const
+    {
+        return handle.index >= 0 && handle.index < m_slots.size()
+                && m_slots[handle.index].used && m_slots[handle.index].generation == handle.generation;
+    }
+
+    T *get(const SlotHandle &handle)
+    {
+        return contains(handle) ? &m_slots[handle.index].value : nullptr;
+    }
+
+    const T *get(const SlotHandle &handle) const
+    {
+        return contains(handle) ? &m_slots[handle.index].value : nullptr;
+    }
+
+    int size() const { return m_count; }
+    bool isEmpty() const { return m_count == 0; }
+
+    // Visits the live elements in slot order.
+    template<typename F>
+    void forEach(F &&visit)
+    {
+        for (Slot &slot : m_slots)
+        {
+            if (slot.used)
+                visit(slot.value);
+        }
+    }
+
+    template<typename F>
+    void forEach(F &&visit) const
+    {
+        for (const Slot &slot : m_slots)
+        {
+            if (slot.used)
+                visit(slot.value);
+        }
+    }
+
+private:
+    struct Slot
+    {
+        T value = T();
+        quint32 generation = 0;
+        bool used = false;
+    };
+
+    QVector<Slot> m_slots;
+    QVector<int> m_free;
+    int m_count = 0;
+};
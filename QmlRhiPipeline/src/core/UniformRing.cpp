@@ -0,0 +1,100 @@
+#include "core/UniformRing.h"
+
+#include <QtCore/QDebug>
+#include <algorithm>
+#include <cstring>
+
+bool UniformRing::create(QRhi *rhi, quint32 initialSize)
+{
+    release();
+    m_rhi = rhi;
+    m_buffer = rhi->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, initialSize);
+    if (!m_buffer->create())
+    {
+        qWarning() << "UniformRing: failed to create buffer";
+        delete m_buffer;
+        m_buffer = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void UniformRing::release()
+{
+    delete m_buffer;
+    m_buffer = nullptr;
+    m_data.clear();
+    m_valid = 0;
+    m_dirty.clear();
+    m_used = 0;
+}
+
+void UniformRing::reset()
+{
+    m_used = 0;
+}
+
+quint32 UniformRing::append(const void *data, quint32 size)
+{
+    const quint32 offset = m_used;
+    m_used = quint32(m_rhi->ubufAligned(int(offset + size)));
+    if (quint32(m_data.size()) < m_used)
+        m_data.resize(m_used);
+    write(offset, data, size);
+    return offset;
+}
+
+void UniformRing::update(quint32 offset, const void *data, quint32 size)
+{
+    write(offset, data, size);
+}
+
+void UniformRing::write(quint32 offset, const void *data, quint32 size)
+{
+    // Only the block written is compared, a still scene uploads nothing.
+    char *block = m_data.data() + offset;
+    if (offset + size <= m_valid && std::memcmp(block, data, size) == 0)
+        return;
+    std::memcpy(block, data, size);
+    m_dirty.push_back(qMakePair(offset, offset + size));
+}
+
+bool UniformRing::upload(QRhiResourceUpdateBatch *u)
+{
+    if (!m_buffer)
+        return false;
+    if (m_used > m_buffer->size())
+    {
+        // The bindings follow the native buffer when it is created again,
+        // which starts out empty.
+        m_buffer->setSize(qMax(m_used, m_buffer->size() + m_buffer->size() / 2));
+        m_dirty.clear();
+        m_dirty.push_back(qMakePair(quint32(0), m_used));
+        m_valid = m_used;
+        if (!m_buffer->create())
+        {
+            qWarning() << "UniformRing: failed to grow buffer";
+            return false;
+        }
+    }
+    m_valid = qMax(m_valid, m_used);
+    if (m_dirty.isEmpty())
+        return true;
+    // Blocks written next to each other go up in one update.
+    std::sort(m_dirty.begin(), m_dirty.end());
+    const char *data = m_data.constData();
+    QPair<quint32, quint32> run = m_dirty.first();
+    for (int i = 1; i <= m_dirty.size(); ++i)
+    {
+        if (i < m_dirty.size() && m_dirty[i].first <= quint32(m_rhi->ubufAligned(int(run.second))))
+        {
+            run.second = qMax(run.second, m_dirty[i].second);
+            continue;
+        }
+        u->updateDynamicBuffer(m_buffer, run.first, run.second - run.first, data + run.first);
+        if (i < m_dirty.size())
+            run = m_dirty[i];
+    }
+    m_dirty.clear();
+    return true;
+}
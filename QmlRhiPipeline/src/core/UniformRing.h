@@ -0,0 +1,41 @@
+#pragma once
+
+#include <QtCore/QByteArray>
+#include <QtCore/QPair>
+#include <QtCore/QVector>
+#include <rhi/qrhi.h>
+
+// Uniform blocks of many draws packed into one dynamic uniform buffer. It is
+// bound once with uniformBufferWithDynamicOffset() and each draw picks its
+// blocks through QRhiCommandBuffer::DynamicOffset. The blocks are either laid
+// out again on every fill or kept and updated in place, QRhi keeps a copy of
+// the buffer per frame in flight.
+class UniformRing
+{
+public:
+    // The buffer the bindings refer to. It keeps its identity when it grows.
+    bool create(QRhi *rhi, quint32 initialSize = 64 * 1024);
+    void release();
+    QRhiBuffer *buffer() const { return m_buffer; }
+
+    // Starts a new fill.
+    void reset();
+    // Copies a block in and returns its offset, aligned for a dynamic offset.
+    quint32 append(const void *data, quint32 size);
+    // Overwrites a block appended before, it keeps its offset.
+    void update(quint32 offset, const void *data, quint32 size);
+    // Grows the buffer to the fill and uploads the blocks written with new
+    // contents since the last upload.
+    bool upload(QRhiResourceUpdateBatch *u);
+
+private:
+    void write(quint32 offset, const void *data, quint32 size);
+
+    QRhi *m_rhi = nullptr;
+    QRhiBuffer *m_buffer = nullptr;
+    QByteArray m_data;
+    // Bytes of m_data that are in the buffer or in m_dirty.
+    quint32 m_valid = 0;
+    QVector<QPair<quint32, quint32>> m_dirty; // begin, end
+    quint32 m_used = 0;
+};
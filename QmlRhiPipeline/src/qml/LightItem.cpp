@@ -3,6 +3,8 @@
 #include <QtMath>
 #include <QtQuick/QQuickItem>
 
+#include "qml/RhiQmlItem.h"
+
 LightItem::LightItem(QObject *parent)
     : QObject(parent)
 {
@@ -165,9 +167,17 @@ Light LightItem::toLight() const
 
 void LightItem::notifyParent()
 {
-    QObject *p = parent();
-    while (p && !qobject_cast<QQuickItem *>(p))
-        p = p->parent();
-    if (auto *item = qobject_cast<QQuickItem *>(p))
-        item->update();
+    QQuickItem *nearest = nullptr;
+    for (QObject *p = parent(); p; p = p->parent())
+    {
+        if (auto *view = qobject_cast<RhiQmlItem *>(p))
+        {
+            view->markLightsDirty();
+            return;
+        }
+        if (!nearest)
+            nearest = qobject_cast<QQuickItem *>(p);
+    }
+    if (nearest)
+        nearest->update();
 }
@@ -2,6 +2,8 @@
 
 #include <QtQuick/QQuickItem>
 
+#include "qml/RhiQmlItem.h"
+
 MeshItem::MeshItem(QObject *parent)
     : QObject(parent)
 {
@@ -68,7 +70,18 @@ void MeshItem::setVisible(bool visible)
 
 void MeshItem::notifyParent()
 {
-    auto *item = qobject_cast<QQuickItem *>(parent());
-    if (item)
-        item->update();
+    // The view may be further up, past wrappers like a Repeater's delegates.
+    QQuickItem *nearest = nullptr;
+    for (QObject *p = parent(); p; p = p->parent())
+    {
+        if (auto *view = qobject_cast<RhiQmlItem *>(p))
+        {
+            view->markMeshItemDirty(this);
+            return;
+        }
+        if (!nearest)
+            nearest = qobject_cast<QQuickItem *>(p);
+    }
+    if (nearest)
+        nearest->update();
 }
@@ -5,7 +5,9 @@
 namespace RhiQmlUtils
 {
 
-Mesh createUnitCubeMesh()
+namespace {
+
+Mesh buildUnitCubeMesh()
 {
     Mesh mesh;
     const float h = 0.5f;
@@ -58,7 +60,7 @@ Mesh createUnitCubeMesh()
     return mesh;
 }
 
-Mesh createUnitQuadMesh()
+Mesh buildUnitQuadMesh()
 {
     Mesh mesh;
     const float h = 0.5f;
@@ -78,7 +80,7 @@ Mesh createUnitQuadMesh()
     return mesh;
 }
 
-Mesh createSphereMesh(float radius, int rings, int sectors)
+Mesh buildSphereMesh(float radius, int rings, int sectors)
 {
     Mesh mesh;
     rings = qMax(2, rings);
@@ -132,6 +134,36 @@ Mesh createSphereMesh(float radius, int rings, int sectors)
     return mesh;
 }
 
+// Built once with their pick geometry, the copies share it and with it their
+// GPU buffers, which lets them draw instanced.
+Mesh sharedMesh(Mesh mesh)
+{
+    buildPickGeometry(mesh);
+    return mesh;
+}
+
+} // namespace
+
+Mesh createUnitCubeMesh()
+{
+    static const Mesh cube = sharedMesh(buildUnitCubeMesh());
+    return cube;
+}
+
+Mesh createUnitQuadMesh()
+{
+    static const Mesh quad = sharedMesh(buildUnitQuadMesh());
+    return quad;
+}
+
+Mesh createSphereMesh(float radius, int rings, int sectors)
+{
+    static const Mesh sphere = sharedMesh(buildSphereMesh(0.5f, 16, 24));
+    if (radius == 0.5f && rings == 16 && sectors == 24)
+        return sphere;
+    return buildSphereMesh(radius, rings, sectors);
+}
+
 Mesh createArcMesh(float majorRadius, float tubeRadius,
                    float startAngle, float endAngle,
                    int segments, int sides)
@@ -122,6 +122,106 @@ float closestAxisT(const QVector3D &rayOrigin, const QVector3D &rayDir,
     return (a * e - b * d) / denom;
 }
 
+namespace
+{
+
+// Records the mesh in `hit` if the ray meets it closer than the current hit.
+void pickMesh(const Mesh &mesh, int meshIndex, const QVector3D &origin, const QVector3D &dir, PickHit &hit)
+{
+    bool invOk = false;
+    const QMatrix4x4 invModel = mesh.modelMatrix.inverted(&invOk);
+    if (!invOk)
+        return;
+    const QVector3D originLocal = (invModel * QVector4D(origin, 1.0f)).toVector3D();
+    // Left unnormalized, distances along it are the world space ones.
+    const QVector3D dirLocal = (invModel * QVector4D(dir, 0.0f)).toVector3D();
+    if (dirLocal.isNull())
+        return;
+
+    const MeshPickGeometry *pick = mesh.pickGeometry.data();
+    if (pick)
+    {
+        float t = hit.distance;
+        if (!pick->bvh.intersect(pick->positions, pick->indices, originLocal, dirLocal, t))
+            return;
+        hit.distance = t;
+        hit.meshIndex = meshIndex;
+        hit.worldPos = origin + dir * t;
+        return;
+    }
+
+    // Meshes not uploaded yet have no pick geometry, test their vertices.
+    if (mesh.vertices.isEmpty())
+        return;
+    const QVector3D dirNormalized = dirLocal.normalized();
+    QVector3D minV = mesh.boundsMin;
+    QVector3D maxV = mesh.boundsMax;
+    if (!mesh.boundsValid)
+    {
+        minV = QVector3D(mesh.vertices[0].px, mesh.vertices[0].py, mesh.vertices[0].pz);
+        maxV = minV;
+        for (const Vertex &v : mesh.vertices)
+        {
+            minV.setX(qMin(minV.x(), v.px));
+            minV.setY(qMin(minV.y(), v.py));
+            minV.setZ(qMin(minV.z(), v.pz));
+            maxV.setX(qMax(maxV.x(), v.px));
+            maxV.setY(qMax(maxV.y(), v.py));
+            maxV.setZ(qMax(maxV.z(), v.pz));
+        }
+    }
+
+    float tNear = 0.0f;
+    float tFar = 0.0f;
+    if (!rayAabbIntersection(originLocal, dirNormalized, minV, maxV, tNear, tFar))
+        return;
+
+    auto getVertex = [&](int idx)
+    {
+        const Vertex &v = mesh.vertices[idx];
+        return QVector3D(v.px, v.py, v.pz);
+    };
+
+    auto testTriangle = [&](const QVector3D &v0, const QVector3D &v1, const QVector3D &v2)
+    {
+        float tHit = 0.0f;
+        if (!rayTriangleIntersection(originLocal, dirNormalized, v0, v1, v2, tHit))
+            return;
+        const QVector3D localHit = originLocal + dirNormalized * tHit;
+        const QVector3D worldHit = (mesh.modelMatrix * QVector4D(localHit, 1.0f)).toVector3D();
+        const float dist = (worldHit - origin).length();
+        if (dist < hit.distance)
+        {
+            hit.distance = dist;
+            hit.meshIndex = meshIndex;
+            hit.worldPos = worldHit;
+        }
+    };
+
+    if (!mesh.indices.isEmpty())
+    {
+        for (int i = 0; i + 2 < mesh.indices.size(); i += 3)
+        {
+            const QVector3D v0 = getVertex(int(mesh.indices[i]));
+            const QVector3D v1 = getVertex(int(mesh.indices[i + 1]));
+            const QVector3D v2 = getVertex(int(mesh.indices[i + 2]));
+            testTriangle(v0, v1, v2);
+        }
+    }
+    else
+    {
+        for (int i = 0; i + 2 < mesh.vertices.size(); i += 3)
+        {
+            const QVector3D v0 = getVertex(i);
+            const QVector3D v1 = getVertex(i + 1);
+            const QVector3D v2 = getVertex(i + 2);
+            testTriangle(v0, v1, v2);
+        }
+    }
+}
+
+}
+
 bool pickSceneMesh(const Scene &scene, QRhi *rhi, const QPointF &normPos,
                    PickFilter filter, PickHit &hit)
 {
@@ -131,97 +231,61 @@ bool pickSceneMesh(const Scene &scene, QRhi *rhi, const QPointF &normPos,
         return false;
 
     const auto &meshes = scene.meshes();
-    for (int meshIndex = 0; meshIndex < meshes.size(); ++meshIndex)
+    auto pickable = [filter](const Mesh &mesh)
     {
-        const Mesh &mesh = meshes[meshIndex];
         if (!mesh.visible)
-            continue;
+            return false;
         if (mesh.gizmoAxis >= 0 && filter != PickFilter::GizmosOnly)
-            continue;
+            return false;
         if (filter == PickFilter::SelectableOnly && !mesh.selectable)
-            continue;
+            return false;
         if (filter == PickFilter::GizmosOnly && mesh.gizmoAxis < 0)
-            continue;
-        if (mesh.vertices.isEmpty())
-            continue;
-
-        bool invOk = false;
-        const QMatrix4x4 invModel = mesh.modelMatrix.inverted(&invOk);
-        if (!invOk)
-            continue;
-
-        const QVector3D originLocal = (invModel * QVector4D(origin, 1.0f)).toVector3D();
-        QVector3D dirLocal = (invModel * QVector4D(dir, 0.0f)).toVector3D();
-        if (dirLocal.isNull())
-            continue;
-        dirLocal.normalize();
+            return false;
+        return true;
+    };
 
-        QVector3D minV = mesh.boundsMin;
-        QVector3D maxV = mesh.boundsMax;
-        if (!mesh.boundsValid)
+    if (filter == PickFilter::GizmosOnly)
+    {
+        for (int meshIndex = 0; meshIndex < meshes.size(); ++meshIndex)
         {
-            minV = QVector3D(mesh.vertices[0].px, mesh.vertices[0].py, mesh.vertices[0].pz);
-            maxV = minV;
-            for (const Vertex &v : mesh.vertices)
-            {
-                minV.setX(qMin(minV.x(), v.px));
-                minV.setY(qMin(minV.y(), v.py));
-                minV.setZ(qMin(minV.z(), v.pz));
-                maxV.setX(qMax(maxV.x(), v.px));
-                maxV.setY(qMax(maxV.y(), v.py));
-                maxV.setZ(qMax(maxV.z(), v.pz));
-            }
+            if (pickable(meshes[meshIndex]))
+                pickMesh(meshes[meshIndex], meshIndex, origin, dir, hit);
         }
+        return hit.meshIndex >= 0;
+    }
 
-        float tNear = 0.0f;
-        float tFar = 0.0f;
-        if (!rayAabbIntersection(originLocal, dirLocal, minV, maxV, tNear, tFar))
-            continue;
+    // The scene BVH holds every visible mesh but the gizmos, the walk only
+    // visits the ones whose bounds the ray enters before the nearest hit.
+    scene.shadowCasterBvh().raycast(origin, dir, hit.distance, [&](int meshIndex)
+    {
+        if (meshIndex < meshes.size() && pickable(meshes[meshIndex]))
+            pickMesh(meshes[meshIndex], meshIndex, origin, dir, hit);
+        return hit.distance;
+    });
+    for (int meshIndex : scene.unboundedShadowCasters())
+    {
+        if (meshIndex < meshes.size() && pickable(meshes[meshIndex]))
+            pickMesh(meshes[meshIndex], meshIndex, origin, dir, hit);
+    }
 
-        auto getVertex = [&](int idx)
-        {
-            const Vertex &v = mesh.vertices[idx];
-            return QVector3D(v.px, v.py, v.pz);
-        };
+    return hit.meshIndex >= 0;
+}
 
-        auto testTriangle = [&](const QVector3D &v0, const QVector3D &v1, const QVector3D &v2)
-        {
-            float tHit = 0.0f;
-            if (!rayTriangleIntersection(originLocal, dirLocal, v0, v1, v2, tHit))
-                return;
-            const QVector3D localHit = originLocal + dirLocal * tHit;
-            const QVector3D worldHit = (mesh.modelMatrix * QVector4D(localHit, 1.0f)).toVector3D();
-            const float dist = (worldHit - origin).length();
-            if (dist < hit.distance)
-            {
-                hit.distance = dist;
-                hit.meshIndex = meshIndex;
-                hit.worldPos = worldHit;
-            }
-        };
-
-        if (!mesh.indices.isEmpty())
-        {
-            for (int i = 0; i + 2 < mesh.indices.size(); i += 3)
-            {
-                const QVector3D v0 = getVertex(int(mesh.indices[i]));
-                const QVector3D v1 = getVertex(int(mesh.indices[i + 1]));
-                const QVector3D v2 = getVertex(int(mesh.indices[i + 2]));
-                testTriangle(v0, v1, v2);
-            }
-        }
-        else
-        {
-            for (int i = 0; i + 2 < mesh.vertices.size(); i += 3)
-            {
-                const QVector3D v0 = getVertex(i);
-                const QVector3D v1 = getVertex(i + 1);
-                const QVector3D v2 = getVertex(i + 2);
-                testTriangle(v0, v1, v2);
-            }
-        }
-    }
+bool pickMeshes(const Scene &scene, QRhi *rhi, const QPointF &normPos,
+                const QVector<int> &meshIndices, PickHit &hit)
+{
+    QVector3D origin;
+    QVector3D dir;
+    if (!computeRay(scene, rhi, normPos, origin, dir))
+        return false;
 
+    const auto &meshes = scene.meshes();
+    for (int meshIndex : meshIndices)
+    {
+        if (meshIndex < 0 || meshIndex >= meshes.size() || !meshes[meshIndex].visible)
+            continue;
+        pickMesh(meshes[meshIndex], meshIndex, origin, dir, hit);
+    }
     return hit.meshIndex >= 0;
 }
 
@@ -2,6 +2,7 @@
 
 #include <QtGui/QVector3D>
 #include <QtCore/QPointF>
+#include <QtCore/QVector>
 #include <limits>
 
 class Scene;
@@ -34,8 +35,12 @@ bool rayTriangleIntersection(const QVector3D &origin, const QVector3D &dir,
                              float &tOut);
 float closestAxisT(const QVector3D &rayOrigin, const QVector3D &rayDir,
                    const QVector3D &axisOrigin, const QVector3D &axisDir);
+// Walks the scene BVH, Scene::updateGeometry() has to run after meshes move.
 bool pickSceneMesh(const Scene &scene, QRhi *rhi, const QPointF &normPos,
                    PickFilter filter, PickHit &hit);
+// Picks among the listed meshes only, e.g. the gizmo parts.
+bool pickMeshes(const Scene &scene, QRhi *rhi, const QPointF &normPos,
+                const QVector<int> &meshIndices, PickHit &hit);
 bool rayPlaneIntersection(const QVector3D &rayOrigin, const QVector3D &rayDir,
                           const QVector3D &planeOrigin, const QVector3D &planeNormal,
                           QVector3D &hit);
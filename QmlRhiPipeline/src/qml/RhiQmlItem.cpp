@@ -1,11 +1,14 @@
 #include "qml/RhiQmlItem.h"
 
+#include <QtCore/QCoreApplication>
 #include <QtCore/QElapsedTimer>
 #include <QtCore/QTimer>
 #include <QtCore/QMetaObject>
+#include <QtCore/QPointer>
 #include <QtCore/QVariant>
 #include <QtCore/QLatin1String>
 #include <QtMath>
+#include <cmath>
 #include <memory>
 #include <QtGui/QMatrix4x4>
 #include <QtGui/QGuiApplication>
@@ -13,6 +16,8 @@
 #include <QtGui/QQuaternion>
 #include <QtGui/QKeyEvent>
 #include <QtGui/QImage>
+#include <QtQuick/QQuickGraphicsConfiguration>
+#include <QtQuick/QQuickWindow>
 #include <QtCore/QHash>
 #include <QtCore/QSet>
 #include <rhi/qrhi.h>
@@ -20,6 +25,7 @@
 #include "core/RhiContext.h"
 #include "core/RenderTargetCache.h"
 #include "core/ShaderManager.h"
+#include "core/SlotMap.h"
 #include "renderer/DeferredRenderer.h"
 #include "scene/AssimpLoader.h"
 #include "qml/CameraItem.h"
@@ -84,6 +90,11 @@ struct MeshRecord
     QVector3D armPivot = QVector3D(0.0f, 0.0f, 0.0f);
     QVector3D headPivot = QVector3D(0.0f, 0.0f, 0.0f);
     bool pivotsValid = false;
+    // Lights the item adds to the scene, and for static lights the transform of
+    // their LightItem children. Kept until the item changes again.
+    QVector<Light> lights;
+    QMatrix4x4 lightMatrix;
+    QQuaternion lightRotation;
 };
 
 static bool isEmitterName(const QString &name)
@@ -93,6 +104,8 @@ static bool isEmitterName(const QString &name)
 
 static QVector3D averageNormal(const Mesh &mesh)
 {
+    if (mesh.pickGeometry)
+        return mesh.pickGeometry->averageNormal;
     QVector3D sum(0.0f, 0.0f, 0.0f);
     for (const Vertex &v : mesh.vertices)
         sum += QVector3D(v.nx, v.ny, v.nz);
@@ -547,40 +560,72 @@ static void hideEmitterMeshes(QVector<Mesh> &meshes, int firstMesh, int meshCoun
     }
 }
 
-static MeshItem *pickHitForRecords(const QVector<MeshRecord> &records, int meshIndex)
+static Light emitterLight(Light light, const EmitterData &emitter)
 {
-    for (const auto &record : records)
+    light.position = emitter.position;
+    if (!emitter.direction.isNull())
+        light.direction = emitter.direction.normalized();
+    if (emitter.diameter > 0.0f)
+        light.beamRadius = emitter.diameter * 0.5f;
+    if (light.beamShape == Light::BeamShapeType::ConeShape
+            && light.beamRadius > 0.0f
+            && light.outerCone > 1e-4f
+            && !light.direction.isNull())
     {
-        if (meshIndex >= record.firstMesh && meshIndex < record.firstMesh + record.meshCount)
-            return const_cast<MeshItem *>(record.item);
+        const float tanOuter = qTan(light.outerCone);
+        if (tanOuter > 1e-4f)
+        {
+            const float coneOffset = light.beamRadius / tanOuter;
+            light.position -= light.direction.normalized() * coneOffset;
+            light.range += coneOffset;
+        }
     }
-    return nullptr;
+    return light;
 }
 
-static void pruneMissingRecords(QVector<MeshRecord> &records,
-                                const QList<MeshItem *> &liveItems,
-                                QVector<Mesh> &meshes)
+static QVector<Light> staticLightLights(const StaticLightItem *item, const QVector<EmitterData> &emitters,
+                                        const QMatrix4x4 &matrix, const QQuaternion &rotation)
 {
-    QSet<const MeshItem *> live;
-    live.reserve(liveItems.size());
-    for (const MeshItem *item : liveItems)
-        live.insert(item);
+    QVector<Light> lights;
+    if (!emitters.isEmpty())
+    {
+        for (const EmitterData &emitter : emitters)
+            lights.push_back(emitterLight(item->toLight(), emitter));
+        return lights;
+    }
+    Light light = item->toLight();
+    light.position = (matrix * QVector4D(light.position, 1.0f)).toVector3D();
+    if (!light.direction.isNull())
+        light.direction = rotation.rotatedVector(light.direction).normalized();
+    lights.push_back(light);
+    return lights;
+}
 
-    for (int i = records.size() - 1; i >= 0; --i)
+static QVector<Light> movingHeadLights(const MovingHeadItem *item, const QVector<EmitterData> &emitters)
+{
+    QVector<Light> lights;
+    for (const EmitterData &emitter : emitters)
+        lights.push_back(emitterLight(item->toLight(), emitter));
+    return lights;
+}
+
+// Box standing in for a model item while its file is imported on a worker thread.
+static void updatePlaceholder(QVector<Mesh> &meshes, int index, const MeshItem *item)
+{
+    Mesh &mesh = meshes[index];
+    QMatrix4x4 model = makeTransform(item->position(), item->rotationDegrees(), item->scale()).matrix;
+    model.scale(0.3f);
+    if (mesh.modelMatrix != model)
     {
-        auto &record = records[i];
-        if (live.contains(record.item))
-            continue;
-        applySelectionVisibility(meshes, record.firstMesh, record.meshCount, false, false, false);
-        if (record.videoTexture)
-        {
-            delete record.videoTexture;
-            record.videoTexture = nullptr;
-        }
-        records.removeAt(i);
+        mesh.modelMatrix = model;
+        mesh.modelDirty = true;
+        mesh.worldBoundsDirty = true;
     }
+    mesh.visible = item->visible();
 }
 
+} // namespace
+
 class RhiQmlItemRenderer final : public QQuickRhiItemRenderer
 {
 public:
@@ -591,6 +636,14 @@ public:
         DragEnd = 2
     };
 
+    ~RhiQmlItemRenderer() override
+    {
+        // Pick readbacks in flight report into this renderer, let them land
+        // while it's still whole.
+        if (m_objectIdPicksInFlight > 0 && m_rhiContext.rhi())
+            m_rhiContext.rhi()->finish();
+    }
+
     void initialize(QRhiCommandBuffer *cb) override
     {
         Q_UNUSED(cb);
@@ -612,22 +665,40 @@ public:
     void synchronize(QQuickRhiItem *item) override
     {
         auto *qmlItem = static_cast<RhiQmlItem *>(item);
-        struct LightTransform
+
+        if (!m_importCallbackSet)
         {
-            QMatrix4x4 matrix;
-            QQuaternion rotation;
-        };
-        QHash<const LightItem *, LightTransform> staticLightTransforms;
-        QHash<const StaticLightItem *, LightTransform> staticLightItemTransforms;
-        QHash<const StaticLightItem *, QVector<EmitterData>> staticLightEmitters;
-        QHash<const MovingHeadItem *, QVector<EmitterData>> movingHeadEmitters;
-        QHash<const BeamBarItem *, QVector<Light>> beamBarLights;
+            // Imports finish on a worker thread, schedule a sync to pick them up.
+            // The item is only looked at on the GUI thread, where it lives.
+            QPointer<QQuickItem> target(qmlItem);
+            m_loader.setImportFinishedCallback([target]() {
+                QMetaObject::invokeMethod(QCoreApplication::instance(), [target]() {
+                    if (target)
+                        target->update();
+                }, Qt::QueuedConnection);
+            });
+            m_importCallbackSet = true;
+            m_updateTarget = qmlItem;
+        }
+        m_renderer.objectIds().enabled = qmlItem->gpuPicking();
+        // Set before loading, the loader releases its copy of a model according to it.
+        m_scene.setCpuDataRetention(qmlItem->retainCpuData() ? Scene::CpuDataRetention::RetainAll
+                                                             : Scene::CpuDataRetention::ReleaseAfterUpload);
 
         QVector<RhiQmlItem::PendingModel> models;
-        QVector<QObject *> selectableItems;
         qmlItem->takePendingModels(models);
+        if (!m_waitingModels.isEmpty())
+        {
+            models = m_waitingModels + models;
+            m_waitingModels.clear();
+        }
         for (const auto &entry : models)
         {
+            if (!m_loader.requestModel(entry.path))
+            {
+                m_waitingModels.push_back(entry);
+                continue;
+            }
             const int beforeCount = m_scene.meshes().size();
             if (!m_loader.loadModel(entry.path, m_scene, true))
             {
@@ -674,19 +745,58 @@ public:
         for (const Light &light : lights)
             m_staticLights.push_back(light);
 
-        const auto qmlMeshItems = qmlItem->findChildren<MeshItem *>(QString(), Qt::FindChildrenRecursively);
-        pruneMissingRecords(m_qmlMeshes, qmlMeshItems, m_scene.meshes());
-
-        auto findRecord = [&](const MeshItem *item) -> MeshRecord * {
-            for (MeshRecord &record : m_qmlMeshes)
+        // Only the items that notified a change since the last sync are visited,
+        // all of them when items were added or removed.
+        RhiQmlItem::SceneChanges changes;
+        qmlItem->takeSceneChanges(changes);
+        bool lightsDirty = changes.lightsChanged || !lights.isEmpty();
+        QVector<MeshItem *> itemsToSync;
+        QSet<MeshItem *> queuedItems;
+        const auto queueSync = [&itemsToSync, &queuedItems](MeshItem *item) {
+            if (!queuedItems.contains(item))
             {
-                if (record.item == item)
-                    return &record;
+                queuedItems.insert(item);
+                itemsToSync.push_back(item);
             }
-            return nullptr;
         };
+        if (changes.itemsChanged)
+        {
+            const QVector<MeshItem *> &liveItems = qmlItem->sceneMeshItems();
+            QSet<const MeshItem *> live;
+            live.reserve(liveItems.size());
+            for (const MeshItem *liveItem : liveItems)
+                live.insert(liveItem);
+            removeMissingRecords(live);
+            for (auto it = m_placeholders.begin(); it != m_placeholders.end();)
+            {
+                if (live.contains(it.key()))
+                {
+                    ++it;
+                    continue;
+                }
+                m_scene.meshes()[it.value()].visible = false;
+                m_freePlaceholders.push_back(it.value());
+                it = m_placeholders.erase(it);
+            }
+            // Items without a record are new, the others only need a sync when dirty.
+            for (MeshItem *liveItem : liveItems)
+            {
+                if (!m_recordByItem.contains(liveItem) && !m_placeholders.contains(liveItem))
+                    queueSync(liveItem);
+            }
+            lightsDirty = true;
+        }
+        for (MeshItem *dirtyItem : std::as_const(changes.dirtyMeshItems))
+            queueSync(dirtyItem);
+        // Nothing notifies the items when their import finishes.
+        for (auto it = m_placeholders.cbegin(); it != m_placeholders.cend(); ++it)
+            queueSync(it.key());
 
-        for (MeshItem *meshItem : qmlMeshItems)
+        auto findRecord = [&](const MeshItem *item) -> MeshRecord * {
+            return m_records.get(m_recordByItem.value(item));
+        };
+
+        for (MeshItem *meshItem : std::as_const(itemsToSync))
         {
             const MeshItem::MeshType type = meshItem->type();
             MeshRecord *record = findRecord(meshItem);
@@ -719,10 +829,12 @@ public:
             }
 
             if (needsPath && path.isEmpty())
+            {
+                qmlItem->setItemSelectable(meshItem, false);
                 continue;
+            }
 
-            if (meshItem->selectable())
-                selectableItems.push_back(meshItem);
+            qmlItem->setItemSelectable(meshItem, meshItem->selectable());
 
             if (record)
             {
@@ -750,13 +862,13 @@ public:
                     syncSelectionVisibilityFromItem(*record, meshItem, m_scene.meshes());
                     hideEmitterMeshes(m_scene.meshes(), record->firstMesh, record->meshCount);
                     const StaticLightItem *staticLight = static_cast<const StaticLightItem *>(meshItem);
-                    staticLightEmitters.insert(staticLight,
-                                               collectEmitters(m_scene.meshes(), record->firstMesh, record->meshCount));
                     const TransformInfo transform = transformFromRecord(*record);
-                    staticLightItemTransforms.insert(staticLight, { transform.matrix, transform.rotation });
-                    const auto lights = staticLight->findChildren<LightItem *>(QString(), Qt::FindChildrenRecursively);
-                    for (const LightItem *lightItem : lights)
-                        staticLightTransforms.insert(lightItem, { transform.matrix, transform.rotation });
+                    record->lightMatrix = transform.matrix;
+                    record->lightRotation = transform.rotation;
+                    record->lights = staticLightLights(staticLight,
+                                                       collectEmitters(m_scene.meshes(), record->firstMesh, record->meshCount),
+                                                       transform.matrix, transform.rotation);
+                    lightsDirty = true;
                 }
                 else if (type == MeshItem::MeshType::MovingHead)
                 {
@@ -785,7 +897,8 @@ public:
                                 emitter.direction = dir;
                         }
                     }
-                    movingHeadEmitters.insert(movingHead, emitters);
+                    record->lights = movingHeadLights(movingHead, emitters);
+                    lightsDirty = true;
                 }
                 else if (type == MeshItem::MeshType::Cube)
                 {
@@ -855,6 +968,7 @@ public:
                     {
                         record->videoFrame = frame;
                         record->videoDirty = true;
+                        m_pendingVideoRecords.push_back(m_recordByItem.value(meshItem));
                     }
                 }
                 else if (type == MeshItem::MeshType::PixelBar)
@@ -911,7 +1025,8 @@ public:
                         light.castShadows = record->castShadows;
                         lights.push_back(light);
                     }
-                    beamBarLights.insert(beamBar, lights);
+                    record->lights = lights;
+                    lightsDirty = true;
                 }
                 continue;
             }
@@ -923,6 +1038,33 @@ public:
                     || type == MeshItem::MeshType::StaticLight
                     || type == MeshItem::MeshType::MovingHead)
             {
+                if (!m_loader.requestModel(path))
+                {
+                    int placeholder = m_placeholders.value(meshItem, -1);
+                    if (placeholder < 0 && !m_freePlaceholders.isEmpty())
+                    {
+                        placeholder = m_freePlaceholders.takeLast();
+                        m_placeholders.insert(meshItem, placeholder);
+                    }
+                    else if (placeholder < 0)
+                    {
+                        Mesh mesh = createUnitCubeMesh();
+                        mesh.selectable = false;
+                        mesh.material.baseColor = QVector3D(0.5f, 0.5f, 0.5f);
+                        placeholder = m_scene.meshes().size();
+                        m_scene.meshes().push_back(mesh);
+                        m_placeholders.insert(meshItem, placeholder);
+                    }
+                    updatePlaceholder(m_scene.meshes(), placeholder, meshItem);
+                    continue;
+                }
+                const int placeholder = m_placeholders.value(meshItem, -1);
+                if (placeholder >= 0)
+                {
+                    m_scene.meshes()[placeholder].visible = false;
+                    m_freePlaceholders.push_back(placeholder);
+                    m_placeholders.remove(meshItem);
+                }
                 if (!m_loader.loadModel(path, m_scene, true))
                 {
                     if (type == MeshItem::MeshType::Model)
@@ -1001,7 +1143,8 @@ public:
                             emitter.direction = dir;
                     }
                 }
-                movingHeadEmitters.insert(static_cast<const MovingHeadItem *>(meshItem), emitters);
+                newRecord.lights = movingHeadLights(static_cast<const MovingHeadItem *>(meshItem), emitters);
+                lightsDirty = true;
             }
             else
             {
@@ -1018,11 +1161,10 @@ public:
                     const StaticLightItem *staticLight = static_cast<const StaticLightItem *>(meshItem);
                     hideEmitterMeshes(m_scene.meshes(), newRecord.firstMesh, newRecord.meshCount);
                     const QVector<EmitterData> emitters = collectEmitters(m_scene.meshes(), newRecord.firstMesh, newRecord.meshCount);
-                    staticLightEmitters.insert(staticLight, emitters);
-                    staticLightItemTransforms.insert(staticLight, { transform.matrix, transform.rotation });
-                    const auto lights = staticLight->findChildren<LightItem *>(QString(), Qt::FindChildrenRecursively);
-                    for (const LightItem *lightItem : lights)
-                        staticLightTransforms.insert(lightItem, { transform.matrix, transform.rotation });
+                    newRecord.lightMatrix = transform.matrix;
+                    newRecord.lightRotation = transform.rotation;
+                    newRecord.lights = staticLightLights(staticLight, emitters, transform.matrix, transform.rotation);
+                    lightsDirty = true;
                 }
                 else if (type == MeshItem::MeshType::Cube)
                 {
@@ -1116,118 +1258,50 @@ public:
                         light.intensity = intensity;
                         lights.push_back(light);
                     }
-                    beamBarLights.insert(beamBar, lights);
+                    newRecord.lights = lights;
+                    lightsDirty = true;
                 }
             }
 
-            m_qmlMeshes.push_back(newRecord);
+            const SlotHandle handle = addRecord(newRecord);
+            if (newRecord.videoDirty)
+                m_pendingVideoRecords.push_back(handle);
         }
 
-        qmlItem->updateSelectableItems(selectableItems);
-
-        QVector<Light> newLights;
-        newLights.reserve(m_staticLights.size() + staticLightItemTransforms.size());
-        newLights = m_staticLights;
-        QVector3D ambientTotal = qmlItem->ambientLight() * qmlItem->ambientIntensity();
-        for (auto it = staticLightItemTransforms.cbegin(); it != staticLightItemTransforms.cend(); ++it)
+        if (lightsDirty)
         {
-            const StaticLightItem *itemPtr = it.key();
-            const QVector<EmitterData> emitters = staticLightEmitters.value(itemPtr);
-            if (!emitters.isEmpty())
+            QVector<Light> newLights = m_staticLights;
+            m_records.forEach([&newLights](const MeshRecord &record) {
+                newLights += record.lights;
+            });
+            m_lightItemAmbient = QVector3D(0.0f, 0.0f, 0.0f);
+            for (const LightItem *lightItem : qmlItem->sceneLightItems())
             {
-                for (const EmitterData &emitter : emitters)
+                if (lightItem->type() == LightItem::Ambient)
                 {
-                    Light light = itemPtr->toLight();
-                    light.position = emitter.position;
-                    if (!emitter.direction.isNull())
-                        light.direction = emitter.direction.normalized();
-                    if (emitter.diameter > 0.0f)
-                        light.beamRadius = emitter.diameter * 0.5f;
-                    if (light.beamShape == Light::BeamShapeType::ConeShape
-                            && light.beamRadius > 0.0f
-                            && light.outerCone > 1e-4f
-                            && !light.direction.isNull())
-                    {
-                        const float tanOuter = qTan(light.outerCone);
-                        if (tanOuter > 1e-4f)
-                        {
-                            const float coneOffset = light.beamRadius / tanOuter;
-                            light.position -= light.direction.normalized() * coneOffset;
-                            light.range += coneOffset;
-                        }
-                    }
-                    newLights.push_back(light);
+                    m_lightItemAmbient += lightItem->color() * lightItem->intensity();
+                    continue;
                 }
-                continue;
-            }
-
-            Light light = itemPtr->toLight();
-            QVector4D worldPos = it.value().matrix * QVector4D(light.position, 1.0f);
-            light.position = worldPos.toVector3D();
-            if (!light.direction.isNull())
-                light.direction = it.value().rotation.rotatedVector(light.direction).normalized();
-            newLights.push_back(light);
-        }
-        for (auto it = movingHeadEmitters.cbegin(); it != movingHeadEmitters.cend(); ++it)
-        {
-            const MovingHeadItem *itemPtr = it.key();
-            const QVector<EmitterData> emitters = it.value();
-            if (emitters.isEmpty())
-                continue;
-            for (const EmitterData &emitter : emitters)
-            {
-                Light light = itemPtr->toLight();
-                light.position = emitter.position;
-                if (!emitter.direction.isNull())
-                    light.direction = emitter.direction.normalized();
-                if (emitter.diameter > 0.0f)
-                    light.beamRadius = emitter.diameter * 0.5f;
-                if (light.beamShape == Light::BeamShapeType::ConeShape
-                        && light.beamRadius > 0.0f
-                        && light.outerCone > 1e-4f
-                        && !light.direction.isNull())
+                Light light = lightItem->toLight();
+                QObject *parent = lightItem->parent();
+                while (parent && !qobject_cast<StaticLightItem *>(parent))
+                    parent = parent->parent();
+                const MeshRecord *staticLight = parent ? findRecord(static_cast<MeshItem *>(parent)) : nullptr;
+                if (staticLight)
                 {
-                    const float tanOuter = qTan(light.outerCone);
-                    if (tanOuter > 1e-4f)
-                    {
-                        const float coneOffset = light.beamRadius / tanOuter;
-                        light.position -= light.direction.normalized() * coneOffset;
-                        light.range += coneOffset;
-                    }
+                    light.position = (staticLight->lightMatrix * QVector4D(light.position, 1.0f)).toVector3D();
+                    if (!light.direction.isNull())
+                        light.direction = staticLight->lightRotation.rotatedVector(light.direction).normalized();
                 }
                 newLights.push_back(light);
             }
+            m_scene.setLights(newLights);
         }
-        for (auto it = beamBarLights.cbegin(); it != beamBarLights.cend(); ++it)
-        {
-            const QVector<Light> lights = it.value();
-            for (const Light &light : lights)
-                newLights.push_back(light);
-        }
-        const auto qmlLights = qmlItem->findChildren<LightItem *>(QString(), Qt::FindChildrenRecursively);
-        for (const LightItem *lightItem : qmlLights)
-        {
-            if (lightItem->type() == LightItem::Ambient)
-            {
-                ambientTotal += lightItem->color() * lightItem->intensity();
-                continue;
-            }
-            Light light = lightItem->toLight();
-            const auto it = staticLightTransforms.constFind(lightItem);
-            if (it != staticLightTransforms.constEnd())
-            {
-                QVector4D worldPos = it->matrix * QVector4D(light.position, 1.0f);
-                light.position = worldPos.toVector3D();
-                if (!light.direction.isNull())
-                    light.direction = it->rotation.rotatedVector(light.direction).normalized();
-            }
-            newLights.push_back(light);
-        }
-        m_scene.setLights(newLights);
+        const QVector3D ambientTotal = qmlItem->ambientLight() * qmlItem->ambientIntensity() + m_lightItemAmbient;
 
         const QSize size = qmlItem->effectiveColorBufferSize();
         const float aspect = size.height() > 0 ? float(size.width()) / float(size.height()) : 1.0f;
-        const CameraItem *cameraItem = qmlItem->findChild<CameraItem *>(QString(), Qt::FindChildrenRecursively);
+        const CameraItem *cameraItem = qmlItem->sceneCamera();
         if (cameraItem && !qmlItem->freeCameraEnabled())
         {
             m_scene.camera().setPosition(cameraItem->position());
@@ -1251,7 +1325,21 @@ public:
         m_scene.setShadowsEnabled(qmlItem->shadowsEnabled());
         m_scene.setSmokeNoiseEnabled(qmlItem->smokeNoiseEnabled());
 
-        const HazerItem *hazer = qmlItem->findChild<HazerItem *>(QString(), Qt::FindChildrenRecursively);
+        FrameProfiler &profiler = m_renderer.profiler();
+        profiler.setEnabled(qmlItem->profilingEnabled());
+        QStringList timingDumps;
+        qmlItem->takePendingTimingDumps(timingDumps);
+        for (const QString &path : timingDumps)
+            profiler.dump(path);
+        if (profiler.isEnabled() && (!m_timingPublish.isValid() || m_timingPublish.elapsed() >= 250))
+        {
+            m_timingPublish.restart();
+            const QVariantMap timings = profiler.toVariantMap();
+            QMetaObject::invokeMethod(qmlItem, [qmlItem, timings]() { qmlItem->setPassTimings(timings); },
+                                      Qt::QueuedConnection);
+        }
+
+        const HazerItem *hazer = qmlItem->sceneHazer();
         if (hazer && hazer->enabled())
         {
             m_scene.setHazeEnabled(true);
@@ -1280,8 +1368,12 @@ public:
             if (drag.type == DragBegin && hasSelected)
             {
                 PickHit gizmoHit;
-                const bool hitOk = pickSceneMesh(m_scene, m_rhiContext.rhi(), drag.normPos,
-                                                 PickFilter::GizmosOnly, gizmoHit);
+                QVector<int> gizmoMeshes;
+                gizmoMeshes.reserve(m_gizmoParts.size());
+                for (const GizmoPart &part : m_gizmoParts)
+                    gizmoMeshes.push_back(part.meshIndex);
+                const bool hitOk = pickMeshes(m_scene, m_rhiContext.rhi(), drag.normPos,
+                                              gizmoMeshes, gizmoHit);
                 if (hitOk)
                 {
                     const Mesh &mesh = m_scene.meshes()[gizmoHit.meshIndex];
@@ -1409,8 +1501,17 @@ public:
         qmlItem->takePendingPickRequests(picks);
         if (!picks.isEmpty() && !skipPick)
         {
+            // Brings the BVH the picks walk up to date with this sync.
+            m_scene.updateGeometry();
             for (const auto &pick : picks)
             {
+                if (qmlItem->gpuPicking())
+                {
+                    m_objectIdPicks.push_back(pick);
+                    continue;
+                }
+                if (!pick.normRect.isNull())
+                    continue;
                 PickHit hit;
                 const bool hitOk = pickSceneMesh(m_scene, m_rhiContext.rhi(), pick.normPos,
                                                  PickFilter::All, hit);
@@ -1418,7 +1519,7 @@ public:
                 QObject *hitItem = nullptr;
                 if (hitOk)
                 {
-                    hitItem = pickHitForRecords(m_qmlMeshes, hit.meshIndex);
+                    hitItem = itemForMesh(hit.meshIndex);
                 }
 
                 QMetaObject::invokeMethod(qmlItem, "dispatchPickResult", Qt::QueuedConnection,
@@ -1428,6 +1529,7 @@ public:
                                           Q_ARG(int, int(pick.modifiers)));
             }
         }
+        resolveObjectIdPicks(qmlItem);
     }
 
     void render(QRhiCommandBuffer *cb) override
@@ -1443,20 +1545,170 @@ public:
 
         m_rhiContext.setExternalFrame(cb, rt);
         uploadVideoFrames(cb);
+        for (const auto &pick : std::as_const(m_objectIdPicks))
+            requestObjectIds(pick, rt->pixelSize());
+        m_objectIdPicks.clear();
         m_renderer.render(&m_scene);
         m_rhiContext.clearExternalFrame();
+        // Readbacks only complete as further frames get rendered.
+        if (m_objectIdPicksInFlight > 0 && m_updateTarget)
+            QMetaObject::invokeMethod(m_updateTarget.data(), "update", Qt::QueuedConnection);
     }
 
 private:
+    SlotHandle addRecord(const MeshRecord &record)
+    {
+        const SlotHandle handle = m_records.insert(record);
+        m_recordByItem.insert(record.item, handle);
+        if (m_meshOwners.size() < record.firstMesh + record.meshCount)
+            m_meshOwners.resize(m_scene.meshes().size());
+        for (int i = record.firstMesh; i < record.firstMesh + record.meshCount; ++i)
+            m_meshOwners[i] = handle;
+        return handle;
+    }
+
+    void removeMissingRecords(const QSet<const MeshItem *> &liveItems)
+    {
+        for (auto it = m_recordByItem.begin(); it != m_recordByItem.end();)
+        {
+            if (liveItems.contains(it.key()))
+            {
+                ++it;
+                continue;
+            }
+            MeshRecord *record = m_records.get(it.value());
+            if (record)
+            {
+                // The meshes stay in the scene, empty, so no other index moves.
+                for (int i = record->firstMesh; i < record->firstMesh + record->meshCount; ++i)
+                    releaseMesh(m_scene.meshes()[i]);
+                if (!record->path.isEmpty())
+                    m_loader.releaseModel(record->path);
+                m_renderer.retireTexture(record->videoTexture);
+                record->videoTexture = nullptr;
+                m_records.remove(it.value());
+            }
+            it = m_recordByItem.erase(it);
+        }
+    }
+
+    MeshItem *itemForMesh(int meshIndex) const
+    {
+        if (meshIndex < 0 || meshIndex >= m_meshOwners.size())
+            return nullptr;
+        const MeshRecord *record = m_records.get(m_meshOwners[meshIndex]);
+        return record ? const_cast<MeshItem *>(record->item) : nullptr;
+    }
+
+    struct ObjectIdPickResult
+    {
+        RhiQmlItem::PickRequest pick;
+        QVector<quint32> ids;
+        QRect rect;
+        QSize targetSize;
+    };
+
+    void requestObjectIds(const RhiQmlItem::PickRequest &pick, const QSize &targetSize)
+    {
+        const int w = targetSize.width();
+        const int h = targetSize.height();
+        QRect rect;
+        if (pick.normRect.isNull())
+        {
+            rect = QRect(int(pick.normPos.x() * w), int(pick.normPos.y() * h), 1, 1);
+        }
+        else
+        {
+            rect = QRect(QPoint(int(std::floor(pick.normRect.left() * w)), int(std::floor(pick.normRect.top() * h))),
+                         QPoint(int(std::ceil(pick.normRect.right() * w)) - 1, int(std::ceil(pick.normRect.bottom() * h)) - 1));
+        }
+        ObjectIdRequest request;
+        request.rect = rect;
+        request.completed = [this, pick, targetSize](const QVector<quint32> &ids, const QRect &readRect) {
+            --m_objectIdPicksInFlight;
+            m_objectIdResults.push_back({ pick, ids, readRect, targetSize });
+            if (m_updateTarget)
+                QMetaObject::invokeMethod(m_updateTarget.data(), "update", Qt::QueuedConnection);
+        };
+        ++m_objectIdPicksInFlight;
+        m_renderer.objectIds().requests.push_back(request);
+    }
+
+    void resolveObjectIdPicks(RhiQmlItem *qmlItem)
+    {
+        if (m_objectIdResults.isEmpty())
+            return;
+        const QVector<ObjectIdPickResult> results = std::move(m_objectIdResults);
+        m_objectIdResults.clear();
+        m_scene.updateGeometry();
+        const QVector<Mesh> &meshes = m_scene.meshes();
+        for (const ObjectIdPickResult &result : results)
+        {
+            const RhiQmlItem::PickRequest &pick = result.pick;
+            if (pick.normRect.isNull())
+            {
+                const int meshIndex = result.ids.isEmpty() ? -1 : int(result.ids.first()) - 1;
+                const bool hitOk = meshIndex >= 0 && meshIndex < meshes.size();
+                PickHit hit;
+                if (hitOk && !pickMeshes(m_scene, m_rhiContext.rhi(), pick.normPos, { meshIndex }, hit))
+                {
+                    // The camera may have moved since the IDs were rendered.
+                    hit.worldPos = (meshes[meshIndex].worldBoundsMin + meshes[meshIndex].worldBoundsMax) * 0.5f;
+                }
+                QObject *hitItem = hitOk ? itemForMesh(meshIndex) : nullptr;
+                QMetaObject::invokeMethod(qmlItem, "dispatchPickResult", Qt::QueuedConnection,
+                                          Q_ARG(QObject *, hitItem),
+                                          Q_ARG(QVector3D, hitOk ? hit.worldPos : QVector3D()),
+                                          Q_ARG(bool, hitOk),
+                                          Q_ARG(int, int(pick.modifiers)));
+                continue;
+            }
+
+            const bool lasso = !pick.normLasso.isEmpty();
+            const int width = result.rect.width();
+            QSet<quint32> seenIds;
+            QSet<QObject *> seenItems;
+            QVariantList items;
+            for (int i = 0; i < result.ids.size(); ++i)
+            {
+                const quint32 id = result.ids[i];
+                if (id == 0 || id > quint32(meshes.size()))
+                    continue;
+                if (lasso)
+                {
+                    const QPointF pos((result.rect.x() + i % width + 0.5) / result.targetSize.width(),
+                                      (result.rect.y() + i / width + 0.5) / result.targetSize.height());
+                    if (!pick.normLasso.containsPoint(pos, Qt::OddEvenFill))
+                        continue;
+                }
+                if (seenIds.contains(id))
+                    continue;
+                seenIds.insert(id);
+                QObject *item = itemForMesh(int(id) - 1);
+                if (!item || seenItems.contains(item))
+                    continue;
+                seenItems.insert(item);
+                items.push_back(QVariant::fromValue(item));
+            }
+            QMetaObject::invokeMethod(qmlItem, "dispatchRegionPickResult", Qt::QueuedConnection,
+                                      Q_ARG(QVariantList, items),
+                                      Q_ARG(int, int(pick.modifiers)));
+        }
+    }
+
     void uploadVideoFrames(QRhiCommandBuffer *cb)
     {
         if (!cb)
             return;
         QRhiResourceUpdateBatch *u = nullptr;
-        for (MeshRecord &record : m_qmlMeshes)
+        const QVector<SlotHandle> pending = std::move(m_pendingVideoRecords);
+        m_pendingVideoRecords.clear();
+        for (const SlotHandle &handle : pending)
         {
-            if (record.type != MeshItem::MeshType::Video || !record.videoDirty)
+            MeshRecord *pendingRecord = m_records.get(handle);
+            if (!pendingRecord || !pendingRecord->videoDirty)
                 continue;
+            MeshRecord &record = *pendingRecord;
             if (record.firstMesh < 0 || record.firstMesh >= m_scene.meshes().size())
             {
                 record.videoDirty = false;
@@ -1474,7 +1726,14 @@ private:
             {
                 if (record.videoTexture)
                 {
-                    delete record.videoTexture;
+                    Mesh &mesh = m_scene.meshes()[record.firstMesh];
+                    if (mesh.emissiveTexture == record.videoTexture)
+                    {
+                        mesh.emissiveTexture = nullptr;
+                        mesh.srb = nullptr;
+                        mesh.gpuReady = false;
+                    }
+                    m_renderer.retireTexture(record.videoTexture);
                     record.videoTexture = nullptr;
                 }
                 record.videoTexture = rhi()->newTexture(QRhiTexture::RGBA8, frame.size(), 1);
@@ -1500,11 +1759,7 @@ private:
                 }
                 if (srbDirty)
                 {
-                    if (mesh.srb)
-                    {
-                        delete mesh.srb;
-                        mesh.srb = nullptr;
-                    }
+                    mesh.srb = nullptr;
                     mesh.gpuReady = false;
                 }
             }
@@ -1525,8 +1780,25 @@ private:
     DeferredRenderer m_renderer;
     Scene m_scene;
     AssimpLoader m_loader;
+    bool m_importCallbackSet = false;
+    QVector<RhiQmlItem::PendingModel> m_waitingModels;
+    QHash<MeshItem *, int> m_placeholders;
+    // Hidden placeholder meshes, reused so that imports don't grow the scene.
+    QVector<int> m_freePlaceholders;
     QVector<Light> m_staticLights;
-    QVector<MeshRecord> m_qmlMeshes;
+    // Records keep their handle, meshes map back to theirs through m_meshOwners.
+    // A removed record's handle stops resolving, even for a picked mesh index.
+    SlotMap<MeshRecord> m_records;
+    QHash<const MeshItem *, SlotHandle> m_recordByItem;
+    QVector<SlotHandle> m_meshOwners;
+    QVector<SlotHandle> m_pendingVideoRecords;
+    // Ambient contribution of the LightItems, gathered with the scene lights.
+    QVector3D m_lightItemAmbient = QVector3D(0.0f, 0.0f, 0.0f);
+    QElapsedTimer m_timingPublish;
+    QPointer<QQuickItem> m_updateTarget;
+    QVector<RhiQmlItem::PickRequest> m_objectIdPicks;
+    QVector<ObjectIdPickResult> m_objectIdResults;
+    int m_objectIdPicksInFlight = 0;
     struct GizmoPart
     {
         int meshIndex = -1;
@@ -1619,10 +1891,9 @@ private:
         QVector3D sum;
         int count = 0;
 
-        for (const MeshRecord &record : m_qmlMeshes)
-        {
+        m_records.forEach([&](const MeshRecord &record) {
             if (!record.selected)
-                continue;
+                return;
             QVector3D minV;
             QVector3D maxV;
             bool hasBounds = false;
@@ -1640,7 +1911,7 @@ private:
                 sum += (minV + maxV) * 0.5f;
                 ++count;
             }
-        }
+        });
 
         if (count == 0)
             return false;
@@ -1651,14 +1922,13 @@ private:
     void buildDragSelection()
     {
         m_dragSelection.clear();
-        for (const MeshRecord &record : m_qmlMeshes)
-        {
+        m_records.forEach([this](const MeshRecord &record) {
             if (!record.selected)
-                continue;
+                return;
             m_dragSelection.push_back({ const_cast<MeshItem *>(record.item),
                                         record.position,
                                         record.rotationDegrees });
-        }
+        });
     }
 
     void ensureGizmoMeshes()
@@ -1685,6 +1955,7 @@ private:
                 mesh.gizmoType = part;
                 mesh.material.baseColor = colors[axis];
                 mesh.material.emissive = colors[axis] * 2.0f;
+                buildPickGeometry(mesh);
                 const int meshIndex = m_scene.meshes().size();
                 m_scene.meshes().push_back(mesh);
                 m_gizmoParts.push_back({ meshIndex, axis, part });
@@ -1696,6 +1967,7 @@ private:
             arc.gizmoType = 2;
             arc.material.baseColor = colors[axis];
             arc.material.emissive = colors[axis] * 2.0f;
+            buildPickGeometry(arc);
             const int arcIndex = m_scene.meshes().size();
             m_scene.meshes().push_back(arc);
             m_gizmoParts.push_back({ arcIndex, axis, 2 });
@@ -1783,13 +2055,12 @@ private:
     }
 };
 
-} // namespace
-
 RhiQmlItem::RhiQmlItem(QQuickItem *parent)
     : QQuickRhiItem(parent)
 {
     setAcceptedMouseButtons(Qt::LeftButton | Qt::RightButton);
     setFlag(ItemIsFocusScope, true);
+    m_profilingEnabled = qEnvironmentVariableIsSet("RHIPIPELINE_PROFILE");
     m_cameraTick = new QTimer(this);
     m_cameraTick->setInterval(16);
     connect(m_cameraTick, &QTimer::timeout, this, [this]()
@@ -2323,6 +2594,59 @@ void RhiQmlItem::addAreaLight(const QVector3D &position,
     update();
 }
 
+void RhiQmlItem::setProfilingEnabled(bool enabled)
+{
+    if (m_profilingEnabled == enabled)
+        return;
+    m_profilingEnabled = enabled;
+    if (enabled)
+        enableGpuTimestamps();
+    else
+        setPassTimings(QVariantMap());
+    emit profilingEnabledChanged();
+    update();
+}
+
+void RhiQmlItem::setRetainCpuData(bool retain)
+{
+    if (m_retainCpuData == retain)
+        return;
+    m_retainCpuData = retain;
+    emit retainCpuDataChanged();
+    update();
+}
+
+void RhiQmlItem::setGpuPicking(bool enabled)
+{
+    if (m_gpuPicking == enabled)
+        return;
+    m_gpuPicking = enabled;
+    emit gpuPickingChanged();
+    update();
+}
+
+void RhiQmlItem::setPassTimings(const QVariantMap &timings)
+{
+    if (!m_profilingEnabled && !timings.isEmpty())
+        return;
+    m_passTimings = timings;
+    emit passTimingsChanged();
+}
+
+void RhiQmlItem::dumpPassTimings(const QString &path)
+{
+    if (path.isEmpty())
+        return;
+    m_pendingTimingDumps.push_back(path);
+    update();
+}
+
+void RhiQmlItem::takePendingTimingDumps(QStringList &out)
+{
+    out = std::move(m_pendingTimingDumps);
+    m_pendingTimingDumps.clear();
+}
+
 void RhiQmlItem::takePendingModels(QVector<PendingModel> &out)
 {
     out = std::move(m_pendingModels);
@@ -2385,6 +2709,83 @@ void RhiQmlItem::handlePick(QObject *item, bool hit, int modifiers)
     }
 }
 
+void RhiQmlItem::pickRect(const QRectF &normRect, int modifiers)
+{
+    if (!m_gpuPicking)
+    {
+        qWarning() << "RhiQmlItem: pickRect requires gpuPicking";
+        return;
+    }
+    const QRectF rect = normRect.normalized();
+    if (rect.isEmpty())
+        return;
+    PickRequest request;
+    request.normPos = rect.center();
+    request.normRect = rect;
+    request.modifiers = Qt::KeyboardModifiers(modifiers);
+    m_pendingPickRequests.push_back(request);
+    update();
+}
+
+void RhiQmlItem::pickLasso(const QVariantList &normPoints, int modifiers)
+{
+    if (!m_gpuPicking)
+    {
+        qWarning() << "RhiQmlItem: pickLasso requires gpuPicking";
+        return;
+    }
+    QPolygonF polygon;
+    polygon.reserve(normPoints.size());
+    for (const QVariant &point : normPoints)
+        polygon.append(point.toPointF());
+    if (polygon.size() < 3 || polygon.boundingRect().isEmpty())
+        return;
+    PickRequest request;
+    request.normPos = polygon.boundingRect().center();
+    request.normRect = polygon.boundingRect();
+    request.normLasso = polygon;
+    request.modifiers = Qt::KeyboardModifiers(modifiers);
+    m_pendingPickRequests.push_back(request);
+    update();
+}
+
+void RhiQmlItem::dispatchRegionPickResult(const QVariantList &items, int modifiers)
+{
+    emit regionPicked(items, modifiers);
+}
+
+void RhiQmlItem::handleRegionPick(const QVariantList &items, int modifiers)
+{
+    const bool multi = (modifiers & Qt::ShiftModifier) != 0;
+    if (!multi)
+    {
+        for (QObject *entry : m_selectableItems)
+        {
+            if (!entry)
+                continue;
+            if (entry->property("selectable").isValid() && !entry->property("selectable").toBool())
+                continue;
+            entry->setProperty("isSelected", false);
+        }
+    }
+
+    QObject *lastSelected = nullptr;
+    for (const QVariant &value : items)
+    {
+        QObject *item = value.value<QObject *>();
+        if (!item || !item->property("isSelected").isValid())
+            continue;
+        if (item->property("selectable").isValid() && !item->property("selectable").toBool())
+            continue;
+        item->setProperty("isSelected", true);
+        lastSelected = item;
+    }
+    if (lastSelected)
+        setSelectedItem(lastSelected);
+    else if (!multi)
+        setSelectedItem(nullptr);
+}
+
 void RhiQmlItem::removeSelectedItems()
 {
     const auto meshItems = findChildren<MeshItem *>(QString(), Qt::FindChildrenRecursively);
@@ -2420,15 +2821,122 @@ void RhiQmlItem::removeSelectedItems()
     update();
 }
 
-void RhiQmlItem::updateSelectableItems(const QVector<QObject *> &items)
+void RhiQmlItem::setItemSelectable(QObject *item, bool selectable)
 {
-    m_selectableItems.clear();
-    for (QObject *item : items)
-    {
-        if (!item)
-            continue;
+    if (selectable)
         m_selectableItems.insert(item);
+    else
+        m_selectableItems.remove(item);
+}
+
+void RhiQmlItem::markMeshItemDirty(MeshItem *item)
+{
+    m_dirtyMeshItems.insert(item);
+    update();
+}
+
+void RhiQmlItem::markLightsDirty()
+{
+    m_lightsDirty = true;
+    update();
+}
+
+void RhiQmlItem::takeSceneChanges(SceneChanges &out)
+{
+    out = SceneChanges();
+    if (m_sceneItemsChanged)
+    {
+        rescanSceneItems();
+        out.itemsChanged = true;
+        out.lightsChanged = true;
+        // Items moved out of the scene still sit in the dirty list.
+        m_dirtyMeshItems.removeIf([this](MeshItem *item) { return !m_sceneMeshItems.contains(item); });
+    }
+    else
+    {
+        out.lightsChanged = m_lightsDirty;
+    }
+    out.dirtyMeshItems = QVector<MeshItem *>(m_dirtyMeshItems.cbegin(), m_dirtyMeshItems.cend());
+    m_dirtyMeshItems.clear();
+    m_sceneItemsChanged = false;
+    m_lightsDirty = false;
+}
+
+void RhiQmlItem::rescanSceneItems()
+{
+    m_sceneMeshItems = findChildren<MeshItem *>(QString(), Qt::FindChildrenRecursively);
+    m_sceneLightItems = findChildren<LightItem *>(QString(), Qt::FindChildrenRecursively);
+    m_sceneCamera = findChild<CameraItem *>(QString(), Qt::FindChildrenRecursively);
+    m_sceneHazer = findChild<HazerItem *>(QString(), Qt::FindChildrenRecursively);
+    // Nested items don't show up in childEvent(), their destruction still needs a rescan.
+    for (QObject *object : std::as_const(m_sceneMeshItems))
+        connect(object, &QObject::destroyed, this, &RhiQmlItem::sceneItemDestroyed, Qt::UniqueConnection);
+    for (QObject *object : std::as_const(m_sceneLightItems))
+        connect(object, &QObject::destroyed, this, &RhiQmlItem::sceneItemDestroyed, Qt::UniqueConnection);
+    if (m_sceneCamera)
+        connect(m_sceneCamera, &QObject::destroyed, this, &RhiQmlItem::sceneItemDestroyed, Qt::UniqueConnection);
+    if (m_sceneHazer)
+        connect(m_sceneHazer, &QObject::destroyed, this, &RhiQmlItem::sceneItemDestroyed, Qt::UniqueConnection);
+    // Same for the items added to the wrappers (e.g. a Repeater's delegates).
+    const QList<QQuickItem *> wrappers = findChildren<QQuickItem *>(QString(), Qt::FindChildrenRecursively);
+    for (QQuickItem *wrapper : wrappers)
+        wrapper->installEventFilter(this);
+}
+
+void RhiQmlItem::sceneItemDestroyed(QObject *object)
+{
+    // Already past its subclass destructors, only compare the pointer.
+    const auto matches = [object](QObject *entry) { return entry == object; };
+    m_dirtyMeshItems.removeIf(matches);
+    m_selectableItems.remove(object);
+    m_sceneMeshItems.removeIf(matches);
+    m_sceneLightItems.removeIf(matches);
+    if (m_sceneCamera == object)
+        m_sceneCamera = nullptr;
+    if (m_sceneHazer == object)
+        m_sceneHazer = nullptr;
+    m_sceneItemsChanged = true;
+    update();
+}
+
+void RhiQmlItem::childEvent(QChildEvent *event)
+{
+    if (event->added() || event->removed())
+    {
+        m_sceneItemsChanged = true;
+        update();
+    }
+    QQuickRhiItem::childEvent(event);
+}
+
+void RhiQmlItem::itemChange(ItemChange change, const ItemChangeData &value)
+{
+    if (change == ItemSceneChange && m_profilingEnabled)
+        enableGpuTimestamps();
+    QQuickRhiItem::itemChange(change, value);
+}
+
+void RhiQmlItem::enableGpuTimestamps()
+{
+    // The configuration is only read when the scene graph initializes.
+    QQuickWindow *w = window();
+    if (!w || w->rhi())
+        return;
+    QQuickGraphicsConfiguration config = w->graphicsConfiguration();
+    if (config.timestampsEnabled())
+        return;
+    config.setTimestamps(true);
+    w->setGraphicsConfiguration(config);
+}
+
+bool RhiQmlItem::eventFilter(QObject *watched, QEvent *event)
+{
+    if (event->type() == QEvent::ChildAdded || event->type() == QEvent::ChildRemoved)
+    {
+        m_sceneItemsChanged = true;
+        update();
     }
+    return QQuickRhiItem::eventFilter(watched, event);
 }
 
 void RhiQmlItem::setCameraDirection(const QVector3D &dir)
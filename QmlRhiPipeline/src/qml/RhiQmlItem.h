@@ -6,13 +6,21 @@
 #include <QtCore/QVector>
 #include <QtCore/QSet>
 #include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QVariant>
 #include <QtCore/QSizeF>
 #include <QtCore/QPointF>
+#include <QtCore/QRectF>
+#include <QtGui/QPolygonF>
 #include <QtCore/Qt>
 
 #include "scene/Scene.h"
 
 class QTimer;
+class CameraItem;
+class HazerItem;
+class LightItem;
+class MeshItem;
 
 class RhiQmlItem : public QQuickRhiItem
 {
@@ -32,6 +40,10 @@ class RhiQmlItem : public QQuickRhiItem
     Q_PROPERTY(bool freeCameraEnabled READ freeCameraEnabled WRITE setFreeCameraEnabled NOTIFY freeCameraEnabledChanged)
     Q_PROPERTY(float moveSpeed READ moveSpeed WRITE setMoveSpeed NOTIFY moveSpeedChanged)
     Q_PROPERTY(float lookSensitivity READ lookSensitivity WRITE setLookSensitivity NOTIFY lookSensitivityChanged)
+    Q_PROPERTY(bool profilingEnabled READ profilingEnabled WRITE setProfilingEnabled NOTIFY profilingEnabledChanged)
+    Q_PROPERTY(bool retainCpuData READ retainCpuData WRITE setRetainCpuData NOTIFY retainCpuDataChanged)
+    Q_PROPERTY(bool gpuPicking READ gpuPicking WRITE setGpuPicking NOTIFY gpuPickingChanged)
+    Q_PROPERTY(QVariantMap passTimings READ passTimings NOTIFY passTimingsChanged)
 
 public:
     enum BeamModel
@@ -76,6 +88,24 @@ public:
     void setMoveSpeed(float speed);
     float lookSensitivity() const { return m_lookSensitivity; }
     void setLookSensitivity(float sensitivity);
+    // GPU times need timestamps on the window, they are turned on when this is
+    // set before the window is shown. Enabling it later reports CPU times only,
+    // unless the app runs with QSG_RHI_PROFILE=1.
+    bool profilingEnabled() const { return m_profilingEnabled; }
+    void setProfilingEnabled(bool enabled);
+    // Keeps vertex, index and image data on the CPU after upload, otherwise
+    // meshes only keep their bounds and a position-only copy for picking.
+    bool retainCpuData() const { return m_retainCpuData; }
+    void setRetainCpuData(bool retain);
+    // Resolves picks from an object ID attachment of the GBuffer, read back a
+    // frame or more later, instead of casting rays on the CPU. Required by
+    // pickRect() and pickLasso().
+    bool gpuPicking() const { return m_gpuPicking; }
+    void setGpuPicking(bool enabled);
+    QVariantMap passTimings() const { return m_passTimings; }
+    // Writes the profiler history on the next rendered frame, CSV unless the path ends in .json.
+    Q_INVOKABLE void dumpPassTimings(const QString &path);
+    void takePendingTimingDumps(QStringList &out);
     float smokeTimeSeconds() const;
 
     Q_INVOKABLE void addModel(const QString &path);
@@ -116,6 +146,9 @@ public:
     {
         QPointF normPos;
         Qt::KeyboardModifiers modifiers = Qt::NoModifier;
+        // Region picks, read from the object IDs. A lasso also fills normRect with its bounds.
+        QRectF normRect;
+        QPolygonF normLasso;
     };
     void takePendingPickRequests(QVector<PickRequest> &out);
     struct DragRequest
@@ -126,6 +159,12 @@ public:
     void takePendingDragRequests(QVector<DragRequest> &out);
     Q_INVOKABLE void dispatchPickResult(QObject *item, const QVector3D &worldPos, bool hit, int modifiers);
     Q_INVOKABLE void handlePick(QObject *item, bool hit, int modifiers);
+    // Selects the items drawn inside a rectangle or polygon, in normalized item
+    // coordinates. Results arrive through regionPicked().
+    Q_INVOKABLE void pickRect(const QRectF &normRect, int modifiers);
+    Q_INVOKABLE void pickLasso(const QVariantList &normPoints, int modifiers);
+    Q_INVOKABLE void dispatchRegionPickResult(const QVariantList &items, int modifiers);
+    Q_INVOKABLE void handleRegionPick(const QVariantList &items, int modifiers);
     Q_INVOKABLE void removeSelectedItems();
     Q_INVOKABLE void setCameraDirection(const QVector3D &dir);
     Q_INVOKABLE void rotateFreeCamera(float yawDelta, float pitchDelta);
@@ -134,7 +173,24 @@ public:
     void setSelectedItem(QObject *item);
     Q_INVOKABLE void setObjectPosition(QObject *item, const QVector3D &pos);
     Q_INVOKABLE void setObjectRotation(QObject *item, const QVector3D &rotation);
-    void updateSelectableItems(const QVector<QObject *> &items);
+    void setItemSelectable(QObject *item, bool selectable);
+
+    // Scene items are found once and then tracked through their change
+    // notifications, so that a sync only visits what changed.
+    struct SceneChanges
+    {
+        // Items were added or removed, every item needs a sync.
+        bool itemsChanged = false;
+        bool lightsChanged = false;
+        QVector<MeshItem *> dirtyMeshItems;
+    };
+    void markMeshItemDirty(MeshItem *item);
+    void markLightsDirty();
+    void takeSceneChanges(SceneChanges &out);
+    const QVector<MeshItem *> &sceneMeshItems() const { return m_sceneMeshItems; }
+    const QVector<LightItem *> &sceneLightItems() const { return m_sceneLightItems; }
+    CameraItem *sceneCamera() const { return m_sceneCamera; }
+    HazerItem *sceneHazer() const { return m_sceneHazer; }
 
 Q_SIGNALS:
     void cameraPositionChanged();
@@ -152,7 +208,12 @@ Q_SIGNALS:
     void freeCameraEnabledChanged();
     void moveSpeedChanged();
     void lookSensitivityChanged();
+    void profilingEnabledChanged();
+    void retainCpuDataChanged();
+    void gpuPickingChanged();
+    void passTimingsChanged();
     void meshPicked(QObject *item, const QVector3D &worldPos, bool hit, int modifiers);
+    void regionPicked(const QVariantList &items, int modifiers);
     void selectedItemChanged();
 
 protected:
@@ -162,13 +223,23 @@ protected:
     void mousePressEvent(QMouseEvent *event) override;
     void mouseReleaseEvent(QMouseEvent *event) override;
     void mouseMoveEvent(QMouseEvent *event) override;
+    void childEvent(QChildEvent *event) override;
+    bool eventFilter(QObject *watched, QEvent *event) override;
+    void itemChange(ItemChange change, const ItemChangeData &value) override;
 
 private:
+    friend class RhiQmlItemRenderer;
+
+    // Only the renderer publishes timings, QML reads them through passTimings.
+    void setPassTimings(const QVariantMap &timings);
+    void enableGpuTimestamps();
     void updateFreeCamera(float dtSeconds);
     void updateYawPitchFromDirection(const QVector3D &dir);
     QVector3D forwardVector() const;
     QVector3D rightVector() const;
     void updateSmokeTicker();
+    void rescanSceneItems();
+    void sceneItemDestroyed(QObject *object);
 
     QVector3D m_cameraPosition = QVector3D(0.0f, 1.0f, 5.0f);
     QVector3D m_cameraTarget = QVector3D(0.0f, 0.0f, 0.0f);
@@ -185,6 +256,11 @@ private:
     bool m_freeCameraEnabled = false;
     float m_moveSpeed = 5.0f;
     float m_lookSensitivity = 0.2f;
+    bool m_profilingEnabled = false;
+    bool m_retainCpuData = false;
+    bool m_gpuPicking = false;
+    QVariantMap m_passTimings;
+    QStringList m_pendingTimingDumps;
     bool m_moveForward = false;
     bool m_moveBackward = false;
     bool m_moveLeft = false;
@@ -207,6 +283,13 @@ private:
     QVector<PickRequest> m_pendingPickRequests;
     QVector<DragRequest> m_pendingDragRequests;
     QSet<QObject *> m_selectableItems;
+    QVector<MeshItem *> m_sceneMeshItems;
+    QVector<LightItem *> m_sceneLightItems;
+    CameraItem *m_sceneCamera = nullptr;
+    HazerItem *m_sceneHazer = nullptr;
+    QSet<MeshItem *> m_dirtyMeshItems;
+    bool m_sceneItemsChanged = true;
+    bool m_lightsDirty = true;
     QObject *m_selectedItem = nullptr;
     bool m_leftDown = false;
 };
@@ -1,5 +1,8 @@
 #include "renderer/DeferredRenderer.h"
 
+#include <algorithm>
+#include <tuple>
+
 #include "core/RhiContext.h"
 #include "core/RenderTargetCache.h"
 #include "core/ShaderManager.h"
@@ -7,6 +10,7 @@
 #include "renderer/PassGBuffer.h"
 #include "renderer/PassLightCulling.h"
 #include "renderer/PassLighting.h"
+#include "renderer/PassOcclusion.h"
 #include "renderer/PassPost.h"
 #include "renderer/PassShadow.h"
 #include "scene/Scene.h"
@@ -20,11 +24,22 @@ void DeferredRenderer::initialize(RhiContext *rhi, RenderTargetCache *targets, S
     m_frameCtx.shaders = shaders;
     m_frameCtx.shadows = &m_shadowData;
     m_frameCtx.lightCulling = &m_lightCulling;
+    m_frameCtx.objectIds = &m_objectIds;
+    m_frameCtx.drawList = &m_drawList;
+    m_frameCtx.depthPrepass = &m_depthPrepass;
+    m_frameCtx.retiredTextures = &m_retiredTextures;
 
     const bool skipLighting = qEnvironmentVariableIsSet("RHIPIPELINE_SKIP_LIGHTING");
     const bool skipPost = qEnvironmentVariableIsSet("RHIPIPELINE_SKIP_POST");
+    m_depthPrepass.enabled = !qEnvironmentVariableIsSet("RHIPIPELINE_SKIP_DEPTH_PREPASS");
+    if (!m_depthPrepass.enabled)
+        qWarning() << "DeferredRenderer: skipping the depth pre-pass (RHIPIPELINE_SKIP_DEPTH_PREPASS)";
     m_frameCtx.lightingEnabled = !skipLighting;
     m_graph.clear();
+    m_graph.setProfiler(&m_profiler);
+    if (qEnvironmentVariableIsSet("RHIPIPELINE_PROFILE"))
+        m_profiler.setEnabled(true);
+    m_graph.addPass(std::make_unique<PassOcclusion>());
     m_graph.addPass(std::make_unique<PassDepth>());
     m_graph.addPass(std::make_unique<PassGBuffer>());
     m_graph.addPass(std::make_unique<PassShadow>());
@@ -40,11 +55,13 @@ void DeferredRenderer::initialize(RhiContext *rhi, RenderTargetCache *targets, S
     if (skipPost)
     {
         qWarning() << "DeferredRenderer: skipping PassPost (RHIPIPELINE_SKIP_POST)";
+        m_graph.addOutput(RenderResource::LightingColor);
     }
     else
     {
         m_graph.addPass(std::make_unique<PassPost>());
     }
+    m_graph.addOutput(RenderResource::Backbuffer);
 }
 
 void DeferredRenderer::resize(const QSize &size)
@@ -53,8 +70,100 @@ void DeferredRenderer::resize(const QSize &size)
     // TODO: notify passes and target cache.
 }
 
+void DeferredRenderer::retireTexture(QRhiTexture *texture)
+{
+    if (texture)
+        m_retiredTextures.textures.push_back(texture);
+}
+
 void DeferredRenderer::render(Scene *scene)
 {
     m_frameCtx.scene = scene;
+    if (scene)
+    {
+        uploadLightBuffer(scene);
+        scene->updateGeometry();
+        updateDrawList(scene);
+    }
     m_graph.run(m_frameCtx);
 }
+
+void DeferredRenderer::updateDrawList(Scene *scene)
+{
+    // The world bounds and the BVH only change with the geometry revision, the
+    // sort keys with the material revision.
+    const Camera &camera = scene->camera();
+    const QMatrix4x4 viewProj = camera.projectionMatrix() * camera.viewMatrix();
+    if (m_drawListRevision == scene->geometryRevision()
+            && m_drawListMaterialRevision == scene->materialRevision()
+            && m_drawListViewProj == viewProj)
+        return;
+    m_drawListRevision = scene->geometryRevision();
+    m_drawListMaterialRevision = scene->materialRevision();
+    m_drawListViewProj = viewProj;
+
+    QVector<int> &list = m_drawList.meshes;
+    list.clear();
+    scene->shadowCasterBvh().query(MeshBvh::Frustum::fromMatrix(viewProj), list);
+    list += scene->unboundedShadowCasters();
+
+    const QVector<Mesh> &meshes = scene->meshes();
+    m_drawDepths.resize(meshes.size());
+    for (int index : std::as_const(list))
+    {
+        const Mesh &mesh = meshes[index];
+        m_drawDepths[index] = mesh.worldBoundsValid
+                ? -camera.viewMatrix().map((mesh.worldBoundsMin + mesh.worldBoundsMax) * 0.5f).z()
+                : 0.0f;
+    }
+    const auto drawKey = [&meshes, this](int index) {
+        const Material &material = meshes[index].material;
+        return std::make_tuple(int(material.alphaMode), material.doubleSided, m_drawDepths[index], index);
+    };
+    std::sort(list.begin(), list.end(), [&drawKey](int a, int b) { return drawKey(a) < drawKey(b); });
+}
+
+void DeferredRenderer::uploadLightBuffer(Scene *scene)
+{
+    QRhi *rhi = m_frameCtx.rhi ? m_frameCtx.rhi->rhi() : nullptr;
+    QRhiCommandBuffer *cb = m_frameCtx.rhi ? m_frameCtx.rhi->commandBuffer() : nullptr;
+    if (!rhi || !cb)
+        return;
+
+    LightBuffer &lights = scene->lightBuffer();
+    lights.setMaxCapacity(rhi->backend() == QRhi::D3D11 ? LightBuffer::kMaxUniformLights : 0);
+    lights.setMaxGoboLayers(rhi->resourceLimit(QRhi::TextureArraySizeMax));
+    scene->updateLightBuffer();
+
+    if (!m_lightBuffer || m_lightBuffer->size() != lights.byteSize())
+    {
+        // Resized in place, the passes know the buffer by its pointer and their
+        // bindings follow the native buffer when it is created again.
+        if (!m_lightBuffer)
+            m_lightBuffer = rhi->newBuffer(QRhiBuffer::Static, QRhiBuffer::StorageBuffer, lights.byteSize());
+        else
+            m_lightBuffer->setSize(lights.byteSize());
+        if (!m_lightBuffer->create())
+        {
+            qWarning() << "DeferredRenderer: failed to create light buffer";
+            delete m_lightBuffer;
+            m_lightBuffer = nullptr;
+            m_frameCtx.lightBuffer = nullptr;
+            return;
+        }
+        m_lightBufferRevision = 0;
+    }
+    m_frameCtx.lightBuffer = m_lightBuffer;
+
+    const QVector<LightBuffer::Range> ranges = lights.rangesSince(m_lightBufferRevision);
+    m_lightBufferRevision = lights.revision();
+    if (ranges.isEmpty())
+        return;
+    QRhiResourceUpdateBatch *u = rhi->nextResourceUpdateBatch();
+    for (const LightBuffer::Range &range : ranges)
+    {
+        u->uploadStaticBuffer(m_lightBuffer, quint32(range.offset * sizeof(QVector4D)),
+                              quint32(range.count * sizeof(QVector4D)), lights.constData() + range.offset);
+    }
+    cb->resourceUpdate(u);
+}
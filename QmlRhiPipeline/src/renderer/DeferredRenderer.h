@@ -2,6 +2,7 @@
 
 #include <memory>
 
+#include "core/FrameProfiler.h"
 #include "core/RenderGraph.h"
 
 class RhiContext;
@@ -17,10 +18,28 @@ public:
     void initialize(RhiContext *rhi, RenderTargetCache *targets, ShaderManager *shaders);
     void resize(const QSize &size);
     void render(Scene *scene);
+    FrameProfiler &profiler() { return m_profiler; }
+    ObjectIdData &objectIds() { return m_objectIds; }
+    // Deletes a texture set on meshes once the passes no longer bind it.
+    void retireTexture(QRhiTexture *texture);
 
 private:
+    void uploadLightBuffer(Scene *scene);
+    void updateDrawList(Scene *scene);
+
     RenderGraph m_graph;
+    FrameProfiler m_profiler;
     FrameContext m_frameCtx;
     ShadowData m_shadowData;
     LightCullingData m_lightCulling;
+    ObjectIdData m_objectIds;
+    DrawListData m_drawList;
+    DepthPrepassData m_depthPrepass;
+    RetiredTextureData m_retiredTextures;
+    QVector<float> m_drawDepths;
+    QMatrix4x4 m_drawListViewProj;
+    quint64 m_drawListRevision = 0;
+    quint64 m_drawListMaterialRevision = 0;
+    QRhiBuffer *m_lightBuffer = nullptr;
+    quint64 m_lightBufferRevision = 0;
 };
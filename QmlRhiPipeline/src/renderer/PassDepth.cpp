@@ -1,13 +1,457 @@
 #include "renderer/PassDepth.h"
 
+#include <QtCore/QDebug>
+#include <QtGui/QMatrix4x4>
+#include <cstring>
+
+#include "core/RhiContext.h"
+#include "core/ShaderManager.h"
+#include "scene/Scene.h"
+
+namespace {
+
+// Invocations per workgroup side, see hiz_downsample.comp.
+constexpr int kHiZGroupSize = 8;
+
+} // namespace
+
+void PassDepth::setup(RenderGraphBuilder &builder, FrameContext &ctx)
+{
+    if (ctx.targets && ctx.rhi && ctx.rhi->swapchainRenderTarget())
+    {
+        // The GBuffer only keeps its depth when this pass can clear and fill it.
+        const bool enabled = ctx.depthPrepass && ctx.depthPrepass->enabled
+                && ctx.rhi->rhi()->isFeatureSupported(QRhi::Instancing);
+        ctx.targets->setDepthPrepassEnabled(enabled);
+        const QSize size = ctx.rhi->swapchainRenderTarget()->pixelSize();
+        const RenderTargetCache::GBufferTargets gbuf = ctx.targets->getOrCreateGBuffer(size, 1);
+        builder.importTexture(RenderResource::DepthPrepass, gbuf.depth);
+    }
+    builder.importTexture(RenderResource::HiZ, m_hiZ);
+    builder.read(RenderResource::Occlusion);
+    builder.write(RenderResource::DepthPrepass);
+    builder.write(RenderResource::HiZ);
+}
+
+void PassDepth::onCulled(FrameContext &ctx)
+{
+    if (!ctx.depthPrepass)
+        return;
+    ctx.depthPrepass->drawn.clear();
+    ctx.depthPrepass->hiZ = nullptr;
+    ctx.depthPrepass->hiZMipCount = 0;
+}
+
 void PassDepth::prepare(FrameContext &ctx)
 {
-    Q_UNUSED(ctx);
-    // TODO: build depth-only pipeline state and targets.
+    if (!ctx.targets || !ctx.rhi || !ctx.depthPrepass)
+        return;
+    const QSize size = ctx.rhi->swapchainRenderTarget()->pixelSize();
+    m_gbuffer = ctx.targets->getOrCreateGBuffer(size, 1);
+    if (!m_gbuffer.depthRt)
+        return;
+
+    ensurePipeline(ctx);
+    ensureHiZ(ctx);
+    // A recreated chain holds no depth until execute() builds it.
+    if (ctx.depthPrepass->hiZ != m_hiZ)
+    {
+        ctx.depthPrepass->hiZ = nullptr;
+        ctx.depthPrepass->hiZMipCount = 0;
+    }
 }
 
 void PassDepth::execute(FrameContext &ctx)
 {
-    Q_UNUSED(ctx);
-    // TODO: render depth pre-pass.
+    if (!ctx.depthPrepass)
+        return;
+    DepthPrepassData &depth = *ctx.depthPrepass;
+    depth.drawn.clear();
+    depth.hiZ = nullptr;
+    depth.hiZMipCount = 0;
+    QRhiCommandBuffer *cb = ctx.rhi ? ctx.rhi->commandBuffer() : nullptr;
+    if (!cb || !m_gbuffer.depthRt)
+        return;
+
+    // Even with nothing to draw the pass clears the depth the GBuffer starts from.
+    const bool draw = ctx.scene && ctx.drawList && m_pipeline && m_pipelineTwoSided && m_srb;
+    if (draw)
+    {
+        // Same expression as PassGBuffer, the EQUAL test needs the same bits.
+        depth.viewProj = ctx.rhi->rhi()->clipSpaceCorrMatrix()
+                * ctx.scene->camera().projectionMatrix()
+                * ctx.scene->camera().viewMatrix();
+        QRhiResourceUpdateBatch *u = ctx.rhi->rhi()->nextResourceUpdateBatch();
+        u->updateDynamicBuffer(m_cameraUbo, 0, 16 * sizeof(float), depth.viewProj.constData());
+        updateInstances(ctx, u);
+        cb->resourceUpdate(u);
+    }
+
+    cb->beginPass(m_gbuffer.depthRt, QColor(0, 0, 0, 0), QRhiDepthStencilClearValue(1.0f, 0));
+    const QSize size = m_gbuffer.depthRt->pixelSize();
+    cb->setViewport(QRhiViewport(0, 0, size.width(), size.height()));
+    if (draw && m_instanceBuffer)
+    {
+        QRhiGraphicsPipeline *boundPipeline = nullptr;
+        for (const InstanceBatch &batch : std::as_const(m_batches))
+        {
+            QRhiGraphicsPipeline *pipeline = batch.twoSided ? m_pipelineTwoSided : m_pipeline;
+            if (pipeline != boundPipeline)
+            {
+                cb->setGraphicsPipeline(pipeline);
+                cb->setShaderResources(m_srb);
+                boundPipeline = pipeline;
+            }
+            const QRhiCommandBuffer::VertexInput bindings[] = {
+                { batch.vertexBuffer, 0 },
+                { m_instanceBuffer, quint32(batch.firstInstance * 16 * sizeof(float)) }
+            };
+            cb->setVertexInput(0, 2, bindings, batch.indexBuffer, 0, QRhiCommandBuffer::IndexUInt32);
+            cb->drawIndexed(batch.indexCount, batch.instanceCount);
+        }
+    }
+    cb->endPass();
+
+    buildHiZ(ctx);
+}
+
+void PassDepth::updateInstances(FrameContext &ctx, QRhiResourceUpdateBatch *u)
+{
+    const QVector<Mesh> &meshes = ctx.scene->meshes();
+    QVector<bool> &drawn = ctx.depthPrepass->drawn;
+    drawn.fill(false, meshes.size());
+    m_batches.clear();
+    m_batchByKey.clear();
+    m_instanceOrder.clear();
+    for (auto it = m_geometry.begin(); it != m_geometry.end();)
+    {
+        if (!it->pickGeometry.isNull())
+        {
+            ++it;
+            continue;
+        }
+        delete it->vertexBuffer;
+        delete it->indexBuffer;
+        it = m_geometry.erase(it);
+    }
+
+    // Batches come in draw list order, so each starts at its nearest mesh.
+    for (int i : std::as_const(ctx.drawList->visible))
+    {
+        const Mesh &mesh = meshes[i];
+        // Masked and blended materials discard, they write their own depth in the GBuffer.
+        if (mesh.material.alphaMode != Material::AlphaMode::Opaque)
+            continue;
+        // Only what the GBuffer is going to draw, a depth without shading leaves holes.
+        if (!mesh.srb || !mesh.vertexBuffer || !mesh.indexBuffer || mesh.indexCount == 0)
+            continue;
+        if (!ensurePositionGeometry(ctx, mesh, u))
+            continue;
+        const QPair<const MeshPickGeometry *, bool> key(mesh.pickGeometry.data(), mesh.material.doubleSided);
+        int batch = m_batchByKey.value(key, -1);
+        if (batch < 0)
+        {
+            const PositionGeometry &geometry = m_geometry[mesh.pickGeometry.data()];
+            batch = m_batches.size();
+            m_batchByKey.insert(key, batch);
+            m_batches.push_back({ geometry.vertexBuffer, geometry.indexBuffer, geometry.indexCount,
+                                  mesh.material.doubleSided, 0, 0 });
+        }
+        ++m_batches[batch].instanceCount;
+        m_instanceOrder.push_back(qMakePair(i, batch));
+    }
+
+    int instanceCount = 0;
+    for (InstanceBatch &batch : m_batches)
+    {
+        batch.firstInstance = instanceCount;
+        instanceCount += batch.instanceCount;
+        batch.instanceCount = 0;
+    }
+    m_instanceData.resize(instanceCount * 16);
+    for (const QPair<int, int> &entry : std::as_const(m_instanceOrder))
+    {
+        InstanceBatch &batch = m_batches[entry.second];
+        const int instance = batch.firstInstance + batch.instanceCount++;
+        std::memcpy(m_instanceData.data() + instance * 16, meshes[entry.first].modelMatrix.constData(),
+                    16 * sizeof(float));
+    }
+    if (m_batches.isEmpty())
+        return;
+
+    const quint32 size = quint32(m_instanceData.size() * sizeof(float));
+    if (!m_instanceBuffer || m_instanceBuffer->size() < size)
+    {
+        delete m_instanceBuffer;
+        m_instanceBuffer = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::VertexBuffer, size);
+        m_uploadedInstanceData.clear();
+        if (!m_instanceBuffer->create())
+        {
+            qWarning() << "PassDepth: failed to create instance buffer";
+            delete m_instanceBuffer;
+            m_instanceBuffer = nullptr;
+            m_batches.clear();
+            return;
+        }
+    }
+    if (m_instanceData != m_uploadedInstanceData)
+    {
+        u->updateDynamicBuffer(m_instanceBuffer, 0, size, m_instanceData.constData());
+        m_uploadedInstanceData = m_instanceData;
+    }
+    for (const QPair<int, int> &entry : std::as_const(m_instanceOrder))
+        drawn[entry.first] = true;
+}
+
+bool PassDepth::ensurePositionGeometry(FrameContext &ctx, const Mesh &mesh, QRhiResourceUpdateBatch *u)
+{
+    const MeshPickGeometry *pick = mesh.pickGeometry.data();
+    if (!pick || pick->positions.isEmpty() || pick->indices.isEmpty())
+        return false;
+    if (m_geometry.contains(pick))
+        return true;
+
+    // The pick geometry already is the compact copy: positions only, kept
+    // after the vertex data is released and shared by the copies of a model.
+    QRhi *rhi = ctx.rhi->rhi();
+    const quint32 vertexSize = quint32(pick->positions.size() * 3 * sizeof(float));
+    const quint32 indexSize = quint32(pick->indices.size() * sizeof(quint32));
+    PositionGeometry geometry;
+    geometry.pickGeometry = mesh.pickGeometry;
+    geometry.vertexBuffer = rhi->newBuffer(QRhiBuffer::Immutable, QRhiBuffer::VertexBuffer, vertexSize);
+    geometry.indexBuffer = rhi->newBuffer(QRhiBuffer::Immutable, QRhiBuffer::IndexBuffer, indexSize);
+    geometry.indexCount = int(pick->indices.size());
+    if (!geometry.vertexBuffer->create() || !geometry.indexBuffer->create())
+    {
+        qWarning() << "PassDepth: failed to create position buffers";
+        delete geometry.vertexBuffer;
+        delete geometry.indexBuffer;
+        return false;
+    }
+    static_assert(sizeof(QVector3D) == 3 * sizeof(float), "positions are uploaded as packed float3");
+    u->uploadStaticBuffer(geometry.vertexBuffer, 0, vertexSize, pick->positions.constData());
+    u->uploadStaticBuffer(geometry.indexBuffer, 0, indexSize, pick->indices.constData());
+    m_geometry.insert(pick, geometry);
+    return true;
+}
+
+void PassDepth::ensurePipeline(FrameContext &ctx)
+{
+    if (!ctx.rhi || !ctx.shaders || !m_gbuffer.depthRpDesc)
+        return;
+    if (m_pipeline && m_rpDesc == m_gbuffer.depthRpDesc)
+        return;
+
+    delete m_pipeline;
+    m_pipeline = nullptr;
+    delete m_pipelineTwoSided;
+    m_pipelineTwoSided = nullptr;
+    delete m_srb;
+    m_srb = nullptr;
+
+    if (!m_cameraUbo)
+    {
+        m_cameraUbo = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, 16 * sizeof(float));
+        if (!m_cameraUbo->create())
+        {
+            delete m_cameraUbo;
+            m_cameraUbo = nullptr;
+            return;
+        }
+    }
+
+    m_srb = ctx.rhi->rhi()->newShaderResourceBindings();
+    m_srb->setBindings({
+        QRhiShaderResourceBinding::uniformBuffer(0, QRhiShaderResourceBinding::VertexStage, m_cameraUbo)
+    });
+    if (!m_srb->create())
+    {
+        delete m_srb;
+        m_srb = nullptr;
+        return;
+    }
+
+    m_pipeline = createPipeline(ctx, QRhiGraphicsPipeline::Back);
+    m_pipelineTwoSided = createPipeline(ctx, QRhiGraphicsPipeline::None);
+    if (!m_pipeline || !m_pipelineTwoSided)
+    {
+        qWarning() << "PassDepth: failed to create pipeline";
+        return;
+    }
+    m_rpDesc = m_gbuffer.depthRpDesc;
+}
+
+QRhiGraphicsPipeline *PassDepth::createPipeline(FrameContext &ctx, QRhiGraphicsPipeline::CullMode cullMode)
+{
+    const QRhiShaderStage vs = ctx.shaders->loadStage(QRhiShaderStage::Vertex, QStringLiteral(":/shaders/depth.vert.qsb"));
+    const QRhiShaderStage fs = ctx.shaders->loadStage(QRhiShaderStage::Fragment, QStringLiteral(":/shaders/depth.frag.qsb"));
+    if (!vs.shader().isValid() || !fs.shader().isValid())
+        return nullptr;
+
+    QRhiGraphicsPipeline *pipeline = ctx.rhi->rhi()->newGraphicsPipeline();
+    pipeline->setShaderStages({ vs, fs });
+
+    QRhiVertexInputLayout inputLayout;
+    inputLayout.setBindings({
+        QRhiVertexInputBinding(3 * sizeof(float)),
+        QRhiVertexInputBinding(16 * sizeof(float), QRhiVertexInputBinding::PerInstance)
+    });
+    inputLayout.setAttributes({
+        QRhiVertexInputAttribute(0, 0, QRhiVertexInputAttribute::Float3, 0),
+        QRhiVertexInputAttribute(1, 1, QRhiVertexInputAttribute::Float4, 0),
+        QRhiVertexInputAttribute(1, 2, QRhiVertexInputAttribute::Float4, 4 * sizeof(float)),
+        QRhiVertexInputAttribute(1, 3, QRhiVertexInputAttribute::Float4, 8 * sizeof(float)),
+        QRhiVertexInputAttribute(1, 4, QRhiVertexInputAttribute::Float4, 12 * sizeof(float))
+    });
+    pipeline->setVertexInputLayout(inputLayout);
+    pipeline->setSampleCount(1);
+    pipeline->setCullMode(cullMode);
+    pipeline->setDepthTest(true);
+    pipeline->setDepthWrite(true);
+    pipeline->setShaderResourceBindings(m_srb);
+    pipeline->setRenderPassDescriptor(m_gbuffer.depthRpDesc);
+
+    if (!pipeline->create())
+    {
+        delete pipeline;
+        return nullptr;
+    }
+    return pipeline;
+}
+
+void PassDepth::ensureHiZ(FrameContext &ctx)
+{
+    QRhi *rhi = ctx.rhi->rhi();
+    if (!m_gbuffer.depth || !ctx.shaders || !rhi->isFeatureSupported(QRhi::Compute)
+        || !rhi->isTextureFormatSupported(QRhiTexture::R32F, QRhiTexture::UsedWithLoadStore))
+    {
+        releaseHiZ();
+        return;
+    }
+    const QSize depthSize = m_gbuffer.depth->pixelSize();
+    const QSize size(qMax(1, depthSize.width() / 2), qMax(1, depthSize.height() / 2));
+    if (m_hiZ && m_hiZSource == m_gbuffer.depth && m_hiZSize == size)
+        return;
+
+    releaseHiZ();
+    m_hiZSource = m_gbuffer.depth;
+    m_hiZSize = size;
+    m_hiZMipCount = rhi->mipLevelsForSize(size);
+    m_hiZ = rhi->newTexture(QRhiTexture::R32F, size, 1, QRhiTexture::MipMapped | QRhiTexture::UsedWithLoadStore);
+    if (!m_hiZ->create())
+    {
+        qWarning() << "PassDepth: failed to create Hi-Z texture";
+        releaseHiZ();
+        return;
+    }
+    if (!m_depthSampler)
+    {
+        m_depthSampler = rhi->newSampler(QRhiSampler::Nearest,
+                                         QRhiSampler::Nearest,
+                                         QRhiSampler::None,
+                                         QRhiSampler::ClampToEdge,
+                                         QRhiSampler::ClampToEdge);
+        if (!m_depthSampler->create())
+        {
+            delete m_depthSampler;
+            m_depthSampler = nullptr;
+            releaseHiZ();
+            return;
+        }
+    }
+
+    for (int level = 0; level < m_hiZMipCount; ++level)
+    {
+        QRhiShaderResourceBindings *srb = rhi->newShaderResourceBindings();
+        m_hiZSrbs.push_back(srb);
+        if (level == 0)
+        {
+            srb->setBindings({
+                QRhiShaderResourceBinding::sampledTexture(0, QRhiShaderResourceBinding::ComputeStage, m_hiZSource, m_depthSampler),
+                QRhiShaderResourceBinding::imageStore(1, QRhiShaderResourceBinding::ComputeStage, m_hiZ, 0)
+            });
+        }
+        else
+        {
+            srb->setBindings({
+                QRhiShaderResourceBinding::imageLoad(0, QRhiShaderResourceBinding::ComputeStage, m_hiZ, level - 1),
+                QRhiShaderResourceBinding::imageStore(1, QRhiShaderResourceBinding::ComputeStage, m_hiZ, level)
+            });
+        }
+        if (!srb->create())
+        {
+            qWarning() << "PassDepth: failed to create Hi-Z bindings";
+            releaseHiZ();
+            return;
+        }
+    }
+
+    const QRhiShaderStage fromDepth = ctx.shaders->loadStage(QRhiShaderStage::Compute,
+                                                             QStringLiteral(":/shaders/hiz_from_depth.comp.qsb"));
+    const QRhiShaderStage downsample = ctx.shaders->loadStage(QRhiShaderStage::Compute,
+                                                              QStringLiteral(":/shaders/hiz_downsample.comp.qsb"));
+    if (!fromDepth.shader().isValid() || !downsample.shader().isValid())
+    {
+        releaseHiZ();
+        return;
+    }
+    m_hiZFromDepthPipeline = rhi->newComputePipeline();
+    m_hiZFromDepthPipeline->setShaderStage(fromDepth);
+    m_hiZFromDepthPipeline->setShaderResourceBindings(m_hiZSrbs.first());
+    if (!m_hiZFromDepthPipeline->create())
+    {
+        qWarning() << "PassDepth: failed to create Hi-Z pipeline";
+        releaseHiZ();
+        return;
+    }
+    if (m_hiZMipCount > 1)
+    {
+        m_hiZDownsamplePipeline = rhi->newComputePipeline();
+        m_hiZDownsamplePipeline->setShaderStage(downsample);
+        m_hiZDownsamplePipeline->setShaderResourceBindings(m_hiZSrbs[1]);
+        if (!m_hiZDownsamplePipeline->create())
+        {
+            qWarning() << "PassDepth: failed to create Hi-Z pipeline";
+            releaseHiZ();
+            return;
+        }
+    }
+}
+
+void PassDepth::buildHiZ(FrameContext &ctx)
+{
+    if (!m_hiZ || !m_hiZFromDepthPipeline)
+        return;
+    QRhiCommandBuffer *cb = ctx.rhi->commandBuffer();
+    cb->beginComputePass();
+    for (int level = 0; level < m_hiZMipCount; ++level)
+    {
+        if (level <= 1)
+            cb->setComputePipeline(level == 0 ? m_hiZFromDepthPipeline : m_hiZDownsamplePipeline);
+        cb->setShaderResources(m_hiZSrbs[level]);
+        const int width = qMax(1, m_hiZSize.width() >> level);
+        const int height = qMax(1, m_hiZSize.height() >> level);
+        cb->dispatch((width + kHiZGroupSize - 1) / kHiZGroupSize, (height + kHiZGroupSize - 1) / kHiZGroupSize, 1);
+    }
+    cb->endComputePass();
+
+    ctx.depthPrepass->hiZ = m_hiZ;
+    ctx.depthPrepass->hiZMipCount = m_hiZMipCount;
+    ctx.depthPrepass->depthSize = m_hiZSource->pixelSize();
+}
+
+void PassDepth::releaseHiZ()
+{
+    delete m_hiZFromDepthPipeline;
+    m_hiZFromDepthPipeline = nullptr;
+    delete m_hiZDownsamplePipeline;
+    m_hiZDownsamplePipeline = nullptr;
+    for (QRhiShaderResourceBindings *srb : m_hiZSrbs)
+        delete srb;
+    m_hiZSrbs.clear();
+    delete m_hiZ;
+    m_hiZ = nullptr;
+    m_hiZSource = nullptr;
+    m_hiZSize = QSize();
+    m_hiZMipCount = 0;
 }
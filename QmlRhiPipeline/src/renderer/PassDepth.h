@@ -1,10 +1,78 @@
 #pragma once
 
+#include <QtCore/QHash>
+#include <QtCore/QPair>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QSize>
+#include <QtCore/QVector>
+#include <rhi/qrhi.h>
+
 #include "core/RenderGraph.h"
+#include "core/RenderTargetCache.h"
+
+struct Mesh;
+struct MeshPickGeometry;
 
+// Renders the opaque meshes of the draw list into the GBuffer depth from a
+// position only copy of their geometry, then reduces that depth into the
+// hierarchical-Z chain.
 class PassDepth final : public RenderPass
 {
 public:
+    const char *name() const override { return "PassDepth"; }
+    void setup(RenderGraphBuilder &builder, FrameContext &ctx) override;
+    void onCulled(FrameContext &ctx) override;
     void prepare(FrameContext &ctx) override;
     void execute(FrameContext &ctx) override;
+
+private:
+    // Positions and indices of a pick geometry, shared by every mesh drawing it.
+    // Dropped with the pick geometry, before its address can be reused.
+    struct PositionGeometry
+    {
+        QWeakPointer<const MeshPickGeometry> pickGeometry;
+        QRhiBuffer *vertexBuffer = nullptr;
+        QRhiBuffer *indexBuffer = nullptr;
+        int indexCount = 0;
+    };
+    struct InstanceBatch
+    {
+        QRhiBuffer *vertexBuffer = nullptr;
+        QRhiBuffer *indexBuffer = nullptr;
+        int indexCount = 0;
+        bool twoSided = false;
+        int firstInstance = 0;
+        int instanceCount = 0;
+    };
+
+    void ensurePipeline(FrameContext &ctx);
+    QRhiGraphicsPipeline *createPipeline(FrameContext &ctx, QRhiGraphicsPipeline::CullMode cullMode);
+    bool ensurePositionGeometry(FrameContext &ctx, const Mesh &mesh, QRhiResourceUpdateBatch *u);
+    void updateInstances(FrameContext &ctx, QRhiResourceUpdateBatch *u);
+    void ensureHiZ(FrameContext &ctx);
+    void buildHiZ(FrameContext &ctx);
+    void releaseHiZ();
+
+    RenderTargetCache::GBufferTargets m_gbuffer;
+    QRhiGraphicsPipeline *m_pipeline = nullptr;
+    QRhiGraphicsPipeline *m_pipelineTwoSided = nullptr;
+    QRhiShaderResourceBindings *m_srb = nullptr;
+    QRhiBuffer *m_cameraUbo = nullptr;
+    QRhiRenderPassDescriptor *m_rpDesc = nullptr;
+    QHash<const MeshPickGeometry *, PositionGeometry> m_geometry;
+    QHash<QPair<const MeshPickGeometry *, bool>, int> m_batchByKey;
+    QVector<InstanceBatch> m_batches;
+    QVector<QPair<int, int>> m_instanceOrder; // mesh, batch
+    QVector<float> m_instanceData;
+    QVector<float> m_uploadedInstanceData;
+    QRhiBuffer *m_instanceBuffer = nullptr;
+
+    QRhiTexture *m_hiZ = nullptr;
+    QRhiTexture *m_hiZSource = nullptr;
+    QSize m_hiZSize;
+    int m_hiZMipCount = 0;
+    QRhiSampler *m_depthSampler = nullptr;
+    QRhiComputePipeline *m_hiZFromDepthPipeline = nullptr;
+    QRhiComputePipeline *m_hiZDownsamplePipeline = nullptr;
+    QVector<QRhiShaderResourceBindings *> m_hiZSrbs; // one per level
 };
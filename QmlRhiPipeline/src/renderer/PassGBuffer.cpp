@@ -2,13 +2,105 @@
 
 #include <QtGui/QImage>
 #include <QtGui/QMatrix4x4>
+#include <algorithm>
 #include <cstring>
+#include <tuple>
 #include <rhi/qrhi.h>
 
 #include "core/RhiContext.h"
 #include "core/ShaderManager.h"
 #include "scene/Scene.h"
 
+namespace {
+
+// Model matrix, the first three normal matrix columns and the material,
+// must match the per instance attributes of gbuffer_instanced.vert.
+struct InstanceData
+{
+    float model[16];
+    float normalMatrix[12];
+    QVector4D baseColorMetal;
+    QVector4D roughnessOcclusion;
+    QVector4D emissive;
+    QVector4D miscParams;
+};
+
+constexpr int kInstanceFloats = sizeof(InstanceData) / sizeof(float);
+
+// Blocks of a single mesh in the uniform ring, see gbuffer.vert and gbuffer.frag.
+struct ModelData
+{
+    float model[16];
+    float normalMatrix[16];
+};
+
+struct MaterialData
+{
+    QVector4D baseColorMetal;
+    QVector4D roughnessOcclusion;
+    QVector4D emissive;
+    QVector4D miscParams;
+};
+
+ModelData modelData(const Scene &scene, int meshIndex)
+{
+    const QMatrix4x4 normalMatrix = scene.normalMatrix(meshIndex);
+    ModelData data;
+    std::memcpy(data.model, scene.meshes()[meshIndex].modelMatrix.constData(), sizeof(data.model));
+    std::memcpy(data.normalMatrix, normalMatrix.constData(), sizeof(data.normalMatrix));
+    return data;
+}
+
+MaterialData materialData(const Mesh &mesh, int meshIndex)
+{
+    MaterialData data;
+    data.baseColorMetal = QVector4D(mesh.material.baseColor, mesh.material.metalness);
+    data.roughnessOcclusion = QVector4D(mesh.material.roughness, mesh.material.occlusion, 0.0f, 0.0f);
+    data.emissive = QVector4D(mesh.material.emissive, 0.0f);
+    data.miscParams = QVector4D(mesh.material.baseAlpha,
+                                mesh.material.alphaCutoff,
+                                float(mesh.material.alphaMode),
+                                float(meshIndex + 1));
+    return data;
+}
+
+} // namespace
+
+PassGBuffer::~PassGBuffer()
+{
+    // Pending object ID readbacks write into their entries and report to the
+    // pickers, let them land first.
+    const bool pending = std::any_of(m_objectIdReadbacks.begin(), m_objectIdReadbacks.end(),
+                                     [](const std::unique_ptr<ObjectIdReadback> &readback) {
+                                         return !readback->done;
+                                     });
+    if (m_rhi && pending)
+        m_rhi->finish();
+}
+
+void PassGBuffer::setup(RenderGraphBuilder &builder, FrameContext &ctx)
+{
+    if (ctx.targets && ctx.rhi && ctx.rhi->swapchainRenderTarget())
+    {
+        const QSize size = ctx.rhi->swapchainRenderTarget()->pixelSize();
+        if (ctx.objectIds)
+            ctx.targets->setObjectIdsEnabled(ctx.objectIds->enabled);
+        const RenderTargetCache::GBufferTargets gbuf = ctx.targets->getOrCreateGBuffer(size, 1);
+        builder.importTexture(RenderResource::GBufferAlbedo, gbuf.color0, true);
+        builder.importTexture(RenderResource::GBufferNormal, gbuf.color1, true);
+        builder.importTexture(RenderResource::GBufferPosition, gbuf.color2, true);
+        builder.importTexture(RenderResource::GBufferEmissive, gbuf.color3, true);
+        builder.importTexture(RenderResource::GBufferDepth, gbuf.depth);
+    }
+    builder.read(RenderResource::DepthPrepass);
+    builder.read(RenderResource::Occlusion);
+    builder.write(RenderResource::GBufferAlbedo);
+    builder.write(RenderResource::GBufferNormal);
+    builder.write(RenderResource::GBufferPosition);
+    builder.write(RenderResource::GBufferEmissive);
+    builder.write(RenderResource::GBufferDepth);
+}
+
 void PassGBuffer::prepare(FrameContext &ctx)
 {
     if (!ctx.targets || !ctx.rhi)
@@ -23,13 +115,25 @@ void PassGBuffer::prepare(FrameContext &ctx)
 
 void PassGBuffer::execute(FrameContext &ctx)
 {
-    if (!ctx.rhi || !m_gbuffer.rt)
-        return;
-    if (!ctx.scene || !m_pipeline || !m_srb)
-        return;
-    QRhiCommandBuffer *cb = ctx.rhi->commandBuffer();
-    if (!cb)
+    releaseRetiredTextures(ctx);
+    QRhiCommandBuffer *cb = ctx.rhi ? ctx.rhi->commandBuffer() : nullptr;
+    if (!cb || !m_gbuffer.rt || !ctx.scene || !ctx.drawList || !m_pipeline || !m_srb)
+    {
+        // The moves of this frame are lost, lay the blocks out again next time.
+        m_uniforms.reset();
+        m_uniformOffsets.clear();
+        // Nothing rendered, don't leave the pickers waiting.
+        if (ctx.objectIds)
+        {
+            for (const ObjectIdRequest &request : std::as_const(ctx.objectIds->requests))
+            {
+                if (request.completed)
+                    request.completed({}, QRect());
+            }
+            ctx.objectIds->requests.clear();
+        }
         return;
+    }
 
     const QColor clear0(0, 0, 0, 0);
     const QRhiDepthStencilClearValue dsClear(1.0f, 0);
@@ -83,131 +187,246 @@ void PassGBuffer::execute(FrameContext &ctx)
         s_dumped = true;
     }
 
-    struct ModelData
-    {
-        float model[16];
-        float normalMatrix[16];
-    };
-
-    struct MaterialData
-    {
-        QVector4D baseColorMetal;
-        QVector4D roughnessOcclusion;
-        QVector4D emissive;
-        QVector4D miscParams;
-    };
+    releaseUnusedMeshResources(ctx);
 
     QRhiResourceUpdateBatch *u = ctx.rhi->rhi()->nextResourceUpdateBatch();
     if (cameraDirty)
         u->updateDynamicBuffer(m_cameraUbo, 0, sizeof(CameraData), &camData);
 
-    for (Mesh &mesh : ctx.scene->meshes())
+    // Every ready mesh gets its blocks the first time it is drawn and keeps
+    // them while the scene doesn't shrink, whether it is culled or instanced
+    // this frame or not. Afterwards a model block is only written again when
+    // the mesh moved, a material block when the material changed.
+    const int meshCount = ctx.scene->meshes().size();
+    if (meshCount < m_uniformOffsets.size())
+    {
+        m_uniforms.reset();
+        m_uniformOffsets.clear();
+    }
+    m_uniformOffsets.resize(meshCount);
+    for (int meshIndex : ctx.scene->movedMeshes())
     {
+        const UniformOffsets &offsets = m_uniformOffsets[meshIndex];
+        if (!offsets.valid)
+            continue;
+        const ModelData model = modelData(*ctx.scene, meshIndex);
+        m_uniforms.update(offsets.model, &model, sizeof(ModelData));
+    }
+    for (int meshIndex = 0; meshIndex < meshCount; ++meshIndex)
+    {
+        Mesh &mesh = ctx.scene->meshes()[meshIndex];
         if (mesh.gizmoAxis >= 0)
             continue;
         if (!mesh.visible)
+        {
+            // A hidden copy may hold the only vertex data of a model the loader
+            // already released, upload it so that the other copies can share it.
+            if (!mesh.vertices.isEmpty()
+                && ctx.scene->cpuDataRetention() == Scene::CpuDataRetention::ReleaseAfterUpload)
+                ensureMeshBuffers(ctx, mesh, u);
             continue;
+        }
         ensureMeshBuffers(ctx, mesh, u);
-        if (!mesh.modelUbo || !mesh.materialUbo)
+        if (!mesh.srb)
             continue;
-        const QMatrix4x4 model = mesh.modelMatrix;
-        QMatrix4x4 normalMatrix = model.inverted();
-        normalMatrix = normalMatrix.transposed();
-
-        if (mesh.modelDirty)
+        UniformOffsets &offsets = m_uniformOffsets[meshIndex];
+        if (!offsets.valid)
         {
-            ModelData modelData;
-            std::memcpy(modelData.model, model.constData(), sizeof(modelData.model));
-            std::memcpy(modelData.normalMatrix, normalMatrix.constData(), sizeof(modelData.normalMatrix));
-            u->updateDynamicBuffer(mesh.modelUbo, 0, sizeof(ModelData), &modelData);
-            mesh.modelDirty = false;
+            const ModelData model = modelData(*ctx.scene, meshIndex);
+            const MaterialData matData = materialData(mesh, meshIndex);
+            offsets.model = m_uniforms.append(&model, sizeof(ModelData));
+            offsets.material = m_uniforms.append(&matData, sizeof(MaterialData));
+            offsets.valid = true;
+            mesh.materialDirty = false;
         }
-
-        if (mesh.materialDirty)
+        else if (mesh.materialDirty)
         {
-            MaterialData matData;
-            matData.baseColorMetal = QVector4D(mesh.material.baseColor, mesh.material.metalness);
-            matData.roughnessOcclusion = QVector4D(mesh.material.roughness, mesh.material.occlusion, 0.0f, 0.0f);
-            matData.emissive = QVector4D(mesh.material.emissive, 0.0f);
-            matData.miscParams = QVector4D(mesh.material.baseAlpha,
-                                           mesh.material.alphaCutoff,
-                                           float(mesh.material.alphaMode),
-                                           0.0f);
-            u->updateDynamicBuffer(mesh.materialUbo, 0, sizeof(MaterialData), &matData);
+            const MaterialData matData = materialData(mesh, meshIndex);
+            m_uniforms.update(offsets.material, &matData, sizeof(MaterialData));
             mesh.materialDirty = false;
         }
     }
 
+    updateInstanceBatches(ctx, u);
+    const bool uniformsReady = m_uniforms.upload(u);
     cb->resourceUpdate(u);
 
     cb->beginPass(m_gbuffer.rt, clear0, dsClear);
     cb->setViewport(QRhiViewport(0, 0, m_gbuffer.rt->pixelSize().width(), m_gbuffer.rt->pixelSize().height()));
 
-    for (Mesh &mesh : ctx.scene->meshes())
+    // The draw list is sorted by pipeline first, most draws keep the bound one.
+    QVector<Mesh> &meshes = ctx.scene->meshes();
+    const QVector<bool> *prepassed = ctx.depthPrepass ? &ctx.depthPrepass->drawn : nullptr;
+    QRhiGraphicsPipeline *boundPipeline = nullptr;
+    const auto bindPipeline = [cb, &boundPipeline](QRhiGraphicsPipeline *pipeline) {
+        if (pipeline == boundPipeline)
+            return;
+        cb->setGraphicsPipeline(pipeline);
+        boundPipeline = pipeline;
+    };
+    for (int i : std::as_const(ctx.drawList->visible))
     {
-        if (mesh.gizmoAxis >= 0)
-            continue;
-        if (!mesh.visible)
-            continue;
+        Mesh &mesh = meshes[i];
         if (!mesh.vertexBuffer || !mesh.indexBuffer || mesh.indexCount == 0)
             continue;
-        if (!mesh.srb)
+        if (!mesh.srb || !uniformsReady)
+            continue;
+        const int batch = m_meshBatches.value(i, -1);
+        if (batch >= 0)
+        {
+            const InstanceBatch &instances = m_instanceBatches[batch];
+            if (instances.mesh != i)
+                continue;
+            bindPipeline(pipelineFor(mesh, true, prepassed && prepassed->value(i)));
+            // The model and material blocks are unused, any offset keeps the layout.
+            const QRhiCommandBuffer::DynamicOffset unused[] = { { 1, 0 }, { 2, 0 } };
+            cb->setShaderResources(mesh.srb, 2, unused);
+            const QRhiCommandBuffer::VertexInput bindings[] = {
+                { mesh.vertexBuffer, 0 },
+                { m_instanceBuffer, quint32(instances.firstInstance * sizeof(InstanceData)) }
+            };
+            cb->setVertexInput(0, 2, bindings, mesh.indexBuffer, 0, QRhiCommandBuffer::IndexUInt32);
+            cb->drawIndexed(mesh.indexCount, instances.instanceCount);
             continue;
-        QRhiGraphicsPipeline *pipeline = mesh.material.doubleSided ? m_pipelineTwoSided : m_pipeline;
+        }
+        QRhiGraphicsPipeline *pipeline = pipelineFor(mesh, false, prepassed && prepassed->value(i));
         if (!pipeline)
             continue;
-        cb->setGraphicsPipeline(pipeline);
-        cb->setShaderResources(mesh.srb);
+        bindPipeline(pipeline);
+        const UniformOffsets &offsets = m_uniformOffsets[i];
+        const QRhiCommandBuffer::DynamicOffset dynamicOffsets[] = { { 1, offsets.model }, { 2, offsets.material } };
+        cb->setShaderResources(mesh.srb, 2, dynamicOffsets);
         const QRhiCommandBuffer::VertexInput vbufBinding(mesh.vertexBuffer, 0);
         cb->setVertexInput(0, 1, &vbufBinding, mesh.indexBuffer, 0, QRhiCommandBuffer::IndexUInt32);
         cb->drawIndexed(mesh.indexCount);
     }
 
-    cb->endPass();
+    cb->endPass(readBackObjectIds(ctx));
+}
+
+QRhiResourceUpdateBatch *PassGBuffer::readBackObjectIds(FrameContext &ctx)
+{
+    for (auto it = m_objectIdReadbacks.begin(); it != m_objectIdReadbacks.end();)
+    {
+        if ((*it)->done)
+        {
+            (*it)->staging->deleteLater();
+            it = m_objectIdReadbacks.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    if (!ctx.objectIds || ctx.objectIds->requests.isEmpty())
+        return nullptr;
+
+    QRhi *rhi = ctx.rhi->rhi();
+    m_rhi = rhi;
+    QRhiResourceUpdateBatch *u = nullptr;
+    const QRect bounds(QPoint(0, 0), m_gbuffer.rt->pixelSize());
+    for (const ObjectIdRequest &request : std::as_const(ctx.objectIds->requests))
+    {
+        const QRect rect = request.rect.intersected(bounds);
+        if (!m_gbuffer.objectIds || rect.isEmpty())
+        {
+            if (request.completed)
+                request.completed({}, rect);
+            continue;
+        }
+        auto readback = std::make_unique<ObjectIdReadback>();
+        readback->request = request;
+        readback->rect = rect;
+        readback->staging = rhi->newTexture(QRhiTexture::RGBA8, rect.size(), 1, QRhiTexture::UsedAsTransferSource);
+        if (!readback->staging->create())
+        {
+            qWarning() << "PassGBuffer: failed to create object ID staging texture";
+            delete readback->staging;
+            if (request.completed)
+                request.completed({}, rect);
+            continue;
+        }
+        // Texture coordinates start at the bottom row with OpenGL, and so does the readback.
+        readback->flipRows = rhi->isYUpInFramebuffer();
+        const int sourceY = readback->flipRows ? bounds.height() - rect.bottom() - 1 : rect.top();
+        QRhiTextureCopyDescription copy;
+        copy.setPixelSize(rect.size());
+        copy.setSourceTopLeft(QPoint(rect.left(), sourceY));
+
+        ObjectIdReadback *pending = readback.get();
+        pending->result.completed = [pending]() {
+            const QSize size = pending->rect.size();
+            QVector<quint32> ids(size.width() * size.height(), 0);
+            const uchar *data = reinterpret_cast<const uchar *>(pending->result.data.constData());
+            if (pending->result.data.size() >= ids.size() * 4)
+            {
+                for (int y = 0; y < size.height(); ++y)
+                {
+                    const int row = pending->flipRows ? size.height() - 1 - y : y;
+                    const uchar *src = data + row * size.width() * 4;
+                    for (int x = 0; x < size.width(); ++x, src += 4)
+                        ids[y * size.width() + x] = quint32(src[0]) | (quint32(src[1]) << 8)
+                                                    | (quint32(src[2]) << 16) | (quint32(src[3]) << 24);
+                }
+            }
+            pending->done = true;
+            if (pending->request.completed)
+                pending->request.completed(ids, pending->rect);
+        };
+        if (!u)
+            u = rhi->nextResourceUpdateBatch();
+        u->copyTexture(pending->staging, m_gbuffer.objectIds, copy);
+        u->readBackTexture(QRhiReadbackDescription(pending->staging), &pending->result);
+        m_objectIdReadbacks.push_back(std::move(readback));
+    }
+    ctx.objectIds->requests.clear();
+    return u;
 }
 
 void PassGBuffer::ensurePipeline(FrameContext &ctx)
 {
     if (!ctx.rhi || !ctx.shaders || !m_gbuffer.rpDesc)
         return;
-    if (m_pipeline && m_rpDesc == m_gbuffer.rpDesc)
+    const bool objectIds = m_gbuffer.objectIds != nullptr;
+    if (m_pipeline && m_rpDesc == m_gbuffer.rpDesc && m_pipelineObjectIds == objectIds)
         return;
 
     delete m_pipeline;
     m_pipeline = nullptr;
     delete m_pipelineTwoSided;
     m_pipelineTwoSided = nullptr;
+    delete m_instancedPipeline;
+    m_instancedPipeline = nullptr;
+    delete m_instancedPipelineTwoSided;
+    m_instancedPipelineTwoSided = nullptr;
+    delete m_pipelineEqual;
+    m_pipelineEqual = nullptr;
+    delete m_pipelineTwoSidedEqual;
+    m_pipelineTwoSidedEqual = nullptr;
+    delete m_instancedPipelineEqual;
+    m_instancedPipelineEqual = nullptr;
+    delete m_instancedPipelineTwoSidedEqual;
+    m_instancedPipelineTwoSidedEqual = nullptr;
     delete m_srb;
     m_srb = nullptr;
+    releaseMaterialSrbs(ctx);
     delete m_cameraUbo;
-    delete m_modelUbo;
-    delete m_materialUbo;
+    m_uniforms.release();
+    m_uniformOffsets.clear();
     delete m_videoSampler;
     m_videoSampler = nullptr;
 
-    if (ctx.scene)
-    {
-        for (Mesh &mesh : ctx.scene->meshes())
-        {
-            delete mesh.srb;
-            mesh.srb = nullptr;
-            mesh.gpuReady = false;
-        }
-    }
-
     const quint32 mat4Size = 16 * sizeof(float);
     m_cameraUbo = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, mat4Size + sizeof(QVector4D));
-    m_modelUbo = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, mat4Size * 2);
-    m_materialUbo = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, sizeof(QVector4D) * 4);
 
-    if (!m_cameraUbo->create() || !m_modelUbo->create() || !m_materialUbo->create())
+    if (!m_cameraUbo->create() || !m_uniforms.create(ctx.rhi->rhi()))
         return;
 
     if (!m_linearSampler)
     {
         m_linearSampler = ctx.rhi->rhi()->newSampler(QRhiSampler::Linear,
                                                      QRhiSampler::Linear,
-                                                     QRhiSampler::None,
+                                                     QRhiSampler::Linear,
                                                      QRhiSampler::Repeat,
                                                      QRhiSampler::Repeat);
         if (!m_linearSampler->create())
@@ -262,8 +481,10 @@ void PassGBuffer::ensurePipeline(FrameContext &ctx)
     m_srb = ctx.rhi->rhi()->newShaderResourceBindings();
     m_srb->setBindings({
         QRhiShaderResourceBinding::uniformBuffer(0, QRhiShaderResourceBinding::VertexStage, m_cameraUbo),
-        QRhiShaderResourceBinding::uniformBuffer(1, QRhiShaderResourceBinding::VertexStage, m_modelUbo),
-        QRhiShaderResourceBinding::uniformBuffer(2, QRhiShaderResourceBinding::FragmentStage, m_materialUbo),
+        QRhiShaderResourceBinding::uniformBufferWithDynamicOffset(1, QRhiShaderResourceBinding::VertexStage,
+                                                                  m_uniforms.buffer(), sizeof(ModelData)),
+        QRhiShaderResourceBinding::uniformBufferWithDynamicOffset(2, QRhiShaderResourceBinding::FragmentStage,
+                                                                  m_uniforms.buffer(), sizeof(MaterialData)),
         QRhiShaderResourceBinding::sampledTexture(3, QRhiShaderResourceBinding::FragmentStage, m_defaultBaseColor, m_linearSampler),
         QRhiShaderResourceBinding::sampledTexture(4, QRhiShaderResourceBinding::FragmentStage, m_defaultNormal, m_linearSampler),
         QRhiShaderResourceBinding::sampledTexture(5, QRhiShaderResourceBinding::FragmentStage, m_defaultMetallicRoughness, m_linearSampler),
@@ -280,17 +501,72 @@ void PassGBuffer::ensurePipeline(FrameContext &ctx)
         qWarning() << "PassGBuffer: failed to create pipeline";
         return;
     }
+    // Repeated meshes fall back to one draw each without the instanced pipelines.
+    if (ctx.rhi->rhi()->isFeatureSupported(QRhi::Instancing))
+    {
+        m_instancedPipeline = createPipeline(ctx, QRhiGraphicsPipeline::Back, true);
+        m_instancedPipelineTwoSided = createPipeline(ctx, QRhiGraphicsPipeline::None, true);
+        if (!m_instancedPipeline || !m_instancedPipelineTwoSided)
+        {
+            qWarning() << "PassGBuffer: failed to create instanced pipeline";
+            delete m_instancedPipeline;
+            m_instancedPipeline = nullptr;
+            delete m_instancedPipelineTwoSided;
+            m_instancedPipelineTwoSided = nullptr;
+        }
+    }
+    // The target keeps the depth of the pre-pass, which only runs with instancing.
+    if (m_gbuffer.depthRt)
+    {
+        m_pipelineEqual = createPipeline(ctx, QRhiGraphicsPipeline::Back, false, true);
+        m_pipelineTwoSidedEqual = createPipeline(ctx, QRhiGraphicsPipeline::None, false, true);
+        if (m_instancedPipeline)
+        {
+            m_instancedPipelineEqual = createPipeline(ctx, QRhiGraphicsPipeline::Back, true, true);
+            m_instancedPipelineTwoSidedEqual = createPipeline(ctx, QRhiGraphicsPipeline::None, true, true);
+        }
+        if (!m_pipelineEqual || !m_pipelineTwoSidedEqual
+            || (m_instancedPipeline && (!m_instancedPipelineEqual || !m_instancedPipelineTwoSidedEqual)))
+            qWarning() << "PassGBuffer: failed to create depth equal pipeline";
+    }
 
     m_rpDesc = m_gbuffer.rpDesc;
+    m_pipelineObjectIds = objectIds;
+}
+
+QRhiGraphicsPipeline *PassGBuffer::pipelineFor(const Mesh &mesh, bool instanced, bool prepassed) const
+{
+    const bool twoSided = mesh.material.doubleSided;
+    if (prepassed)
+    {
+        QRhiGraphicsPipeline *pipeline = instanced
+                ? (twoSided ? m_instancedPipelineTwoSidedEqual : m_instancedPipelineEqual)
+                : (twoSided ? m_pipelineTwoSidedEqual : m_pipelineEqual);
+        if (pipeline)
+            return pipeline;
+    }
+    if (instanced)
+        return twoSided ? m_instancedPipelineTwoSided : m_instancedPipeline;
+    return twoSided ? m_pipelineTwoSided : m_pipeline;
 }
 
-QRhiGraphicsPipeline *PassGBuffer::createPipeline(FrameContext &ctx, QRhiGraphicsPipeline::CullMode cullMode)
+QRhiGraphicsPipeline *PassGBuffer::createPipeline(FrameContext &ctx, QRhiGraphicsPipeline::CullMode cullMode,
+                                                  bool instanced, bool depthEqual)
 {
     if (!ctx.rhi || !m_gbuffer.rpDesc || !m_srb)
         return nullptr;
 
-    const QRhiShaderStage vs = ctx.shaders->loadStage(QRhiShaderStage::Vertex, QStringLiteral(":/shaders/gbuffer.vert.qsb"));
-    const QRhiShaderStage fs = ctx.shaders->loadStage(QRhiShaderStage::Fragment, QStringLiteral(":/shaders/gbuffer.frag.qsb"));
+    const QRhiShaderStage vs = ctx.shaders->loadStage(QRhiShaderStage::Vertex,
+                                                      instanced ? QStringLiteral(":/shaders/gbuffer_instanced.vert.qsb")
+                                                                : QStringLiteral(":/shaders/gbuffer.vert.qsb"));
+    QString fsPath;
+    if (m_gbuffer.objectIds)
+        fsPath = instanced ? QStringLiteral(":/shaders/gbuffer_instanced_id.frag.qsb")
+                           : QStringLiteral(":/shaders/gbuffer_id.frag.qsb");
+    else
+        fsPath = instanced ? QStringLiteral(":/shaders/gbuffer_instanced.frag.qsb")
+                           : QStringLiteral(":/shaders/gbuffer.frag.qsb");
+    const QRhiShaderStage fs = ctx.shaders->loadStage(QRhiShaderStage::Fragment, fsPath);
     if (!vs.shader().isValid() || !fs.shader().isValid())
         return nullptr;
 
@@ -298,67 +574,387 @@ QRhiGraphicsPipeline *PassGBuffer::createPipeline(FrameContext &ctx, QRhiGraphic
     pipeline->setShaderStages({ vs, fs });
 
     QRhiVertexInputLayout inputLayout;
-    inputLayout.setBindings({
-        QRhiVertexInputBinding(sizeof(Vertex))
-    });
-    inputLayout.setAttributes({
+    QVector<QRhiVertexInputAttribute> attributes = {
         QRhiVertexInputAttribute(0, 0, QRhiVertexInputAttribute::Float3, 0),
         QRhiVertexInputAttribute(0, 1, QRhiVertexInputAttribute::Float3, 12),
         QRhiVertexInputAttribute(0, 2, QRhiVertexInputAttribute::Float2, 24)
-    });
+    };
+    if (instanced)
+    {
+        inputLayout.setBindings({
+            QRhiVertexInputBinding(sizeof(Vertex)),
+            QRhiVertexInputBinding(sizeof(InstanceData), QRhiVertexInputBinding::PerInstance)
+        });
+        for (int location = 3; location < 14; ++location)
+        {
+            attributes.append(QRhiVertexInputAttribute(1, location, QRhiVertexInputAttribute::Float4,
+                                                       quint32((location - 3) * sizeof(QVector4D))));
+        }
+    }
+    else
+    {
+        inputLayout.setBindings({
+            QRhiVertexInputBinding(sizeof(Vertex))
+        });
+    }
+    inputLayout.setAttributes(attributes.cbegin(), attributes.cend());
     pipeline->setVertexInputLayout(inputLayout);
     pipeline->setSampleCount(1);
     pipeline->setCullMode(cullMode);
     pipeline->setDepthTest(true);
-    pipeline->setDepthWrite(true);
-    pipeline->setTargetBlends({
-        QRhiGraphicsPipeline::TargetBlend(),
-        QRhiGraphicsPipeline::TargetBlend(),
-        QRhiGraphicsPipeline::TargetBlend(),
-        QRhiGraphicsPipeline::TargetBlend()
-    });
+    if (depthEqual)
+    {
+        // Every fragment but the nearest fails before it's shaded.
+        pipeline->setDepthOp(QRhiGraphicsPipeline::Equal);
+        pipeline->setDepthWrite(false);
+    }
+    else
+    {
+        pipeline->setDepthWrite(true);
+    }
+    QVector<QRhiGraphicsPipeline::TargetBlend> targetBlends(m_gbuffer.objectIds ? 5 : 4);
+    pipeline->setTargetBlends(targetBlends.cbegin(), targetBlends.cend());
     pipeline->setShaderResourceBindings(m_srb);
     pipeline->setRenderPassDescriptor(m_gbuffer.rpDesc);
 
     if (!pipeline->create())
+    {
+        delete pipeline;
         return nullptr;
+    }
     return pipeline;
 }
 
-void PassGBuffer::ensureMeshBuffers(FrameContext &ctx, Mesh &mesh, QRhiResourceUpdateBatch *u)
+void PassGBuffer::updateInstanceBatches(FrameContext &ctx, QRhiResourceUpdateBatch *u)
 {
-    if (mesh.vertices.isEmpty() || mesh.indices.isEmpty())
+    QVector<Mesh> &meshes = ctx.scene->meshes();
+    m_instanceBatches.clear();
+    m_meshBatches.fill(-1, meshes.size());
+    if (!m_instancedPipeline || !m_instancedPipelineTwoSided)
         return;
-    if (mesh.gpuReady)
+
+    // Only the meshes that are drawn, in draw list order, so that a batch is
+    // drawn at its nearest mesh.
+    m_batchOrder.clear();
+    for (int i : std::as_const(ctx.drawList->visible))
+    {
+        const Mesh &mesh = meshes[i];
+        if (!mesh.srb)
+            continue;
+        if (!mesh.vertexBuffer || !mesh.indexBuffer || mesh.indexCount == 0)
+            continue;
+        m_batchOrder.push_back(i);
+    }
+
+    // Meshes can share a draw when they use the same geometry, textures and
+    // pipeline, everything else goes through the instance attributes.
+    const QVector<bool> *prepassed = ctx.depthPrepass ? &ctx.depthPrepass->drawn : nullptr;
+    const auto batchKey = [&meshes, prepassed](int index) {
+        const Mesh &mesh = meshes[index];
+        return std::make_tuple(mesh.vertexBuffer, mesh.indexBuffer, mesh.indexCount,
+                               mesh.baseColorTexture, mesh.normalTexture, mesh.metallicRoughnessTexture,
+                               mesh.occlusionTexture, mesh.emissiveTexture,
+                               mesh.baseColorSampler, mesh.normalSampler, mesh.metallicRoughnessSampler,
+                               mesh.occlusionSampler, mesh.emissiveSampler,
+                               mesh.material.doubleSided, prepassed && prepassed->value(index));
+    };
+    std::stable_sort(m_batchOrder.begin(), m_batchOrder.end(),
+                     [&batchKey](int a, int b) { return batchKey(a) < batchKey(b); });
+
+    m_instanceData.clear();
+    for (int start = 0; start < m_batchOrder.size();)
+    {
+        int end = start + 1;
+        while (end < m_batchOrder.size() && batchKey(m_batchOrder[end]) == batchKey(m_batchOrder[start]))
+            ++end;
+        if (end - start < 2)
+        {
+            start = end;
+            continue;
+        }
+        const int batch = m_instanceBatches.size();
+        m_instanceBatches.push_back({ m_batchOrder[start], int(m_instanceData.size() / kInstanceFloats), end - start });
+        for (int k = start; k < end; ++k)
+        {
+            const Mesh &mesh = meshes[m_batchOrder[k]];
+            const QMatrix4x4 normalMatrix = ctx.scene->normalMatrix(m_batchOrder[k]);
+            InstanceData instance;
+            std::memcpy(instance.model, mesh.modelMatrix.constData(), sizeof(instance.model));
+            std::memcpy(instance.normalMatrix, normalMatrix.constData(), sizeof(instance.normalMatrix));
+            instance.baseColorMetal = QVector4D(mesh.material.baseColor, mesh.material.metalness);
+            instance.roughnessOcclusion = QVector4D(mesh.material.roughness, mesh.material.occlusion, 0.0f, 0.0f);
+            instance.emissive = QVector4D(mesh.material.emissive, 0.0f);
+            instance.miscParams = QVector4D(mesh.material.baseAlpha,
+                                            mesh.material.alphaCutoff,
+                                            float(mesh.material.alphaMode),
+                                            float(m_batchOrder[k] + 1));
+            const float *data = reinterpret_cast<const float *>(&instance);
+            m_instanceData.insert(m_instanceData.end(), data, data + kInstanceFloats);
+            m_meshBatches[m_batchOrder[k]] = batch;
+        }
+        start = end;
+    }
+    if (m_instanceBatches.isEmpty())
         return;
 
-    if (!mesh.vertexBuffer || !mesh.indexBuffer)
+    const quint32 size = quint32(m_instanceData.size() * sizeof(float));
+    if (!m_instanceBuffer || m_instanceBuffer->size() < size)
     {
-        mesh.vertexBuffer = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Immutable, QRhiBuffer::VertexBuffer, mesh.vertices.size() * sizeof(Vertex));
-        mesh.indexBuffer = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Immutable, QRhiBuffer::IndexBuffer, mesh.indices.size() * sizeof(quint32));
-        if (!mesh.vertexBuffer->create() || !mesh.indexBuffer->create())
+        delete m_instanceBuffer;
+        m_instanceBuffer = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::VertexBuffer, size);
+        m_uploadedInstanceData.clear();
+        if (!m_instanceBuffer->create())
+        {
+            qWarning() << "PassGBuffer: failed to create instance buffer";
+            delete m_instanceBuffer;
+            m_instanceBuffer = nullptr;
+            m_instanceBatches.clear();
+            m_meshBatches.fill(-1);
             return;
+        }
+    }
+    if (m_instanceData != m_uploadedInstanceData)
+    {
+        u->updateDynamicBuffer(m_instanceBuffer, 0, size, m_instanceData.constData());
+        m_uploadedInstanceData = m_instanceData;
+    }
+}
 
-        u->uploadStaticBuffer(mesh.vertexBuffer, mesh.vertices.constData());
-        u->uploadStaticBuffer(mesh.indexBuffer, mesh.indices.constData());
-        mesh.indexCount = mesh.indices.size();
+QRhiTexture *PassGBuffer::materialTexture(FrameContext &ctx, const QImage &source, const QVector<QImage> &mips,
+                                          QRhiResourceUpdateBatch *u)
+{
+    if (source.isNull())
+        return nullptr;
+    // Copies of a cached model share their images, and with them the texture.
+    const qint64 key = source.cacheKey();
+    if (QRhiTexture *texture = m_materialTextures.value(key))
+        return texture;
+    const QImage image = source.convertToFormat(QImage::Format_RGBA8888);
+    if (image.isNull())
+        return nullptr;
+    // The loader provides the full chain below the base level, anything else
+    // is uploaded as a single level.
+    const bool mipmapped = !mips.isEmpty()
+            && mips.size() == ctx.rhi->rhi()->mipLevelsForSize(image.size()) - 1;
+    QRhiTexture *texture = ctx.rhi->rhi()->newTexture(QRhiTexture::RGBA8, image.size(), 1,
+                                                      mipmapped ? QRhiTexture::MipMapped : QRhiTexture::Flags());
+    if (!texture->create())
+    {
+        delete texture;
+        return nullptr;
     }
-    if (mesh.indexCount == 0 && !mesh.indices.isEmpty())
-        mesh.indexCount = mesh.indices.size();
+    QVector<QRhiTextureUploadEntry> levels;
+    levels.push_back(QRhiTextureUploadEntry(0, 0, QRhiTextureSubresourceUploadDescription(image)));
+    if (mipmapped)
+    {
+        for (int level = 0; level < mips.size(); ++level)
+        {
+            levels.push_back(QRhiTextureUploadEntry(0, level + 1, QRhiTextureSubresourceUploadDescription(
+                    mips[level].convertToFormat(QImage::Format_RGBA8888))));
+        }
+    }
+    QRhiTextureUploadDescription upload;
+    upload.setEntries(levels.cbegin(), levels.cend());
+    u->uploadTexture(texture, upload);
+    m_materialTextures.insert(key, texture);
+    return texture;
+}
 
-    if (!mesh.modelUbo)
+QRhiShaderResourceBindings *PassGBuffer::srbForMesh(FrameContext &ctx, const Mesh &mesh)
+{
+    // Meshes differ by their textures only, the blocks come from m_uniforms.
+    MaterialBindings key;
+    key.textures[0] = mesh.baseColorTexture;
+    key.textures[1] = mesh.normalTexture;
+    key.textures[2] = mesh.metallicRoughnessTexture;
+    key.textures[3] = mesh.occlusionTexture;
+    key.textures[4] = mesh.emissiveTexture;
+    key.samplers[0] = mesh.baseColorSampler;
+    key.samplers[1] = mesh.normalSampler;
+    key.samplers[2] = mesh.metallicRoughnessSampler;
+    key.samplers[3] = mesh.occlusionSampler;
+    key.samplers[4] = mesh.emissiveSampler;
+    if (QRhiShaderResourceBindings *srb = m_materialSrbs.value(key))
+        return srb;
+
+    QRhiShaderResourceBindings *srb = ctx.rhi->rhi()->newShaderResourceBindings();
+    srb->setBindings({
+        QRhiShaderResourceBinding::uniformBuffer(0, QRhiShaderResourceBinding::VertexStage, m_cameraUbo),
+        QRhiShaderResourceBinding::uniformBufferWithDynamicOffset(1, QRhiShaderResourceBinding::VertexStage,
+                                                                  m_uniforms.buffer(), sizeof(ModelData)),
+        QRhiShaderResourceBinding::uniformBufferWithDynamicOffset(2, QRhiShaderResourceBinding::FragmentStage,
+                                                                  m_uniforms.buffer(), sizeof(MaterialData)),
+        QRhiShaderResourceBinding::sampledTexture(3, QRhiShaderResourceBinding::FragmentStage,
+                                                  mesh.baseColorTexture, mesh.baseColorSampler),
+        QRhiShaderResourceBinding::sampledTexture(4, QRhiShaderResourceBinding::FragmentStage,
+                                                  mesh.normalTexture, mesh.normalSampler),
+        QRhiShaderResourceBinding::sampledTexture(5, QRhiShaderResourceBinding::FragmentStage,
+                                                  mesh.metallicRoughnessTexture, mesh.metallicRoughnessSampler),
+        QRhiShaderResourceBinding::sampledTexture(6, QRhiShaderResourceBinding::FragmentStage,
+                                                  mesh.occlusionTexture, mesh.occlusionSampler),
+        QRhiShaderResourceBinding::sampledTexture(7, QRhiShaderResourceBinding::FragmentStage,
+                                                  mesh.emissiveTexture, mesh.emissiveSampler)
+    });
+    if (!srb->create())
     {
-        const quint32 mat4Size = 16 * sizeof(float);
-        mesh.modelUbo = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, mat4Size * 2);
-        if (!mesh.modelUbo->create())
-            return;
+        qWarning() << "PassGBuffer: failed to create mesh bindings";
+        delete srb;
+        return nullptr;
     }
-    if (!mesh.materialUbo)
+    m_materialSrbs.insert(key, srb);
+    return srb;
+}
+
+void PassGBuffer::releaseMaterialSrbs(FrameContext &ctx)
+{
+    for (QRhiShaderResourceBindings *srb : std::as_const(m_materialSrbs))
+        delete srb;
+    m_materialSrbs.clear();
+    if (ctx.scene)
     {
-        mesh.materialUbo = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, sizeof(QVector4D) * 4);
-        if (!mesh.materialUbo->create())
-            return;
+        for (Mesh &mesh : ctx.scene->meshes())
+        {
+            mesh.srb = nullptr;
+            mesh.gpuReady = false;
+        }
+    }
+}
+
+void PassGBuffer::releaseMaterialSrbs(const QSet<QRhiTexture *> &textures)
+{
+    for (auto it = m_materialSrbs.begin(); it != m_materialSrbs.end();)
+    {
+        const bool uses = std::any_of(std::begin(it.key().textures), std::end(it.key().textures),
+                                      [&textures](QRhiTexture *texture) { return textures.contains(texture); });
+        if (!uses)
+        {
+            ++it;
+            continue;
+        }
+        delete it.value();
+        it = m_materialSrbs.erase(it);
+    }
+}
+
+void PassGBuffer::releaseRetiredTextures(FrameContext &ctx)
+{
+    if (!ctx.retiredTextures || ctx.retiredTextures->textures.isEmpty())
+        return;
+    const QVector<QRhiTexture *> &retired = ctx.retiredTextures->textures;
+    releaseMaterialSrbs(QSet<QRhiTexture *>(retired.cbegin(), retired.cend()));
+    qDeleteAll(retired);
+    ctx.retiredTextures->textures.clear();
+}
+
+void PassGBuffer::releaseUnusedMeshResources(FrameContext &ctx)
+{
+    // Once every copy of a pick geometry is gone, so is the model it came from.
+    // Its buffers and textures go too, unless another mesh shares them.
+    QSet<QRhiBuffer *> buffers;
+    QSet<QRhiTexture *> textures;
+    for (auto it = m_uploadedMeshes.begin(); it != m_uploadedMeshes.end();)
+    {
+        if (!it->pickGeometry.isNull())
+        {
+            ++it;
+            continue;
+        }
+        buffers << it->vertexBuffer << it->indexBuffer;
+        textures << it->baseColorTexture << it->normalTexture << it->metallicRoughnessTexture
+                 << it->occlusionTexture << it->emissiveTexture;
+        it = m_uploadedMeshes.erase(it);
+    }
+    if (buffers.isEmpty() && textures.isEmpty())
+        return;
+
+    const auto keep = [&buffers, &textures](QRhiBuffer *vertexBuffer, QRhiBuffer *indexBuffer,
+                                            std::initializer_list<QRhiTexture *> used) {
+        buffers.remove(vertexBuffer);
+        buffers.remove(indexBuffer);
+        for (QRhiTexture *texture : used)
+            textures.remove(texture);
+    };
+    for (const UploadedMesh &uploaded : std::as_const(m_uploadedMeshes))
+    {
+        keep(uploaded.vertexBuffer, uploaded.indexBuffer,
+             { uploaded.baseColorTexture, uploaded.normalTexture, uploaded.metallicRoughnessTexture,
+               uploaded.occlusionTexture, uploaded.emissiveTexture });
+    }
+    for (const Mesh &mesh : std::as_const(ctx.scene->meshes()))
+    {
+        keep(mesh.vertexBuffer, mesh.indexBuffer,
+             { mesh.baseColorTexture, mesh.normalTexture, mesh.metallicRoughnessTexture,
+               mesh.occlusionTexture, mesh.emissiveTexture });
     }
+    buffers.remove(nullptr);
+    qDeleteAll(buffers);
+
+    // Only the textures made by materialTexture() are ours, video frames
+    // belong to their item and the defaults stay.
+    QSet<QRhiTexture *> owned;
+    for (auto it = m_materialTextures.begin(); it != m_materialTextures.end();)
+    {
+        if (!textures.contains(it.value()))
+        {
+            ++it;
+            continue;
+        }
+        owned.insert(it.value());
+        it = m_materialTextures.erase(it);
+    }
+    releaseMaterialSrbs(owned);
+    qDeleteAll(owned);
+}
+
+void PassGBuffer::ensureMeshBuffers(FrameContext &ctx, Mesh &mesh, QRhiResourceUpdateBatch *u)
+{
+    if (mesh.gpuReady)
+        return;
+    const bool retainCpuData = ctx.scene->cpuDataRetention() == Scene::CpuDataRetention::RetainAll;
+    buildPickGeometry(mesh);
+
+    if (!mesh.vertexBuffer || !mesh.indexBuffer)
+    {
+        // Copies of a loaded model or of a primitive share their pick geometry.
+        // It finds the resources of the first copy uploaded, also for copies
+        // the loader made after releasing its own vertex and image data, and
+        // lets the copies draw instanced.
+        const auto uploaded = m_uploadedMeshes.constFind(mesh.pickGeometry.data());
+        if (uploaded != m_uploadedMeshes.constEnd() && uploaded->pickGeometry == mesh.pickGeometry)
+        {
+            mesh.vertexBuffer = uploaded->vertexBuffer;
+            mesh.indexBuffer = uploaded->indexBuffer;
+            mesh.indexCount = uploaded->indexCount;
+            if (!mesh.baseColorTexture)
+                mesh.baseColorTexture = uploaded->baseColorTexture;
+            if (!mesh.normalTexture)
+                mesh.normalTexture = uploaded->normalTexture;
+            if (!mesh.metallicRoughnessTexture)
+                mesh.metallicRoughnessTexture = uploaded->metallicRoughnessTexture;
+            if (!mesh.occlusionTexture)
+                mesh.occlusionTexture = uploaded->occlusionTexture;
+            if (!mesh.emissiveTexture)
+                mesh.emissiveTexture = uploaded->emissiveTexture;
+        }
+        else
+        {
+            if (mesh.vertices.isEmpty() || mesh.indices.isEmpty())
+                return;
+            const quint32 verticesSize = quint32(mesh.vertices.size() * sizeof(Vertex));
+            const quint32 indicesSize = quint32(mesh.indices.size() * sizeof(quint32));
+            mesh.vertexBuffer = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Immutable, QRhiBuffer::VertexBuffer, verticesSize);
+            mesh.indexBuffer = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Immutable, QRhiBuffer::IndexBuffer, indicesSize);
+            if (!mesh.vertexBuffer->create() || !mesh.indexBuffer->create())
+                return;
+
+            u->uploadStaticBuffer(mesh.vertexBuffer, mesh.vertices.constData());
+            u->uploadStaticBuffer(mesh.indexBuffer, mesh.indices.constData());
+            mesh.indexCount = mesh.indices.size();
+        }
+    }
+    if (mesh.indexCount == 0 && !mesh.indices.isEmpty())
+        mesh.indexCount = mesh.indices.size();
+
     if (m_defaultBaseColor && !m_defaultBaseColorUploaded)
     {
         QImage white(1, 1, QImage::Format_RGBA8888);
@@ -406,25 +1002,7 @@ void PassGBuffer::ensureMeshBuffers(FrameContext &ctx, Mesh &mesh, QRhiResourceU
     }
     if (!mesh.baseColorTexture)
     {
-        if (!mesh.material.baseColorMap.isNull())
-        {
-            const QImage image = mesh.material.baseColorMap.convertToFormat(QImage::Format_RGBA8888);
-            if (!image.isNull())
-            {
-                mesh.baseColorTexture = ctx.rhi->rhi()->newTexture(QRhiTexture::RGBA8, image.size(), 1);
-                if (mesh.baseColorTexture->create())
-                {
-                    QRhiTextureUploadDescription upload(QRhiTextureUploadEntry(0, 0,
-                                                                                QRhiTextureSubresourceUploadDescription(image)));
-                    u->uploadTexture(mesh.baseColorTexture, upload);
-                }
-                else
-                {
-                    delete mesh.baseColorTexture;
-                    mesh.baseColorTexture = nullptr;
-                }
-            }
-        }
+        mesh.baseColorTexture = materialTexture(ctx, mesh.material.baseColorMap, mesh.material.baseColorMips, u);
         if (!mesh.baseColorTexture)
             mesh.baseColorTexture = m_defaultBaseColor;
     }
@@ -436,25 +1014,7 @@ void PassGBuffer::ensureMeshBuffers(FrameContext &ctx, Mesh &mesh, QRhiResourceU
     }
     if (!mesh.normalTexture)
     {
-        if (!mesh.material.normalMap.isNull())
-        {
-            const QImage image = mesh.material.normalMap.convertToFormat(QImage::Format_RGBA8888);
-            if (!image.isNull())
-            {
-                mesh.normalTexture = ctx.rhi->rhi()->newTexture(QRhiTexture::RGBA8, image.size(), 1);
-                if (mesh.normalTexture->create())
-                {
-                    QRhiTextureUploadDescription upload(QRhiTextureUploadEntry(0, 0,
-                                                                                QRhiTextureSubresourceUploadDescription(image)));
-                    u->uploadTexture(mesh.normalTexture, upload);
-                }
-                else
-                {
-                    delete mesh.normalTexture;
-                    mesh.normalTexture = nullptr;
-                }
-            }
-        }
+        mesh.normalTexture = materialTexture(ctx, mesh.material.normalMap, mesh.material.normalMips, u);
         if (!mesh.normalTexture)
             mesh.normalTexture = m_defaultNormal;
     }
@@ -462,25 +1022,7 @@ void PassGBuffer::ensureMeshBuffers(FrameContext &ctx, Mesh &mesh, QRhiResourceU
         mesh.normalSampler = m_linearSampler;
     if (!mesh.metallicRoughnessTexture)
     {
-        if (!mesh.material.metallicRoughnessMap.isNull())
-        {
-            const QImage image = mesh.material.metallicRoughnessMap.convertToFormat(QImage::Format_RGBA8888);
-            if (!image.isNull())
-            {
-                mesh.metallicRoughnessTexture = ctx.rhi->rhi()->newTexture(QRhiTexture::RGBA8, image.size(), 1);
-                if (mesh.metallicRoughnessTexture->create())
-                {
-                    QRhiTextureUploadDescription upload(QRhiTextureUploadEntry(0, 0,
-                                                                                QRhiTextureSubresourceUploadDescription(image)));
-                    u->uploadTexture(mesh.metallicRoughnessTexture, upload);
-                }
-                else
-                {
-                    delete mesh.metallicRoughnessTexture;
-                    mesh.metallicRoughnessTexture = nullptr;
-                }
-            }
-        }
+        mesh.metallicRoughnessTexture = materialTexture(ctx, mesh.material.metallicRoughnessMap, mesh.material.metallicRoughnessMips, u);
         if (!mesh.metallicRoughnessTexture)
             mesh.metallicRoughnessTexture = m_defaultMetallicRoughness;
     }
@@ -488,25 +1030,7 @@ void PassGBuffer::ensureMeshBuffers(FrameContext &ctx, Mesh &mesh, QRhiResourceU
         mesh.metallicRoughnessSampler = m_linearSampler;
     if (!mesh.occlusionTexture)
     {
-        if (!mesh.material.occlusionMap.isNull())
-        {
-            const QImage image = mesh.material.occlusionMap.convertToFormat(QImage::Format_RGBA8888);
-            if (!image.isNull())
-            {
-                mesh.occlusionTexture = ctx.rhi->rhi()->newTexture(QRhiTexture::RGBA8, image.size(), 1);
-                if (mesh.occlusionTexture->create())
-                {
-                    QRhiTextureUploadDescription upload(QRhiTextureUploadEntry(0, 0,
-                                                                                QRhiTextureSubresourceUploadDescription(image)));
-                    u->uploadTexture(mesh.occlusionTexture, upload);
-                }
-                else
-                {
-                    delete mesh.occlusionTexture;
-                    mesh.occlusionTexture = nullptr;
-                }
-            }
-        }
+        mesh.occlusionTexture = materialTexture(ctx, mesh.material.occlusionMap, mesh.material.occlusionMips, u);
         if (!mesh.occlusionTexture)
             mesh.occlusionTexture = m_defaultOcclusion;
     }
@@ -514,25 +1038,7 @@ void PassGBuffer::ensureMeshBuffers(FrameContext &ctx, Mesh &mesh, QRhiResourceU
         mesh.occlusionSampler = m_linearSampler;
     if (!mesh.emissiveTexture)
     {
-        if (!mesh.material.emissiveMap.isNull())
-        {
-            const QImage image = mesh.material.emissiveMap.convertToFormat(QImage::Format_RGBA8888);
-            if (!image.isNull())
-            {
-                mesh.emissiveTexture = ctx.rhi->rhi()->newTexture(QRhiTexture::RGBA8, image.size(), 1);
-                if (mesh.emissiveTexture->create())
-                {
-                    QRhiTextureUploadDescription upload(QRhiTextureUploadEntry(0, 0,
-                                                                                QRhiTextureSubresourceUploadDescription(image)));
-                    u->uploadTexture(mesh.emissiveTexture, upload);
-                }
-                else
-                {
-                    delete mesh.emissiveTexture;
-                    mesh.emissiveTexture = nullptr;
-                }
-            }
-        }
+        mesh.emissiveTexture = materialTexture(ctx, mesh.material.emissiveMap, mesh.material.emissiveMips, u);
         if (!mesh.emissiveTexture)
             mesh.emissiveTexture = m_defaultEmissive;
     }
@@ -540,24 +1046,27 @@ void PassGBuffer::ensureMeshBuffers(FrameContext &ctx, Mesh &mesh, QRhiResourceU
         mesh.emissiveSampler = m_linearSampler;
     if (!mesh.srb)
     {
-        mesh.srb = ctx.rhi->rhi()->newShaderResourceBindings();
-        mesh.srb->setBindings({
-            QRhiShaderResourceBinding::uniformBuffer(0, QRhiShaderResourceBinding::VertexStage, m_cameraUbo),
-            QRhiShaderResourceBinding::uniformBuffer(1, QRhiShaderResourceBinding::VertexStage, mesh.modelUbo),
-            QRhiShaderResourceBinding::uniformBuffer(2, QRhiShaderResourceBinding::FragmentStage, mesh.materialUbo),
-            QRhiShaderResourceBinding::sampledTexture(3, QRhiShaderResourceBinding::FragmentStage,
-                                                      mesh.baseColorTexture, mesh.baseColorSampler),
-            QRhiShaderResourceBinding::sampledTexture(4, QRhiShaderResourceBinding::FragmentStage,
-                                                      mesh.normalTexture, mesh.normalSampler),
-            QRhiShaderResourceBinding::sampledTexture(5, QRhiShaderResourceBinding::FragmentStage,
-                                                      mesh.metallicRoughnessTexture, mesh.metallicRoughnessSampler),
-            QRhiShaderResourceBinding::sampledTexture(6, QRhiShaderResourceBinding::FragmentStage,
-                                                      mesh.occlusionTexture, mesh.occlusionSampler),
-            QRhiShaderResourceBinding::sampledTexture(7, QRhiShaderResourceBinding::FragmentStage,
-                                                      mesh.emissiveTexture, mesh.emissiveSampler)
-        });
-        if (!mesh.srb->create())
+        mesh.srb = srbForMesh(ctx, mesh);
+        if (!mesh.srb)
             return;
     }
+    if (mesh.pickGeometry && !m_uploadedMeshes.contains(mesh.pickGeometry.data()))
+    {
+        // Only the textures of the material are passed on, not the ones an item
+        // set on this copy, like a video frame.
+        const auto materialOnly = [this](QRhiTexture *texture) -> QRhiTexture * {
+            const bool fromMaterial = std::find(m_materialTextures.cbegin(), m_materialTextures.cend(), texture)
+                    != m_materialTextures.cend();
+            return fromMaterial ? texture : nullptr;
+        };
+        m_uploadedMeshes.insert(mesh.pickGeometry.data(),
+                                { mesh.pickGeometry, mesh.vertexBuffer, mesh.indexBuffer, mesh.indexCount,
+                                  materialOnly(mesh.baseColorTexture), materialOnly(mesh.normalTexture),
+                                  materialOnly(mesh.metallicRoughnessTexture), materialOnly(mesh.occlusionTexture),
+                                  materialOnly(mesh.emissiveTexture) });
+    }
     mesh.gpuReady = true;
+    // Uploads copy their data, the batch doesn't need the arrays or images.
+    if (!retainCpuData)
+        releaseCpuData(mesh);
 }
@@ -1,28 +1,114 @@
 #pragma once
 
+#include <QtCore/QHash>
+#include <QtCore/QSet>
+#include <QtCore/QVector>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <vector>
+
 #include "core/RenderGraph.h"
 #include "core/RenderTargetCache.h"
+#include "core/UniformRing.h"
+#include "scene/Mesh.h"
 
-class Mesh;
+class QImage;
 
 class PassGBuffer final : public RenderPass
 {
 public:
+    ~PassGBuffer() override;
+    const char *name() const override { return "PassGBuffer"; }
+    void setup(RenderGraphBuilder &builder, FrameContext &ctx) override;
     void prepare(FrameContext &ctx) override;
     void execute(FrameContext &ctx) override;
 
 private:
     void ensurePipeline(FrameContext &ctx);
     void ensureMeshBuffers(FrameContext &ctx, Mesh &mesh, QRhiResourceUpdateBatch *u);
-    QRhiGraphicsPipeline *createPipeline(FrameContext &ctx, QRhiGraphicsPipeline::CullMode cullMode);
+    void updateInstanceBatches(FrameContext &ctx, QRhiResourceUpdateBatch *u);
+    QRhiShaderResourceBindings *srbForMesh(FrameContext &ctx, const Mesh &mesh);
+    void releaseMaterialSrbs(FrameContext &ctx);
+    void releaseMaterialSrbs(const QSet<QRhiTexture *> &textures);
+    void releaseUnusedMeshResources(FrameContext &ctx);
+    void releaseRetiredTextures(FrameContext &ctx);
+    QRhiTexture *materialTexture(FrameContext &ctx, const QImage &source, const QVector<QImage> &mips,
+                                 QRhiResourceUpdateBatch *u);
+    QRhiGraphicsPipeline *createPipeline(FrameContext &ctx, QRhiGraphicsPipeline::CullMode cullMode,
+                                         bool instanced = false, bool depthEqual = false);
+    QRhiGraphicsPipeline *pipelineFor(const Mesh &mesh, bool instanced, bool prepassed) const;
+    QRhiResourceUpdateBatch *readBackObjectIds(FrameContext &ctx);
+
+    // Resources of the first mesh uploaded with a given pick geometry. The entry
+    // is dropped with the pick geometry, before its address can be reused.
+    struct UploadedMesh
+    {
+        QWeakPointer<const MeshPickGeometry> pickGeometry;
+        QRhiBuffer *vertexBuffer = nullptr;
+        QRhiBuffer *indexBuffer = nullptr;
+        int indexCount = 0;
+        QRhiTexture *baseColorTexture = nullptr;
+        QRhiTexture *normalTexture = nullptr;
+        QRhiTexture *metallicRoughnessTexture = nullptr;
+        QRhiTexture *occlusionTexture = nullptr;
+        QRhiTexture *emissiveTexture = nullptr;
+    };
+    struct ObjectIdReadback
+    {
+        ObjectIdRequest request;
+        QRect rect;
+        QRhiTexture *staging = nullptr;
+        QRhiReadbackResult result;
+        bool flipRows = false;
+        bool done = false;
+    };
+    struct InstanceBatch
+    {
+        int mesh = -1; // first mesh of the batch, the one issuing the draw
+        int firstInstance = 0;
+        int instanceCount = 0;
+    };
+    // Textures and samplers of a mesh, the meshes sharing them share bindings.
+    struct MaterialBindings
+    {
+        QRhiTexture *textures[5] = {};
+        QRhiSampler *samplers[5] = {};
+
+        bool operator==(const MaterialBindings &other) const
+        {
+            return std::equal(std::begin(textures), std::end(textures), std::begin(other.textures))
+                    && std::equal(std::begin(samplers), std::end(samplers), std::begin(other.samplers));
+        }
+        friend size_t qHash(const MaterialBindings &key, size_t seed = 0)
+        {
+            return qHashBits(&key, sizeof(key), seed);
+        }
+    };
+    // Offsets of the model and material blocks of a mesh in m_uniforms.
+    struct UniformOffsets
+    {
+        quint32 model = 0;
+        quint32 material = 0;
+        bool valid = false;
+    };
 
     RenderTargetCache::GBufferTargets m_gbuffer;
     QRhiGraphicsPipeline *m_pipeline = nullptr;
     QRhiGraphicsPipeline *m_pipelineTwoSided = nullptr;
+    QRhiGraphicsPipeline *m_instancedPipeline = nullptr;
+    QRhiGraphicsPipeline *m_instancedPipelineTwoSided = nullptr;
+    // Same as above, testing EQUAL against the depth pre-pass without writing depth.
+    QRhiGraphicsPipeline *m_pipelineEqual = nullptr;
+    QRhiGraphicsPipeline *m_pipelineTwoSidedEqual = nullptr;
+    QRhiGraphicsPipeline *m_instancedPipelineEqual = nullptr;
+    QRhiGraphicsPipeline *m_instancedPipelineTwoSidedEqual = nullptr;
     QRhiShaderResourceBindings *m_srb = nullptr;
     QRhiBuffer *m_cameraUbo = nullptr;
-    QRhiBuffer *m_modelUbo = nullptr;
-    QRhiBuffer *m_materialUbo = nullptr;
+    // Model and material blocks of every mesh, bound with dynamic offsets.
+    UniformRing m_uniforms;
+    QVector<UniformOffsets> m_uniformOffsets; // per mesh
+    QHash<MaterialBindings, QRhiShaderResourceBindings *> m_materialSrbs;
     QRhiTexture *m_defaultBaseColor = nullptr;
     QRhiTexture *m_defaultNormal = nullptr;
     QRhiTexture *m_defaultMetallicRoughness = nullptr;
@@ -36,4 +122,15 @@ private:
     bool m_defaultOcclusionUploaded = false;
     bool m_defaultEmissiveUploaded = false;
     QRhiRenderPassDescriptor *m_rpDesc = nullptr;
+    QHash<const MeshPickGeometry *, UploadedMesh> m_uploadedMeshes;
+    QHash<qint64, QRhiTexture *> m_materialTextures;
+    QVector<InstanceBatch> m_instanceBatches;
+    QVector<int> m_meshBatches;
+    QVector<int> m_batchOrder;
+    QVector<float> m_instanceData;
+    QVector<float> m_uploadedInstanceData;
+    QRhiBuffer *m_instanceBuffer = nullptr;
+    bool m_pipelineObjectIds = false;
+    std::vector<std::unique_ptr<ObjectIdReadback>> m_objectIdReadbacks;
+    QRhi *m_rhi = nullptr; // of the readbacks in flight
 };
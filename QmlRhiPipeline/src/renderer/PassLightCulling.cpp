@@ -6,6 +6,7 @@
 #include <QtGui/QMatrix4x4>
 #include <cstring>
 #include <cmath>
+#include <limits>
 
 #include "core/RhiContext.h"
 #include "core/ShaderManager.h"
@@ -13,22 +14,20 @@
 
 namespace {
 
-struct LightsData
-{
-    QVector4D lightCount;
-    QVector4D lightParams;
-    QVector4D lightFlags;
-    QVector4D lightBeam[kMaxLights];
-    QVector4D posRange[kMaxLights];
-    QVector4D colorIntensity[kMaxLights];
-    QVector4D dirInner[kMaxLights];
-    QVector4D other[kMaxLights];
-};
+// Grid texels per cluster: light offset, light count, beam offset, beam count.
+constexpr int kGridWidth = 4;
+// Width of the compacted light index list, rows are added as it fills up.
+constexpr int kListWidth = 1024;
+constexpr int kInitialLightsPerCluster = 16;
+// Without buffer readback the list is sized from the light and beam counts alone.
+constexpr int kMaxFallbackLightsPerCluster = 128;
+constexpr int kMaxFallbackBeamsPerCluster = 32;
 
 struct CullParams
 {
     float view[16];
     float proj[16];
+    float invProj[16];
     QVector4D screen; // x=width y=height z=invW w=invH
     QVector4D cluster; // x=countX y=countY z=countZ w=clusterSize
     QVector4D zParams; // x=logScale y=logBias z=near w=far
@@ -37,6 +36,26 @@ struct CullParams
 
 } // namespace
 
+PassLightCulling::~PassLightCulling()
+{
+    // The pending counter readback writes into this pass, let it land first.
+    if (m_rhi && m_readbackPending)
+        m_rhi->finish();
+}
+
+void PassLightCulling::setup(RenderGraphBuilder &builder, FrameContext &ctx)
+{
+    Q_UNUSED(ctx);
+    builder.importTexture(RenderResource::LightClusters, m_lightIndexTexture);
+    builder.write(RenderResource::LightClusters);
+}
+
+void PassLightCulling::onCulled(FrameContext &ctx)
+{
+    if (ctx.lightCulling)
+        ctx.lightCulling->enabled = false;
+}
+
 void PassLightCulling::prepare(FrameContext &ctx)
 {
     if (!ctx.rhi || !ctx.shaders || !ctx.lightCulling)
@@ -47,7 +66,10 @@ void PassLightCulling::prepare(FrameContext &ctx)
     const bool supported = rhi->isFeatureSupported(QRhi::Compute);
     ctx.lightCulling->enabled = supported;
     if (!supported)
+    {
         ctx.lightCulling->clusterLightIndexTexture = nullptr;
+        ctx.lightCulling->clusterLightListTexture = nullptr;
+    }
     ctx.lightCulling->clusterSize = m_clusterSize;
     ctx.lightCulling->clusterCountZ = m_clusterCountZ;
 
@@ -61,14 +83,16 @@ void PassLightCulling::prepare(FrameContext &ctx)
     if (size.isEmpty())
     {
         ctx.lightCulling->clusterLightIndexTexture = nullptr;
+        ctx.lightCulling->clusterLightListTexture = nullptr;
         return;
     }
 
     ensureBuffers(ctx, size);
     ensurePipeline(ctx);
-    if (m_lightIndexTexture)
+    if (m_lightIndexTexture && m_lightListTexture)
     {
         ctx.lightCulling->clusterLightIndexTexture = m_lightIndexTexture;
+        ctx.lightCulling->clusterLightListTexture = m_lightListTexture;
         ctx.lightCulling->clusterCountX = m_lastClusterCountX;
         ctx.lightCulling->clusterCountY = m_lastClusterCountY;
         ctx.lightCulling->clusterCountZ = m_clusterCountZ;
@@ -77,6 +101,7 @@ void PassLightCulling::prepare(FrameContext &ctx)
     {
         ctx.lightCulling->enabled = false;
         ctx.lightCulling->clusterLightIndexTexture = nullptr;
+        ctx.lightCulling->clusterLightListTexture = nullptr;
     }
 }
 
@@ -84,51 +109,14 @@ void PassLightCulling::execute(FrameContext &ctx)
 {
     if (!ctx.rhi || !ctx.scene || !ctx.lightCulling || !ctx.lightCulling->enabled)
         return;
-    if (!m_pipeline || !m_srb || !m_lightUbo || !m_cullUbo || !m_lightIndexTexture)
+    if (!m_pipeline || !m_srb || !m_lightBuffer || !m_cullUbo || !m_counterBuffer
+            || !m_lightIndexTexture || !m_lightListTexture)
         return;
 
     QRhiCommandBuffer *cb = ctx.rhi->commandBuffer();
     if (!cb)
         return;
 
-    const int maxLights = qMin(kMaxLights, ctx.scene->lights().size());
-    LightsData lightData = {};
-    const QVector3D ambient = ctx.scene->ambientLight() * ctx.scene->ambientIntensity();
-    lightData.lightCount = QVector4D(float(maxLights), ambient.x(), ambient.y(), ambient.z());
-    lightData.lightParams = QVector4D(ctx.scene->smokeAmount(),
-                                      float(static_cast<int>(ctx.scene->beamModel())),
-                                      ctx.scene->bloomIntensity(),
-                                      ctx.scene->bloomRadius());
-    lightData.lightFlags = QVector4D(ctx.scene->volumetricEnabled() ? 1.0f : 0.0f,
-                                     ctx.scene->smokeNoiseEnabled() ? 1.0f : 0.0f,
-                                     ctx.scene->shadowsEnabled() ? 1.0f : 0.0f,
-                                     0.0f);
-    for (int i = 0; i < maxLights; ++i)
-    {
-        const Light &l = ctx.scene->lights()[i];
-        const QVector3D dir = l.direction.normalized();
-        lightData.posRange[i] = QVector4D(l.position, l.range);
-        lightData.colorIntensity[i] = QVector4D(l.color, l.intensity);
-        lightData.dirInner[i] = QVector4D(dir, qCos(l.innerCone));
-        lightData.lightBeam[i] = QVector4D(l.beamRadius, float(l.beamShape), 0.0f, 0.0f);
-        float extraZ = 0.0f;
-        float extraW = 0.0f;
-        if (l.type == Light::Type::Area)
-        {
-            extraZ = l.areaSize.x();
-            extraW = l.areaSize.y();
-        }
-        else if (l.type == Light::Type::Spot)
-        {
-            extraZ = l.goboPath.isEmpty() ? -1.0f : float(i);
-            extraW = float(l.qualitySteps);
-        }
-        lightData.other[i] = QVector4D(qCos(l.outerCone),
-                                       float(l.type),
-                                       extraZ,
-                                       extraW);
-    }
-
     const QSize size = m_lastSize;
     const int clusterCountX = m_lastClusterCountX;
     const int clusterCountY = m_lastClusterCountY;
@@ -140,6 +128,8 @@ void PassLightCulling::execute(FrameContext &ctx)
             * ctx.scene->camera().projectionMatrix();
     std::memcpy(params.view, view.constData(), sizeof(params.view));
     std::memcpy(params.proj, proj.constData(), sizeof(params.proj));
+    const QMatrix4x4 invProj = proj.inverted();
+    std::memcpy(params.invProj, invProj.constData(), sizeof(params.invProj));
     params.screen = QVector4D(float(size.width()), float(size.height()),
                               1.0f / float(size.width()), 1.0f / float(size.height()));
     const float nearPlane = qMax(0.001f, ctx.scene->camera().nearPlane());
@@ -152,18 +142,41 @@ void PassLightCulling::execute(FrameContext &ctx)
     params.zParams = QVector4D(logScale, logBias, nearPlane, farPlane);
     params.flags = QVector4D(1.0f, 0.0f, 0.0f, 0.0f);
 
-    QRhiResourceUpdateBatch *u = ctx.rhi->rhi()->nextResourceUpdateBatch();
-    u->uploadStaticBuffer(m_lightUbo, 0, sizeof(LightsData), &lightData);
+    QRhi *rhi = ctx.rhi->rhi();
+    const quint32 zero = 0;
+    QRhiResourceUpdateBatch *u = rhi->nextResourceUpdateBatch();
     u->updateDynamicBuffer(m_cullUbo, 0, sizeof(CullParams), &params);
+    u->uploadStaticBuffer(m_counterBuffer, 0, sizeof(zero), &zero);
     cb->resourceUpdate(u);
 
     cb->beginComputePass();
     cb->setComputePipeline(m_pipeline);
     cb->setShaderResources(m_srb);
+    // One workgroup per cluster, see CULL_GROUP_SIZE in light_cull.comp.
     cb->dispatch(clusterCountX, clusterCountY, clusterCountZ);
-    cb->endComputePass();
+
+    // The counter holds the total number of cluster/light pairs even when the
+    // list overflowed, so reading it back tells how far the list must grow.
+    QRhiResourceUpdateBatch *readback = nullptr;
+    if (!m_readbackPending && rhi->isFeatureSupported(QRhi::ReadBackNonUniformBuffer))
+    {
+        m_rhi = rhi;
+        m_readbackPending = true;
+        m_counterReadback.completed = [this]() {
+            m_readbackPending = false;
+            if (m_counterReadback.data.size() < int(sizeof(quint32)))
+                return;
+            quint32 total = 0;
+            std::memcpy(&total, m_counterReadback.data.constData(), sizeof(total));
+            m_listDemand = int(qMin<quint32>(total, quint32(std::numeric_limits<int>::max())));
+        };
+        readback = rhi->nextResourceUpdateBatch();
+        readback->readBackBuffer(m_counterBuffer, 0, sizeof(quint32), &m_counterReadback);
+    }
+    cb->endComputePass(readback);
 
     ctx.lightCulling->clusterLightIndexTexture = m_lightIndexTexture;
+    ctx.lightCulling->clusterLightListTexture = m_lightListTexture;
     ctx.lightCulling->clusterCountX = clusterCountX;
     ctx.lightCulling->clusterCountY = clusterCountY;
     ctx.lightCulling->clusterCountZ = clusterCountZ;
@@ -176,9 +189,9 @@ void PassLightCulling::execute(FrameContext &ctx)
 
 void PassLightCulling::ensurePipeline(FrameContext &ctx)
 {
-    if (!ctx.rhi || !ctx.shaders || !m_lightIndexTexture)
+    if (!ctx.rhi || !ctx.shaders || !m_lightIndexTexture || !m_lightListTexture)
         return;
-    if (m_pipeline && m_srb)
+    if (m_pipeline && m_srb && m_lightBuffer == ctx.lightBuffer)
         return;
 
     delete m_pipeline;
@@ -191,16 +204,9 @@ void PassLightCulling::ensurePipeline(FrameContext &ctx)
     if (!cs.shader().isValid())
         return;
 
-    if (!m_lightUbo)
-    {
-        m_lightUbo = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Static, QRhiBuffer::StorageBuffer, sizeof(LightsData));
-        if (!m_lightUbo->create())
-        {
-            delete m_lightUbo;
-            m_lightUbo = nullptr;
-            return;
-        }
-    }
+    m_lightBuffer = ctx.lightBuffer;
+    if (!m_lightBuffer)
+        return;
     if (!m_cullUbo)
     {
         m_cullUbo = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, sizeof(CullParams));
@@ -211,12 +217,24 @@ void PassLightCulling::ensurePipeline(FrameContext &ctx)
             return;
         }
     }
+    if (!m_counterBuffer)
+    {
+        m_counterBuffer = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Static, QRhiBuffer::StorageBuffer, sizeof(quint32));
+        if (!m_counterBuffer->create())
+        {
+            delete m_counterBuffer;
+            m_counterBuffer = nullptr;
+            return;
+        }
+    }
 
     m_srb = ctx.rhi->rhi()->newShaderResourceBindings();
     m_srb->setBindings({
-        QRhiShaderResourceBinding::bufferLoad(0, QRhiShaderResourceBinding::ComputeStage, m_lightUbo),
+        QRhiShaderResourceBinding::bufferLoad(0, QRhiShaderResourceBinding::ComputeStage, m_lightBuffer),
         QRhiShaderResourceBinding::uniformBuffer(1, QRhiShaderResourceBinding::ComputeStage, m_cullUbo),
-        QRhiShaderResourceBinding::imageStore(2, QRhiShaderResourceBinding::ComputeStage, m_lightIndexTexture, 0)
+        QRhiShaderResourceBinding::imageStore(2, QRhiShaderResourceBinding::ComputeStage, m_lightIndexTexture, 0),
+        QRhiShaderResourceBinding::imageStore(3, QRhiShaderResourceBinding::ComputeStage, m_lightListTexture, 0),
+        QRhiShaderResourceBinding::bufferLoadStore(4, QRhiShaderResourceBinding::ComputeStage, m_counterBuffer)
     });
     if (!m_srb->create())
     {
@@ -240,50 +258,84 @@ void PassLightCulling::ensureBuffers(FrameContext &ctx, const QSize &size)
 {
     const int clusterCountX = (size.width() + m_clusterSize - 1) / m_clusterSize;
     const int clusterCountY = (size.height() + m_clusterSize - 1) / m_clusterSize;
-    if (size == m_lastSize && clusterCountX == m_lastClusterCountX && clusterCountY == m_lastClusterCountY && m_lightIndexTexture)
+    const int clusterCount = clusterCountX * clusterCountY * m_clusterCountZ;
+    const int lightCount = ctx.scene ? int(ctx.scene->lights().size()) : 0;
+    int beamCount = 0;
+    if (ctx.scene)
+    {
+        for (const Light &light : ctx.scene->lights())
+        {
+            if (light.type == Light::Type::Spot && light.qualitySteps > 0)
+                ++beamCount;
+        }
+    }
+    QRhi *rhi = ctx.rhi->rhi();
+
+    qint64 listCapacity = qint64(clusterCount) * kInitialLightsPerCluster;
+    if (rhi->isFeatureSupported(QRhi::ReadBackNonUniformBuffer))
+        listCapacity = qMax(listCapacity, qint64(m_listDemand));
+    else
+        listCapacity = qint64(clusterCount) * (qBound(kInitialLightsPerCluster, lightCount, kMaxFallbackLightsPerCluster)
+                                               + qMin(beamCount, kMaxFallbackBeamsPerCluster));
+    const int maxRows = qMax(1, rhi->resourceLimit(QRhi::TextureSizeMax));
+    int listRows = int(qMin<qint64>((listCapacity + kListWidth - 1) / kListWidth, maxRows));
+    // Grow in steps of a quarter so a slowly rising demand does not recreate every frame.
+    if (listRows > m_listRows && m_listRows > 0)
+        listRows = qMin(maxRows, qMax(listRows, m_listRows + m_listRows / 4));
+    else
+        listRows = qMax(listRows, m_listRows);
+
+    if (size == m_lastSize && clusterCountX == m_lastClusterCountX && clusterCountY == m_lastClusterCountY
+            && listRows == m_listRows && m_lightIndexTexture && m_lightListTexture)
         return;
 
     m_lastSize = size;
     m_lastClusterCountX = clusterCountX;
     m_lastClusterCountY = clusterCountY;
+    m_listRows = listRows;
 
     delete m_lightIndexTexture;
     m_lightIndexTexture = nullptr;
-    const int width = kMaxLights + 1;
-    const int height = clusterCountX * clusterCountY * m_clusterCountZ;
-    if (width <= 0 || height <= 0)
+    delete m_lightListTexture;
+    m_lightListTexture = nullptr;
+    if (m_srb)
+    {
+        delete m_srb;
+        m_srb = nullptr;
+    }
+    if (m_pipeline)
+    {
+        delete m_pipeline;
+        m_pipeline = nullptr;
+    }
+    if (clusterCount <= 0 || listRows <= 0)
     {
         ctx.lightCulling->enabled = false;
         ctx.lightCulling->clusterLightIndexTexture = nullptr;
+        ctx.lightCulling->clusterLightListTexture = nullptr;
         return;
     }
-    QRhi *rhi = ctx.rhi->rhi();
     const QRhiTexture::Flags flags = QRhiTexture::UsedWithLoadStore;
     if (!rhi->isTextureFormatSupported(QRhiTexture::R32UI, flags))
     {
         qWarning() << "PassLightCulling: R32UI load/store not supported, disabling clustered culling";
         ctx.lightCulling->enabled = false;
         ctx.lightCulling->clusterLightIndexTexture = nullptr;
+        ctx.lightCulling->clusterLightListTexture = nullptr;
         return;
     }
-    m_lightIndexTexture = rhi->newTexture(QRhiTexture::R32UI, QSize(width, height), 1, flags);
-    if (!m_lightIndexTexture->create())
+    m_lightIndexTexture = rhi->newTexture(QRhiTexture::R32UI, QSize(kGridWidth, clusterCount), 1, flags);
+    m_lightListTexture = rhi->newTexture(QRhiTexture::R32UI, QSize(kListWidth, listRows), 1, flags);
+    if (!m_lightIndexTexture->create() || !m_lightListTexture->create())
     {
+        qWarning() << "PassLightCulling: failed to create cluster textures";
         delete m_lightIndexTexture;
         m_lightIndexTexture = nullptr;
+        delete m_lightListTexture;
+        m_lightListTexture = nullptr;
         ctx.lightCulling->enabled = false;
         ctx.lightCulling->clusterLightIndexTexture = nullptr;
+        ctx.lightCulling->clusterLightListTexture = nullptr;
         return;
     }
-
-    if (m_srb)
-    {
-        delete m_srb;
-        m_srb = nullptr;
-    }
-    if (m_pipeline)
-    {
-        delete m_pipeline;
-        m_pipeline = nullptr;
-    }
 }
@@ -7,6 +7,10 @@
 class PassLightCulling final : public RenderPass
 {
 public:
+    ~PassLightCulling() override;
+    const char *name() const override { return "PassLightCulling"; }
+    void setup(RenderGraphBuilder &builder, FrameContext &ctx) override;
+    void onCulled(FrameContext &ctx) override;
     void prepare(FrameContext &ctx) override;
     void execute(FrameContext &ctx) override;
 
@@ -14,11 +18,18 @@ private:
     void ensurePipeline(FrameContext &ctx);
     void ensureBuffers(FrameContext &ctx, const QSize &size);
 
+    QRhi *m_rhi = nullptr;
     QRhiComputePipeline *m_pipeline = nullptr;
     QRhiShaderResourceBindings *m_srb = nullptr;
-    QRhiBuffer *m_lightUbo = nullptr;
+    QRhiBuffer *m_lightBuffer = nullptr;
     QRhiBuffer *m_cullUbo = nullptr;
+    QRhiBuffer *m_counterBuffer = nullptr;
     QRhiTexture *m_lightIndexTexture = nullptr;
+    QRhiTexture *m_lightListTexture = nullptr;
+    QRhiBufferReadbackResult m_counterReadback;
+    bool m_readbackPending = false;
+    int m_listDemand = 0;
+    int m_listRows = 0;
     QSize m_lastSize;
     int m_clusterSize = 120;
     int m_clusterCountZ = 24;
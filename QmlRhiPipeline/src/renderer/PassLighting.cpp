@@ -19,6 +19,15 @@
 #include "core/ShaderManager.h"
 #include "scene/Scene.h"
 
+static constexpr int kShadowHeaderVec4Count = 16;
+static constexpr int kSpotDataVec4Count = 5;
+static constexpr int kMinGoboLayers = 8;
+
+static quint32 shadowBufferSize(int lightCapacity)
+{
+    return quint32((kShadowHeaderVec4Count + kSpotDataVec4Count * lightCapacity) * sizeof(QVector4D));
+}
+
 static QString resolveGoboPath(const QString &path)
 {
     if (path.isEmpty())
@@ -110,6 +119,43 @@ QImage PassLighting::loadGoboCached(const QString &path)
     return image;
 }
 
+QRhiTexture *PassLighting::spotShadowFallback(FrameContext &ctx)
+{
+    // Bound in place of the spot shadow array while PassShadow is culled.
+    if (!m_spotShadowFallback)
+    {
+        m_spotShadowFallback = ctx.rhi->rhi()->newTextureArray(QRhiTexture::R16F, 1, QSize(1, 1));
+        if (!m_spotShadowFallback->create())
+        {
+            delete m_spotShadowFallback;
+            m_spotShadowFallback = nullptr;
+        }
+    }
+    return m_spotShadowFallback;
+}
+
+void PassLighting::setup(RenderGraphBuilder &builder, FrameContext &ctx)
+{
+    builder.read(RenderResource::GBufferAlbedo);
+    builder.read(RenderResource::GBufferNormal);
+    builder.read(RenderResource::GBufferPosition);
+    builder.read(RenderResource::GBufferEmissive);
+    builder.read(RenderResource::GBufferDepth);
+    if (ctx.scene && ctx.scene->hasShadowCasters())
+        builder.read(RenderResource::ShadowMaps);
+    if (ctx.scene && ctx.scene->hasLocalLights())
+        builder.read(RenderResource::LightClusters);
+
+    QRhiRenderTarget *swapRt = ctx.rhi ? ctx.rhi->swapchainRenderTarget() : nullptr;
+    if (swapRt && ctx.targets)
+    {
+        const RenderTargetCache::LightingTargets lighting
+                = ctx.targets->getOrCreateLightingTarget(swapRt->pixelSize(), 1);
+        builder.importTexture(RenderResource::LightingColor, lighting.color, true);
+    }
+    builder.write(RenderResource::LightingColor);
+}
+
 void PassLighting::prepare(FrameContext &ctx)
 {
     if (qEnvironmentVariableIsSet("RHIPIPELINE_SKIP_LIGHTING"))
@@ -124,19 +170,20 @@ void PassLighting::updateGoboTextures(FrameContext &ctx, QRhiResourceUpdateBatch
 {
     if (!ctx.scene || !m_spotGoboMap || !u)
         return;
+    if (m_goboLayerPaths.size() != m_spotGoboCapacity)
+        m_goboLayerPaths.resize(m_spotGoboCapacity);
     QVector<QRhiTextureUploadEntry> entries;
-    entries.reserve(kMaxLights);
-    const auto &lights = ctx.scene->lights();
-    for (int i = 0; i < kMaxLights; ++i)
+    const QHash<QString, int> &layers = ctx.scene->lightBuffer().goboLayers();
+    for (auto it = layers.cbegin(); it != layers.cend(); ++it)
     {
-        const QString path = i < lights.size() ? lights[i].goboPath : QString();
-        if (!m_spotGoboPaths[i].isNull() && path == m_spotGoboPaths[i])
+        const int layer = it.value();
+        if (layer < 0 || layer >= m_goboLayerPaths.size() || m_goboLayerPaths[layer] == it.key())
             continue;
-        m_spotGoboPaths[i] = path;
-        QImage image = loadGoboCached(path);
+        m_goboLayerPaths[layer] = it.key();
+        QImage image = loadGoboCached(it.key());
         if (image.isNull())
             image = loadGoboImage(QString(), m_spotGoboSize);
-        entries.push_back(QRhiTextureUploadEntry(i, 0, QRhiTextureSubresourceUploadDescription(image)));
+        entries.push_back(QRhiTextureUploadEntry(layer, 0, QRhiTextureSubresourceUploadDescription(image)));
     }
     if (entries.isEmpty())
         return;
@@ -160,57 +207,8 @@ void PassLighting::execute(FrameContext &ctx)
     if (!rt)
         return;
 
-    const bool lightDataDirty = ctx.scene->lightsDirty() || ctx.scene->lightParamsDirty();
-    struct LightsData
-    {
-        QVector4D lightCount;
-        QVector4D lightParams;
-        QVector4D lightFlags;
-        QVector4D lightBeam[kMaxLights];
-        QVector4D posRange[kMaxLights];
-        QVector4D colorIntensity[kMaxLights];
-        QVector4D dirInner[kMaxLights];
-        QVector4D other[kMaxLights];
-    } lightData;
-    if (lightDataDirty)
-    {
-        memset(&lightData, 0, sizeof(LightsData));
-        const int maxLights = qMin(kMaxLights, ctx.scene->lights().size());
-        const QVector3D ambient = ctx.scene->ambientLight() * ctx.scene->ambientIntensity();
-        lightData.lightCount = QVector4D(float(maxLights), ambient.x(), ambient.y(), ambient.z());
-        lightData.lightParams = QVector4D(ctx.scene->smokeAmount(),
-                                          float(static_cast<int>(ctx.scene->beamModel())),
-                                          ctx.scene->bloomIntensity(),
-                                          ctx.scene->bloomRadius());
-        lightData.lightFlags = QVector4D(ctx.scene->volumetricEnabled() ? 1.0f : 0.0f,
-                                         ctx.scene->smokeNoiseEnabled() ? 1.0f : 0.0f,
-                                         ctx.scene->shadowsEnabled() ? 1.0f : 0.0f,
-                                         0.0f);
-        for (int i = 0; i < maxLights; ++i)
-        {
-            const Light &l = ctx.scene->lights()[i];
-            const QVector3D dir = l.direction.normalized();
-            lightData.posRange[i] = QVector4D(l.position, l.range);
-            lightData.colorIntensity[i] = QVector4D(l.color, l.intensity);
-            lightData.dirInner[i] = QVector4D(dir, qCos(l.innerCone));
-            lightData.lightBeam[i] = QVector4D(l.beamRadius, float(l.beamShape), 0.0f, 0.0f);
-            float extraZ = 0.0f;
-            float extraW = 0.0f;
-            if (l.type == Light::Type::Area)
-            {
-                extraZ = l.areaSize.x();
-                extraW = l.areaSize.y();
-            } else if (l.type == Light::Type::Spot)
-            {
-                extraZ = l.goboPath.isEmpty() ? -1.0f : float(i);
-                extraW = float(l.qualitySteps);
-            }
-            lightData.other[i] = QVector4D(qCos(l.outerCone),
-                                           float(l.type),
-                                           extraZ,
-                                           extraW);
-        }
-    }
+    const LightBuffer &lightBuffer = ctx.scene->lightBuffer();
+    const int lightCount = lightBuffer.lightCount();
 
     const bool cameraDirty = ctx.scene->cameraDirty() || ctx.scene->timeDirty();
     struct CameraData
@@ -231,79 +229,68 @@ void PassLighting::execute(FrameContext &ctx)
         camData.cameraPos = QVector4D(ctx.scene->camera().position(), ctx.scene->timeSeconds());
     }
 
-    struct ShadowDataGpu
-    {
-        float lightViewProj[3][16];
-        float splits[4];
-        float dirLightDir[4];
-        float dirLightColorIntensity[4];
-        float spotLightViewProj[kMaxLights][16];
-        float spotShadowParams[kMaxLights][4];
-        float shadowDepthParams[4];
-    } shadowData;
-    memset(&shadowData, 0, sizeof(ShadowDataGpu));
+    // lightViewProj[3], splits, dirLightDir, dirLightColorIntensity, shadowDepthParams,
+    // then five vec4 per light: the spot view-projection columns and the spot params.
+    m_shadowData.fill(QVector4D(), kShadowHeaderVec4Count + kSpotDataVec4Count * lightCount);
+    QVector4D *shadowData = m_shadowData.data();
+    QVector4D &splits = shadowData[12];
+    QVector4D &dirLightDir = shadowData[13];
+    QVector4D &dirLightColorIntensity = shadowData[14];
+    QVector4D &shadowDepthParams = shadowData[15];
     if (ctx.shadows && ctx.shadows->cascadeCount > 0)
     {
         for (int i = 0; i < ctx.shadows->cascadeCount; ++i)
-            std::memcpy(shadowData.lightViewProj[i], ctx.shadows->lightViewProj[i].constData(), sizeof(shadowData.lightViewProj[i]));
-        shadowData.splits[0] = ctx.shadows->splits.x();
-        shadowData.splits[1] = ctx.shadows->splits.y();
-        shadowData.splits[2] = ctx.shadows->splits.z();
-        shadowData.splits[3] = ctx.shadows->splits.w();
-        shadowData.dirLightDir[0] = ctx.shadows->dirLightDir.x();
-        shadowData.dirLightDir[1] = ctx.shadows->dirLightDir.y();
-        shadowData.dirLightDir[2] = ctx.shadows->dirLightDir.z();
-        shadowData.dirLightDir[3] = ctx.shadows->dirLightDir.w();
-        shadowData.dirLightColorIntensity[0] = ctx.shadows->dirLightColorIntensity.x();
-        shadowData.dirLightColorIntensity[1] = ctx.shadows->dirLightColorIntensity.y();
-        shadowData.dirLightColorIntensity[2] = ctx.shadows->dirLightColorIntensity.z();
-        shadowData.dirLightColorIntensity[3] = ctx.shadows->dirLightColorIntensity.w();
+        {
+            for (int c = 0; c < 4; ++c)
+                shadowData[i * 4 + c] = ctx.shadows->lightViewProj[i].column(c);
+        }
+        splits = ctx.shadows->splits;
+        dirLightDir = ctx.shadows->dirLightDir;
+        dirLightColorIntensity = ctx.shadows->dirLightColorIntensity;
     }
 
-    if (shadowData.dirLightColorIntensity[3] <= 0.0f && ctx.scene)
+    if (dirLightColorIntensity.w() <= 0.0f && ctx.scene)
     {
         for (const Light &l : ctx.scene->lights())
         {
             if (l.type != Light::Type::Directional)
                 continue;
-            const QVector3D dir = l.direction.normalized();
-            shadowData.dirLightDir[0] = dir.x();
-            shadowData.dirLightDir[1] = dir.y();
-            shadowData.dirLightDir[2] = dir.z();
-            shadowData.dirLightDir[3] = 0.0f;
-            shadowData.dirLightColorIntensity[0] = l.color.x();
-            shadowData.dirLightColorIntensity[1] = l.color.y();
-            shadowData.dirLightColorIntensity[2] = l.color.z();
-            shadowData.dirLightColorIntensity[3] = l.intensity;
+            dirLightDir = QVector4D(l.direction.normalized(), 0.0f);
+            dirLightColorIntensity = QVector4D(l.color, l.intensity);
             break;
         }
     }
+    QVector4D *spotData = shadowData + kShadowHeaderVec4Count;
+    for (int i = 0; i < lightCount; ++i)
+        spotData[i * kSpotDataVec4Count + 4] = QVector4D(-1.0f, 0.0f, 0.0f, 0.0f);
     if (ctx.shadows)
     {
-        for (int i = 0; i < kMaxLights; ++i)
+        const int spotCount = qMin(lightCount, int(ctx.shadows->spotLightViewProj.size()));
+        for (int i = 0; i < spotCount; ++i)
         {
-            std::memcpy(shadowData.spotLightViewProj[i], ctx.shadows->spotLightViewProj[i].constData(), sizeof(shadowData.spotLightViewProj[i]));
-            shadowData.spotShadowParams[i][0] = ctx.shadows->spotShadowParams[i].x();
-            shadowData.spotShadowParams[i][1] = ctx.shadows->spotShadowParams[i].y();
-            shadowData.spotShadowParams[i][2] = ctx.shadows->spotShadowParams[i].z();
-            shadowData.spotShadowParams[i][3] = ctx.shadows->spotShadowParams[i].w();
+            QVector4D *spot = spotData + i * kSpotDataVec4Count;
+            for (int c = 0; c < 4; ++c)
+                spot[c] = ctx.shadows->spotLightViewProj[i].column(c);
+            if (i < ctx.shadows->spotShadowParams.size())
+                spot[4] = ctx.shadows->spotShadowParams[i];
         }
-        shadowData.shadowDepthParams[0] = ctx.shadows->shadowDepthParams.x();
-        shadowData.shadowDepthParams[1] = ctx.shadows->shadowDepthParams.y();
-        shadowData.shadowDepthParams[2] = ctx.shadows->shadowDepthParams.z();
-        shadowData.shadowDepthParams[3] = m_gbufWorldPosFloat ? 1.0f : 0.0f;
+        shadowDepthParams = QVector4D(ctx.shadows->shadowDepthParams.toVector3D(),
+                                      m_gbufWorldPosFloat ? 1.0f : 0.0f);
     }
 
     QRhiResourceUpdateBatch *u = ctx.rhi->rhi()->nextResourceUpdateBatch();
+    const bool d3d11 = ctx.rhi->rhi()->backend() == QRhi::D3D11;
     if (m_lightsUbo)
     {
-        if (lightDataDirty)
+        // D3D11 keeps its own constant buffer copy, other backends bind the shared storage buffer.
+        const QVector<LightBuffer::Range> ranges = lightBuffer.rangesSince(m_lightsUboRevision);
+        for (const LightBuffer::Range &range : ranges)
         {
-            if (ctx.rhi->rhi()->backend() == QRhi::D3D11)
-                u->updateDynamicBuffer(m_lightsUbo, 0, sizeof(LightsData), &lightData);
-            else
-                u->uploadStaticBuffer(m_lightsUbo, 0, sizeof(LightsData), &lightData);
+            u->updateDynamicBuffer(m_lightsUbo, quint32(range.offset * sizeof(QVector4D)),
+                                   quint32(range.count * sizeof(QVector4D)),
+                                   lightBuffer.constData() + range.offset);
         }
+        m_lightsUboRevision = lightBuffer.revision();
     }
     if (m_cameraUbo)
     {
@@ -312,10 +299,11 @@ void PassLighting::execute(FrameContext &ctx)
     }
     if (m_shadowUbo)
     {
-        if (ctx.rhi->rhi()->backend() == QRhi::D3D11)
-            u->updateDynamicBuffer(m_shadowUbo, 0, sizeof(ShadowDataGpu), &shadowData);
+        const quint32 size = quint32(m_shadowData.size() * sizeof(QVector4D));
+        if (d3d11)
+            u->updateDynamicBuffer(m_shadowUbo, 0, size, m_shadowData.constData());
         else
-            u->uploadStaticBuffer(m_shadowUbo, 0, sizeof(ShadowDataGpu), &shadowData);
+            u->uploadStaticBuffer(m_shadowUbo, 0, size, m_shadowData.constData());
     }
     bool flipSampleY = !ctx.rhi->rhi()->isYUpInFramebuffer();
     bool flipNdcY = !ctx.rhi->rhi()->isYUpInNDC();
@@ -420,71 +408,6 @@ void PassLighting::execute(FrameContext &ctx)
             {0, 4}, {1, 5}, {2, 6}, {3, 7}
         };
 
-        auto getLocalBounds = [](Mesh &mesh, QVector3D &minV, QVector3D &maxV) -> bool {
-            if (mesh.boundsValid)
-            {
-                minV = mesh.boundsMin;
-                maxV = mesh.boundsMax;
-                return true;
-            }
-            if (mesh.vertices.isEmpty())
-                return false;
-            minV = QVector3D(mesh.vertices[0].px, mesh.vertices[0].py, mesh.vertices[0].pz);
-            maxV = minV;
-            for (const Vertex &v : mesh.vertices)
-            {
-                minV.setX(qMin(minV.x(), v.px));
-                minV.setY(qMin(minV.y(), v.py));
-                minV.setZ(qMin(minV.z(), v.pz));
-                maxV.setX(qMax(maxV.x(), v.px));
-                maxV.setY(qMax(maxV.y(), v.py));
-                maxV.setZ(qMax(maxV.z(), v.pz));
-            }
-            return true;
-        };
-
-        auto updateWorldBounds = [&](Mesh &mesh) -> bool {
-            QVector3D localMin;
-            QVector3D localMax;
-            if (!getLocalBounds(mesh, localMin, localMax))
-                return false;
-            QVector3D corners[8] = {
-                { localMin.x(), localMin.y(), localMin.z() },
-                { localMax.x(), localMin.y(), localMin.z() },
-                { localMax.x(), localMax.y(), localMin.z() },
-                { localMin.x(), localMax.y(), localMin.z() },
-                { localMin.x(), localMin.y(), localMax.z() },
-                { localMax.x(), localMin.y(), localMax.z() },
-                { localMax.x(), localMax.y(), localMax.z() },
-                { localMin.x(), localMax.y(), localMax.z() }
-            };
-            QVector3D minV;
-            QVector3D maxV;
-            for (int i = 0; i < 8; ++i)
-            {
-                const QVector3D world = (mesh.modelMatrix * QVector4D(corners[i], 1.0f)).toVector3D();
-                if (i == 0)
-                {
-                    minV = world;
-                    maxV = world;
-                }
-                else
-                {
-                    minV.setX(qMin(minV.x(), world.x()));
-                    minV.setY(qMin(minV.y(), world.y()));
-                    minV.setZ(qMin(minV.z(), world.z()));
-                    maxV.setX(qMax(maxV.x(), world.x()));
-                    maxV.setY(qMax(maxV.y(), world.y()));
-                    maxV.setZ(qMax(maxV.z(), world.z()));
-                }
-            }
-            mesh.worldBoundsMin = minV;
-            mesh.worldBoundsMax = maxV;
-            mesh.worldBoundsValid = true;
-            mesh.worldBoundsDirty = false;
-            return true;
-        };
-
         if (selectionDirty)
         {
             QHash<int, GroupBounds> boundsByGroup;
@@ -495,11 +418,10 @@ void PassLighting::execute(FrameContext &ctx)
                 Mesh &mesh = const_cast<Mesh &>(meshes[meshIndex]);
                 if (!mesh.selected || !mesh.visible)
                     continue;
-                if (!mesh.worldBoundsValid || mesh.worldBoundsDirty)
-                {
-                    if (!updateWorldBounds(mesh))
-                        continue;
-                }
+                // Scene::updateGeometry() keeps the world bounds up to date.
+                if (!mesh.worldBoundsValid)
+                    continue;
+                mesh.worldBoundsDirty = false;
                 const int groupId = mesh.selectionGroup >= 0 ? mesh.selectionGroup : meshIndex;
                 GroupBounds &group = boundsByGroup[groupId];
                 if (!group.hasBounds)
@@ -621,7 +543,8 @@ void PassLighting::ensurePipeline(FrameContext &ctx)
     const bool metal = ctx.rhi->rhi()->backend() == QRhi::Metal;
     const bool useLightCulling = ctx.lightCulling
             && ctx.lightCulling->enabled
-            && ctx.lightCulling->clusterLightIndexTexture;
+            && ctx.lightCulling->clusterLightIndexTexture
+            && ctx.lightCulling->clusterLightListTexture;
     const bool effectiveLightCulling = useLightCulling;
     bool spotChanged = false;
     if (ctx.shadows)
@@ -642,9 +565,18 @@ void PassLighting::ensurePipeline(FrameContext &ctx)
                 shadowsChanged = true;
         }
     }
+    // The shader side arrays of D3D11 are fixed size, other backends follow the scene light buffer.
+    const LightBuffer *lightBuffer = ctx.scene ? &ctx.scene->lightBuffer() : nullptr;
+    const int lightCapacity = d3d11
+            ? LightBuffer::kMaxUniformLights
+            : (lightBuffer ? lightBuffer->capacity() : LightBuffer::kMinCapacity);
+    const int goboLayerCount = lightBuffer ? lightBuffer->goboLayerCount() : 0;
     if (m_pipeline && m_rpDesc == rt->renderPassDescriptor() && !shadowsChanged && !gbufChanged
             && !spotChanged && m_reverseZ == reverseZ && m_useLightCulling == effectiveLightCulling
-            && (!effectiveLightCulling || m_lightIndexTexture == ctx.lightCulling->clusterLightIndexTexture))
+            && lightCapacity == m_lightCapacity && goboLayerCount <= m_spotGoboCapacity
+            && (d3d11 || m_lightStorage == ctx.lightBuffer)
+            && (!effectiveLightCulling || (m_lightIndexTexture == ctx.lightCulling->clusterLightIndexTexture
+                                           && m_lightListTexture == ctx.lightCulling->clusterLightListTexture)))
         return;
 
     delete m_pipeline;
@@ -680,11 +612,14 @@ void PassLighting::ensurePipeline(FrameContext &ctx)
     delete m_lightIndexSampler;
     m_lightIndexSampler = nullptr;
     m_lightIndexTexture = nullptr;
+    m_lightListTexture = nullptr;
     delete m_spotGoboMap;
     m_spotGoboMap = nullptr;
+    m_spotGoboCapacity = 0;
     m_spotShadowMapArray = nullptr;
-    for (QString &path : m_spotGoboPaths)
-        path = QString();
+    m_goboLayerPaths.clear();
+    m_lightStorage = nullptr;
+    m_lightsUboRevision = 0;
     m_lastFlip = QVector4D(-1.0f, -1.0f, 0.0f, 0.0f);
     m_lightCullParamsValid = false;
 
@@ -723,20 +658,22 @@ void PassLighting::ensurePipeline(FrameContext &ctx)
     m_reverseZ = reverseZ;
     m_useLightCulling = effectiveLightCulling;
 
-    struct LightsDataSize
+    m_lightCapacity = lightCapacity;
+    if (d3d11)
     {
-        QVector4D lightCount;
-        QVector4D lightParams;
-        QVector4D lightFlags;
-        QVector4D lightBeam[kMaxLights];
-        QVector4D posRange[kMaxLights];
-        QVector4D colorIntensity[kMaxLights];
-        QVector4D dirInner[kMaxLights];
-        QVector4D other[kMaxLights];
-    };
-    m_lightsUbo = ctx.rhi->rhi()->newBuffer(d3d11 ? QRhiBuffer::Dynamic : QRhiBuffer::Static,
-                                            d3d11 ? QRhiBuffer::UniformBuffer : QRhiBuffer::StorageBuffer,
-                                            sizeof(LightsDataSize));
+        m_lightsUbo = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer,
+                                                quint32((LightBuffer::kHeaderVec4Count
+                                                         + LightBuffer::kArrayCount * m_lightCapacity)
+                                                        * sizeof(QVector4D)));
+        if (!m_lightsUbo->create())
+            return;
+    }
+    else
+    {
+        m_lightStorage = ctx.lightBuffer;
+        if (!m_lightStorage)
+            return;
+    }
     struct CameraDataSize
     {
         float view[16];
@@ -745,19 +682,9 @@ void PassLighting::ensurePipeline(FrameContext &ctx)
     };
     m_cameraUbo = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer,
                                             sizeof(CameraDataSize));
-    struct ShadowDataGpu
-    {
-        float lightViewProj[3][16];
-        float splits[4];
-        float dirLightDir[4];
-        float dirLightColorIntensity[4];
-        float spotLightViewProj[kMaxLights][16];
-        float spotShadowParams[kMaxLights][4];
-        float shadowDepthParams[4];
-    };
     m_shadowUbo = ctx.rhi->rhi()->newBuffer(d3d11 ? QRhiBuffer::Dynamic : QRhiBuffer::Static,
                                             d3d11 ? QRhiBuffer::UniformBuffer : QRhiBuffer::StorageBuffer,
-                                            sizeof(ShadowDataGpu));
+                                            shadowBufferSize(m_lightCapacity));
     m_flipUbo = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, sizeof(QVector4D));
     if (m_useLightCulling)
     {
@@ -766,7 +693,8 @@ void PassLighting::ensurePipeline(FrameContext &ctx)
         if (!m_lightCullUbo->create())
             return;
         m_lightIndexTexture = ctx.lightCulling ? ctx.lightCulling->clusterLightIndexTexture : nullptr;
-        if (!m_lightIndexTexture)
+        m_lightListTexture = ctx.lightCulling ? ctx.lightCulling->clusterLightListTexture : nullptr;
+        if (!m_lightIndexTexture || !m_lightListTexture)
             return;
         if (!m_lightIndexSampler)
         {
@@ -781,7 +709,7 @@ void PassLighting::ensurePipeline(FrameContext &ctx)
     }
     if (!m_flipUbo->create())
         return;
-    if (!m_lightsUbo->create() || !m_cameraUbo->create() || !m_shadowUbo->create())
+    if (!m_cameraUbo->create() || !m_shadowUbo->create())
         return;
 
     if (!gbuf.color0 || !gbuf.color1 || !gbuf.color2 || !gbuf.color3)
@@ -799,9 +727,16 @@ void PassLighting::ensurePipeline(FrameContext &ctx)
     m_spotShadowMapArray = ctx.shadows ? ctx.shadows->spotShadowMapArray : nullptr;
     if (!m_spotGoboMap)
     {
-        m_spotGoboMap = ctx.rhi->rhi()->newTextureArray(QRhiTexture::RGBA8, kMaxLights, m_spotGoboSize);
+        int goboCapacity = kMinGoboLayers;
+        while (goboCapacity < goboLayerCount)
+            goboCapacity *= 2;
+        const int arraySizeMax = ctx.rhi->rhi()->resourceLimit(QRhi::TextureArraySizeMax);
+        if (arraySizeMax > 0)
+            goboCapacity = qMin(goboCapacity, arraySizeMax);
+        m_spotGoboMap = ctx.rhi->rhi()->newTextureArray(QRhiTexture::RGBA8, goboCapacity, m_spotGoboSize);
         if (!m_spotGoboMap->create())
             return;
+        m_spotGoboCapacity = goboCapacity;
     }
 
     m_srb = ctx.rhi->rhi()->newShaderResourceBindings();
@@ -815,7 +750,7 @@ void PassLighting::ensurePipeline(FrameContext &ctx)
             QRhiShaderResourceBinding::sampledTexture(3, QRhiShaderResourceBinding::FragmentStage, gbuf.color1, m_sampler),
             QRhiShaderResourceBinding::sampledTexture(4, QRhiShaderResourceBinding::FragmentStage, gbuf.color2, m_sampler),
             QRhiShaderResourceBinding::sampledTexture(5, QRhiShaderResourceBinding::FragmentStage, gbuf.depth, m_sampler),
-            QRhiShaderResourceBinding::bufferLoad(6, QRhiShaderResourceBinding::FragmentStage, m_lightsUbo),
+            QRhiShaderResourceBinding::bufferLoad(6, QRhiShaderResourceBinding::FragmentStage, m_lightStorage),
             QRhiShaderResourceBinding::uniformBuffer(7, QRhiShaderResourceBinding::FragmentStage, m_cameraUbo),
             QRhiShaderResourceBinding::bufferLoad(8, QRhiShaderResourceBinding::FragmentStage, m_shadowUbo)
         };
@@ -825,8 +760,12 @@ void PassLighting::ensurePipeline(FrameContext &ctx)
                                                                         m_lightCullUbo));
             bindings.push_back(QRhiShaderResourceBinding::sampledTexture(11, QRhiShaderResourceBinding::FragmentStage,
                                                                          m_lightIndexTexture, m_lightIndexSampler));
+            bindings.push_back(QRhiShaderResourceBinding::sampledTexture(12, QRhiShaderResourceBinding::FragmentStage,
+                                                                         m_lightListTexture, m_lightIndexSampler));
         }
         QRhiTexture *spotTex = ctx.shadows ? ctx.shadows->spotShadowMapArray : nullptr;
+        if (!spotTex)
+            spotTex = spotShadowFallback(ctx);
         if (!spotTex)
             return;
         bindings.push_back(QRhiShaderResourceBinding::sampledTexture(9, QRhiShaderResourceBinding::FragmentStage,
@@ -851,6 +790,8 @@ void PassLighting::ensurePipeline(FrameContext &ctx)
                                                                         m_lightCullUbo));
             bindings.push_back(QRhiShaderResourceBinding::sampledTexture(25, QRhiShaderResourceBinding::FragmentStage,
                                                                          m_lightIndexTexture, m_lightIndexSampler));
+            bindings.push_back(QRhiShaderResourceBinding::sampledTexture(26, QRhiShaderResourceBinding::FragmentStage,
+                                                                         m_lightListTexture, m_lightIndexSampler));
         }
     }
     else
@@ -860,7 +801,7 @@ void PassLighting::ensurePipeline(FrameContext &ctx)
             QRhiShaderResourceBinding::sampledTexture(1, QRhiShaderResourceBinding::FragmentStage, gbuf.color1, m_sampler),
             QRhiShaderResourceBinding::sampledTexture(2, QRhiShaderResourceBinding::FragmentStage, gbuf.color2, m_sampler),
             QRhiShaderResourceBinding::sampledTexture(20, QRhiShaderResourceBinding::FragmentStage, gbuf.color3, m_sampler),
-            QRhiShaderResourceBinding::bufferLoad(3, QRhiShaderResourceBinding::FragmentStage, m_lightsUbo),
+            QRhiShaderResourceBinding::bufferLoad(3, QRhiShaderResourceBinding::FragmentStage, m_lightStorage),
             QRhiShaderResourceBinding::uniformBuffer(4, QRhiShaderResourceBinding::FragmentStage, m_cameraUbo),
             QRhiShaderResourceBinding::bufferLoad(5, QRhiShaderResourceBinding::FragmentStage, m_shadowUbo),
             QRhiShaderResourceBinding::uniformBuffer(19, QRhiShaderResourceBinding::FragmentStage, m_flipUbo)
@@ -871,6 +812,8 @@ void PassLighting::ensurePipeline(FrameContext &ctx)
                                                                         m_lightCullUbo));
             bindings.push_back(QRhiShaderResourceBinding::sampledTexture(22, QRhiShaderResourceBinding::FragmentStage,
                                                                          m_lightIndexTexture, m_lightIndexSampler));
+            bindings.push_back(QRhiShaderResourceBinding::sampledTexture(23, QRhiShaderResourceBinding::FragmentStage,
+                                                                         m_lightListTexture, m_lightIndexSampler));
         }
     }
 
@@ -895,6 +838,8 @@ void PassLighting::ensurePipeline(FrameContext &ctx)
     if (!metal)
     {
         QRhiTexture *spotTex = ctx.shadows ? ctx.shadows->spotShadowMapArray : nullptr;
+        if (!spotTex)
+            spotTex = spotShadowFallback(ctx);
         if (!spotTex)
             return;
         const int base = d3d11 ? 6 : 9;
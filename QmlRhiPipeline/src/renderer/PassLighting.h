@@ -4,6 +4,7 @@
 #include <QtCore/QString>
 #include <QtCore/QSize>
 #include <QtCore/QHash>
+#include <QtCore/QVector>
 #include <QtGui/QImage>
 #include <QtGui/QVector4D>
 
@@ -19,6 +20,8 @@ class QRhiTexture;
 class PassLighting final : public RenderPass
 {
 public:
+    const char *name() const override { return "PassLighting"; }
+    void setup(RenderGraphBuilder &builder, FrameContext &ctx) override;
     void prepare(FrameContext &ctx) override;
     void execute(FrameContext &ctx) override;
 
@@ -27,6 +30,7 @@ private:
     void ensureSelectionBoxesPipeline(FrameContext &ctx, QRhiRenderTarget *rt);
     void updateGoboTextures(FrameContext &ctx, QRhiResourceUpdateBatch *u);
     QImage loadGoboCached(const QString &path);
+    QRhiTexture *spotShadowFallback(FrameContext &ctx);
 
     QRhiGraphicsPipeline *m_pipeline = nullptr;
     QRhiShaderResourceBindings *m_srb = nullptr;
@@ -36,11 +40,14 @@ private:
     QRhiSampler *m_goboSampler = nullptr;
     QRhiSampler *m_lightIndexSampler = nullptr;
     QRhiBuffer *m_lightsUbo = nullptr;
+    QRhiBuffer *m_lightStorage = nullptr;
+    quint64 m_lightsUboRevision = 0;
     QRhiBuffer *m_cameraUbo = nullptr;
     QRhiBuffer *m_shadowUbo = nullptr;
     QRhiBuffer *m_flipUbo = nullptr;
     QRhiBuffer *m_lightCullUbo = nullptr;
     QRhiTexture *m_lightIndexTexture = nullptr;
+    QRhiTexture *m_lightListTexture = nullptr;
     QRhiRenderPassDescriptor *m_rpDesc = nullptr;
     QRhiTexture *m_shadowMapRefs[3] = { nullptr, nullptr, nullptr };
     QRhiTexture *m_gbufColor0 = nullptr;
@@ -50,9 +57,13 @@ private:
     QRhiTexture *m_gbufDepth = nullptr;
     bool m_gbufWorldPosFloat = false;
     QRhiTexture *m_spotShadowMapArray = nullptr;
+    QRhiTexture *m_spotShadowFallback = nullptr;
     QRhiTexture *m_spotGoboMap = nullptr;
-    QString m_spotGoboPaths[kMaxLights];
+    QVector<QString> m_goboLayerPaths;
+    int m_spotGoboCapacity = 0;
     QSize m_spotGoboSize = QSize(256, 256);
+    int m_lightCapacity = 0;
+    QVector<QVector4D> m_shadowData;
     QHash<QString, QImage> m_goboCache;
     bool m_reverseZ = false;
     bool m_useLightCulling = false;
@@ -0,0 +1,310 @@
+#include "renderer/PassOcclusion.h"
+
+#include <QtCore/QDebug>
+#include <cstring>
+
+#include "core/RhiContext.h"
+#include "core/ShaderManager.h"
+#include "scene/Scene.h"
+
+namespace {
+
+// Invocations per workgroup, see occlusion_cull.comp.
+constexpr int kCullGroupSize = 64;
+// Boxes are tested grown by a fraction of their size plus a minimum, a result
+// stays valid while the mesh remains inside the box it was tested with.
+constexpr float kBoundsMargin = 0.05f;
+constexpr float kMinBoundsMargin = 0.02f;
+// Tests waiting for their readback, beyond that a frame is not tested.
+constexpr int kMaxPendingTests = 3;
+
+struct CullParams
+{
+    float viewProj[16];
+    QVector4D hiZSize; // xy=depth size z=mip count w=box count
+    QVector4D clip;    // x=depth scale y=depth bias z=flip y
+};
+
+bool containsBox(const QVector3D &outerMin, const QVector3D &outerMax,
+                 const QVector3D &innerMin, const QVector3D &innerMax)
+{
+    return innerMin.x() >= outerMin.x() && innerMin.y() >= outerMin.y() && innerMin.z() >= outerMin.z()
+            && innerMax.x() <= outerMax.x() && innerMax.y() <= outerMax.y() && innerMax.z() <= outerMax.z();
+}
+
+} // namespace
+
+PassOcclusion::~PassOcclusion()
+{
+    // Pending readbacks write into their tests, let them land first.
+    if (m_rhi && !m_pending.empty())
+        m_rhi->finish();
+}
+
+void PassOcclusion::setup(RenderGraphBuilder &builder, FrameContext &ctx)
+{
+    Q_UNUSED(ctx);
+    // Runs before PassDepth replaces the Hi-Z of the previous frame. Reading
+    // the Hi-Z here would order this pass after it, PassDepth reads this instead.
+    builder.write(RenderResource::Occlusion);
+}
+
+void PassOcclusion::onCulled(FrameContext &ctx)
+{
+    if (ctx.drawList)
+        ctx.drawList->visible = ctx.drawList->meshes;
+}
+
+void PassOcclusion::prepare(FrameContext &ctx)
+{
+    if (!ctx.rhi || !ctx.shaders)
+        return;
+    QRhi *rhi = ctx.rhi->rhi();
+    if (!rhi->isFeatureSupported(QRhi::Compute) || !rhi->isFeatureSupported(QRhi::ReadBackNonUniformBuffer))
+        return;
+    ensureResources(ctx);
+}
+
+void PassOcclusion::execute(FrameContext &ctx)
+{
+    if (!ctx.drawList)
+        return;
+
+    for (auto it = m_pending.begin(); it != m_pending.end();)
+    {
+        if ((*it)->done)
+        {
+            applyResults(**it);
+            it = m_pending.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    if (ctx.scene && ctx.rhi && ctx.shaders && m_cullUbo && m_sampler)
+        dispatch(ctx);
+    filterDrawList(ctx);
+}
+
+void PassOcclusion::dispatch(FrameContext &ctx)
+{
+    // Until PassDepth runs the Hi-Z still is the one of the previous frame.
+    const DepthPrepassData *depth = ctx.depthPrepass;
+    if (!depth || !depth->enabled || !depth->hiZ || depth->hiZMipCount <= 0)
+        return;
+    if (int(m_pending.size()) >= kMaxPendingTests)
+        return;
+    QRhiCommandBuffer *cb = ctx.rhi->commandBuffer();
+    if (!cb)
+        return;
+
+    auto test = std::make_unique<Test>();
+    const QVector<Mesh> &meshes = ctx.scene->meshes();
+    for (int i : std::as_const(ctx.drawList->meshes))
+    {
+        const Mesh &mesh = meshes[i];
+        if (!mesh.worldBoundsValid)
+            continue;
+        const QVector3D margin = (mesh.worldBoundsMax - mesh.worldBoundsMin) * kBoundsMargin
+                + QVector3D(kMinBoundsMargin, kMinBoundsMargin, kMinBoundsMargin);
+        test->meshes.push_back(i);
+        test->bounds.push_back(QVector4D(mesh.worldBoundsMin - margin, 1.0f));
+        test->bounds.push_back(QVector4D(mesh.worldBoundsMax + margin, 1.0f));
+    }
+    const int count = int(test->meshes.size());
+    if (count == 0 || !ensureBuffers(ctx, count) || !ensureBindings(ctx, depth->hiZ))
+        return;
+    test->viewProj = depth->viewProj;
+
+    QRhi *rhi = ctx.rhi->rhi();
+    m_rhi = rhi;
+    CullParams params = {};
+    std::memcpy(params.viewProj, depth->viewProj.constData(), sizeof(params.viewProj));
+    params.hiZSize = QVector4D(float(depth->depthSize.width()), float(depth->depthSize.height()),
+                               float(depth->hiZMipCount), float(count));
+    // OpenGL clip depth is [-1, 1] and its framebuffer rows run bottom up.
+    const bool zeroToOne = rhi->isClipDepthZeroToOne();
+    params.clip = QVector4D(zeroToOne ? 1.0f : 0.5f,
+                            zeroToOne ? 0.0f : 0.5f,
+                            rhi->isYUpInNDC() != rhi->isYUpInFramebuffer() ? 1.0f : 0.0f,
+                            0.0f);
+
+    QRhiResourceUpdateBatch *u = rhi->nextResourceUpdateBatch();
+    u->updateDynamicBuffer(m_cullUbo, 0, sizeof(CullParams), &params);
+    u->uploadStaticBuffer(m_boundsBuffer, 0, quint32(count * 2 * sizeof(QVector4D)), test->bounds.constData());
+    cb->beginComputePass(u);
+    cb->setComputePipeline(m_pipeline);
+    cb->setShaderResources(m_srb);
+    cb->dispatch((count + kCullGroupSize - 1) / kCullGroupSize, 1, 1);
+
+    // QRhi has no indirect draws, the visibility comes back to the CPU.
+    Test *pending = test.get();
+    pending->readback.completed = [pending]() { pending->done = true; };
+    QRhiResourceUpdateBatch *readback = rhi->nextResourceUpdateBatch();
+    readback->readBackBuffer(m_visibilityBuffer, 0, quint32(count * sizeof(quint32)), &pending->readback);
+    cb->endComputePass(readback);
+    m_pending.push_back(std::move(test));
+}
+
+void PassOcclusion::applyResults(const Test &test)
+{
+    const int count = int(test.meshes.size());
+    if (test.readback.data.size() < int(count * sizeof(quint32)))
+        return;
+    if (test.viewProj != m_resultsViewProj)
+    {
+        m_results.clear();
+        m_resultsViewProj = test.viewProj;
+    }
+    const quint32 *visible = reinterpret_cast<const quint32 *>(test.readback.data.constData());
+    for (int k = 0; k < count; ++k)
+    {
+        const int mesh = test.meshes[k];
+        if (mesh >= m_results.size())
+            m_results.resize(mesh + 1);
+        Result &result = m_results[mesh];
+        result.boundsMin = test.bounds[k * 2].toVector3D();
+        result.boundsMax = test.bounds[k * 2 + 1].toVector3D();
+        result.occluded = visible[k] == 0;
+    }
+}
+
+void PassOcclusion::filterDrawList(FrameContext &ctx)
+{
+    QVector<int> &visible = ctx.drawList->visible;
+    const QVector<int> &candidates = ctx.drawList->meshes;
+    if (!ctx.scene || !ctx.rhi || m_results.isEmpty())
+    {
+        visible = candidates;
+        return;
+    }
+    // Results only hold for the view they were tested from.
+    const QMatrix4x4 viewProj = ctx.rhi->rhi()->clipSpaceCorrMatrix()
+            * ctx.scene->camera().projectionMatrix()
+            * ctx.scene->camera().viewMatrix();
+    if (viewProj != m_resultsViewProj)
+    {
+        visible = candidates;
+        return;
+    }
+
+    const QVector<Mesh> &meshes = ctx.scene->meshes();
+    visible.clear();
+    for (int i : candidates)
+    {
+        const Mesh &mesh = meshes[i];
+        if (i < m_results.size() && m_results[i].occluded && mesh.worldBoundsValid
+                && containsBox(m_results[i].boundsMin, m_results[i].boundsMax,
+                               mesh.worldBoundsMin, mesh.worldBoundsMax))
+            continue;
+        visible.push_back(i);
+    }
+}
+
+void PassOcclusion::ensureResources(FrameContext &ctx)
+{
+    if (m_cullUbo && m_sampler)
+        return;
+    QRhi *rhi = ctx.rhi->rhi();
+    if (!m_cullUbo)
+    {
+        m_cullUbo = rhi->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, sizeof(CullParams));
+        if (!m_cullUbo->create())
+        {
+            delete m_cullUbo;
+            m_cullUbo = nullptr;
+            return;
+        }
+    }
+    if (!m_sampler)
+    {
+        m_sampler = rhi->newSampler(QRhiSampler::Nearest,
+                                    QRhiSampler::Nearest,
+                                    QRhiSampler::Nearest,
+                                    QRhiSampler::ClampToEdge,
+                                    QRhiSampler::ClampToEdge);
+        if (!m_sampler->create())
+        {
+            delete m_sampler;
+            m_sampler = nullptr;
+            return;
+        }
+    }
+}
+
+bool PassOcclusion::ensureBuffers(FrameContext &ctx, int count)
+{
+    if (m_boundsBuffer && m_visibilityBuffer && count <= m_capacity)
+        return true;
+
+    delete m_srb;
+    m_srb = nullptr;
+    m_boundHiZ = nullptr;
+    delete m_boundsBuffer;
+    m_boundsBuffer = nullptr;
+    delete m_visibilityBuffer;
+    m_visibilityBuffer = nullptr;
+
+    // Grow by half again so a slowly growing scene does not recreate every frame.
+    m_capacity = qMax(kCullGroupSize, qMax(count, m_capacity + m_capacity / 2));
+    QRhi *rhi = ctx.rhi->rhi();
+    m_boundsBuffer = rhi->newBuffer(QRhiBuffer::Static, QRhiBuffer::StorageBuffer,
+                                    quint32(m_capacity * 2 * sizeof(QVector4D)));
+    m_visibilityBuffer = rhi->newBuffer(QRhiBuffer::Static, QRhiBuffer::StorageBuffer,
+                                        quint32(m_capacity * sizeof(quint32)));
+    if (!m_boundsBuffer->create() || !m_visibilityBuffer->create())
+    {
+        qWarning() << "PassOcclusion: failed to create buffers";
+        delete m_boundsBuffer;
+        m_boundsBuffer = nullptr;
+        delete m_visibilityBuffer;
+        m_visibilityBuffer = nullptr;
+        m_capacity = 0;
+        return false;
+    }
+    return true;
+}
+
+bool PassOcclusion::ensureBindings(FrameContext &ctx, QRhiTexture *hiZ)
+{
+    if (m_srb && m_boundHiZ == hiZ)
+        return true;
+
+    delete m_srb;
+    m_boundHiZ = nullptr;
+    m_srb = ctx.rhi->rhi()->newShaderResourceBindings();
+    m_srb->setBindings({
+        QRhiShaderResourceBinding::uniformBuffer(0, QRhiShaderResourceBinding::ComputeStage, m_cullUbo),
+        QRhiShaderResourceBinding::bufferLoad(1, QRhiShaderResourceBinding::ComputeStage, m_boundsBuffer),
+        QRhiShaderResourceBinding::bufferStore(2, QRhiShaderResourceBinding::ComputeStage, m_visibilityBuffer),
+        QRhiShaderResourceBinding::sampledTexture(3, QRhiShaderResourceBinding::ComputeStage, hiZ, m_sampler)
+    });
+    if (!m_srb->create())
+    {
+        qWarning() << "PassOcclusion: failed to create bindings";
+        delete m_srb;
+        m_srb = nullptr;
+        return false;
+    }
+    if (!m_pipeline)
+    {
+        const QRhiShaderStage cs = ctx.shaders->loadStage(QRhiShaderStage::Compute,
+                                                          QStringLiteral(":/shaders/occlusion_cull.comp.qsb"));
+        if (!cs.shader().isValid())
+            return false;
+        m_pipeline = ctx.rhi->rhi()->newComputePipeline();
+        m_pipeline->setShaderStage(cs);
+        m_pipeline->setShaderResourceBindings(m_srb);
+        if (!m_pipeline->create())
+        {
+            qWarning() << "PassOcclusion: failed to create pipeline";
+            delete m_pipeline;
+            m_pipeline = nullptr;
+            return false;
+        }
+    }
+    m_boundHiZ = hiZ;
+    return true;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <QtCore/QVector>
+#include <QtGui/QMatrix4x4>
+#include <QtGui/QVector3D>
+#include <QtGui/QVector4D>
+#include <memory>
+#include <vector>
+#include <rhi/qrhi.h>
+
+#include "core/RenderGraph.h"
+
+// Tests the bounds of the draw list against the Hi-Z PassDepth built in the
+// previous frame and drops the meshes found occluded from what PassDepth and
+// PassGBuffer draw. Results are read back, so they apply a few frames late.
+// They only hold for the view they were tested from: while the camera moves
+// nothing is culled, culling resumes a few frames after it stops.
+class PassOcclusion final : public RenderPass
+{
+public:
+    ~PassOcclusion() override;
+    const char *name() const override { return "PassOcclusion"; }
+    void setup(RenderGraphBuilder &builder, FrameContext &ctx) override;
+    void onCulled(FrameContext &ctx) override;
+    void prepare(FrameContext &ctx) override;
+    void execute(FrameContext &ctx) override;
+
+private:
+    struct Test
+    {
+        QVector<int> meshes;
+        QVector<QVector4D> bounds; // min, max per mesh, grown by the margin
+        QMatrix4x4 viewProj;
+        QRhiBufferReadbackResult readback;
+        bool done = false;
+    };
+    struct Result
+    {
+        QVector3D boundsMin;
+        QVector3D boundsMax;
+        bool occluded = false;
+    };
+
+    void ensureResources(FrameContext &ctx);
+    bool ensureBuffers(FrameContext &ctx, int count);
+    bool ensureBindings(FrameContext &ctx, QRhiTexture *hiZ);
+    void dispatch(FrameContext &ctx);
+    void applyResults(const Test &test);
+    void filterDrawList(FrameContext &ctx);
+
+    QRhi *m_rhi = nullptr;
+    QRhiComputePipeline *m_pipeline = nullptr;
+    QRhiShaderResourceBindings *m_srb = nullptr;
+    QRhiBuffer *m_cullUbo = nullptr;
+    QRhiBuffer *m_boundsBuffer = nullptr;
+    QRhiBuffer *m_visibilityBuffer = nullptr;
+    QRhiSampler *m_sampler = nullptr;
+    QRhiTexture *m_boundHiZ = nullptr;
+    int m_capacity = 0;
+    std::vector<std::unique_ptr<Test>> m_pending;
+    QVector<Result> m_results; // per mesh
+    QMatrix4x4 m_resultsViewProj;
+};
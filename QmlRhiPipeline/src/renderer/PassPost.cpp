@@ -9,6 +9,24 @@
 #include <QtGui/QVector4D>
 #include <cstring>
 
+namespace {
+
+// Blocks of a gizmo in the uniform ring, see gizmo.vert and gizmo.frag.
+struct GizmoModelData
+{
+    float model[16];
+    float normalMatrix[16];
+};
+
+struct GizmoMaterialData
+{
+    QVector4D baseColorMetal;
+    QVector4D roughnessOcclusion;
+    QVector4D emissive;
+};
+
+} // namespace
+
 void PassPost::ensureGizmoPipeline(FrameContext &ctx)
 {
     if (!ctx.rhi || !ctx.shaders)
@@ -30,41 +48,24 @@ void PassPost::ensureGizmoPipeline(FrameContext &ctx)
             m_gizmoCameraUbo = nullptr;
             return;
         }
-        if (ctx.scene)
-        {
-            for (Mesh &mesh : ctx.scene->meshes())
-            {
-                delete mesh.gizmoSrb;
-                mesh.gizmoSrb = nullptr;
-            }
-        }
     }
 
-    if (!m_gizmoModelUbo)
-    {
-        const quint32 mat4Size = 16 * sizeof(float);
-        m_gizmoModelUbo = rhi->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, mat4Size * 2);
-        if (!m_gizmoModelUbo->create())
-            return;
-    }
-    if (!m_gizmoMaterialUbo)
-    {
-        m_gizmoMaterialUbo = rhi->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, sizeof(QVector4D) * 3);
-        if (!m_gizmoMaterialUbo->create())
-            return;
-    }
-    if (!m_gizmoLayoutSrb)
+    if (!m_gizmoUniforms.buffer() && !m_gizmoUniforms.create(rhi, 4 * 1024))
+        return;
+    if (!m_gizmoSrb)
     {
-        m_gizmoLayoutSrb = rhi->newShaderResourceBindings();
-        m_gizmoLayoutSrb->setBindings({
+        m_gizmoSrb = rhi->newShaderResourceBindings();
+        m_gizmoSrb->setBindings({
             QRhiShaderResourceBinding::uniformBuffer(0, QRhiShaderResourceBinding::VertexStage, m_gizmoCameraUbo),
-            QRhiShaderResourceBinding::uniformBuffer(1, QRhiShaderResourceBinding::VertexStage, m_gizmoModelUbo),
-            QRhiShaderResourceBinding::uniformBuffer(2, QRhiShaderResourceBinding::FragmentStage, m_gizmoMaterialUbo)
+            QRhiShaderResourceBinding::uniformBufferWithDynamicOffset(1, QRhiShaderResourceBinding::VertexStage,
+                                                                      m_gizmoUniforms.buffer(), sizeof(GizmoModelData)),
+            QRhiShaderResourceBinding::uniformBufferWithDynamicOffset(2, QRhiShaderResourceBinding::FragmentStage,
+                                                                      m_gizmoUniforms.buffer(), sizeof(GizmoMaterialData))
         });
-        if (!m_gizmoLayoutSrb->create())
+        if (!m_gizmoSrb->create())
         {
-            delete m_gizmoLayoutSrb;
-            m_gizmoLayoutSrb = nullptr;
+            delete m_gizmoSrb;
+            m_gizmoSrb = nullptr;
             return;
         }
     }
@@ -97,7 +98,7 @@ void PassPost::ensureGizmoPipeline(FrameContext &ctx)
     pipeline->setCullMode(QRhiGraphicsPipeline::None);
     pipeline->setDepthTest(false);
     pipeline->setDepthWrite(false);
-    pipeline->setShaderResourceBindings(m_gizmoLayoutSrb);
+    pipeline->setShaderResourceBindings(m_gizmoSrb);
     pipeline->setRenderPassDescriptor(swapRt->renderPassDescriptor());
 
     if (!pipeline->create())
@@ -127,20 +128,31 @@ void PassPost::ensureGizmoMeshBuffers(FrameContext &ctx, Mesh &mesh, QRhiResourc
     }
     if (mesh.indexCount == 0 && !mesh.indices.isEmpty())
         mesh.indexCount = mesh.indices.size();
+}
 
-    if (!mesh.modelUbo)
-    {
-        const quint32 mat4Size = 16 * sizeof(float);
-        mesh.modelUbo = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, mat4Size * 2);
-        if (!mesh.modelUbo->create())
-            return;
-    }
-    if (!mesh.materialUbo)
+void PassPost::setup(RenderGraphBuilder &builder, FrameContext &ctx)
+{
+    builder.read(ctx.lightingEnabled ? RenderResource::LightingColor : RenderResource::GBufferAlbedo);
+    builder.read(RenderResource::GBufferEmissive);
+
+    QRhi *rhi = ctx.rhi ? ctx.rhi->rhi() : nullptr;
+    QRhiRenderTarget *swapRt = ctx.rhi ? ctx.rhi->swapchainRenderTarget() : nullptr;
+    if (rhi && swapRt && !swapRt->pixelSize().isEmpty())
     {
-        mesh.materialUbo = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, sizeof(QVector4D) * 4);
-        if (!mesh.materialUbo->create())
-            return;
+        // Same format rules as the GBuffer so the full-res blur target can
+        // alias a GBuffer attachment that is dead after lighting.
+        const QSize size = swapRt->pixelSize();
+        RenderGraphTextureDesc desc;
+        desc.format = QRhiTexture::RGBA16F;
+        if (!rhi->isTextureFormatSupported(desc.format, QRhiTexture::RenderTarget))
+            desc.format = QRhiTexture::RGBA8;
+        desc.flags = QRhiTexture::RenderTarget;
+        desc.size = QSize(qMax(1, size.width() / 2), qMax(1, size.height() / 2));
+        builder.createTexture(RenderResource::Bloom, desc);
+        desc.size = size;
+        builder.createTexture(RenderResource::BloomBlur, desc);
     }
+    builder.write(RenderResource::Backbuffer);
 }
 
 void PassPost::prepare(FrameContext &ctx)
@@ -158,19 +170,22 @@ void PassPost::prepare(FrameContext &ctx)
     if (size.isEmpty())
         return;
 
-    if (m_lastSize != size)
+    QRhiTexture *bloomTex = ctx.graph ? ctx.graph->texture(RenderResource::Bloom) : nullptr;
+    QRhiTexture *bloomBlurTex = ctx.graph ? ctx.graph->texture(RenderResource::BloomBlur) : nullptr;
+    if (!bloomTex || !bloomBlurTex)
+        return;
+
+    if (m_lastSize != size || m_bloomTex != bloomTex || m_bloomBlurTex != bloomBlurTex)
     {
         delete m_bloomRpDesc;
         m_bloomRpDesc = nullptr;
         delete m_bloomRt;
         m_bloomRt = nullptr;
-        delete m_bloomTex;
         m_bloomTex = nullptr;
         delete m_bloomBlurRpDesc;
         m_bloomBlurRpDesc = nullptr;
         delete m_bloomBlurRt;
         m_bloomBlurRt = nullptr;
-        delete m_bloomBlurTex;
         m_bloomBlurTex = nullptr;
         delete m_bloomSrb;
         m_bloomSrb = nullptr;
@@ -205,15 +220,9 @@ void PassPost::prepare(FrameContext &ctx)
             return;
     }
 
-    if (!m_bloomTex)
+    if (!m_bloomRt)
     {
-        const QSize half = QSize(qMax(1, size.width() / 2), qMax(1, size.height() / 2));
-        QRhiTexture::Format colorFormat = QRhiTexture::RGBA16F;
-        if (!rhi->isTextureFormatSupported(colorFormat, QRhiTexture::RenderTarget))
-            colorFormat = QRhiTexture::RGBA8;
-        m_bloomTex = rhi->newTexture(colorFormat, half, 1, QRhiTexture::RenderTarget);
-        if (!m_bloomTex->create())
-            return;
+        m_bloomTex = bloomTex;
         QRhiTextureRenderTargetDescription rtDesc;
         rtDesc.setColorAttachments({ QRhiColorAttachment(m_bloomTex) });
         m_bloomRt = rhi->newTextureRenderTarget(rtDesc);
@@ -222,14 +231,9 @@ void PassPost::prepare(FrameContext &ctx)
         if (!m_bloomRt->create())
             return;
     }
-    if (!m_bloomBlurTex)
+    if (!m_bloomBlurRt)
     {
-        QRhiTexture::Format colorFormat = QRhiTexture::RGBA16F;
-        if (!rhi->isTextureFormatSupported(colorFormat, QRhiTexture::RenderTarget))
-            colorFormat = QRhiTexture::RGBA8;
-        m_bloomBlurTex = rhi->newTexture(colorFormat, size, 1, QRhiTexture::RenderTarget);
-        if (!m_bloomBlurTex->create())
-            return;
+        m_bloomBlurTex = bloomBlurTex;
         QRhiTextureRenderTargetDescription rtDesc;
         rtDesc.setColorAttachments({ QRhiColorAttachment(m_bloomBlurTex) });
         m_bloomBlurRt = rhi->newTextureRenderTarget(rtDesc);
@@ -419,74 +423,49 @@ void PassPost::execute(FrameContext &ctx)
         QRhiResourceUpdateBatch *gizmoUpdates = ctx.rhi->rhi()->nextResourceUpdateBatch();
         gizmoUpdates->updateDynamicBuffer(m_gizmoCameraUbo, 0, sizeof(GizmoCameraData), &camData);
 
-        struct ModelData
-        {
-            float model[16];
-            float normalMatrix[16];
-        };
-        struct MaterialData
-        {
-            QVector4D baseColorMetal;
-            QVector4D roughnessOcclusion;
-            QVector4D emissive;
-        };
-
-        for (Mesh &mesh : ctx.scene->meshes())
+        m_gizmoUniforms.reset();
+        m_gizmoDraws.clear();
+        QVector<Mesh> &meshes = ctx.scene->meshes();
+        for (int i = 0; i < meshes.size(); ++i)
         {
+            Mesh &mesh = meshes[i];
             if (mesh.gizmoAxis < 0)
                 continue;
             ensureGizmoMeshBuffers(ctx, mesh, gizmoUpdates);
-            if (!mesh.modelUbo || !mesh.materialUbo)
+            if (!mesh.vertexBuffer || !mesh.indexBuffer || mesh.indexCount == 0)
                 continue;
 
-            QMatrix4x4 model = mesh.modelMatrix;
-            QMatrix4x4 normalMatrix = model.inverted();
-            normalMatrix = normalMatrix.transposed();
-            ModelData modelData;
-            std::memcpy(modelData.model, model.constData(), sizeof(modelData.model));
+            const QMatrix4x4 normalMatrix = ctx.scene->normalMatrix(i);
+            GizmoModelData modelData;
+            std::memcpy(modelData.model, mesh.modelMatrix.constData(), sizeof(modelData.model));
             std::memcpy(modelData.normalMatrix, normalMatrix.constData(), sizeof(modelData.normalMatrix));
 
-            MaterialData matData;
+            GizmoMaterialData matData;
             matData.baseColorMetal = QVector4D(mesh.material.baseColor, mesh.material.metalness);
             matData.roughnessOcclusion = QVector4D(mesh.material.roughness, mesh.material.occlusion, 0.0f, 0.0f);
             matData.emissive = QVector4D(mesh.material.emissive, 0.0f);
 
-            gizmoUpdates->updateDynamicBuffer(mesh.modelUbo, 0, sizeof(ModelData), &modelData);
-            gizmoUpdates->updateDynamicBuffer(mesh.materialUbo, 0, sizeof(MaterialData), &matData);
+            GizmoDraw draw;
+            draw.mesh = i;
+            draw.modelOffset = m_gizmoUniforms.append(&modelData, sizeof(GizmoModelData));
+            draw.materialOffset = m_gizmoUniforms.append(&matData, sizeof(GizmoMaterialData));
+            m_gizmoDraws.push_back(draw);
         }
+        if (!m_gizmoUniforms.upload(gizmoUpdates))
+            m_gizmoDraws.clear();
 
         cb->resourceUpdate(gizmoUpdates);
         cb->setGraphicsPipeline(m_gizmoPipeline);
         cb->setViewport(QRhiViewport(0, 0, size.width(), size.height()));
 
-        for (Mesh &mesh : ctx.scene->meshes())
+        for (const GizmoDraw &draw : std::as_const(m_gizmoDraws))
         {
-            if (mesh.gizmoAxis < 0)
-                continue;
-            if (!mesh.vertexBuffer || !mesh.indexBuffer || mesh.indexCount == 0)
-                continue;
-            if (!mesh.modelUbo || !mesh.materialUbo)
-                continue;
-
-            if (!mesh.gizmoSrb)
-            {
-                mesh.gizmoSrb = ctx.rhi->rhi()->newShaderResourceBindings();
-                mesh.gizmoSrb->setBindings({
-                    QRhiShaderResourceBinding::uniformBuffer(0, QRhiShaderResourceBinding::VertexStage, m_gizmoCameraUbo),
-                    QRhiShaderResourceBinding::uniformBuffer(1, QRhiShaderResourceBinding::VertexStage, mesh.modelUbo),
-                    QRhiShaderResourceBinding::uniformBuffer(2, QRhiShaderResourceBinding::FragmentStage, mesh.materialUbo)
-                });
-                if (!mesh.gizmoSrb->create())
-                {
-                    delete mesh.gizmoSrb;
-                    mesh.gizmoSrb = nullptr;
-                }
-            }
-
-            if (!mesh.gizmoSrb)
-                continue;
-
-            cb->setShaderResources(mesh.gizmoSrb);
+            const Mesh &mesh = meshes[draw.mesh];
+            const QRhiCommandBuffer::DynamicOffset dynamicOffsets[] = {
+                { 1, draw.modelOffset },
+                { 2, draw.materialOffset }
+            };
+            cb->setShaderResources(m_gizmoSrb, 2, dynamicOffsets);
             const QRhiCommandBuffer::VertexInput vbufBinding(mesh.vertexBuffer, 0);
             cb->setVertexInput(0, 1, &vbufBinding, mesh.indexBuffer, 0, QRhiCommandBuffer::IndexUInt32);
             cb->drawIndexed(mesh.indexCount);
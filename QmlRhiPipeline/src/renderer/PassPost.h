@@ -1,6 +1,8 @@
 #pragma once
 
 #include "core/RenderGraph.h"
+#include "core/UniformRing.h"
+#include <QtCore/QVector>
 #include <rhi/qrhi.h>
 
 struct Mesh;
@@ -8,6 +10,8 @@ struct Mesh;
 class PassPost final : public RenderPass
 {
 public:
+    const char *name() const override { return "PassPost"; }
+    void setup(RenderGraphBuilder &builder, FrameContext &ctx) override;
     void prepare(FrameContext &ctx) override;
     void execute(FrameContext &ctx) override;
 
@@ -15,6 +19,13 @@ private:
     void ensureGizmoPipeline(FrameContext &ctx);
     void ensureGizmoMeshBuffers(FrameContext &ctx, Mesh &mesh, QRhiResourceUpdateBatch *u);
 
+    struct GizmoDraw
+    {
+        int mesh = -1;
+        quint32 modelOffset = 0;
+        quint32 materialOffset = 0;
+    };
+
     QRhiTexture *m_bloomTex = nullptr;
     QRhiTextureRenderTarget *m_bloomRt = nullptr;
     QRhiRenderPassDescriptor *m_bloomRpDesc = nullptr;
@@ -29,9 +40,10 @@ private:
     QRhiGraphicsPipeline *m_bloomUpsamplePipeline = nullptr;
     QRhiGraphicsPipeline *m_combinePipeline = nullptr;
     QRhiGraphicsPipeline *m_gizmoPipeline = nullptr;
-    QRhiShaderResourceBindings *m_gizmoLayoutSrb = nullptr;
-    QRhiBuffer *m_gizmoModelUbo = nullptr;
-    QRhiBuffer *m_gizmoMaterialUbo = nullptr;
+    QRhiShaderResourceBindings *m_gizmoSrb = nullptr;
+    // Model and material blocks of the gizmos, bound with dynamic offsets.
+    UniformRing m_gizmoUniforms;
+    QVector<GizmoDraw> m_gizmoDraws;
     QRhiSampler *m_sampler = nullptr;
     QRhiRenderPassDescriptor *m_swapRpDesc = nullptr;
     QRhiBuffer *m_gizmoCameraUbo = nullptr;
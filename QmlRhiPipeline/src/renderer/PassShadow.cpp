@@ -14,6 +14,12 @@
 #include "core/ShaderManager.h"
 #include "scene/Scene.h"
 
+// Must match SPOT_VIEW_COUNT in shadow_spot_multiview.vert/.frag.
+static constexpr int kSpotViewsPerPass = 4;
+// One model matrix per caster block and per instance.
+static constexpr quint32 kModelSize = 16 * sizeof(float);
+static constexpr quint32 kInstanceStride = kModelSize;
+
 static QVector3D safeUp(const QVector3D &dir)
 {
     const QVector3D up(0.0f, 1.0f, 0.0f);
@@ -22,6 +28,20 @@ static QVector3D safeUp(const QVector3D &dir)
     return up;
 }
 
+void PassShadow::setup(RenderGraphBuilder &builder, FrameContext &ctx)
+{
+    Q_UNUSED(ctx);
+    builder.write(RenderResource::ShadowMaps);
+}
+
+void PassShadow::onCulled(FrameContext &ctx)
+{
+    if (!ctx.rhi || !ctx.shadows)
+        return;
+    resetShadowData(ctx);
+    updateLightMatrices(ctx);
+}
+
 void PassShadow::prepare(FrameContext &ctx)
 {
     if (!ctx.rhi || !ctx.shaders)
@@ -35,28 +55,69 @@ void PassShadow::prepare(FrameContext &ctx)
     ensureResources(ctx);
 
     if (ctx.shadows)
+        resetShadowData(ctx);
+}
+
+void PassShadow::resetShadowData(FrameContext &ctx)
+{
+    const bool depthZeroToOne = ctx.rhi->rhi()->isClipDepthZeroToOne();
+    const float depthScale = depthZeroToOne ? 1.0f : 0.5f;
+    const float depthBias = depthZeroToOne ? 0.0f : 0.5f;
+    bool reverseZ = ctx.rhi->rhi()->clipSpaceCorrMatrix()(2, 2) < 0.0f;
+    if (ctx.rhi->rhi()->backend() == QRhi::D3D11 || ctx.rhi->rhi()->backend() == QRhi::Metal)
+        reverseZ = false;
+    ctx.shadows->cascadeCount = 0;
+    ctx.shadows->splits = {};
+    ctx.shadows->dirLightDir = {};
+    ctx.shadows->dirLightColorIntensity = {};
+    for (int i = 0; i < 3; ++i)
+        ctx.shadows->shadowMaps[i] = m_cascades[i].color;
+    ctx.shadows->spotLightViewProj.clear();
+    ctx.shadows->spotShadowParams.clear();
+    ctx.shadows->spotShadowCount = 0;
+    ctx.shadows->spotShadowMapArray = m_spotShadowMapArray;
+    ctx.shadows->shadowDepthParams = QVector4D(depthScale, depthBias,
+                                               reverseZ ? 1.0f : 0.0f, 0.0f);
+}
+
+void PassShadow::invalidateShadowCache()
+{
+    for (Cascade &c : m_cascades)
+        c.cached = false;
+    m_spotSlots.fill(SpotSlot(), m_spotRts.size());
+}
+
+void PassShadow::updateLightMatrices(FrameContext &ctx)
+{
+    if (!ctx.scene || !ctx.shadows)
+        return;
+
+    // Lighting still needs the directional light and the spot projections
+    // (gobos) even when no shadow map gets rendered.
+    const Scene &scene = *ctx.scene;
+    const QMatrix4x4 clipCorr = ctx.rhi->rhi()->clipSpaceCorrMatrix();
+    for (const Light &l : scene.lights())
     {
-        const bool depthZeroToOne = ctx.rhi->rhi()->isClipDepthZeroToOne();
-        const float depthScale = depthZeroToOne ? 1.0f : 0.5f;
-        const float depthBias = depthZeroToOne ? 0.0f : 0.5f;
-        bool reverseZ = ctx.rhi->rhi()->clipSpaceCorrMatrix()(2, 2) < 0.0f;
-        if (ctx.rhi->rhi()->backend() == QRhi::D3D11 || ctx.rhi->rhi()->backend() == QRhi::Metal)
-            reverseZ = false;
-        ctx.shadows->cascadeCount = 0;
-        ctx.shadows->splits = {};
-        ctx.shadows->dirLightDir = {};
-        ctx.shadows->dirLightColorIntensity = {};
-        for (int i = 0; i < 3; ++i)
-            ctx.shadows->shadowMaps[i] = m_cascades[i].color;
-        for (int i = 0; i < kMaxLights; ++i)
-        {
-            ctx.shadows->spotLightViewProj[i] = QMatrix4x4();
-            ctx.shadows->spotShadowParams[i] = QVector4D(-1.0f, 0.0f, 0.0f, 0.0f);
-        }
-        ctx.shadows->spotShadowCount = 0;
-        ctx.shadows->spotShadowMapArray = m_spotShadowMapArray;
-        ctx.shadows->shadowDepthParams = QVector4D(depthScale, depthBias,
-                                                   reverseZ ? 1.0f : 0.0f, 0.0f);
+        if (l.type != Light::Type::Directional)
+            continue;
+        ctx.shadows->dirLightDir = QVector4D(l.direction.normalized(), 0.0f);
+        ctx.shadows->dirLightColorIntensity = QVector4D(l.color, l.intensity);
+        break;
+    }
+
+    const auto &lights = scene.lights();
+    ctx.shadows->spotLightViewProj.fill(QMatrix4x4(), lights.size());
+    ctx.shadows->spotShadowParams.fill(QVector4D(-1.0f, 0.0f, 0.0f, 0.0f), lights.size());
+    ctx.shadows->spotShadowCount = 0;
+
+    for (int i = 0; i < lights.size(); ++i)
+    {
+        const Light &light = lights[i];
+        if (light.type != Light::Type::Spot || light.range <= 0.0f)
+            continue;
+        const float nearPlane = 1.0f;
+        const float farPlane = qMax(light.range, nearPlane + 0.1f);
+        ctx.shadows->spotLightViewProj[i] = clipCorr * computeSpotViewProj(light, nearPlane, farPlane);
     }
 }
 
@@ -66,14 +127,11 @@ void PassShadow::execute(FrameContext &ctx)
         return;
 
     const bool shadowsEnabled = ctx.scene->shadowsEnabled();
-    const Light *dirLight = nullptr;
     const Light *dirShadowLight = nullptr;
     for (const Light &l : ctx.scene->lights())
     {
         if (l.type != Light::Type::Directional)
             continue;
-        if (!dirLight)
-            dirLight = &l;
         if (!dirShadowLight && l.castShadows)
         {
             dirShadowLight = &l;
@@ -91,12 +149,10 @@ void PassShadow::execute(FrameContext &ctx)
         ctx.shadows->shadowDepthParams = QVector4D(depthScale, depthBias,
                                                    reverseZ ? 1.0f : 0.0f, 0.0f);
     }
-    if (dirLight)
-    {
-        ctx.shadows->dirLightDir = QVector4D(dirLight->direction.normalized(), 0.0f);
-        ctx.shadows->dirLightColorIntensity = QVector4D(dirLight->color, dirLight->intensity);
-    }
+    updateLightMatrices(ctx);
 
+    const quint64 geometryRevision = ctx.scene->geometryRevision();
+    updateInstanceBatches(ctx);
     if (dirShadowLight && shadowsEnabled)
     {
         const Camera &cam = ctx.scene->camera();
@@ -122,10 +178,17 @@ void PassShadow::execute(FrameContext &ctx)
         {
             const float cNear = splits[i];
             const float cFar = splits[i + 1];
-            QMatrix4x4 lightViewProj = clipCorr * computeLightViewProj(cam, dirShadowLight->direction, cNear, cFar);
-            m_cascades[i].lightViewProj = lightViewProj;
+            const QMatrix4x4 cullViewProj = computeLightViewProj(cam, dirShadowLight->direction, cNear, cFar);
+            const QMatrix4x4 lightViewProj = clipCorr * cullViewProj;
             ctx.shadows->lightViewProj[i] = lightViewProj;
-            renderCascade(ctx, m_cascades[i], lightViewProj);
+            Cascade &cascade = m_cascades[i];
+            if (cascade.cached && cascade.lightViewProj == lightViewProj
+                    && cascade.geometryRevision == geometryRevision)
+                continue;
+            cascade.lightViewProj = lightViewProj;
+            cascade.geometryRevision = geometryRevision;
+            cascade.cached = true;
+            renderCascade(ctx, cascade, lightViewProj, collectCasters(*ctx.scene, cullViewProj));
         }
     }
     else
@@ -133,25 +196,7 @@ void PassShadow::execute(FrameContext &ctx)
         ctx.shadows->cascadeCount = 0;
     }
 
-    for (int i = 0; i < kMaxLights; ++i)
-    {
-        ctx.shadows->spotLightViewProj[i] = QMatrix4x4();
-        ctx.shadows->spotShadowParams[i] = QVector4D(-1.0f, 0.0f, 0.0f, 0.0f);
-    }
-    ctx.shadows->spotShadowCount = 0;
-
     const auto &lights = ctx.scene->lights();
-    for (int i = 0; i < lights.size(); ++i)
-    {
-        const Light &light = lights[i];
-        if (light.type != Light::Type::Spot || light.range <= 0.0f)
-            continue;
-        const float nearPlane = 1.0f;
-        const float farPlane = qMax(light.range, nearPlane + 0.1f);
-        const QMatrix4x4 lightViewProj = clipCorr * computeSpotViewProj(light, nearPlane, farPlane);
-        ctx.shadows->spotLightViewProj[i] = lightViewProj;
-    }
-
     if (shadowsEnabled && !m_spotRts.isEmpty() && m_spotShadowMapArray)
     {
         const int maxSlots = qMin(int(m_spotRts.size()), m_spotShadowSlots);
@@ -186,20 +231,91 @@ void PassShadow::execute(FrameContext &ctx)
         }
         std::stable_sort(candidates.begin(), candidates.end(),
                          [](const SpotCandidate &a, const SpotCandidate &b) { return a.score > b.score; });
-        int slot = 0;
-        for (const SpotCandidate &candidate : candidates)
+        if (candidates.size() > maxSlots)
+            candidates.resize(maxSlots);
+        if (m_spotSlots.size() != m_spotRts.size())
+            m_spotSlots.fill(SpotSlot(), m_spotRts.size());
+
+        // Lights keep the slot they had last frame so their cached map can be
+        // reused, the others take whatever slot got freed.
+        QVector<int> candidateSlots(candidates.size(), -1);
+        QVector<bool> slotTaken(maxSlots, false);
+        for (int c = 0; c < candidates.size(); ++c)
         {
-            if (slot >= maxSlots)
+            for (int slot = 0; slot < maxSlots; ++slot)
+            {
+                if (slotTaken[slot] || m_spotSlots[slot].lightIndex != candidates[c].index)
+                    continue;
+                candidateSlots[c] = slot;
+                slotTaken[slot] = true;
                 break;
+            }
+        }
+        int freeSlot = 0;
+        for (int c = 0; c < candidates.size(); ++c)
+        {
+            if (candidateSlots[c] >= 0)
+                continue;
+            while (slotTaken[freeSlot])
+                ++freeSlot;
+            candidateSlots[c] = freeSlot;
+            slotTaken[freeSlot] = true;
+        }
+
+        m_spotViews.fill(SpotView(), maxSlots);
+        for (int c = 0; c < candidates.size(); ++c)
+        {
+            const SpotCandidate &candidate = candidates[c];
+            const int slot = candidateSlots[c];
             const int lightIndex = candidate.index;
             const Light &light = lights[lightIndex];
             const QMatrix4x4 lightViewProj = ctx.shadows->spotLightViewProj[lightIndex];
+            const QVector4D lightPosFar(light.position, candidate.farPlane);
             ctx.shadows->spotShadowParams[lightIndex] = QVector4D(float(slot), 1.0f, candidate.nearPlane, candidate.farPlane);
-            renderSpot(ctx, m_spotRts[slot], lightViewProj, light.position, candidate.nearPlane, candidate.farPlane, slot);
-            ++slot;
+            SpotView &view = m_spotViews[slot];
+            view.lightIndex = lightIndex;
+            view.nearPlane = candidate.nearPlane;
+            view.farPlane = candidate.farPlane;
+            SpotSlot &cache = m_spotSlots[slot];
+            cache.lightIndex = lightIndex;
+            if (cache.cached && cache.lightViewProj == lightViewProj && cache.lightPosFar == lightPosFar
+                    && cache.geometryRevision == geometryRevision)
+                continue;
+            cache.lightViewProj = lightViewProj;
+            cache.lightPosFar = lightPosFar;
+            cache.geometryRevision = geometryRevision;
+            cache.cached = true;
+            view.dirty = true;
+        }
+
+        // Groups of slots with any change go through the multiview path in one
+        // pass, which rewrites every layer of the group.
+        int firstSingleSlot = 0;
+        if (m_spotMultiViewPipeline)
+        {
+            const int batchCount = qMin(int(m_spotMultiViewRts.size()), maxSlots / kSpotViewsPerPass);
+            for (int batch = 0; batch < batchCount; ++batch)
+            {
+                bool dirty = false;
+                for (int v = 0; v < kSpotViewsPerPass; ++v)
+                    dirty = dirty || m_spotViews[batch * kSpotViewsPerPass + v].dirty;
+                if (dirty)
+                    renderSpotBatch(ctx, batch);
+            }
+            firstSingleSlot = batchCount * kSpotViewsPerPass;
+        }
+        for (int slot = firstSingleSlot; slot < maxSlots; ++slot)
+        {
+            const SpotView &view = m_spotViews[slot];
+            if (!view.dirty)
+                continue;
+            const Light &light = lights[view.lightIndex];
+            const QVector<int> &casters = collectCasters(*ctx.scene,
+                                                         computeSpotViewProj(light, view.nearPlane, view.farPlane));
+            renderSpot(ctx, m_spotRts[slot], casters, m_spotSlots[slot].lightViewProj, light.position,
+                       view.nearPlane, view.farPlane, slot);
         }
-        ctx.shadows->spotShadowCount = slot;
-        // Debug/capture block removed.
+        ctx.shadows->spotShadowCount = candidates.size();
     }
 }
 
@@ -221,12 +337,20 @@ void PassShadow::ensureResources(FrameContext &ctx)
     if (!ctx.rhi || !ctx.rhi->rhi())
         return;
 
+    releaseSpotMultiView();
     if (m_pipeline || m_spotPipeline || m_cascades[0].rt || m_spotShadowMapArray || !m_spotRts.isEmpty())
     {
         delete m_pipeline;
         m_pipeline = nullptr;
         delete m_spotPipeline;
         m_spotPipeline = nullptr;
+        delete m_instancedPipeline;
+        m_instancedPipeline = nullptr;
+        delete m_spotInstancedPipeline;
+        m_spotInstancedPipeline = nullptr;
+        for (QRhiShaderResourceBindings *srb : m_spotSrbs)
+            delete srb;
+        m_spotSrbs.clear();
         delete m_srb;
         m_srb = nullptr;
         delete m_shadowUbo;
@@ -234,8 +358,8 @@ void PassShadow::ensureResources(FrameContext &ctx)
         for (QRhiBuffer *ubo : m_spotShadowUbos)
             delete ubo;
         m_spotShadowUbos.clear();
-        delete m_modelUbo;
-        m_modelUbo = nullptr;
+        m_models.release();
+        m_modelOffsets.clear();
         for (Cascade &c : m_cascades)
         {
             delete c.rpDesc;
@@ -258,20 +382,11 @@ void PassShadow::ensureResources(FrameContext &ctx)
             delete buf;
         m_spotDepthStencils.clear();
     }
-    if (ctx.scene)
-    {
-        for (Mesh &mesh : ctx.scene->meshes())
-        {
-            delete mesh.shadowSrb;
-            mesh.shadowSrb = nullptr;
-            for (QRhiShaderResourceBindings *srb : mesh.spotShadowSrbs)
-                delete srb;
-            mesh.spotShadowSrbs.clear();
-        }
-    }
 
     m_reverseZ = reverseZ;
     m_spotShaderVersion = kSpotShaderVersion;
+    invalidateShadowCache();
+    m_instanceRevision = 0;
 
     QRhiTexture::Format colorFormat = QRhiTexture::RGBA16F;
     if (!ctx.rhi->rhi()->isTextureFormatSupported(colorFormat, QRhiTexture::RenderTarget))
@@ -343,8 +458,7 @@ void PassShadow::ensureResources(FrameContext &ctx)
     const quint32 mat4Size = 16 * sizeof(float);
     const quint32 shadowUboSize = mat4Size + 3 * 4 * sizeof(float);
     m_shadowUbo = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, shadowUboSize);
-    m_modelUbo = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, mat4Size);
-    if (!m_shadowUbo->create() || !m_modelUbo->create())
+    if (!m_shadowUbo->create() || !m_models.create(ctx.rhi->rhi()))
         return;
     m_spotShadowUbos.reserve(m_spotShadowSlots);
     for (int i = 0; i < m_spotShadowSlots; ++i)
@@ -364,7 +478,8 @@ void PassShadow::ensureResources(FrameContext &ctx)
                                                  QRhiShaderResourceBinding::VertexStage
                                                  | QRhiShaderResourceBinding::FragmentStage,
                                                  m_shadowUbo),
-        QRhiShaderResourceBinding::uniformBuffer(1, QRhiShaderResourceBinding::VertexStage, m_modelUbo)
+        QRhiShaderResourceBinding::uniformBufferWithDynamicOffset(1, QRhiShaderResourceBinding::VertexStage,
+                                                                  m_models.buffer(), kModelSize)
     });
     if (!m_srb->create())
         return;
@@ -379,17 +494,38 @@ void PassShadow::ensureResources(FrameContext &ctx)
                               bool useMinBlend,
                               QRhiGraphicsPipeline::CompareOp depthOp,
                               const QRhiShaderStage &vsStage,
-                              const QRhiShaderStage &fsStage) -> QRhiGraphicsPipeline *
+                              const QRhiShaderStage &fsStage,
+                              int viewCount = 0,
+                              bool instanced = false) -> QRhiGraphicsPipeline *
                               {
         if (!rpDesc)
             return nullptr;
         QRhiGraphicsPipeline *pipeline = ctx.rhi->rhi()->newGraphicsPipeline();
         pipeline->setShaderStages({ vsStage, fsStage });
+        if (viewCount > 0)
+            pipeline->setMultiViewCount(viewCount);
         QRhiVertexInputLayout inputLayout;
-        inputLayout.setBindings({ QRhiVertexInputBinding(sizeof(Vertex)) });
-        inputLayout.setAttributes({
-            QRhiVertexInputAttribute(0, 0, QRhiVertexInputAttribute::Float3, 0)
-        });
+        if (instanced)
+        {
+            inputLayout.setBindings({
+                QRhiVertexInputBinding(sizeof(Vertex)),
+                QRhiVertexInputBinding(kInstanceStride, QRhiVertexInputBinding::PerInstance)
+            });
+            inputLayout.setAttributes({
+                QRhiVertexInputAttribute(0, 0, QRhiVertexInputAttribute::Float3, 0),
+                QRhiVertexInputAttribute(1, 3, QRhiVertexInputAttribute::Float4, 0),
+                QRhiVertexInputAttribute(1, 4, QRhiVertexInputAttribute::Float4, 4 * sizeof(float)),
+                QRhiVertexInputAttribute(1, 5, QRhiVertexInputAttribute::Float4, 8 * sizeof(float)),
+                QRhiVertexInputAttribute(1, 6, QRhiVertexInputAttribute::Float4, 12 * sizeof(float))
+            });
+        }
+        else
+        {
+            inputLayout.setBindings({ QRhiVertexInputBinding(sizeof(Vertex)) });
+            inputLayout.setAttributes({
+                QRhiVertexInputAttribute(0, 0, QRhiVertexInputAttribute::Float3, 0)
+            });
+        }
         pipeline->setVertexInputLayout(inputLayout);
         pipeline->setDepthTest(enableDepth);
         pipeline->setDepthWrite(enableDepth);
@@ -414,7 +550,10 @@ void PassShadow::ensureResources(FrameContext &ctx)
         pipeline->setShaderResourceBindings(m_srb);
         pipeline->setRenderPassDescriptor(rpDesc);
         if (!pipeline->create())
+        {
+            delete pipeline;
             return nullptr;
+        }
         return pipeline;
     };
 
@@ -436,58 +575,317 @@ void PassShadow::ensureResources(FrameContext &ctx)
                                     vs, fsSpot);
     if (!m_spotPipeline)
         return;
+
+    // Without the instanced pipelines every caster is drawn on its own.
+    const QRhiShaderStage vsInstanced = ctx.rhi->rhi()->isFeatureSupported(QRhi::Instancing)
+            ? ctx.shaders->loadStage(QRhiShaderStage::Vertex, QStringLiteral(":/shaders/shadow_instanced.vert.qsb"))
+            : QRhiShaderStage();
+    if (vsInstanced.shader().isValid())
+    {
+        m_instancedPipeline = createPipeline(m_cascades[0].rpDesc, true, false,
+                                             m_reverseZ ? QRhiGraphicsPipeline::GreaterOrEqual
+                                                        : QRhiGraphicsPipeline::LessOrEqual,
+                                             vsInstanced, fsShadow, 0, true);
+        m_spotInstancedPipeline = createPipeline(m_spotRpDesc, true, false,
+                                                 m_reverseZ ? QRhiGraphicsPipeline::GreaterOrEqual
+                                                            : QRhiGraphicsPipeline::LessOrEqual,
+                                                 vsInstanced, fsSpot, 0, true);
+    }
+
+    // The binding layout matches m_srb, so the same pipeline layout is used.
+    if (createSpotMultiViewTargets(ctx))
+    {
+        const QRhiShaderStage vsMultiView = ctx.shaders->loadStage(QRhiShaderStage::Vertex,
+                                                                   QStringLiteral(":/shaders/shadow_spot_multiview.vert.qsb"));
+        const QRhiShaderStage fsMultiView = ctx.shaders->loadStage(QRhiShaderStage::Fragment,
+                                                                   QStringLiteral(":/shaders/shadow_spot_multiview.frag.qsb"));
+        if (vsMultiView.shader().isValid() && fsMultiView.shader().isValid())
+        {
+            m_spotMultiViewPipeline = createPipeline(m_spotMultiViewRpDesc, true, false,
+                                                     m_reverseZ ? QRhiGraphicsPipeline::GreaterOrEqual
+                                                                : QRhiGraphicsPipeline::LessOrEqual,
+                                                     vsMultiView, fsMultiView, kSpotViewsPerPass);
+        }
+        if (!m_spotMultiViewPipeline)
+        {
+            qWarning() << "PassShadow: multiview spot shadows unavailable, rendering one slot per pass";
+            releaseSpotMultiView();
+        }
+        else if (vsInstanced.shader().isValid())
+        {
+            const QRhiShaderStage vsMultiViewInstanced = ctx.shaders->loadStage(
+                    QRhiShaderStage::Vertex, QStringLiteral(":/shaders/shadow_spot_multiview_instanced.vert.qsb"));
+            if (vsMultiViewInstanced.shader().isValid())
+            {
+                m_spotMultiViewInstancedPipeline = createPipeline(m_spotMultiViewRpDesc, true, false,
+                                                                  m_reverseZ ? QRhiGraphicsPipeline::GreaterOrEqual
+                                                                             : QRhiGraphicsPipeline::LessOrEqual,
+                                                                  vsMultiViewInstanced, fsMultiView,
+                                                                  kSpotViewsPerPass, true);
+            }
+        }
+    }
 }
 
-QRhiShaderResourceBindings *PassShadow::shadowSrbForMesh(FrameContext &ctx, Mesh &mesh)
+bool PassShadow::createSpotMultiViewTargets(FrameContext &ctx)
 {
-    if (!m_shadowUbo || !mesh.modelUbo)
-        return nullptr;
-    if (mesh.shadowSrb)
-        return mesh.shadowSrb;
-    mesh.shadowSrb = ctx.rhi->rhi()->newShaderResourceBindings();
-    mesh.shadowSrb->setBindings({
-        QRhiShaderResourceBinding::uniformBuffer(0,
-                                                 QRhiShaderResourceBinding::VertexStage
-                                                 | QRhiShaderResourceBinding::FragmentStage,
-                                                 m_shadowUbo),
-        QRhiShaderResourceBinding::uniformBuffer(1, QRhiShaderResourceBinding::VertexStage, mesh.modelUbo)
-    });
-    if (!mesh.shadowSrb->create())
+#if QT_VERSION >= QT_VERSION_CHECK(6, 7, 0)
+    QRhi *rhi = ctx.rhi->rhi();
+    const int batchCount = m_spotShadowSlots / kSpotViewsPerPass;
+    if (batchCount <= 0 || !rhi->isFeatureSupported(QRhi::MultiView))
+        return false;
+
+    // Multiview needs the depth attachment to be an array with one layer per view.
+    QRhiTexture::Format depthFormat = QRhiTexture::D24S8;
+    if (!rhi->isTextureFormatSupported(depthFormat))
+        depthFormat = QRhiTexture::D32F;
+    m_spotMultiViewDepth = rhi->newTextureArray(depthFormat, kSpotViewsPerPass,
+                                                QSize(m_spotShadowSize, m_spotShadowSize), 1,
+                                                QRhiTexture::RenderTarget);
+    if (!m_spotMultiViewDepth->create())
+        return false;
+
+    const quint32 uboSize = kSpotViewsPerPass * (16 + 4 + 4) * sizeof(float) + 4 * sizeof(float);
+    for (int batch = 0; batch < batchCount; ++batch)
     {
-        delete mesh.shadowSrb;
-        mesh.shadowSrb = nullptr;
+        QRhiColorAttachment colorAttachment(m_spotShadowMapArray);
+        colorAttachment.setLayer(batch * kSpotViewsPerPass);
+        colorAttachment.setMultiViewCount(kSpotViewsPerPass);
+        QRhiTextureRenderTargetDescription desc;
+        desc.setColorAttachments({ colorAttachment });
+        desc.setDepthTexture(m_spotMultiViewDepth);
+        QRhiTextureRenderTarget *rt = rhi->newTextureRenderTarget(desc);
+        if (!m_spotMultiViewRpDesc)
+            m_spotMultiViewRpDesc = rt->newCompatibleRenderPassDescriptor();
+        rt->setRenderPassDescriptor(m_spotMultiViewRpDesc);
+        m_spotMultiViewRts.push_back(rt);
+        if (!rt->create())
+            return false;
+
+        QRhiBuffer *ubo = rhi->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, uboSize);
+        m_spotMultiViewUbos.push_back(ubo);
+        if (!ubo->create())
+            return false;
     }
-    return mesh.shadowSrb;
+    return true;
+#else
+    Q_UNUSED(ctx);
+    return false;
+#endif
 }
 
-QRhiShaderResourceBindings *PassShadow::spotShadowSrbForMesh(FrameContext &ctx, Mesh &mesh, int slot)
+void PassShadow::releaseSpotMultiView()
 {
-    if (slot < 0 || slot >= m_spotShadowUbos.size())
-        return nullptr;
-    if (!m_spotShadowUbos[slot] || !mesh.modelUbo)
+    delete m_spotMultiViewPipeline;
+    m_spotMultiViewPipeline = nullptr;
+    delete m_spotMultiViewInstancedPipeline;
+    m_spotMultiViewInstancedPipeline = nullptr;
+    for (QRhiShaderResourceBindings *srb : m_spotMultiViewSrbs)
+        delete srb;
+    m_spotMultiViewSrbs.clear();
+    for (QRhiTextureRenderTarget *rt : m_spotMultiViewRts)
+        delete rt;
+    m_spotMultiViewRts.clear();
+    delete m_spotMultiViewRpDesc;
+    m_spotMultiViewRpDesc = nullptr;
+    delete m_spotMultiViewDepth;
+    m_spotMultiViewDepth = nullptr;
+    for (QRhiBuffer *ubo : m_spotMultiViewUbos)
+        delete ubo;
+    m_spotMultiViewUbos.clear();
+}
+
+QRhiShaderResourceBindings *PassShadow::viewSrb(FrameContext &ctx, QVector<QRhiShaderResourceBindings *> &srbs,
+                                                const QVector<QRhiBuffer *> &ubos, int index)
+{
+    // Same layout as m_srb, each caster picks its model block with a dynamic offset.
+    if (index < 0 || index >= ubos.size() || !ubos[index] || !m_models.buffer())
         return nullptr;
-    if (mesh.spotShadowSrbs.size() != m_spotShadowUbos.size())
-        mesh.spotShadowSrbs.resize(m_spotShadowUbos.size());
-    if (mesh.spotShadowSrbs[slot])
-        return mesh.spotShadowSrbs[slot];
+    if (srbs.size() != ubos.size())
+        srbs.resize(ubos.size());
+    if (srbs[index])
+        return srbs[index];
     QRhiShaderResourceBindings *srb = ctx.rhi->rhi()->newShaderResourceBindings();
     srb->setBindings({
         QRhiShaderResourceBinding::uniformBuffer(0,
                                                  QRhiShaderResourceBinding::VertexStage
                                                  | QRhiShaderResourceBinding::FragmentStage,
-                                                 m_spotShadowUbos[slot]),
-        QRhiShaderResourceBinding::uniformBuffer(1, QRhiShaderResourceBinding::VertexStage, mesh.modelUbo)
+                                                 ubos[index]),
+        QRhiShaderResourceBinding::uniformBufferWithDynamicOffset(1, QRhiShaderResourceBinding::VertexStage,
+                                                                  m_models.buffer(), kModelSize)
     });
     if (!srb->create())
     {
         delete srb;
         return nullptr;
     }
-    mesh.spotShadowSrbs[slot] = srb;
+    srbs[index] = srb;
     return srb;
 }
 
-void PassShadow::renderCascade(FrameContext &ctx, Cascade &cascade, const QMatrix4x4 &lightViewProj)
+void PassShadow::updateInstanceBatches(FrameContext &ctx)
+{
+    const Scene &scene = *ctx.scene;
+    if (m_instanceRevision == scene.geometryRevision())
+        return;
+    m_instanceRevision = scene.geometryRevision();
+
+    const QVector<Mesh> &meshes = scene.meshes();
+    m_instanceBatches.clear();
+    m_casterBatches.fill(-1, meshes.size());
+
+    // The model blocks only change with the revision, as do the cached maps.
+    m_models.reset();
+    m_modelOffsets.fill(0, meshes.size());
+    for (int i = 0; i < meshes.size(); ++i)
+    {
+        const Mesh &mesh = meshes[i];
+        if (mesh.gizmoAxis >= 0 || !mesh.visible)
+            continue;
+        m_modelOffsets[i] = m_models.append(mesh.modelMatrix.constData(), kModelSize);
+    }
+    QRhiResourceUpdateBatch *models = ctx.rhi->rhi()->nextResourceUpdateBatch();
+    const bool modelsReady = m_models.upload(models);
+    ctx.rhi->commandBuffer()->resourceUpdate(models);
+    if (!modelsReady)
+    {
+        m_modelOffsets.clear();
+        m_instanceRevision = 0;
+        return;
+    }
+    if (!m_instancedPipeline && !m_spotInstancedPipeline && !m_spotMultiViewInstancedPipeline)
+        return;
+
+    QHash<const QRhiBuffer *, int> groupByBuffer;
+    QVector<QVector<int>> groups;
+    for (int i = 0; i < meshes.size(); ++i)
+    {
+        const Mesh &mesh = meshes[i];
+        if (mesh.gizmoAxis >= 0 || !mesh.visible)
+            continue;
+        if (!mesh.vertexBuffer || !mesh.indexBuffer || mesh.indexCount == 0)
+            continue;
+        const int group = groupByBuffer.value(mesh.vertexBuffer, -1);
+        if (group < 0)
+        {
+            groupByBuffer.insert(mesh.vertexBuffer, groups.size());
+            groups.push_back({ i });
+            continue;
+        }
+        const Mesh &first = meshes[groups[group].first()];
+        if (first.indexBuffer == mesh.indexBuffer && first.indexCount == mesh.indexCount)
+            groups[group].push_back(i);
+    }
+
+    QVector<float> instanceData;
+    for (const QVector<int> &group : groups)
+    {
+        if (group.size() < 2)
+            continue;
+        const int batch = m_instanceBatches.size();
+        m_instanceBatches.push_back({ group.first(), int(instanceData.size() / 16), int(group.size()) });
+        for (int index : group)
+        {
+            const float *model = meshes[index].modelMatrix.constData();
+            instanceData.insert(instanceData.end(), model, model + 16);
+            m_casterBatches[index] = batch;
+        }
+    }
+    m_batchStamps.fill(0, m_instanceBatches.size());
+    if (m_instanceBatches.isEmpty())
+        return;
+
+    const quint32 size = quint32(instanceData.size() * sizeof(float));
+    if (!m_instanceBuffer || m_instanceBuffer->size() < size)
+    {
+        delete m_instanceBuffer;
+        m_instanceBuffer = ctx.rhi->rhi()->newBuffer(QRhiBuffer::Static, QRhiBuffer::VertexBuffer, size);
+        if (!m_instanceBuffer->create())
+        {
+            qWarning() << "PassShadow: failed to create instance buffer";
+            delete m_instanceBuffer;
+            m_instanceBuffer = nullptr;
+            m_instanceBatches.clear();
+            m_casterBatches.fill(-1);
+            return;
+        }
+    }
+    QRhiResourceUpdateBatch *u = ctx.rhi->rhi()->nextResourceUpdateBatch();
+    u->uploadStaticBuffer(m_instanceBuffer, 0, size, instanceData.constData());
+    ctx.rhi->commandBuffer()->resourceUpdate(u);
+}
+
+void PassShadow::drawCasters(FrameContext &ctx, const QVector<int> &casters, const QRhiViewport &viewport,
+                             QRhiGraphicsPipeline *pipeline, QRhiShaderResourceBindings *srb,
+                             QRhiGraphicsPipeline *instancedPipeline)
+{
+    QRhiCommandBuffer *cb = ctx.rhi->commandBuffer();
+    QVector<Mesh> &meshes = ctx.scene->meshes();
+    const bool instancing = instancedPipeline && m_instanceBuffer;
+    ++m_drawStamp;
+    m_batchesToDraw.clear();
+    cb->setGraphicsPipeline(pipeline);
+    cb->setViewport(viewport);
+    for (int index : casters)
+    {
+        if (index >= meshes.size() || index >= m_modelOffsets.size())
+            continue;
+        Mesh &mesh = meshes[index];
+        if (mesh.gizmoAxis >= 0)
+            continue;
+        if (!mesh.visible)
+            continue;
+        if (!mesh.vertexBuffer || !mesh.indexBuffer || mesh.indexCount == 0)
+            continue;
+        const int batch = instancing && index < m_casterBatches.size() ? m_casterBatches[index] : -1;
+        if (batch >= 0)
+        {
+            if (m_batchStamps[batch] != m_drawStamp)
+            {
+                m_batchStamps[batch] = m_drawStamp;
+                m_batchesToDraw.push_back(batch);
+            }
+            continue;
+        }
+        const QRhiCommandBuffer::DynamicOffset modelOffset(1, m_modelOffsets[index]);
+        cb->setShaderResources(srb, 1, &modelOffset);
+
+        const QRhiCommandBuffer::VertexInput vbufBinding(mesh.vertexBuffer, 0);
+        cb->setVertexInput(0, 1, &vbufBinding, mesh.indexBuffer, 0, QRhiCommandBuffer::IndexUInt32);
+        cb->drawIndexed(mesh.indexCount);
+    }
+    if (m_batchesToDraw.isEmpty())
+        return;
+
+    // A batch is drawn whole as soon as one of its instances is in the view.
+    cb->setGraphicsPipeline(instancedPipeline);
+    cb->setViewport(viewport);
+    // The instanced shaders read their matrices from the instance buffer.
+    const QRhiCommandBuffer::DynamicOffset unused(1, 0);
+    cb->setShaderResources(srb, 1, &unused);
+    for (int batch : m_batchesToDraw)
+    {
+        const InstanceBatch &instances = m_instanceBatches[batch];
+        const Mesh &mesh = meshes[instances.mesh];
+        const QRhiCommandBuffer::VertexInput bindings[] = {
+            { mesh.vertexBuffer, 0 },
+            { m_instanceBuffer, quint32(instances.firstInstance * kInstanceStride) }
+        };
+        cb->setVertexInput(0, 2, bindings, mesh.indexBuffer, 0, QRhiCommandBuffer::IndexUInt32);
+        cb->drawIndexed(mesh.indexCount, instances.instanceCount);
+    }
+}
+
+const QVector<int> &PassShadow::collectCasters(const Scene &scene, const QMatrix4x4 &viewProj)
+{
+    m_casters.clear();
+    scene.shadowCasterBvh().query(MeshBvh::Frustum::fromMatrix(viewProj), m_casters);
+    m_casters += scene.unboundedShadowCasters();
+    return m_casters;
+}
+
+void PassShadow::renderCascade(FrameContext &ctx, Cascade &cascade, const QMatrix4x4 &lightViewProj,
+                               const QVector<int> &casters)
 {
     if (!ctx.scene || !m_pipeline || !cascade.rt)
         return;
@@ -497,8 +895,6 @@ void PassShadow::renderCascade(FrameContext &ctx, Cascade &cascade, const QMatri
 
     const QRhiDepthStencilClearValue dsClear(m_reverseZ ? 0.0f : 1.0f, 0);
     cb->beginPass(cascade.rt, Qt::white, dsClear);
-    cb->setGraphicsPipeline(m_pipeline);
-    cb->setViewport(QRhiViewport(0, 0, cascade.rt->pixelSize().width(), cascade.rt->pixelSize().height()));
     struct ShadowUboData
     {
         float lightViewProj[16];
@@ -523,30 +919,15 @@ void PassShadow::renderCascade(FrameContext &ctx, Cascade &cascade, const QMatri
     u->updateDynamicBuffer(m_shadowUbo, 0, sizeof(ShadowUboData), &shadowData);
     cb->resourceUpdate(u);
 
-    const auto &meshes = ctx.scene->meshes();
-    for (int i = meshes.size() - 1; i >= 0; --i)
-    {
-        Mesh &mesh = const_cast<Mesh &>(meshes[i]);
-        if (mesh.gizmoAxis >= 0)
-            continue;
-        if (!mesh.visible)
-            continue;
-        if (!mesh.vertexBuffer || !mesh.indexBuffer || mesh.indexCount == 0)
-            continue;
-        QRhiShaderResourceBindings *meshSrb = shadowSrbForMesh(ctx, mesh);
-        if (!meshSrb)
-            continue;
-        cb->setShaderResources(meshSrb);
-
-        const QRhiCommandBuffer::VertexInput vbufBinding(mesh.vertexBuffer, 0);
-        cb->setVertexInput(0, 1, &vbufBinding, mesh.indexBuffer, 0, QRhiCommandBuffer::IndexUInt32);
-        cb->drawIndexed(mesh.indexCount);
-    }
+    drawCasters(ctx, casters,
+                QRhiViewport(0, 0, cascade.rt->pixelSize().width(), cascade.rt->pixelSize().height()),
+                m_pipeline, m_srb, m_instancedPipeline);
     cb->endPass();
 }
 
 void PassShadow::renderSpot(FrameContext &ctx,
                             QRhiTextureRenderTarget *rt,
+                            const QVector<int> &casters,
                             const QMatrix4x4 &lightViewProj,
                             const QVector3D &lightPos, float nearPlane, float farPlane,
                             int slot)
@@ -554,14 +935,13 @@ void PassShadow::renderSpot(FrameContext &ctx,
     if (!ctx.scene || !m_spotPipeline || !rt)
         return;
     QRhiCommandBuffer *cb = ctx.rhi->commandBuffer();
-    if (!cb)
+    QRhiShaderResourceBindings *srb = viewSrb(ctx, m_spotSrbs, m_spotShadowUbos, slot);
+    if (!cb || !srb)
         return;
 
     const QColor clearColor = Qt::white;
     const QRhiDepthStencilClearValue dsClear(m_reverseZ ? 0.0f : 1.0f, 0);
     cb->beginPass(rt, clearColor, dsClear);
-    cb->setGraphicsPipeline(m_spotPipeline);
-    cb->setViewport(QRhiViewport(0, 0, rt->pixelSize().width(), rt->pixelSize().height()));
     struct ShadowUboData
     {
         float lightViewProj[16];
@@ -588,23 +968,68 @@ void PassShadow::renderSpot(FrameContext &ctx,
     u->updateDynamicBuffer(m_spotShadowUbos[slot], 0, sizeof(ShadowUboData), &shadowData);
     cb->resourceUpdate(u);
 
-    for (Mesh &mesh : ctx.scene->meshes())
+    drawCasters(ctx, casters, QRhiViewport(0, 0, rt->pixelSize().width(), rt->pixelSize().height()),
+                m_spotPipeline, srb, m_spotInstancedPipeline);
+    cb->endPass();
+}
+
+void PassShadow::renderSpotBatch(FrameContext &ctx, int batch)
+{
+    if (!ctx.scene || !m_spotMultiViewPipeline || batch < 0 || batch >= m_spotMultiViewRts.size())
+        return;
+    QRhiCommandBuffer *cb = ctx.rhi->commandBuffer();
+    QRhiShaderResourceBindings *srb = viewSrb(ctx, m_spotMultiViewSrbs, m_spotMultiViewUbos, batch);
+    if (!cb || !srb)
+        return;
+
+    struct SpotViewsUboData
     {
-        if (mesh.gizmoAxis >= 0)
-            continue;
-        if (!mesh.visible)
-            continue;
-        if (!mesh.vertexBuffer || !mesh.indexBuffer || mesh.indexCount == 0)
-            continue;
-        QRhiShaderResourceBindings *meshSrb = spotShadowSrbForMesh(ctx, mesh, slot);
-        if (!meshSrb)
-            continue;
-        cb->setShaderResources(meshSrb);
+        float lightViewProj[kSpotViewsPerPass][16];
+        float lightPosNear[kSpotViewsPerPass][4];
+        float lightParams[kSpotViewsPerPass][4];
+        float shadowDepthParams[4];
+    } viewsData;
+    std::memset(&viewsData, 0, sizeof(viewsData));
 
-        const QRhiCommandBuffer::VertexInput vbufBinding(mesh.vertexBuffer, 0);
-        cb->setVertexInput(0, 1, &vbufBinding, mesh.indexBuffer, 0, QRhiCommandBuffer::IndexUInt32);
-        cb->drawIndexed(mesh.indexCount);
+    // A zero matrix clips everything, so unused layers just get cleared.
+    const Scene &scene = *ctx.scene;
+    const auto &lights = scene.lights();
+    m_casters.clear();
+    for (int v = 0; v < kSpotViewsPerPass; ++v)
+    {
+        const int slot = batch * kSpotViewsPerPass + v;
+        const SpotView &view = m_spotViews[slot];
+        if (view.lightIndex < 0)
+        {
+            m_spotSlots[slot] = SpotSlot();
+            continue;
+        }
+        const Light &light = lights[view.lightIndex];
+        std::memcpy(viewsData.lightViewProj[v], m_spotSlots[slot].lightViewProj.constData(), sizeof(viewsData.lightViewProj[v]));
+        viewsData.lightPosNear[v][0] = light.position.x();
+        viewsData.lightPosNear[v][1] = light.position.y();
+        viewsData.lightPosNear[v][2] = light.position.z();
+        viewsData.lightPosNear[v][3] = view.nearPlane;
+        viewsData.lightParams[v][0] = view.farPlane;
+        scene.shadowCasterBvh().query(MeshBvh::Frustum::fromMatrix(computeSpotViewProj(light, view.nearPlane, view.farPlane)),
+                                      m_casters);
     }
+    std::sort(m_casters.begin(), m_casters.end());
+    m_casters.erase(std::unique(m_casters.begin(), m_casters.end()), m_casters.end());
+    m_casters += scene.unboundedShadowCasters();
+    const QVector4D depthParams = ctx.shadows ? ctx.shadows->shadowDepthParams : QVector4D(1.0f, 0.0f, 0.0f, 0.0f);
+    viewsData.shadowDepthParams[0] = depthParams.x();
+    viewsData.shadowDepthParams[1] = depthParams.y();
+    viewsData.shadowDepthParams[2] = depthParams.z();
+    viewsData.shadowDepthParams[3] = depthParams.w();
+
+    QRhiTextureRenderTarget *rt = m_spotMultiViewRts[batch];
+    QRhiResourceUpdateBatch *u = ctx.rhi->rhi()->nextResourceUpdateBatch();
+    u->updateDynamicBuffer(m_spotMultiViewUbos[batch], 0, sizeof(SpotViewsUboData), &viewsData);
+    const QRhiDepthStencilClearValue dsClear(m_reverseZ ? 0.0f : 1.0f, 0);
+    cb->beginPass(rt, Qt::white, dsClear, u);
+    drawCasters(ctx, m_casters, QRhiViewport(0, 0, rt->pixelSize().width(), rt->pixelSize().height()),
+                m_spotMultiViewPipeline, srb, m_spotMultiViewInstancedPipeline);
     cb->endPass();
 }
 
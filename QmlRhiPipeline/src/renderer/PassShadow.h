@@ -1,17 +1,22 @@
 #pragma once
 
 #include "core/RenderGraph.h"
+#include "core/UniformRing.h"
 #include "scene/Mesh.h"
 #include <QtCore/QVector>
 #include <QtGui/QVector3D>
 
 class Camera;
+class Scene;
 struct Light;
 class QRhiRenderBuffer;
 
 class PassShadow final : public RenderPass
 {
 public:
+    const char *name() const override { return "PassShadow"; }
+    void setup(RenderGraphBuilder &builder, FrameContext &ctx) override;
+    void onCulled(FrameContext &ctx) override;
     void prepare(FrameContext &ctx) override;
     void execute(FrameContext &ctx) override;
 
@@ -23,31 +28,97 @@ private:
         QRhiTextureRenderTarget *rt = nullptr;
         QRhiRenderPassDescriptor *rpDesc = nullptr;
         QMatrix4x4 lightViewProj;
+        quint64 geometryRevision = 0;
+        bool cached = false;
+    };
+
+    // What a spot slot of the shadow map array was last rendered with, the slot
+    // is only rendered again when the light or the scene geometry changed.
+    struct SpotSlot
+    {
+        int lightIndex = -1;
+        QMatrix4x4 lightViewProj;
+        QVector4D lightPosFar;
+        quint64 geometryRevision = 0;
+        bool cached = false;
+    };
+
+    // Light rendered into a spot slot this frame.
+    struct SpotView
+    {
+        int lightIndex = -1;
+        float nearPlane = 1.0f;
+        float farPlane = 1.0f;
+        bool dirty = false;
+    };
+
+    // Casters sharing vertex and index buffers, drawn with one instanced call.
+    struct InstanceBatch
+    {
+        int mesh = -1;
+        int firstInstance = 0;
+        int instanceCount = 0;
     };
 
     void ensureResources(FrameContext &ctx);
-    void renderCascade(FrameContext &ctx, Cascade &cascade, const QMatrix4x4 &lightViewProj);
+    bool createSpotMultiViewTargets(FrameContext &ctx);
+    void releaseSpotMultiView();
+    void resetShadowData(FrameContext &ctx);
+    void invalidateShadowCache();
+    void updateLightMatrices(FrameContext &ctx);
+    const QVector<int> &collectCasters(const Scene &scene, const QMatrix4x4 &viewProj);
+    void updateInstanceBatches(FrameContext &ctx);
+    void drawCasters(FrameContext &ctx, const QVector<int> &casters, const QRhiViewport &viewport,
+                     QRhiGraphicsPipeline *pipeline, QRhiShaderResourceBindings *srb,
+                     QRhiGraphicsPipeline *instancedPipeline);
+    void renderCascade(FrameContext &ctx, Cascade &cascade, const QMatrix4x4 &lightViewProj,
+                       const QVector<int> &casters);
     void renderSpot(FrameContext &ctx,
                     QRhiTextureRenderTarget *rt,
+                    const QVector<int> &casters,
                     const QMatrix4x4 &lightViewProj,
                     const QVector3D &lightPos, float nearPlane, float farPlane,
                     int slot);
+    void renderSpotBatch(FrameContext &ctx, int batch);
     QMatrix4x4 computeLightViewProj(const Camera &camera, const QVector3D &lightDir, float nearPlane, float farPlane);
     QMatrix4x4 computeSpotViewProj(const Light &light, float nearPlane, float farPlane);
-    QRhiShaderResourceBindings *shadowSrbForMesh(FrameContext &ctx, Mesh &mesh);
-    QRhiShaderResourceBindings *spotShadowSrbForMesh(FrameContext &ctx, Mesh &mesh, int slot);
+    QRhiShaderResourceBindings *viewSrb(FrameContext &ctx, QVector<QRhiShaderResourceBindings *> &srbs,
+                                        const QVector<QRhiBuffer *> &ubos, int index);
 
     Cascade m_cascades[3];
     QRhiTexture *m_spotShadowMapArray = nullptr;
     QVector<QRhiRenderBuffer *> m_spotDepthStencils;
     QVector<QRhiTextureRenderTarget *> m_spotRts;
+    QVector<SpotSlot> m_spotSlots;
+    QVector<SpotView> m_spotViews;
+    QVector<int> m_casters;
+    QVector<InstanceBatch> m_instanceBatches;
+    QVector<int> m_casterBatches;
+    QVector<quint32> m_batchStamps;
+    QVector<int> m_batchesToDraw;
+    QRhiBuffer *m_instanceBuffer = nullptr;
+    quint64 m_instanceRevision = 0;
+    quint32 m_drawStamp = 0;
     QRhiRenderPassDescriptor *m_spotRpDesc = nullptr;
     QRhiGraphicsPipeline *m_pipeline = nullptr;
     QRhiGraphicsPipeline *m_spotPipeline = nullptr;
+    QRhiGraphicsPipeline *m_instancedPipeline = nullptr;
+    QRhiGraphicsPipeline *m_spotInstancedPipeline = nullptr;
+    QVector<QRhiShaderResourceBindings *> m_spotSrbs;
     QRhiShaderResourceBindings *m_srb = nullptr;
     QRhiBuffer *m_shadowUbo = nullptr;
     QVector<QRhiBuffer *> m_spotShadowUbos;
-    QRhiBuffer *m_modelUbo = nullptr;
+    // Multiview path: one render target per group of kSpotViewsPerPass layers.
+    QVector<QRhiTextureRenderTarget *> m_spotMultiViewRts;
+    QVector<QRhiBuffer *> m_spotMultiViewUbos;
+    QRhiTexture *m_spotMultiViewDepth = nullptr;
+    QRhiRenderPassDescriptor *m_spotMultiViewRpDesc = nullptr;
+    QRhiGraphicsPipeline *m_spotMultiViewPipeline = nullptr;
+    QRhiGraphicsPipeline *m_spotMultiViewInstancedPipeline = nullptr;
+    QVector<QRhiShaderResourceBindings *> m_spotMultiViewSrbs;
+    // Model matrix of every caster, bound with a dynamic offset.
+    UniformRing m_models;
+    QVector<quint32> m_modelOffsets; // per mesh
     int m_shadowSize = 2048;
     int m_spotShadowSize = 512;
     int m_maxSpotShadows = kMaxSpotShadows;
@@ -1,5 +1,16 @@
 #include "scene/AssimpLoader.h"
 
+AssimpLoader::~AssimpLoader()
+{
+    m_importPool.waitForDone();
+}
+
+void AssimpLoader::setImportFinishedCallback(std::function<void()> callback)
+{
+    QMutexLocker locker(&m_importMutex);
+    m_importFinished = std::move(callback);
+}
+
 #ifdef RHIPIPELINE_NO_ASSIMP
 bool AssimpLoader::loadModel(const QString &path, Scene &scene)
 {
@@ -15,6 +26,17 @@ bool AssimpLoader::loadModel(const QString &path, Scene &scene, bool append)
     Q_UNUSED(append);
     return false;
 }
+
+void AssimpLoader::releaseModel(const QString &path)
+{
+    Q_UNUSED(path);
+}
+
+bool AssimpLoader::requestModel(const QString &path)
+{
+    Q_UNUSED(path);
+    return true;
+}
 #else
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -27,17 +49,28 @@ bool AssimpLoader::loadModel(const QString &path, Scene &scene, bool append)
 #include <assimp/pbrmaterial.h>
 #endif
 #include <functional>
+#include <numeric>
 #include <QtCore/QByteArray>
 #include <QtCore/QDir>
 #include <QtCore/QFileInfo>
 #include <QtCore/QLatin1Char>
+#include <QtCore/QThreadPool>
 #include <QtCore/QUrl>
+#include <QtConcurrent/QtConcurrentMap>
 #include <QtGui/QColor>
 #include <QtGui/QImage>
 #include <QtGui/QMatrix4x4>
 #include <QtGui/QVector3D>
 #include <QtGui/QVector2D>
 
+#include "scene/ModelCache.h"
+
+static constexpr unsigned int kImportFlags = aiProcess_Triangulate
+        | aiProcess_GenSmoothNormals
+        | aiProcess_GenUVCoords
+        | aiProcess_CalcTangentSpace
+        | aiProcess_JoinIdenticalVertices;
+
 static QMatrix4x4 toQtMatrix(const aiMatrix4x4 &m)
 {
     QMatrix4x4 out;
@@ -183,22 +216,77 @@ static QImage buildMetallicRoughnessMap(const QImage &metalness, const QImage &r
     if (!roughScaled.isNull() && roughScaled.size() != size)
         roughScaled = roughScaled.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
 
+    // glTF layout: roughness in G, metalness in B. Each RGBA8888 texel is handled
+    // as one 32-bit word so the loops reduce to masks and shifts the compiler
+    // turns into SIMD code.
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    constexpr int kRedShift = 0;
+    constexpr int kGreenShift = 8;
+    constexpr int kBlueShift = 16;
+    constexpr int kAlphaShift = 24;
+#else
+    constexpr int kRedShift = 24;
+    constexpr int kGreenShift = 16;
+    constexpr int kBlueShift = 8;
+    constexpr int kAlphaShift = 0;
+#endif
+    const quint32 opaque = 0xffu << kAlphaShift;
+    const quint32 defaultRough = 0xffu << kGreenShift;
     QImage combined(size, QImage::Format_RGBA8888);
+    const int width = size.width();
     for (int y = 0; y < size.height(); ++y)
     {
-        const QRgb *metalLine = metalScaled.isNull() ? nullptr : reinterpret_cast<const QRgb *>(metalScaled.constScanLine(y));
-        const QRgb *roughLine = roughScaled.isNull() ? nullptr : reinterpret_cast<const QRgb *>(roughScaled.constScanLine(y));
-        QRgb *outLine = reinterpret_cast<QRgb *>(combined.scanLine(y));
-        for (int x = 0; x < size.width(); ++x)
+        const quint32 *metalLine = metalScaled.isNull() ? nullptr : reinterpret_cast<const quint32 *>(metalScaled.constScanLine(y));
+        const quint32 *roughLine = roughScaled.isNull() ? nullptr : reinterpret_cast<const quint32 *>(roughScaled.constScanLine(y));
+        quint32 *outLine = reinterpret_cast<quint32 *>(combined.scanLine(y));
+        if (metalLine && roughLine)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                outLine[x] = opaque
+                        | (((roughLine[x] >> kRedShift) & 0xffu) << kGreenShift)
+                        | (((metalLine[x] >> kRedShift) & 0xffu) << kBlueShift);
+            }
+        }
+        else if (metalLine)
+        {
+            for (int x = 0; x < width; ++x)
+                outLine[x] = opaque | defaultRough | (((metalLine[x] >> kRedShift) & 0xffu) << kBlueShift);
+        }
+        else
         {
-            const int metalValue = metalLine ? qRed(metalLine[x]) : 0;
-            const int roughValue = roughLine ? qRed(roughLine[x]) : 255;
-            outLine[x] = qRgba(0, roughValue, metalValue, 255);
+            for (int x = 0; x < width; ++x)
+                outLine[x] = opaque | (((roughLine[x] >> kRedShift) & 0xffu) << kGreenShift);
         }
     }
     return combined;
 }
 
+static QVector<QImage> buildMipChain(const QImage &image)
+{
+    QVector<QImage> mips;
+    if (image.isNull())
+        return mips;
+    QImage level = image;
+    while (level.width() > 1 || level.height() > 1)
+    {
+        const QSize size(qMax(1, level.width() / 2), qMax(1, level.height() / 2));
+        level = level.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation)
+                .convertToFormat(QImage::Format_RGBA8888);
+        mips.push_back(level);
+    }
+    return mips;
+}
+
+static void buildMaterialMips(Material &material)
+{
+    material.baseColorMips = buildMipChain(material.baseColorMap);
+    material.normalMips = buildMipChain(material.normalMap);
+    material.metallicRoughnessMips = buildMipChain(material.metallicRoughnessMap);
+    material.occlusionMips = buildMipChain(material.occlusionMap);
+    material.emissiveMips = buildMipChain(material.emissiveMap);
+}
+
 static void readMaterial(const aiScene *scene, const QString &modelPath, const aiMaterial *mat, Material &out)
 {
     aiColor4D color;
@@ -292,28 +380,33 @@ static void readMaterial(const aiScene *scene, const QString &modelPath, const a
 #endif
 }
 
-bool AssimpLoader::loadModel(const QString &path, Scene &scene)
-{
-    return loadModel(path, scene, false);
-}
-
-bool AssimpLoader::loadModel(const QString &path, Scene &scene, bool append)
+static bool importModel(const QString &resolvedPath, QVector<Mesh> &meshes, QThreadPool *pool)
 {
-    if (!append)
-        scene.meshes().clear();
+    if (ModelCache::load(resolvedPath, kImportFlags, meshes))
+    {
+        for (Mesh &mesh : meshes)
+            buildPickGeometry(mesh);
+        return true;
+    }
 
     Assimp::Importer importer;
     importer.SetPropertyFloat(AI_CONFIG_PP_GSN_MAX_SMOOTHING_ANGLE, 60.0f);
-    const QString resolvedPath = resolveModelPath(path);
-    const aiScene *ai = importer.ReadFile(resolvedPath.toStdString(),
-                                         aiProcess_Triangulate |
-                                         aiProcess_GenSmoothNormals |
-                                         aiProcess_GenUVCoords |
-                                         aiProcess_CalcTangentSpace |
-                                         aiProcess_JoinIdenticalVertices);
+    const aiScene *ai = importer.ReadFile(resolvedPath.toStdString(), kImportFlags);
     if (!ai)
         return false;
 
+    // Materials are read once and shared by their meshes. Each one decodes its
+    // textures and builds their mips in its own task on the import pool, which
+    // lends the importing thread back while it waits.
+    QVector<Material> materials(int(ai->mNumMaterials));
+    Material *materialData = materials.data();
+    QVector<int> materialIndices(materials.size());
+    std::iota(materialIndices.begin(), materialIndices.end(), 0);
+    QtConcurrent::blockingMap(pool, materialIndices, [ai, &resolvedPath, materialData](int i) {
+        readMaterial(ai, resolvedPath, ai->mMaterials[i], materialData[i]);
+        buildMaterialMips(materialData[i]);
+    });
+
     std::function<void(aiNode *, const QMatrix4x4 &)> visitNode;
     visitNode = [&](aiNode *node, const QMatrix4x4 &parent)
     {
@@ -443,12 +536,9 @@ bool AssimpLoader::loadModel(const QString &path, Scene &scene, bool append)
             }
 
             if (m->mMaterialIndex < ai->mNumMaterials)
-            {
-                const aiMaterial *mat = ai->mMaterials[m->mMaterialIndex];
-                readMaterial(ai, resolvedPath, mat, mesh.material);
-            }
+                mesh.material = materials[int(m->mMaterialIndex)];
 
-            scene.meshes().push_back(mesh);
+            meshes.push_back(mesh);
         }
 
         for (unsigned int c = 0; c < node->mNumChildren; ++c)
@@ -456,6 +546,112 @@ bool AssimpLoader::loadModel(const QString &path, Scene &scene, bool append)
     };
 
     visitNode(ai->mRootNode, QMatrix4x4());
+    ModelCache::store(resolvedPath, kImportFlags, meshes);
+    for (Mesh &mesh : meshes)
+        buildPickGeometry(mesh);
+    return true;
+}
+
+bool AssimpLoader::loadModel(const QString &path, Scene &scene)
+{
+    return loadModel(path, scene, false);
+}
+
+bool AssimpLoader::loadModel(const QString &path, Scene &scene, bool append)
+{
+    if (!append)
+        scene.meshes().clear();
+
+    const QString resolvedPath = resolveModelPath(path);
+    if (isKnownFailure(resolvedPath))
+        return false;
+    auto it = m_cache.find(resolvedPath);
+    if (it == m_cache.end())
+    {
+        // Without a prior requestModel() the import runs right here.
+        CachedModel model;
+        if (!importModel(resolvedPath, model.meshes, &m_importPool))
+        {
+            m_failed.insert(resolvedPath, QFileInfo(resolvedPath).lastModified());
+            return false;
+        }
+        it = m_cache.insert(resolvedPath, model);
+    }
+    ++it->refCount;
+    scene.meshes() += it->meshes;
+    // The copies hold on to the data until the renderer has uploaded it. Later
+    // copies find the uploaded buffers and textures through their pick geometry.
+    if (scene.cpuDataRetention() == Scene::CpuDataRetention::ReleaseAfterUpload)
+    {
+        for (Mesh &mesh : it->meshes)
+            releaseCpuData(mesh);
+    }
     return !scene.meshes().isEmpty();
 }
+
+void AssimpLoader::releaseModel(const QString &path)
+{
+    auto it = m_cache.find(resolveModelPath(path));
+    if (it == m_cache.end())
+        return;
+    if (--it->refCount <= 0)
+        m_cache.erase(it);
+}
+
+bool AssimpLoader::requestModel(const QString &path)
+{
+    const QString resolvedPath = resolveModelPath(path);
+    if (m_cache.contains(resolvedPath) || isKnownFailure(resolvedPath))
+        return true;
+
+    QMutexLocker locker(&m_importMutex);
+    auto it = m_imports.find(resolvedPath);
+    if (it == m_imports.end())
+    {
+        m_imports.insert(resolvedPath, PendingImport());
+        m_importPool.start([this, resolvedPath]() {
+            QVector<Mesh> meshes;
+            const bool ok = importModel(resolvedPath, meshes, &m_importPool);
+            std::function<void()> finished;
+            {
+                QMutexLocker locker(&m_importMutex);
+                PendingImport &import = m_imports[resolvedPath];
+                import.finished = true;
+                import.ok = ok;
+                import.meshes = meshes;
+                finished = m_importFinished;
+            }
+            if (finished)
+                finished();
+        });
+        return false;
+    }
+    if (!it->finished)
+        return false;
+
+    // Finished imports move to the cache on the calling thread.
+    if (it->ok)
+    {
+        CachedModel model;
+        model.meshes = it->meshes;
+        m_cache.insert(resolvedPath, model);
+    }
+    else
+    {
+        m_failed.insert(resolvedPath, QFileInfo(resolvedPath).lastModified());
+    }
+    m_imports.erase(it);
+    return true;
+}
+
+bool AssimpLoader::isKnownFailure(const QString &resolvedPath)
+{
+    const auto it = m_failed.constFind(resolvedPath);
+    if (it == m_failed.constEnd())
+        return false;
+    if (QFileInfo(resolvedPath).lastModified() == it.value())
+        return true;
+    m_failed.erase(it);
+    return false;
+}
 #endif
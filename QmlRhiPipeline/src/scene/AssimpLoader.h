@@ -1,12 +1,57 @@
 #pragma once
 
+#include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
 #include <QtCore/QString>
+#include <QtCore/QThreadPool>
+#include <QtCore/QVector>
+#include <functional>
 
 #include "scene/Scene.h"
 
 class AssimpLoader
 {
 public:
+    ~AssimpLoader();
+
     bool loadModel(const QString &path, Scene &scene);
     bool loadModel(const QString &path, Scene &scene, bool append);
+    // Drops a reference taken by loadModel(), the cached import goes with the last one.
+    void releaseModel(const QString &path);
+
+    // Starts importing `path` on a worker thread if needed. Returns true once
+    // loadModel() can run without blocking, either on the cached model or on
+    // a known failure. The callback runs on the worker when an import ends,
+    // it must not touch objects of other threads.
+    bool requestModel(const QString &path);
+    void setImportFinishedCallback(std::function<void()> callback);
+
+private:
+    // Meshes imported from one file. They are appended as implicitly shared copies,
+    // so every instance of a model shares its vertices, indices and texture images,
+    // or only its pick geometry once the scene releases CPU data after upload.
+    struct CachedModel
+    {
+        QVector<Mesh> meshes;
+        int refCount = 0;
+    };
+    struct PendingImport
+    {
+        bool finished = false;
+        bool ok = false;
+        QVector<Mesh> meshes;
+    };
+
+    // False while a failed import's file is unchanged, so that it is retried
+    // once the file is fixed.
+    bool isKnownFailure(const QString &resolvedPath);
+
+    QHash<QString, CachedModel> m_cache;
+    QHash<QString, QDateTime> m_failed; // modification time at the failure
+    QMutex m_importMutex;
+    QHash<QString, PendingImport> m_imports;
+    std::function<void()> m_importFinished;
+    QThreadPool m_importPool;
 };
@@ -0,0 +1,223 @@
+#include "scene/LightBuffer.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QtMath>
+#include <algorithm>
+
+#include "scene/Scene.h"
+
+void LightBuffer::setMaxCapacity(int capacity)
+{
+    if (m_maxCapacity == capacity)
+        return;
+    m_maxCapacity = capacity;
+    markAllDirty();
+}
+
+void LightBuffer::setMaxGoboLayers(int layers)
+{
+    if (m_maxGoboLayers == layers)
+        return;
+    m_maxGoboLayers = layers;
+    markAllDirty();
+}
+
+void LightBuffer::markLightDirty(int index)
+{
+    if (!m_allDirty)
+        m_dirtyLights.push_back(index);
+}
+
+void LightBuffer::markAllDirty()
+{
+    m_allDirty = true;
+    m_dirtyLights.clear();
+}
+
+void LightBuffer::update(const Scene &scene)
+{
+    const QVector<Light> &lights = scene.lights();
+    int capacity = qMax(kMinCapacity, m_capacity);
+    while (capacity < lights.size())
+        capacity *= 2;
+    if (m_maxCapacity > 0)
+        capacity = qMin(capacity, m_maxCapacity);
+    if (capacity != m_capacity)
+    {
+        m_capacity = capacity;
+        markAllDirty();
+    }
+    const int count = qMin(int(lights.size()), m_capacity);
+    for (int i = m_lightCount; i < count; ++i)
+        markLightDirty(i);
+    m_lightCount = count;
+
+    bool goboDirty = m_allDirty || m_lightGoboPaths.size() != count;
+    for (int i = 0; i < m_dirtyLights.size() && !goboDirty; ++i)
+    {
+        const int index = m_dirtyLights[i];
+        if (index >= count)
+            continue;
+        const Light &l = lights[index];
+        const QString path = l.type == Light::Type::Spot ? l.goboPath : QString();
+        goboDirty = path != m_lightGoboPaths[index];
+    }
+    if (goboDirty)
+        assignGoboLayers(lights);
+
+    QVector<Range> ranges;
+    if (m_allDirty)
+    {
+        m_data.fill(QVector4D(), kHeaderVec4Count + kArrayCount * m_capacity);
+        packHeader(scene);
+        for (int i = 0; i < count; ++i)
+            packLight(i, lights[i]);
+        ranges.push_back({ 0, int(m_data.size()) });
+    }
+    else
+    {
+        if (packHeader(scene))
+            ranges.push_back({ 0, kHeaderVec4Count });
+        std::sort(m_dirtyLights.begin(), m_dirtyLights.end());
+        m_dirtyLights.erase(std::unique(m_dirtyLights.begin(), m_dirtyLights.end()), m_dirtyLights.end());
+        int i = 0;
+        while (i < m_dirtyLights.size() && m_dirtyLights[i] < count)
+        {
+            const int first = m_dirtyLights[i];
+            int last = first;
+            packLight(first, lights[first]);
+            ++i;
+            while (i < m_dirtyLights.size() && m_dirtyLights[i] == last + 1 && m_dirtyLights[i] < count)
+            {
+                last = m_dirtyLights[i];
+                packLight(last, lights[last]);
+                ++i;
+            }
+            for (int array = 0; array < kArrayCount; ++array)
+                ranges.push_back({ kHeaderVec4Count + array * m_capacity + first, last - first + 1 });
+        }
+    }
+    m_dirtyLights.clear();
+    m_allDirty = false;
+    if (ranges.isEmpty())
+        return;
+    m_ranges = ranges;
+    m_previousRevision = m_revision;
+    ++m_revision;
+}
+
+QVector<LightBuffer::Range> LightBuffer::rangesSince(quint64 revision) const
+{
+    if (revision == m_revision)
+        return {};
+    if (revision == m_previousRevision)
+        return m_ranges;
+    return { { 0, int(m_data.size()) } };
+}
+
+void LightBuffer::assignGoboLayers(const QVector<Light> &lights)
+{
+    // Spots projecting the same image share a layer. Images still in use keep
+    // their layer so the renderer does not upload them again.
+    m_lightGoboPaths.resize(m_lightCount);
+    QHash<QString, int> layers;
+    QVector<bool> taken;
+    for (int i = 0; i < m_lightCount; ++i)
+    {
+        const Light &l = lights[i];
+        m_lightGoboPaths[i] = l.type == Light::Type::Spot ? l.goboPath : QString();
+        const QString &path = m_lightGoboPaths[i];
+        if (path.isEmpty() || layers.contains(path))
+            continue;
+        const int layer = m_goboLayers.value(path, -1);
+        layers.insert(path, layer);
+        if (layer < 0)
+            continue;
+        if (layer >= taken.size())
+            taken.resize(layer + 1);
+        taken[layer] = true;
+    }
+
+    int next = 0;
+    int layerCount = 0;
+    for (auto it = layers.begin(); it != layers.end(); ++it)
+    {
+        if (it.value() < 0)
+        {
+            while (next < taken.size() && taken[next])
+                ++next;
+            if (m_maxGoboLayers > 0 && next >= m_maxGoboLayers)
+            {
+                qWarning() << "LightBuffer: gobo array full, ignoring" << it.key();
+                continue;
+            }
+            it.value() = next++;
+        }
+        layerCount = qMax(layerCount, it.value() + 1);
+    }
+    m_goboLayers = layers;
+    m_goboLayerCount = layerCount;
+
+    m_lightGoboLayers.resize(m_lightCount);
+    for (int i = 0; i < m_lightCount; ++i)
+    {
+        const QString &path = m_lightGoboPaths[i];
+        const int layer = path.isEmpty() ? -1 : layers.value(path, -1);
+        if (layer == m_lightGoboLayers[i])
+            continue;
+        m_lightGoboLayers[i] = layer;
+        markLightDirty(i);
+    }
+}
+
+bool LightBuffer::packHeader(const Scene &scene)
+{
+    const QVector3D ambient = scene.ambientLight() * scene.ambientIntensity();
+    const QVector4D header[kHeaderVec4Count] = {
+        QVector4D(float(m_lightCount), ambient.x(), ambient.y(), ambient.z()),
+        QVector4D(scene.smokeAmount(),
+                  float(static_cast<int>(scene.beamModel())),
+                  scene.bloomIntensity(),
+                  scene.bloomRadius()),
+        QVector4D(scene.volumetricEnabled() ? 1.0f : 0.0f,
+                  scene.smokeNoiseEnabled() ? 1.0f : 0.0f,
+                  scene.shadowsEnabled() ? 1.0f : 0.0f,
+                  0.0f),
+        QVector4D(float(m_capacity), 0.0f, 0.0f, 0.0f)
+    };
+    bool changed = false;
+    for (int i = 0; i < kHeaderVec4Count; ++i)
+    {
+        if (m_data[i] == header[i])
+            continue;
+        m_data[i] = header[i];
+        changed = true;
+    }
+    return changed;
+}
+
+void LightBuffer::packLight(int index, const Light &l)
+{
+    QVector4D *beam = m_data.data() + kHeaderVec4Count;
+    QVector4D *posRange = beam + m_capacity;
+    QVector4D *colorIntensity = posRange + m_capacity;
+    QVector4D *dirInner = colorIntensity + m_capacity;
+    QVector4D *other = dirInner + m_capacity;
+    beam[index] = QVector4D(l.beamRadius, float(l.beamShape), 0.0f, 0.0f);
+    posRange[index] = QVector4D(l.position, l.range);
+    colorIntensity[index] = QVector4D(l.color, l.intensity);
+    dirInner[index] = QVector4D(l.direction.normalized(), qCos(l.innerCone));
+    float extraZ = 0.0f;
+    float extraW = 0.0f;
+    if (l.type == Light::Type::Area)
+    {
+        extraZ = l.areaSize.x();
+        extraW = l.areaSize.y();
+    }
+    else if (l.type == Light::Type::Spot)
+    {
+        extraZ = index < m_lightGoboLayers.size() ? float(m_lightGoboLayers[index]) : -1.0f;
+        extraW = float(l.qualitySteps);
+    }
+    other[index] = QVector4D(qCos(l.outerCone), float(l.type), extraZ, extraW);
+}
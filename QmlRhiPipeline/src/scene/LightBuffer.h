@@ -0,0 +1,68 @@
+#pragma once
+
+#include <QtCore/QHash>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+#include <QtGui/QVector4D>
+
+class Scene;
+struct Light;
+
+// CPU side of the light storage read by the lighting shaders and light_cull.comp:
+// a header of count/params/flags/layout followed by five arrays of `capacity`
+// vec4 (beam, posRange, colorIntensity, dirInner, other). Only lights marked
+// dirty are repacked and the touched vec4 ranges are kept for the GPU copies.
+class LightBuffer
+{
+public:
+    static constexpr int kHeaderVec4Count = 4;
+    static constexpr int kArrayCount = 5;
+    static constexpr int kMinCapacity = 16;
+    // D3D11 reads the lights from a constant buffer, which cannot be runtime sized.
+    static constexpr int kMaxUniformLights = 256;
+
+    struct Range
+    {
+        int offset = 0;
+        int count = 0;
+    };
+
+    void setMaxCapacity(int capacity);
+    void setMaxGoboLayers(int layers);
+    void markLightDirty(int index);
+    void markAllDirty();
+    void update(const Scene &scene);
+
+    int capacity() const { return m_capacity; }
+    int lightCount() const { return m_lightCount; }
+    int vec4Count() const { return m_data.size(); }
+    quint32 byteSize() const { return quint32(m_data.size() * sizeof(QVector4D)); }
+    const QVector4D *constData() const { return m_data.constData(); }
+    quint64 revision() const { return m_revision; }
+    // Ranges a GPU copy synced at `revision` has to upload, everything when it is
+    // more than one update behind.
+    QVector<Range> rangesSince(quint64 revision) const;
+
+    const QHash<QString, int> &goboLayers() const { return m_goboLayers; }
+    int goboLayerCount() const { return m_goboLayerCount; }
+
+private:
+    void assignGoboLayers(const QVector<Light> &lights);
+    bool packHeader(const Scene &scene);
+    void packLight(int index, const Light &light);
+
+    QVector<QVector4D> m_data;
+    QVector<Range> m_ranges;
+    QVector<int> m_dirtyLights;
+    QVector<QString> m_lightGoboPaths;
+    QVector<int> m_lightGoboLayers;
+    QHash<QString, int> m_goboLayers;
+    int m_goboLayerCount = 0;
+    int m_maxGoboLayers = 0;
+    int m_maxCapacity = 0;
+    int m_capacity = 0;
+    int m_lightCount = 0;
+    bool m_allDirty = true;
+    quint64 m_revision = 1;
+    quint64 m_previousRevision = 0;
+};
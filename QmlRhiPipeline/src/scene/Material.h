@@ -1,6 +1,7 @@
 #pragma once
 
 #include <QtCore/QString>
+#include <QtCore/QVector>
 #include <QtGui/QImage>
 #include <QtGui/QVector3D>
 
@@ -31,4 +32,10 @@ struct Material
     QImage occlusionMap;
     QString emissiveMapPath;
     QImage emissiveMap;
+    // Mip levels 1..n of each map, filled in by the loader.
+    QVector<QImage> baseColorMips;
+    QVector<QImage> normalMips;
+    QVector<QImage> metallicRoughnessMips;
+    QVector<QImage> occlusionMips;
+    QVector<QImage> emissiveMips;
 };
@@ -1,3 +1,69 @@
 #include "scene/Mesh.h"
 
-// Mesh is a plain data struct.
+void buildPickGeometry(Mesh &mesh)
+{
+    if (mesh.vertices.isEmpty())
+        return;
+
+    if (!mesh.boundsValid)
+    {
+        QVector3D minV(mesh.vertices[0].px, mesh.vertices[0].py, mesh.vertices[0].pz);
+        QVector3D maxV = minV;
+        for (const Vertex &v : mesh.vertices)
+        {
+            minV = QVector3D(qMin(minV.x(), v.px), qMin(minV.y(), v.py), qMin(minV.z(), v.pz));
+            maxV = QVector3D(qMax(maxV.x(), v.px), qMax(maxV.y(), v.py), qMax(maxV.z(), v.pz));
+        }
+        mesh.boundsMin = minV;
+        mesh.boundsMax = maxV;
+        mesh.boundsValid = true;
+    }
+
+    if (mesh.pickGeometry)
+        return;
+    QSharedPointer<MeshPickGeometry> pick = QSharedPointer<MeshPickGeometry>::create();
+    pick->positions.reserve(mesh.vertices.size());
+    QVector3D normalSum(0.0f, 0.0f, 0.0f);
+    for (const Vertex &v : mesh.vertices)
+    {
+        pick->positions.push_back(QVector3D(v.px, v.py, v.pz));
+        normalSum += QVector3D(v.nx, v.ny, v.nz);
+    }
+    pick->indices = mesh.indices;
+    if (pick->indices.isEmpty())
+    {
+        pick->indices.reserve(mesh.vertices.size());
+        for (int i = 0; i < mesh.vertices.size(); ++i)
+            pick->indices.push_back(quint32(i));
+    }
+    pick->bvh.build(pick->positions, pick->indices);
+    if (!normalSum.isNull())
+        pick->averageNormal = normalSum.normalized();
+    mesh.pickGeometry = pick;
+}
+
+void releaseCpuData(Mesh &mesh)
+{
+    buildPickGeometry(mesh);
+    mesh.vertices = QVector<Vertex>();
+    mesh.indices = QVector<quint32>();
+
+    Material &material = mesh.material;
+    material.baseColorMap = QImage();
+    material.normalMap = QImage();
+    material.metallicRoughnessMap = QImage();
+    material.occlusionMap = QImage();
+    material.emissiveMap = QImage();
+    material.baseColorMips = QVector<QImage>();
+    material.normalMips = QVector<QImage>();
+    material.metallicRoughnessMips = QVector<QImage>();
+    material.occlusionMips = QVector<QImage>();
+    material.emissiveMips = QVector<QImage>();
+}
+
+void releaseMesh(Mesh &mesh)
+{
+    mesh = Mesh();
+    mesh.visible = false;
+    mesh.selectable = false;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <QtCore/QSharedPointer>
 #include <QtCore/QVector>
 #include <QtCore/QString>
 #include <QtGui/QMatrix4x4>
@@ -8,6 +9,7 @@
 #include <rhi/qrhi.h>
 
 #include "scene/Material.h"
+#include "scene/MeshBvh.h"
 
 struct Vertex
 {
@@ -16,11 +18,22 @@ struct Vertex
     float u, v;
 };
 
+// Position-only copy of a mesh's triangles. It outlives the vertex data, which
+// is dropped once uploaded, and is shared by every copy of a loaded mesh.
+struct MeshPickGeometry
+{
+    QVector<QVector3D> positions;
+    QVector<quint32> indices; // in the triangle order of the BVH
+    TriangleBvh bvh;
+    QVector3D averageNormal = QVector3D(0.0f, -1.0f, 0.0f);
+};
+
 struct Mesh
 {
     QString name;
     QVector<Vertex> vertices;
     QVector<quint32> indices;
+    QSharedPointer<const MeshPickGeometry> pickGeometry;
     QRhiBuffer *vertexBuffer = nullptr;
     QRhiBuffer *indexBuffer = nullptr;
     QRhiTexture *baseColorTexture = nullptr;
@@ -33,12 +46,8 @@ struct Mesh
     QRhiSampler *metallicRoughnessSampler = nullptr;
     QRhiSampler *occlusionSampler = nullptr;
     QRhiSampler *emissiveSampler = nullptr;
-    QRhiBuffer *modelUbo = nullptr;
-    QRhiBuffer *materialUbo = nullptr;
+    // Shared by the meshes with the same textures, owned by PassGBuffer.
     QRhiShaderResourceBindings *srb = nullptr;
-    QRhiShaderResourceBindings *gizmoSrb = nullptr;
-    QRhiShaderResourceBindings *shadowSrb = nullptr;
-    QVector<QRhiShaderResourceBindings *> spotShadowSrbs;
     int indexCount = 0;
     QMatrix4x4 baseModelMatrix;
     QMatrix4x4 modelMatrix;
@@ -62,3 +71,13 @@ struct Mesh
     int selectionGroup = -1;
     Material material;
 };
+
+// Fills in the local bounds and the pick geometry from the vertex data, unless
+// the mesh already has them.
+void buildPickGeometry(Mesh &mesh);
+// Drops the vertex, index and texture image data, the bounds and the pick
+// geometry are built first and kept.
+void releaseCpuData(Mesh &mesh);
+// Empties a mesh whose item is gone. Its slot stays in the scene, hidden, and
+// the renderer frees the GPU resources once no other mesh shares them.
+void releaseMesh(Mesh &mesh);
@@ -0,0 +1,467 @@
+#include "scene/MeshBvh.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "scene/Mesh.h"
+
+namespace {
+
+constexpr int kMaxLeafItems = 4;
+constexpr int kMaxLeafTriangles = 8;
+
+struct Ray
+{
+    explicit Ray(const QVector3D &o, const QVector3D &d)
+        : origin(o)
+        , dir(d)
+    {
+        // A huge value instead of infinity keeps 0 * invDir out of NaN land.
+        for (int axis = 0; axis < 3; ++axis)
+            invDir[axis] = std::abs(d[axis]) > 1e-12f ? 1.0f / d[axis] : std::copysign(1e30f, d[axis]);
+    }
+
+    QVector3D origin;
+    QVector3D dir;
+    QVector3D invDir;
+};
+
+bool rayEntersBox(const Ray &ray, const QVector3D &boundsMin, const QVector3D &boundsMax,
+                  float tMax, float &tEntry)
+{
+    float t0 = 0.0f;
+    float t1 = tMax;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        float tNear = (boundsMin[axis] - ray.origin[axis]) * ray.invDir[axis];
+        float tFar = (boundsMax[axis] - ray.origin[axis]) * ray.invDir[axis];
+        if (tNear > tFar)
+            std::swap(tNear, tFar);
+        t0 = qMax(t0, tNear);
+        t1 = qMin(t1, tFar);
+        if (t0 > t1)
+            return false;
+    }
+    tEntry = t0;
+    return true;
+}
+
+bool rayHitsTriangle(const Ray &ray, const QVector3D &v0, const QVector3D &v1, const QVector3D &v2,
+                     float &tOut)
+{
+    const float eps = 1e-6f;
+    const QVector3D e1 = v1 - v0;
+    const QVector3D e2 = v2 - v0;
+    const QVector3D p = QVector3D::crossProduct(ray.dir, e2);
+    const float det = QVector3D::dotProduct(e1, p);
+    if (std::abs(det) < eps * eps)
+        return false;
+    const float invDet = 1.0f / det;
+    const QVector3D t = ray.origin - v0;
+    const float u = QVector3D::dotProduct(t, p) * invDet;
+    if (u < 0.0f || u > 1.0f)
+        return false;
+    const QVector3D q = QVector3D::crossProduct(t, e1);
+    const float v = QVector3D::dotProduct(ray.dir, q) * invDet;
+    if (v < 0.0f || (u + v) > 1.0f)
+        return false;
+    const float tHit = QVector3D::dotProduct(e2, q) * invDet;
+    if (tHit <= eps)
+        return false;
+    tOut = tHit;
+    return true;
+}
+
+// Pushes the children of an inner node that the ray enters, the nearer one last
+// so that it's walked first.
+void pushChildren(const Ray &ray, const QVector3D *childMin, const QVector3D *childMax, int left,
+                  float tMax, int *stack, int &top)
+{
+    float tLeft = 0.0f;
+    float tRight = 0.0f;
+    const bool hitLeft = rayEntersBox(ray, childMin[0], childMax[0], tMax, tLeft);
+    const bool hitRight = rayEntersBox(ray, childMin[1], childMax[1], tMax, tRight);
+    if (hitLeft && hitRight)
+    {
+        stack[top++] = tLeft <= tRight ? left + 1 : left;
+        stack[top++] = tLeft <= tRight ? left : left + 1;
+    }
+    else if (hitLeft)
+    {
+        stack[top++] = left;
+    }
+    else if (hitRight)
+    {
+        stack[top++] = left + 1;
+    }
+}
+
+} // namespace
+
+MeshBvh::Frustum MeshBvh::Frustum::fromMatrix(const QMatrix4x4 &viewProj)
+{
+    const QVector4D r0 = viewProj.row(0);
+    const QVector4D r1 = viewProj.row(1);
+    const QVector4D r2 = viewProj.row(2);
+    const QVector4D r3 = viewProj.row(3);
+    Frustum frustum;
+    frustum.planes[0] = r3 + r0;
+    frustum.planes[1] = r3 - r0;
+    frustum.planes[2] = r3 + r1;
+    frustum.planes[3] = r3 - r1;
+    frustum.planes[4] = r3 + r2;
+    frustum.planes[5] = r3 - r2;
+    return frustum;
+}
+
+bool MeshBvh::Frustum::intersects(const QVector3D &boundsMin, const QVector3D &boundsMax) const
+{
+    for (const QVector4D &p : planes)
+    {
+        const QVector3D corner(p.x() >= 0.0f ? boundsMax.x() : boundsMin.x(),
+                               p.y() >= 0.0f ? boundsMax.y() : boundsMin.y(),
+                               p.z() >= 0.0f ? boundsMax.z() : boundsMin.z());
+        if (QVector3D::dotProduct(p.toVector3D(), corner) + p.w() < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+void MeshBvh::build(const QVector<Mesh> &meshes, const QVector<int> &meshIndices)
+{
+    clear();
+    if (meshIndices.isEmpty())
+        return;
+    m_items.reserve(meshIndices.size());
+    for (int index : meshIndices)
+    {
+        const Mesh &mesh = meshes[index];
+        m_items.push_back({ mesh.worldBoundsMin, mesh.worldBoundsMax,
+                            (mesh.worldBoundsMin + mesh.worldBoundsMax) * 0.5f, index });
+    }
+    m_nodes.reserve(2 * (m_items.size() / kMaxLeafItems + 1));
+    m_nodes.push_back(Node());
+    buildNode(0, 0, m_items.size());
+
+    m_itemLeaves.resize(m_items.size());
+    for (int nodeIndex = 0; nodeIndex < m_nodes.size(); ++nodeIndex)
+    {
+        const Node &node = m_nodes[nodeIndex];
+        for (int i = node.first; i < node.first + node.count; ++i)
+            m_itemLeaves[i] = nodeIndex;
+    }
+    m_meshItems.fill(-1, meshes.size());
+    for (int i = 0; i < m_items.size(); ++i)
+        m_meshItems[m_items[i].meshIndex] = i;
+}
+
+void MeshBvh::refit(const QVector<Mesh> &meshes, const QVector<int> &meshIndices)
+{
+    for (int index : meshIndices)
+    {
+        const int itemIndex = m_meshItems.value(index, -1);
+        if (itemIndex < 0)
+            continue;
+        const Mesh &mesh = meshes[index];
+        Item &item = m_items[itemIndex];
+        item.boundsMin = mesh.worldBoundsMin;
+        item.boundsMax = mesh.worldBoundsMax;
+        item.center = (mesh.worldBoundsMin + mesh.worldBoundsMax) * 0.5f;
+        // Stops where the bounds stay the same, the nodes above don't change.
+        for (int nodeIndex = m_itemLeaves[itemIndex]; nodeIndex >= 0 && fitNode(nodeIndex);)
+            nodeIndex = m_nodes[nodeIndex].parent;
+    }
+}
+
+void MeshBvh::clear()
+{
+    m_nodes.clear();
+    m_items.clear();
+    m_itemLeaves.clear();
+    m_meshItems.clear();
+}
+
+bool MeshBvh::fitNode(int nodeIndex)
+{
+    Node &node = m_nodes[nodeIndex];
+    QVector3D boundsMin;
+    QVector3D boundsMax;
+    const auto bounds = [&](int i, const QVector3D &childMin, const QVector3D &childMax) {
+        if (i == 0)
+        {
+            boundsMin = childMin;
+            boundsMax = childMax;
+            return;
+        }
+        boundsMin = QVector3D(qMin(boundsMin.x(), childMin.x()),
+                              qMin(boundsMin.y(), childMin.y()),
+                              qMin(boundsMin.z(), childMin.z()));
+        boundsMax = QVector3D(qMax(boundsMax.x(), childMax.x()),
+                              qMax(boundsMax.y(), childMax.y()),
+                              qMax(boundsMax.z(), childMax.z()));
+    };
+    if (node.count > 0)
+    {
+        for (int i = 0; i < node.count; ++i)
+            bounds(i, m_items[node.first + i].boundsMin, m_items[node.first + i].boundsMax);
+    }
+    else
+    {
+        for (int i = 0; i < 2; ++i)
+            bounds(i, m_nodes[node.first + i].boundsMin, m_nodes[node.first + i].boundsMax);
+    }
+    if (boundsMin == node.boundsMin && boundsMax == node.boundsMax)
+        return false;
+    node.boundsMin = boundsMin;
+    node.boundsMax = boundsMax;
+    return true;
+}
+
+void MeshBvh::buildNode(int nodeIndex, int first, int count)
+{
+    QVector3D boundsMin = m_items[first].boundsMin;
+    QVector3D boundsMax = m_items[first].boundsMax;
+    QVector3D centerMin = m_items[first].center;
+    QVector3D centerMax = centerMin;
+    for (int i = first + 1; i < first + count; ++i)
+    {
+        const Item &item = m_items[i];
+        boundsMin = QVector3D(qMin(boundsMin.x(), item.boundsMin.x()),
+                              qMin(boundsMin.y(), item.boundsMin.y()),
+                              qMin(boundsMin.z(), item.boundsMin.z()));
+        boundsMax = QVector3D(qMax(boundsMax.x(), item.boundsMax.x()),
+                              qMax(boundsMax.y(), item.boundsMax.y()),
+                              qMax(boundsMax.z(), item.boundsMax.z()));
+        centerMin = QVector3D(qMin(centerMin.x(), item.center.x()),
+                              qMin(centerMin.y(), item.center.y()),
+                              qMin(centerMin.z(), item.center.z()));
+        centerMax = QVector3D(qMax(centerMax.x(), item.center.x()),
+                              qMax(centerMax.y(), item.center.y()),
+                              qMax(centerMax.z(), item.center.z()));
+    }
+    m_nodes[nodeIndex].boundsMin = boundsMin;
+    m_nodes[nodeIndex].boundsMax = boundsMax;
+
+    const QVector3D extent = centerMax - centerMin;
+    int axis = 0;
+    if (extent.y() > extent[axis])
+        axis = 1;
+    if (extent.z() > extent[axis])
+        axis = 2;
+    if (count <= kMaxLeafItems || extent[axis] <= 0.0f)
+    {
+        m_nodes[nodeIndex].first = first;
+        m_nodes[nodeIndex].count = count;
+        return;
+    }
+
+    // Median split along the widest axis of the item centers.
+    const int half = count / 2;
+    std::nth_element(m_items.begin() + first, m_items.begin() + first + half, m_items.begin() + first + count,
+                     [axis](const Item &a, const Item &b) { return a.center[axis] < b.center[axis]; });
+    const int left = m_nodes.size();
+    m_nodes[nodeIndex].first = left;
+    m_nodes[nodeIndex].count = 0;
+    m_nodes.push_back(Node());
+    m_nodes.push_back(Node());
+    m_nodes[left].parent = nodeIndex;
+    m_nodes[left + 1].parent = nodeIndex;
+    buildNode(left, first, half);
+    buildNode(left + 1, first + half, count - half);
+}
+
+void MeshBvh::query(const Frustum &frustum, QVector<int> &result) const
+{
+    if (m_nodes.isEmpty())
+        return;
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0)
+    {
+        const Node &node = m_nodes[stack[--top]];
+        if (!frustum.intersects(node.boundsMin, node.boundsMax))
+            continue;
+        if (node.count > 0)
+        {
+            for (int i = node.first; i < node.first + node.count; ++i)
+            {
+                const Item &item = m_items[i];
+                if (frustum.intersects(item.boundsMin, item.boundsMax))
+                    result.push_back(item.meshIndex);
+            }
+            continue;
+        }
+        stack[top++] = node.first;
+        stack[top++] = node.first + 1;
+    }
+}
+
+void MeshBvh::raycast(const QVector3D &origin, const QVector3D &dir, float tMax,
+                      const std::function<float(int meshIndex)> &visit) const
+{
+    if (m_nodes.isEmpty())
+        return;
+    const Ray ray(origin, dir);
+    float tEntry = 0.0f;
+    if (!rayEntersBox(ray, m_nodes[0].boundsMin, m_nodes[0].boundsMax, tMax, tEntry))
+        return;
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0)
+    {
+        const Node &node = m_nodes[stack[--top]];
+        // Checked again, tMax may have dropped since the node was pushed.
+        if (!rayEntersBox(ray, node.boundsMin, node.boundsMax, tMax, tEntry))
+            continue;
+        if (node.count > 0)
+        {
+            for (int i = node.first; i < node.first + node.count; ++i)
+            {
+                const Item &item = m_items[i];
+                if (rayEntersBox(ray, item.boundsMin, item.boundsMax, tMax, tEntry))
+                    tMax = qMin(tMax, visit(item.meshIndex));
+            }
+            continue;
+        }
+        const QVector3D childMin[2] = { m_nodes[node.first].boundsMin, m_nodes[node.first + 1].boundsMin };
+        const QVector3D childMax[2] = { m_nodes[node.first].boundsMax, m_nodes[node.first + 1].boundsMax };
+        pushChildren(ray, childMin, childMax, node.first, tMax, stack, top);
+    }
+}
+
+void TriangleBvh::build(const QVector<QVector3D> &positions, QVector<quint32> &indices)
+{
+    m_nodes.clear();
+    const int triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+    QVector<Triangle> triangles;
+    triangles.reserve(triangleCount);
+    for (int i = 0; i < triangleCount; ++i)
+    {
+        const quint32 i0 = indices[i * 3];
+        const quint32 i1 = indices[i * 3 + 1];
+        const quint32 i2 = indices[i * 3 + 2];
+        if (i0 >= quint32(positions.size()) || i1 >= quint32(positions.size()) || i2 >= quint32(positions.size()))
+            continue;
+        const QVector3D &v0 = positions[int(i0)];
+        const QVector3D &v1 = positions[int(i1)];
+        const QVector3D &v2 = positions[int(i2)];
+        Triangle triangle;
+        triangle.boundsMin = QVector3D(qMin(v0.x(), qMin(v1.x(), v2.x())),
+                                       qMin(v0.y(), qMin(v1.y(), v2.y())),
+                                       qMin(v0.z(), qMin(v1.z(), v2.z())));
+        triangle.boundsMax = QVector3D(qMax(v0.x(), qMax(v1.x(), v2.x())),
+                                       qMax(v0.y(), qMax(v1.y(), v2.y())),
+                                       qMax(v0.z(), qMax(v1.z(), v2.z())));
+        triangle.center = (triangle.boundsMin + triangle.boundsMax) * 0.5f;
+        triangle.index = i;
+        triangles.push_back(triangle);
+    }
+    if (triangles.isEmpty())
+        return;
+    m_nodes.reserve(2 * (triangles.size() / kMaxLeafTriangles + 1));
+    m_nodes.push_back(Node());
+    buildNode(triangles, 0, 0, triangles.size());
+
+    // Triangles with out of range indices are dropped here.
+    QVector<quint32> sorted;
+    sorted.reserve(triangles.size() * 3);
+    for (const Triangle &triangle : triangles)
+    {
+        sorted.push_back(indices[triangle.index * 3]);
+        sorted.push_back(indices[triangle.index * 3 + 1]);
+        sorted.push_back(indices[triangle.index * 3 + 2]);
+    }
+    indices = sorted;
+}
+
+void TriangleBvh::buildNode(QVector<Triangle> &triangles, int nodeIndex, int first, int count)
+{
+    QVector3D boundsMin = triangles[first].boundsMin;
+    QVector3D boundsMax = triangles[first].boundsMax;
+    QVector3D centerMin = triangles[first].center;
+    QVector3D centerMax = centerMin;
+    for (int i = first + 1; i < first + count; ++i)
+    {
+        const Triangle &triangle = triangles[i];
+        boundsMin = QVector3D(qMin(boundsMin.x(), triangle.boundsMin.x()),
+                              qMin(boundsMin.y(), triangle.boundsMin.y()),
+                              qMin(boundsMin.z(), triangle.boundsMin.z()));
+        boundsMax = QVector3D(qMax(boundsMax.x(), triangle.boundsMax.x()),
+                              qMax(boundsMax.y(), triangle.boundsMax.y()),
+                              qMax(boundsMax.z(), triangle.boundsMax.z()));
+        centerMin = QVector3D(qMin(centerMin.x(), triangle.center.x()),
+                              qMin(centerMin.y(), triangle.center.y()),
+                              qMin(centerMin.z(), triangle.center.z()));
+        centerMax = QVector3D(qMax(centerMax.x(), triangle.center.x()),
+                              qMax(centerMax.y(), triangle.center.y()),
+                              qMax(centerMax.z(), triangle.center.z()));
+    }
+    m_nodes[nodeIndex].boundsMin = boundsMin;
+    m_nodes[nodeIndex].boundsMax = boundsMax;
+
+    const QVector3D extent = centerMax - centerMin;
+    int axis = 0;
+    if (extent.y() > extent[axis])
+        axis = 1;
+    if (extent.z() > extent[axis])
+        axis = 2;
+    if (count <= kMaxLeafTriangles || extent[axis] <= 0.0f)
+    {
+        m_nodes[nodeIndex].first = first;
+        m_nodes[nodeIndex].count = count;
+        return;
+    }
+
+    const int half = count / 2;
+    std::nth_element(triangles.begin() + first, triangles.begin() + first + half, triangles.begin() + first + count,
+                     [axis](const Triangle &a, const Triangle &b) { return a.center[axis] < b.center[axis]; });
+    const int left = m_nodes.size();
+    m_nodes[nodeIndex].first = left;
+    m_nodes[nodeIndex].count = 0;
+    m_nodes.push_back(Node());
+    m_nodes.push_back(Node());
+    buildNode(triangles, left, first, half);
+    buildNode(triangles, left + 1, first + half, count - half);
+}
+
+bool TriangleBvh::intersect(const QVector<QVector3D> &positions, const QVector<quint32> &indices,
+                            const QVector3D &origin, const QVector3D &dir, float &t) const
+{
+    if (m_nodes.isEmpty())
+        return false;
+    const Ray ray(origin, dir);
+    bool hit = false;
+    float tEntry = 0.0f;
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0)
+    {
+        const Node &node = m_nodes[stack[--top]];
+        if (!rayEntersBox(ray, node.boundsMin, node.boundsMax, t, tEntry))
+            continue;
+        if (node.count > 0)
+        {
+            for (int i = node.first; i < node.first + node.count; ++i)
+            {
+                float tHit = 0.0f;
+                if (rayHitsTriangle(ray, positions[int(indices[i * 3])], positions[int(indices[i * 3 + 1])],
+                                    positions[int(indices[i * 3 + 2])], tHit)
+                    && tHit < t)
+                {
+                    t = tHit;
+                    hit = true;
+                }
+            }
+            continue;
+        }
+        const QVector3D childMin[2] = { m_nodes[node.first].boundsMin, m_nodes[node.first + 1].boundsMin };
+        const QVector3D childMax[2] = { m_nodes[node.first].boundsMax, m_nodes[node.first + 1].boundsMax };
+        pushChildren(ray, childMin, childMax, node.first, t, stack, top);
+    }
+    return hit;
+}
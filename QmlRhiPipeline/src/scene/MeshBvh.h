@@ -0,0 +1,102 @@
+#pragma once
+
+#include <QtCore/QVector>
+#include <QtGui/QMatrix4x4>
+#include <QtGui/QVector3D>
+#include <QtGui/QVector4D>
+#include <functional>
+
+struct Mesh;
+
+// Bounding volume hierarchy over the world bounds of a set of scene meshes,
+// rebuilt when the set changes, refitted when they only move, and queried
+// once per shadow view.
+class MeshBvh
+{
+public:
+    struct Frustum
+    {
+        // Planes of a GL style clip space (-w <= z <= w), normals pointing inwards.
+        static Frustum fromMatrix(const QMatrix4x4 &viewProj);
+        bool intersects(const QVector3D &boundsMin, const QVector3D &boundsMax) const;
+
+        QVector4D planes[6];
+    };
+
+    // Indexes the meshes listed in `meshIndices`, their world bounds must be valid.
+    void build(const QVector<Mesh> &meshes, const QVector<int> &meshIndices);
+    // Takes the new world bounds of the listed meshes and grows or shrinks the
+    // nodes above them. The tree keeps its shape, meshes it doesn't index are
+    // skipped.
+    void refit(const QVector<Mesh> &meshes, const QVector<int> &meshIndices);
+    void clear();
+    bool isEmpty() const { return m_nodes.isEmpty(); }
+    // Appends the indices of the meshes whose bounds intersect the frustum.
+    void query(const Frustum &frustum, QVector<int> &result) const;
+    // Calls `visit` for the meshes whose bounds the ray enters before `tMax`,
+    // nearer nodes first. `visit` returns the distance of the nearest hit found
+    // so far, which prunes the rest of the walk.
+    void raycast(const QVector3D &origin, const QVector3D &dir, float tMax,
+                 const std::function<float(int meshIndex)> &visit) const;
+
+private:
+    struct Node
+    {
+        QVector3D boundsMin;
+        QVector3D boundsMax;
+        int first = 0; // first child node, or first item for leaves
+        int count = 0; // item count, 0 for inner nodes
+        int parent = -1;
+    };
+    struct Item
+    {
+        QVector3D boundsMin;
+        QVector3D boundsMax;
+        QVector3D center;
+        int meshIndex = -1;
+    };
+
+    void buildNode(int nodeIndex, int first, int count);
+    // Recomputes the bounds of a node from its items or children, returns
+    // whether they changed.
+    bool fitNode(int nodeIndex);
+
+    QVector<Node> m_nodes;
+    QVector<Item> m_items;
+    QVector<int> m_itemLeaves; // per item
+    QVector<int> m_meshItems; // per mesh index, -1 when not indexed
+};
+
+// Bounding volume hierarchy over the triangles of one geometry, built once and
+// shared by every mesh drawing it. Distances are in units of the ray direction,
+// so a ray moved into the mesh's local space keeps its world space distances.
+class TriangleBvh
+{
+public:
+    // Reorders the triangles of `indices` so that each leaf covers a contiguous range.
+    void build(const QVector<QVector3D> &positions, QVector<quint32> &indices);
+    bool isEmpty() const { return m_nodes.isEmpty(); }
+    // Finds the nearest triangle hit closer than `t` and lowers `t` to it.
+    bool intersect(const QVector<QVector3D> &positions, const QVector<quint32> &indices,
+                   const QVector3D &origin, const QVector3D &dir, float &t) const;
+
+private:
+    struct Node
+    {
+        QVector3D boundsMin;
+        QVector3D boundsMax;
+        int first = 0; // first child node, or first triangle for leaves
+        int count = 0; // triangle count, 0 for inner nodes
+    };
+    struct Triangle
+    {
+        QVector3D boundsMin;
+        QVector3D boundsMax;
+        QVector3D center;
+        int index = -1;
+    };
+
+    void buildNode(QVector<Triangle> &triangles, int nodeIndex, int first, int count);
+
+    QVector<Node> m_nodes;
+};
@@ -0,0 +1,413 @@
+#include "scene/ModelCache.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDateTime>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QHash>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
+#include <QtGui/QImage>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+namespace {
+
+constexpr quint32 kMagic = 0x434d5052; // "RPMC"
+constexpr quint32 kVersion = 2;
+constexpr int kTextureSlots = 5;
+constexpr int kStringSlots = 1 + kTextureSlots;
+constexpr int kBlobAlignment = 16;
+
+static_assert(sizeof(Vertex) == 8 * sizeof(float), "ModelCache stores Vertex as raw bytes");
+
+struct FileHeader
+{
+    quint32 magic;
+    quint32 version;
+    quint32 importFlags;
+    quint32 meshCount;
+    qint64 sourceSize;
+    qint64 sourceModified;
+    quint32 textureCount;
+    quint32 reserved;
+};
+
+// RGBA8888 pixels, tightly packed, the mip levels follow the base level.
+struct TextureEntry
+{
+    quint32 width;
+    quint32 height;
+    quint32 levels;
+    quint32 reserved;
+    quint64 offset;
+};
+
+struct Texture
+{
+    QImage image;
+    QVector<QImage> mips;
+};
+
+struct StringEntry
+{
+    quint64 offset;
+    quint64 length;
+};
+
+struct MeshEntry
+{
+    float modelMatrix[16]; // column-major
+    float boundsMin[3];
+    float boundsMax[3];
+    float baseColor[3];
+    float baseAlpha;
+    float metalness;
+    float roughness;
+    float occlusion;
+    float emissive[3];
+    float alphaCutoff;
+    quint32 alphaMode;
+    quint32 flags;
+    qint32 textures[kTextureSlots];
+    quint64 vertexCount;
+    quint64 vertexOffset;
+    quint64 indexCount;
+    quint64 indexOffset;
+    StringEntry strings[kStringSlots]; // name, then the texture paths
+};
+
+enum MeshFlags : quint32
+{
+    BoundsValid = 1u << 0,
+    DoubleSided = 1u << 1
+};
+
+struct MaterialSlots
+{
+    QImage *images[kTextureSlots];
+    QVector<QImage> *mips[kTextureSlots];
+    QString *paths[kTextureSlots];
+};
+
+MaterialSlots materialSlots(Material &material)
+{
+    return { { &material.baseColorMap, &material.normalMap, &material.metallicRoughnessMap,
+               &material.occlusionMap, &material.emissiveMap },
+             { &material.baseColorMips, &material.normalMips, &material.metallicRoughnessMips,
+               &material.occlusionMips, &material.emissiveMips },
+             { &material.baseColorMapPath, &material.normalMapPath, &material.metallicRoughnessMapPath,
+               &material.occlusionMapPath, &material.emissiveMapPath } };
+}
+
+quint64 mipChainBytes(quint32 width, quint32 height, quint32 levels)
+{
+    quint64 bytes = 0;
+    for (quint32 level = 0; level < levels; ++level)
+    {
+        bytes += quint64(width) * height * 4;
+        width = qMax(1u, width / 2);
+        height = qMax(1u, height / 2);
+    }
+    return bytes;
+}
+
+quint64 appendBlob(QByteArray &out, const void *data, qint64 size)
+{
+    const qint64 padding = (kBlobAlignment - out.size() % kBlobAlignment) % kBlobAlignment;
+    out.append(QByteArray(padding, '\0'));
+    const quint64 offset = quint64(out.size());
+    if (size > 0)
+        out.append(reinterpret_cast<const char *>(data), size);
+    return offset;
+}
+
+bool sourceStamp(const QString &sourcePath, qint64 &size, qint64 &modified)
+{
+    const QFileInfo info(sourcePath);
+    if (!info.exists())
+        return false;
+    size = info.size();
+    modified = info.lastModified().toMSecsSinceEpoch();
+    return true;
+}
+
+void releaseMapping(void *info)
+{
+    delete static_cast<std::shared_ptr<QFile> *>(info);
+}
+
+} // namespace
+
+QString ModelCache::cacheFilePath(const QString &sourcePath)
+{
+    const QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (dir.isEmpty())
+        return QString();
+    const QByteArray key = QCryptographicHash::hash(sourcePath.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return QDir(dir).filePath(QStringLiteral("models/") + QString::fromLatin1(key) + QStringLiteral(".rpmc"));
+}
+
+bool ModelCache::load(const QString &sourcePath, quint32 importFlags, QVector<Mesh> &meshes)
+{
+    qint64 sourceSize = 0;
+    qint64 sourceModified = 0;
+    if (!sourceStamp(sourcePath, sourceSize, sourceModified))
+        return false;
+    const QString path = cacheFilePath(sourcePath);
+    if (path.isEmpty() || !QFileInfo::exists(path))
+        return false;
+
+    auto file = std::make_shared<QFile>(path);
+    if (!file->open(QIODevice::ReadOnly))
+        return false;
+    const quint64 fileSize = quint64(file->size());
+    if (fileSize < sizeof(FileHeader))
+        return false;
+    const uchar *data = file->map(0, file->size());
+    if (!data)
+        return false;
+
+    FileHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if (header.magic != kMagic || header.version != kVersion || header.importFlags != importFlags
+        || header.sourceSize != sourceSize || header.sourceModified != sourceModified)
+        return false;
+    const quint64 tablesSize = sizeof(FileHeader) + quint64(header.textureCount) * sizeof(TextureEntry)
+            + quint64(header.meshCount) * sizeof(MeshEntry);
+    if (tablesSize > fileSize)
+    {
+        qWarning() << "ModelCache: truncated cache file" << path;
+        return false;
+    }
+    const auto inFile = [fileSize](quint64 offset, quint64 size) {
+        return offset <= fileSize && size <= fileSize - offset;
+    };
+
+    const uchar *textureTable = data + sizeof(FileHeader);
+    QVector<Texture> textures;
+    textures.reserve(int(header.textureCount));
+    for (quint32 i = 0; i < header.textureCount; ++i)
+    {
+        TextureEntry entry;
+        std::memcpy(&entry, textureTable + i * sizeof(TextureEntry), sizeof(entry));
+        if (entry.width == 0 || entry.height == 0 || entry.width > 65536 || entry.height > 65536
+            || entry.levels == 0 || entry.levels > 17
+            || !inFile(entry.offset, mipChainBytes(entry.width, entry.height, entry.levels)))
+        {
+            qWarning() << "ModelCache: corrupt texture table in" << path;
+            return false;
+        }
+        Texture texture;
+        quint64 offset = entry.offset;
+        quint32 width = entry.width;
+        quint32 height = entry.height;
+        for (quint32 level = 0; level < entry.levels; ++level)
+        {
+            const QImage image(data + offset, int(width), int(height), int(width) * 4,
+                               QImage::Format_RGBA8888, releaseMapping, new std::shared_ptr<QFile>(file));
+            if (level == 0)
+                texture.image = image;
+            else
+                texture.mips.push_back(image);
+            offset += quint64(width) * height * 4;
+            width = qMax(1u, width / 2);
+            height = qMax(1u, height / 2);
+        }
+        textures.push_back(texture);
+    }
+
+    const uchar *meshTable = textureTable + header.textureCount * sizeof(TextureEntry);
+    QVector<Mesh> loaded;
+    loaded.reserve(int(header.meshCount));
+    for (quint32 i = 0; i < header.meshCount; ++i)
+    {
+        MeshEntry entry;
+        std::memcpy(&entry, meshTable + i * sizeof(MeshEntry), sizeof(entry));
+        if (entry.vertexCount > fileSize || entry.indexCount > fileSize
+            || !inFile(entry.vertexOffset, entry.vertexCount * sizeof(Vertex))
+            || !inFile(entry.indexOffset, entry.indexCount * sizeof(quint32))
+            || entry.alphaMode > quint32(Material::AlphaMode::Blend))
+        {
+            qWarning() << "ModelCache: corrupt mesh table in" << path;
+            return false;
+        }
+        QString strings[kStringSlots];
+        for (int s = 0; s < kStringSlots; ++s)
+        {
+            if (!inFile(entry.strings[s].offset, entry.strings[s].length))
+                return false;
+            strings[s] = QString::fromUtf8(reinterpret_cast<const char *>(data + entry.strings[s].offset),
+                                           qsizetype(entry.strings[s].length));
+        }
+
+        Mesh mesh;
+        mesh.name = strings[0];
+        mesh.modelMatrix = QMatrix4x4(entry.modelMatrix).transposed();
+        mesh.boundsMin = QVector3D(entry.boundsMin[0], entry.boundsMin[1], entry.boundsMin[2]);
+        mesh.boundsMax = QVector3D(entry.boundsMax[0], entry.boundsMax[1], entry.boundsMax[2]);
+        mesh.boundsValid = (entry.flags & BoundsValid) != 0;
+        mesh.vertices.resize(qsizetype(entry.vertexCount));
+        std::memcpy(mesh.vertices.data(), data + entry.vertexOffset, entry.vertexCount * sizeof(Vertex));
+        mesh.indices.resize(qsizetype(entry.indexCount));
+        std::memcpy(mesh.indices.data(), data + entry.indexOffset, entry.indexCount * sizeof(quint32));
+        // The pick geometry and the GPU read vertices through the indices.
+        const quint64 vertexCount = entry.vertexCount;
+        if (std::any_of(mesh.indices.cbegin(), mesh.indices.cend(),
+                        [vertexCount](quint32 index) { return index >= vertexCount; }))
+        {
+            qWarning() << "ModelCache: index out of range in" << path;
+            return false;
+        }
+
+        Material &material = mesh.material;
+        material.baseColor = QVector3D(entry.baseColor[0], entry.baseColor[1], entry.baseColor[2]);
+        material.baseAlpha = entry.baseAlpha;
+        material.metalness = entry.metalness;
+        material.roughness = entry.roughness;
+        material.occlusion = entry.occlusion;
+        material.emissive = QVector3D(entry.emissive[0], entry.emissive[1], entry.emissive[2]);
+        material.alphaCutoff = entry.alphaCutoff;
+        material.alphaMode = Material::AlphaMode(entry.alphaMode);
+        material.doubleSided = (entry.flags & DoubleSided) != 0;
+        const MaterialSlots slots = materialSlots(material);
+        for (int t = 0; t < kTextureSlots; ++t)
+        {
+            *slots.paths[t] = strings[1 + t];
+            const qint32 texture = entry.textures[t];
+            if (texture >= 0 && texture < textures.size())
+            {
+                *slots.images[t] = textures[texture].image;
+                *slots.mips[t] = textures[texture].mips;
+            }
+        }
+        loaded.push_back(mesh);
+    }
+    meshes = loaded;
+    return true;
+}
+
+bool ModelCache::store(const QString &sourcePath, quint32 importFlags, const QVector<Mesh> &meshes)
+{
+    FileHeader header = {};
+    header.magic = kMagic;
+    header.version = kVersion;
+    header.importFlags = importFlags;
+    header.meshCount = quint32(meshes.size());
+    if (!sourceStamp(sourcePath, header.sourceSize, header.sourceModified))
+        return false;
+    const QString path = cacheFilePath(sourcePath);
+    if (path.isEmpty() || !QDir().mkpath(QFileInfo(path).absolutePath()))
+        return false;
+
+    // Images shared between meshes are stored once.
+    QVector<Texture> textures;
+    QHash<qint64, int> textureIndex;
+    QVector<MeshEntry> entries(meshes.size());
+    for (int i = 0; i < meshes.size(); ++i)
+    {
+        Material material = meshes[i].material;
+        const MaterialSlots slots = materialSlots(material);
+        for (int t = 0; t < kTextureSlots; ++t)
+        {
+            const QImage &image = *slots.images[t];
+            entries[i].textures[t] = -1;
+            if (image.isNull())
+                continue;
+            int index = textureIndex.value(image.cacheKey(), -1);
+            if (index < 0)
+            {
+                index = textures.size();
+                textureIndex.insert(image.cacheKey(), index);
+                Texture texture;
+                texture.image = image.convertToFormat(QImage::Format_RGBA8888);
+                // Only levels following the halving chain are kept.
+                QSize expected(qMax(1, image.width() / 2), qMax(1, image.height() / 2));
+                for (const QImage &mip : *slots.mips[t])
+                {
+                    if (mip.size() != expected)
+                        break;
+                    texture.mips.push_back(mip.convertToFormat(QImage::Format_RGBA8888));
+                    expected = QSize(qMax(1, expected.width() / 2), qMax(1, expected.height() / 2));
+                }
+                textures.push_back(texture);
+            }
+            entries[i].textures[t] = qint32(index);
+        }
+    }
+    header.textureCount = quint32(textures.size());
+
+    QByteArray out(qsizetype(sizeof(FileHeader) + textures.size() * sizeof(TextureEntry)
+                             + meshes.size() * sizeof(MeshEntry)), '\0');
+    QVector<TextureEntry> textureEntries(textures.size());
+    for (int i = 0; i < textures.size(); ++i)
+    {
+        const Texture &texture = textures[i];
+        textureEntries[i].width = quint32(texture.image.width());
+        textureEntries[i].height = quint32(texture.image.height());
+        textureEntries[i].levels = quint32(1 + texture.mips.size());
+        textureEntries[i].offset = appendBlob(out, nullptr, 0);
+        for (int level = 0; level <= texture.mips.size(); ++level)
+        {
+            const QImage &image = level == 0 ? texture.image : texture.mips[level - 1];
+            for (int y = 0; y < image.height(); ++y)
+                out.append(reinterpret_cast<const char *>(image.constScanLine(y)), image.width() * 4);
+        }
+    }
+    for (int i = 0; i < meshes.size(); ++i)
+    {
+        const Mesh &mesh = meshes[i];
+        MeshEntry &entry = entries[i];
+        std::memcpy(entry.modelMatrix, mesh.modelMatrix.constData(), sizeof(entry.modelMatrix));
+        for (int c = 0; c < 3; ++c)
+        {
+            entry.boundsMin[c] = mesh.boundsMin[c];
+            entry.boundsMax[c] = mesh.boundsMax[c];
+            entry.baseColor[c] = mesh.material.baseColor[c];
+            entry.emissive[c] = mesh.material.emissive[c];
+        }
+        entry.baseAlpha = mesh.material.baseAlpha;
+        entry.metalness = mesh.material.metalness;
+        entry.roughness = mesh.material.roughness;
+        entry.occlusion = mesh.material.occlusion;
+        entry.alphaCutoff = mesh.material.alphaCutoff;
+        entry.alphaMode = quint32(mesh.material.alphaMode);
+        entry.flags = (mesh.boundsValid ? BoundsValid : 0u) | (mesh.material.doubleSided ? DoubleSided : 0u);
+        entry.vertexCount = quint64(mesh.vertices.size());
+        entry.vertexOffset = appendBlob(out, mesh.vertices.constData(), mesh.vertices.size() * sizeof(Vertex));
+        entry.indexCount = quint64(mesh.indices.size());
+        entry.indexOffset = appendBlob(out, mesh.indices.constData(), mesh.indices.size() * sizeof(quint32));
+
+        Material material = mesh.material;
+        const MaterialSlots slots = materialSlots(material);
+        const QString *strings[kStringSlots] = { &mesh.name, slots.paths[0], slots.paths[1], slots.paths[2],
+                                                 slots.paths[3], slots.paths[4] };
+        for (int s = 0; s < kStringSlots; ++s)
+        {
+            const QByteArray utf8 = strings[s]->toUtf8();
+            entry.strings[s].length = quint64(utf8.size());
+            entry.strings[s].offset = appendBlob(out, utf8.constData(), utf8.size());
+        }
+    }
+
+    char *tables = out.data();
+    std::memcpy(tables, &header, sizeof(header));
+    tables += sizeof(header);
+    if (!textureEntries.isEmpty())
+        std::memcpy(tables, textureEntries.constData(), textureEntries.size() * sizeof(TextureEntry));
+    tables += textureEntries.size() * sizeof(TextureEntry);
+    if (!entries.isEmpty())
+        std::memcpy(tables, entries.constData(), entries.size() * sizeof(MeshEntry));
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(out) != out.size() || !file.commit())
+    {
+        qWarning() << "ModelCache: failed to write" << path;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+#include "scene/Mesh.h"
+
+// On-disk cache of imported models, one file per source model under the
+// application cache location. A file is only used when the source size,
+// modification time and import flags it was written with still match.
+// Vertex and index arrays are copied out of the mapping, texture images
+// keep pointing into it until the last QImage referencing them goes away.
+class ModelCache
+{
+public:
+    static bool load(const QString &sourcePath, quint32 importFlags, QVector<Mesh> &meshes);
+    static bool store(const QString &sourcePath, quint32 importFlags, const QVector<Mesh> &meshes);
+
+private:
+    static QString cacheFilePath(const QString &sourcePath);
+};
@@ -1,5 +1,7 @@
 #include "scene/Scene.h"
 
+#include <QtCore/QHash>
+
 namespace {
 
 bool lightEquals(const Light &a, const Light &b)
@@ -20,25 +22,117 @@ bool lightEquals(const Light &a, const Light &b)
             && a.beamShape == b.beamShape;
 }
 
+bool isShadowCaster(const Mesh &mesh)
+{
+    return mesh.gizmoAxis < 0 && mesh.visible;
+}
+
 } // namespace
 
 bool Scene::setLights(const QVector<Light> &lights)
 {
-    if (m_lights.size() == lights.size())
+    bool changed = m_lights.size() != lights.size();
+    const int common = qMin(m_lights.size(), lights.size());
+    for (int i = 0; i < common; ++i)
     {
-        bool same = true;
-        for (int i = 0; i < lights.size(); ++i)
-        {
-            if (!lightEquals(m_lights[i], lights[i]))
-            {
-                same = false;
-                break;
-            }
-        }
-        if (same)
-            return false;
+        if (lightEquals(m_lights[i], lights[i]))
+            continue;
+        m_lightBuffer.markLightDirty(i);
+        changed = true;
     }
+    if (!changed)
+        return false;
+    for (int i = common; i < lights.size(); ++i)
+        m_lightBuffer.markLightDirty(i);
     m_lights = lights;
     m_lightsDirty = true;
     return true;
 }
+
+bool Scene::setLight(int index, const Light &light)
+{
+    if (index < 0 || index >= m_lights.size())
+        return false;
+    if (lightEquals(m_lights[index], light))
+        return false;
+    m_lights[index] = light;
+    m_lightBuffer.markLightDirty(index);
+    m_lightsDirty = true;
+    return true;
+}
+
+void Scene::updateGeometry()
+{
+    // Moves are known from the transforms, the hash only covers what else
+    // changes the casters. worldBoundsDirty is left alone, the selection
+    // boxes use it to notice moves.
+    m_transforms.update(m_meshes);
+    bool moved = false;
+    for (int index : m_transforms.updated())
+        moved = moved || isShadowCaster(m_meshes[index]);
+    size_t hash = qHash(m_meshes.size());
+    size_t materialHash = 0;
+    for (int i = 0; i < m_meshes.size(); ++i)
+    {
+        const Mesh &mesh = m_meshes[i];
+        if (!isShadowCaster(mesh))
+            continue;
+        hash = qHashMulti(hash, i, mesh.vertexBuffer, mesh.indexBuffer, mesh.indexCount, mesh.boundsValid);
+        materialHash = qHashMulti(materialHash, i, int(mesh.material.alphaMode), mesh.material.doubleSided);
+    }
+    if (materialHash != m_materialHash)
+    {
+        m_materialHash = materialHash;
+        ++m_materialRevision;
+    }
+    if (!moved && hash == m_geometryHash)
+        return;
+    ++m_geometryRevision;
+    if (hash == m_geometryHash)
+    {
+        // The same casters moved, only the nodes above them change.
+        m_shadowCasterBvh.refit(m_meshes, m_transforms.updated());
+        return;
+    }
+    m_geometryHash = hash;
+
+    QVector<int> bounded;
+    m_unboundedShadowCasters.clear();
+    for (int i = 0; i < m_meshes.size(); ++i)
+    {
+        const Mesh &mesh = m_meshes[i];
+        if (!isShadowCaster(mesh))
+            continue;
+        if (mesh.worldBoundsValid)
+            bounded.push_back(i);
+        else
+            m_unboundedShadowCasters.push_back(i);
+    }
+    m_shadowCasterBvh.build(m_meshes, bounded);
+}
+
+bool Scene::hasShadowCasters() const
+{
+    if (!m_shadowsEnabled)
+        return false;
+    for (const Light &light : m_lights)
+    {
+        if (!light.castShadows)
+            continue;
+        if (light.type == Light::Type::Directional)
+            return true;
+        if (light.type == Light::Type::Spot && light.range > 0.0f)
+            return true;
+    }
+    return false;
+}
+
+bool Scene::hasLocalLights() const
+{
+    for (const Light &light : m_lights)
+    {
+        if (light.type != Light::Type::Directional)
+            return true;
+    }
+    return false;
+}
@@ -6,7 +6,10 @@
 #include <QtGui/QVector2D>
 
 #include "scene/Camera.h"
+#include "scene/LightBuffer.h"
 #include "scene/Mesh.h"
+#include "scene/MeshBvh.h"
+#include "scene/TransformCache.h"
 
 struct Light
 {
@@ -47,6 +50,13 @@ public:
         SoftHaze,
         Physical
     };
+    enum class CpuDataRetention
+    {
+        // Vertex, index and image data is dropped once it's on the GPU, meshes
+        // keep their bounds and a position-only copy for picking.
+        ReleaseAfterUpload,
+        RetainAll
+    };
     Camera &camera()
     {
         return m_camera;
@@ -65,19 +75,47 @@ public:
         return m_meshes;
     }
 
-    QVector<Light> &lights()
+    const QVector<Light> &lights() const
     {
-        m_lightsDirty = true;
         return m_lights;
     }
-    const QVector<Light> &lights() const
+    const Light &lightAt(int index) const
     {
-        return m_lights;
+        return m_lights.at(index);
     }
     bool setLights(const QVector<Light> &lights);
-    void markLightsDirty() { m_lightsDirty = true; }
+    // Marks only this light for re-upload.
+    bool setLight(int index, const Light &light);
+    void markLightsDirty()
+    {
+        m_lightsDirty = true;
+        m_lightBuffer.markAllDirty();
+    }
     bool lightsDirty() const { return m_lightsDirty; }
     void clearLightsDirty() { m_lightsDirty = false; }
+    bool hasShadowCasters() const;
+    bool hasLocalLights() const;
+    LightBuffer &lightBuffer() { return m_lightBuffer; }
+    const LightBuffer &lightBuffer() const { return m_lightBuffer; }
+    void updateLightBuffer() { m_lightBuffer.update(*this); }
+    // Bumped whenever a mesh that can cast shadows is added, removed, moved or
+    // hidden, so cached shadow maps know when they have to be rendered again.
+    quint64 geometryRevision() const { return m_geometryRevision; }
+    // Bumped when the alpha mode or the culling of a shadow caster's material
+    // changes, the draw order depends on them.
+    quint64 materialRevision() const { return m_materialRevision; }
+    // Refreshes the normal matrices and world bounds of the meshes that moved,
+    // then the geometry revision and, when it changed, the BVH of the shadow
+    // casters, every visible mesh but the gizmos. The BVH is refitted when the
+    // casters only moved, rebuilt otherwise. Picking walks the same BVH.
+    void updateGeometry();
+    // Inverse transpose of the model matrix of a mesh as of updateGeometry().
+    QMatrix4x4 normalMatrix(int index) const { return m_transforms.normalMatrix(index); }
+    // Meshes whose model matrix or bounds updateGeometry() found changed.
+    const QVector<int> &movedMeshes() const { return m_transforms.updated(); }
+    const MeshBvh &shadowCasterBvh() const { return m_shadowCasterBvh; }
+    // Casters without bounds, they are drawn into every shadow view.
+    const QVector<int> &unboundedShadowCasters() const { return m_unboundedShadowCasters; }
 
     QVector3D ambientLight() const
     {
@@ -238,6 +276,15 @@ public:
         m_smokeNoiseEnabled = enabled;
         m_lightParamsDirty = true;
     }
+    CpuDataRetention cpuDataRetention() const
+    {
+        return m_cpuDataRetention;
+    }
+    // Only affects meshes uploaded afterwards, released data doesn't come back.
+    void setCpuDataRetention(CpuDataRetention retention)
+    {
+        m_cpuDataRetention = retention;
+    }
     float timeSeconds() const
     {
         return m_timeSeconds;
@@ -276,6 +323,14 @@ private:
     Camera m_camera;
     QVector<Mesh> m_meshes;
     QVector<Light> m_lights;
+    LightBuffer m_lightBuffer;
+    TransformCache m_transforms;
+    size_t m_geometryHash = 0;
+    size_t m_materialHash = 0;
+    MeshBvh m_shadowCasterBvh;
+    QVector<int> m_unboundedShadowCasters;
+    quint64 m_geometryRevision = 1;
+    quint64 m_materialRevision = 1;
     QVector3D m_ambientLight = QVector3D(0.0f, 0.0f, 0.0f);
     float m_ambientIntensity = 1.0f;
     float m_smokeAmount = 0.0f;
@@ -292,6 +347,7 @@ private:
     float m_hazeRadius = 1.0f;
     float m_hazeDensity = 0.0f;
     bool m_hazeEnabled = false;
+    CpuDataRetention m_cpuDataRetention = CpuDataRetention::ReleaseAfterUpload;
     bool m_lightsDirty = true;
     bool m_lightParamsDirty = true;
     bool m_cameraDirty = true;
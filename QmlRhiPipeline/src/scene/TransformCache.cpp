@@ -0,0 +1,108 @@
+#include "scene/TransformCache.h"
+
+#include <cmath>
+
+#include "scene/Mesh.h"
+
+namespace {
+
+// Model matrices are affine, the normal matrix only needs the inverse of the
+// upper 3x3 (cofactors over the determinant) and the bounds can be moved by
+// center and extent instead of by eight corners.
+void computeNormalMatrix(const float *m, QMatrix4x4 &normalMatrix)
+{
+    // Column-major, a(row, col).
+    const auto a = [m](int row, int col) { return m[col * 4 + row]; };
+    const float c00 = a(1, 1) * a(2, 2) - a(1, 2) * a(2, 1);
+    const float c01 = a(1, 2) * a(2, 0) - a(1, 0) * a(2, 2);
+    const float c02 = a(1, 0) * a(2, 1) - a(1, 1) * a(2, 0);
+    const float det = a(0, 0) * c00 + a(0, 1) * c01 + a(0, 2) * c02;
+    if (det == 0.0f)
+    {
+        normalMatrix.setToIdentity();
+        return;
+    }
+    const float cof[3][3] = {
+        { c00, c01, c02 },
+        { a(0, 2) * a(2, 1) - a(0, 1) * a(2, 2),
+          a(0, 0) * a(2, 2) - a(0, 2) * a(2, 0),
+          a(0, 1) * a(2, 0) - a(0, 0) * a(2, 1) },
+        { a(0, 1) * a(1, 2) - a(0, 2) * a(1, 1),
+          a(0, 2) * a(1, 0) - a(0, 0) * a(1, 2),
+          a(0, 0) * a(1, 1) - a(0, 1) * a(1, 0) }
+    };
+    // The inverse transpose is the cofactor matrix over the determinant.
+    const float invDet = 1.0f / det;
+    float *n = normalMatrix.data();
+    for (int col = 0; col < 3; ++col)
+    {
+        for (int row = 0; row < 3; ++row)
+            n[col * 4 + row] = cof[row][col] * invDet;
+        n[col * 4 + 3] = 0.0f;
+    }
+    n[12] = 0.0f;
+    n[13] = 0.0f;
+    n[14] = 0.0f;
+    n[15] = 1.0f;
+}
+
+bool computeWorldBounds(Mesh &mesh)
+{
+    if (!mesh.boundsValid)
+    {
+        if (mesh.vertices.isEmpty())
+            return false;
+        QVector3D minV(mesh.vertices[0].px, mesh.vertices[0].py, mesh.vertices[0].pz);
+        QVector3D maxV = minV;
+        for (const Vertex &v : mesh.vertices)
+        {
+            minV = QVector3D(qMin(minV.x(), v.px), qMin(minV.y(), v.py), qMin(minV.z(), v.pz));
+            maxV = QVector3D(qMax(maxV.x(), v.px), qMax(maxV.y(), v.py), qMax(maxV.z(), v.pz));
+        }
+        mesh.boundsMin = minV;
+        mesh.boundsMax = maxV;
+        mesh.boundsValid = true;
+    }
+    const float *m = mesh.modelMatrix.constData();
+    const QVector3D center = (mesh.boundsMin + mesh.boundsMax) * 0.5f;
+    const QVector3D extent = (mesh.boundsMax - mesh.boundsMin) * 0.5f;
+    float worldCenter[3];
+    float worldExtent[3];
+    for (int row = 0; row < 3; ++row)
+    {
+        worldCenter[row] = m[row] * center.x() + m[4 + row] * center.y() + m[8 + row] * center.z() + m[12 + row];
+        worldExtent[row] = std::abs(m[row]) * extent.x() + std::abs(m[4 + row]) * extent.y()
+                + std::abs(m[8 + row]) * extent.z();
+    }
+    mesh.worldBoundsMin = QVector3D(worldCenter[0] - worldExtent[0],
+                                    worldCenter[1] - worldExtent[1],
+                                    worldCenter[2] - worldExtent[2]);
+    mesh.worldBoundsMax = QVector3D(worldCenter[0] + worldExtent[0],
+                                    worldCenter[1] + worldExtent[1],
+                                    worldCenter[2] + worldExtent[2]);
+    mesh.worldBoundsValid = true;
+    return true;
+}
+
+} // namespace
+
+void TransformCache::update(QVector<Mesh> &meshes)
+{
+    m_updated.clear();
+    if (meshes.size() < m_normalMatrices.size())
+        m_normalMatrices.clear();
+    const int known = m_normalMatrices.size();
+    m_normalMatrices.resize(meshes.size());
+    for (int i = 0; i < meshes.size(); ++i)
+    {
+        Mesh &mesh = meshes[i];
+        // Meshes without bounds are tried again until they have vertices.
+        const bool needsBounds = !mesh.worldBoundsValid && (mesh.boundsValid || !mesh.vertices.isEmpty());
+        if (i < known && !mesh.modelDirty && !needsBounds)
+            continue;
+        computeNormalMatrix(mesh.modelMatrix.constData(), m_normalMatrices[i]);
+        computeWorldBounds(mesh);
+        mesh.modelDirty = false;
+        m_updated.push_back(i);
+    }
+}
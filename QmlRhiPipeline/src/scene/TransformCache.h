@@ -0,0 +1,25 @@
+#pragma once
+
+#include <QtCore/QVector>
+#include <QtGui/QMatrix4x4>
+
+struct Mesh;
+
+// Normal matrices and world bounds of the scene meshes. Only the meshes whose
+// model matrix changed since the last update (Mesh::modelDirty) are computed
+// again, so a frame costs what moved. Meshes are expected to only be appended,
+// fewer meshes than before restarts from scratch.
+class TransformCache
+{
+public:
+    void update(QVector<Mesh> &meshes);
+
+    // Inverse transpose of the model matrix, identity when it can't be inverted.
+    QMatrix4x4 normalMatrix(int index) const { return m_normalMatrices.value(index); }
+    // Meshes computed by the last update.
+    const QVector<int> &updated() const { return m_updated; }
+
+private:
+    QVector<QMatrix4x4> m_normalMatrices;
+    QVector<int> m_updated;
+};